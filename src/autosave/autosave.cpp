@@ -0,0 +1,188 @@
+#include "autosave.hpp"
+#include "../globalFunctions.hpp"
+#include "../gui/popup/popup.hpp"
+#include "../views/settings/configEditor.hpp"
+#include "../views/pattern/songFileActions.hpp"
+#define SI_CONVERT_GENERIC
+#include "SimpleIni.h"
+#include <atomic>
+#include <ctime>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+/* Number of rotating recovery files */
+#define AUTOSAVE_FILES 3
+
+extern string saveAs;
+
+static mtsynth *snapshot;
+static std::atomic<bool> saving(false);
+static sf::Clock autosaveClock;
+static unsigned savedRevision;
+static string autosaveDir;
+static int nextFile;
+
+/* What the background thread is saving. Only written by the GUI thread while no save is running */
+static int snapshotFile;
+static string snapshotSong, snapshotTime;
+
+/* Recovery file found at startup */
+static int recoveryFile = -1;
+static string recoverySong, recoveryTime;
+
+static void autosaveFunc();
+static sf::Thread autosaveThread(&autosaveFunc);
+
+static string recoveryFileName(int file)
+{
+	return autosaveDir + "recovery" + int2str[file] + ".mdts";
+}
+
+static string indexFileName()
+{
+	return autosaveDir + "recovery.ini";
+}
+
+/* Runs in the background thread */
+static void autosaveFunc()
+{
+	if (mt_saveSong(snapshot, recoveryFileName(snapshotFile).c_str()))
+	{
+		CSimpleIniA index;
+		index.LoadFile(indexFileName().c_str());
+
+		string section = "file" + int2str[snapshotFile];
+		index.SetValue(section.c_str(), "song", snapshotSong.c_str());
+		index.SetValue(section.c_str(), "time", snapshotTime.c_str());
+		index.SetValue("recovery", "last", int2str[snapshotFile].c_str());
+		index.SaveFile(indexFileName().c_str());
+	}
+	saving = false;
+}
+
+void autosave_initialize()
+{
+	autosaveDir = appconfigdir + "autosave" + pathSeparator;
+#ifdef _WIN32
+	_mkdir(autosaveDir.c_str());
+#else
+	mkdir(autosaveDir.c_str(), 0774);
+#endif
+
+	if (!(snapshot = mt_create(44100)))
+	{
+		error("Can't initialize autosave");
+	}
+}
+
+void autosave_update()
+{
+	if (!snapshot || saving || !isSongModified || songRevision == savedRevision || config->autosaveInterval.value == 0
+		|| autosaveClock.getElapsedTime().asSeconds() < config->autosaveInterval.value * 60)
+	{
+		return;
+	}
+
+	autosaveClock.restart();
+
+	/* Only the patterns changed since the previous autosave are copied, the song is serialized in the background */
+	if (!mt_copySong(snapshot, fm))
+	{
+		return;
+	}
+
+	char timeText[32];
+	time_t now = time(NULL);
+	strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M", localtime(&now));
+
+	snapshotFile = nextFile;
+	snapshotSong = saveAs;
+	snapshotTime = timeText;
+	nextFile = (nextFile + 1) % AUTOSAVE_FILES;
+	savedRevision = songRevision;
+
+	saving = true;
+	autosaveThread.launch();
+}
+
+void autosave_exit()
+{
+	autosaveThread.wait();
+	autosave_discardRecovery();
+	mt_destroy(snapshot);
+	snapshot = NULL;
+}
+
+void autosave_offerRecovery()
+{
+	CSimpleIniA index;
+	if (index.LoadFile(indexFileName().c_str()) < 0)
+	{
+		return;
+	}
+
+	int file = atoi(index.GetValue("recovery", "last", "-1"));
+	if (file < 0 || file >= AUTOSAVE_FILES)
+	{
+		return;
+	}
+
+	FILE *fp = fopen(recoveryFileName(file).c_str(), "rb");
+	if (!fp)
+	{
+		return;
+	}
+	fclose(fp);
+
+	string section = "file" + int2str[file];
+	recoveryFile = file;
+	recoverySong = index.GetValue(section.c_str(), "song", "");
+	recoveryTime = index.GetValue(section.c_str(), "time", "");
+
+	/* Don't overwrite it before the user made a choice */
+	nextFile = (file + 1) % AUTOSAVE_FILES;
+
+	popup->show(POPUP_RECOVERY);
+}
+
+string autosave_recoveryDescription()
+{
+	string song = recoverySong.empty() ? "an unsaved song" : recoverySong.substr(recoverySong.find_last_of("\\/") + 1);
+	return "MUDTracker was not closed properly.\n\nAn autosave of " + song + " from " + recoveryTime + " can be recovered.";
+}
+
+/* Called once the recovery file is loaded */
+static void recovered()
+{
+	/* Saving goes to the original song, which still has the older content */
+	saveAs = recoverySong;
+	setWindowTitle(recoverySong.empty() ? "Recovered song" : recoverySong);
+	songModified(1);
+}
+
+void autosave_recover()
+{
+	if (recoveryFile < 0)
+	{
+		return;
+	}
+
+	song_load(recoveryFileName(recoveryFile).c_str(), true, recovered);
+	recoveryFile = -1;
+}
+
+void autosave_discardRecovery()
+{
+	autosaveThread.wait();
+
+	for (int i = 0; i < AUTOSAVE_FILES; i++)
+	{
+		remove(recoveryFileName(i).c_str());
+	}
+	remove(indexFileName().c_str());
+	recoveryFile = -1;
+}
@@ -0,0 +1,34 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <string>
+
+/* Background autosave
+
+	At the interval set in the preferences, a modified song is copied into a snapshot synth (mt_copySong, which only
+	rewrites the patterns changed since the last autosave) and saved from a background thread, so the GUI and audio
+	threads never wait for the disk. Saves rotate between a few recovery files in the config directory.
+	Recovery files are removed on a normal exit : if some are found at startup, MUDTracker didn't close properly
+	and the most recent one is offered for recovery. */
+
+void autosave_initialize();
+
+/* Called every frame from the main loop, starts an autosave when needed */
+void autosave_update();
+
+/* Waits for a running autosave and removes the recovery files */
+void autosave_exit();
+
+/* Shows the recovery popup if recovery files were left by a previous session */
+void autosave_offerRecovery();
+
+/* Description of the most recent recovery file, shown in the recovery popup */
+std::string autosave_recoveryDescription();
+
+/* Loads the most recent recovery file */
+void autosave_recover();
+
+/* Removes the recovery files without loading them */
+void autosave_discardRecovery();
+
+#endif
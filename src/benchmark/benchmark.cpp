@@ -0,0 +1,273 @@
+#include "benchmark.hpp"
+#include "../mtengine/mtlib.h"
+#include <SFML/System.hpp>
+#include <stdio.h>
+#include <string.h>
+
+/* Instruments of the generated song, only the even ones are used */
+#define BENCHMARK_INSTRUMENTS 32
+
+/* Seconds of the song rendered */
+#define BENCHMARK_RENDER_SECONDS 10
+
+/* Seconds of the song frozen, then played with the freeze */
+#define BENCHMARK_FREEZE_SECONDS 3
+
+#define BENCHMARK_SEEKS 100000
+
+static sf::Clock stepClock;
+static int failed = 0;
+
+static unsigned seed = 1;
+
+static unsigned nextRandom()
+{
+	seed = seed * 214013 + 2531011;
+	return (seed >> 16) & 0x7FFF;
+}
+
+static void beginStep()
+{
+	stepClock.restart();
+}
+
+static void endStep(const char *name, bool success = true, const char *details = "")
+{
+	printf("%-28s %10.1f  %s%s\n", name, stepClock.getElapsedTime().asMicroseconds() / 1000.f, success ? "" : "FAILED ", details);
+	fflush(stdout);
+	failed |= !success;
+}
+
+/* Notes every 4 rows in each channel, volume and panning effects, and a tempo change every 16 rows */
+static bool generateSong(mtsynth *mt, unsigned patterns, unsigned *notes)
+{
+	mt_clearSong(mt);
+
+	if (!mt_resizeInstrumentList(mt, BENCHMARK_INSTRUMENTS))
+		return false;
+
+	for (unsigned i = 0; i < BENCHMARK_INSTRUMENTS; i++)
+	{
+		mt_createDefaultInstrument(mt, i);
+	}
+
+	/* One by one, as the MIDI import does */
+	for (unsigned p = 0; p < patterns; p++)
+	{
+		if (!mt_insertPattern(mt, BENCHMARK_ROWS, mt->patternCount))
+			return false;
+	}
+	mt_compactPatterns(mt);
+
+	*notes = 0;
+	for (unsigned p = 0; p < mt->patternCount; p++)
+	{
+		for (unsigned row = 0; row < BENCHMARK_ROWS; row++)
+		{
+			for (unsigned ch = 0; ch < mt->channelCount; ch++)
+			{
+				Cell &cell = mt->pattern[p][row][ch];
+
+				if (row % 4 == ch % 4)
+				{
+					cell.note = 36 + nextRandom() % 48;
+					cell.instr = (ch * 2) % BENCHMARK_INSTRUMENTS;
+					cell.vol = nextRandom() % 2 ? 40 + nextRandom() % 60 : 255;
+					(*notes)++;
+				}
+				else if (row % 4 == (ch + 2) % 4 && nextRandom() % 4 == 0)
+				{
+					cell.fx = nextRandom() % 2 ? 'M' : 'X';
+					cell.fxdata = nextRandom() % 100;
+				}
+			}
+
+			if (row % 16 == 0)
+			{
+				mt->pattern[p][row][0].fx = 'T';
+				mt->pattern[p][row][0].fxdata = 100 + nextRandom() % 60;
+			}
+		}
+	}
+	mt_cellsChanged(mt, -1);
+	return true;
+}
+
+static bool sameCells(mtsynth *a, mtsynth *b)
+{
+	if (a->patternCount != b->patternCount || a->channelCount != b->channelCount || a->instrumentCount != b->instrumentCount)
+		return false;
+
+	for (unsigned p = 0; p < a->patternCount; p++)
+	{
+		if (a->patternSize[p] != b->patternSize[p])
+			return false;
+
+		for (unsigned row = 0; row < a->patternSize[p]; row++)
+		{
+			if (memcmp(a->pattern[p][row], b->pattern[p][row], sizeof(Cell)*a->channelCount))
+				return false;
+		}
+	}
+	return memcmp(a->instrument, b->instrument, sizeof(fm_instrument)*a->instrumentCount) == 0;
+}
+
+/* Freezes the first channel in a copy of the song, then plays the song live with it : the freeze must have been
+recorded at the tempo of the live render, or it goes stale */
+static bool freezeChannel(mtsynth *mt, mtsynth *copy, short *buffer, unsigned frames)
+{
+	mtFreeze *freeze = mt_copySong(copy, mt) ? mt_freezeBegin(copy, 0) : NULL;
+	bool frozen = freeze != NULL;
+	for (unsigned f = 0; frozen && f < BENCHMARK_FREEZE_SECONDS * copy->sampleRate; f += frames)
+	{
+		frozen = mt_freezeStep(copy, freeze, frames) > 0;
+	}
+	frozen = frozen && mt_freezeEnd(copy, freeze) && mt_freezeMatches(mt, freeze, 1);
+
+	if (frozen)
+	{
+		/* Stops a second short of the end of the recording */
+		mt_setChannelFreeze(mt, 0, freeze);
+		mt_setPosition(mt, 0, 0, 0);
+		mt_play(mt);
+		for (unsigned f = 0; f < (BENCHMARK_FREEZE_SECONDS - 1) * mt->sampleRate; f += frames)
+		{
+			mt_render(mt, buffer, frames * 2, MT_RENDER_16);
+		}
+		frozen = !freeze->stale;
+		mt_stop(mt, 1);
+		mt_setPosition(mt, 0, 0, 0);
+		mt_setChannelFreeze(mt, 0, NULL);
+	}
+	if (freeze)
+	{
+		mt_freezeDestroy(freeze);
+	}
+	return frozen;
+}
+
+int benchmark_run(unsigned patterns, const std::string &tempFile)
+{
+	patterns = patterns > 0 ? patterns : BENCHMARK_DEFAULT_PATTERNS;
+
+	mtsynth *mt = mt_create(44100), *loaded = mt_create(44100), *copy = mt_create(44100);
+	if (!mt || !loaded || !copy)
+	{
+		fprintf(stderr, "Can't initialize the FM synthesizer\n");
+		return 1;
+	}
+
+	char details[128];
+	unsigned notes;
+
+	printf("Benchmark : %u patterns of %u rows, %u channels\n", patterns, BENCHMARK_ROWS, mt->channelCount);
+	printf("Step                          time (ms)\n");
+
+	beginStep();
+	bool generated = generateSong(mt, patterns, &notes);
+	snprintf(details, sizeof(details), "%u rows, %u notes", (unsigned)mt_getSongPosition(mt, mt->patternCount, 0), notes);
+	endStep("generate", generated, details);
+
+	if (!generated)
+	{
+		mt_destroy(mt);
+		mt_destroy(loaded);
+		mt_destroy(copy);
+		return 1;
+	}
+
+	beginStep();
+	mt_buildStateTable(mt, 0, mt->patternCount, 0, mt->channelCount);
+	snprintf(details, sizeof(details), "%.0f s long", mt_getSongLength(mt));
+	endStep("state table", true, details);
+
+	beginStep();
+	unsigned songRows = mt_getSongPosition(mt, mt->patternCount, 0), checksum = 0;
+	for (unsigned i = 0; i < BENCHMARK_SEEKS; i++)
+	{
+		unsigned pattern, row;
+		mt_getPatternRow(mt, (nextRandom() << 15 | nextRandom()) % songRows, &pattern, &row);
+		checksum += mt_getSongPosition(mt, pattern, row);
+	}
+	snprintf(details, sizeof(details), "%u positions", BENCHMARK_SEEKS);
+	endStep("seek", checksum > 0, details);
+
+	beginStep();
+	unsigned usedChannels = mt_getUsedChannels(mt);
+	endStep("used channels", usedChannels == mt->channelCount);
+
+	beginStep();
+	unsigned char used[32];
+	mt_getUsedInstruments(mt, used);
+	endStep("used instruments", used[0] == 0x55);
+
+	beginStep();
+	unsigned usedCount = 0;
+	for (unsigned i = 0; i < mt->instrumentCount; i++)
+	{
+		usedCount += mt_isInstrumentUsed(mt, i);
+	}
+	snprintf(details, sizeof(details), "%u instruments checked one by one", mt->instrumentCount);
+	endStep("instrument checks", usedCount == BENCHMARK_INSTRUMENTS / 2, details);
+
+	beginStep();
+	unsigned removed = mt_removeUnusedInstruments(mt, NULL);
+	snprintf(details, sizeof(details), "%u removed", removed);
+	endStep("instrument cleanup", removed == BENCHMARK_INSTRUMENTS / 2, details);
+
+	beginStep();
+	bool copied = mt_copySong(copy, mt) != 0;
+	endStep("copy", copied);
+
+	beginStep();
+	copied = mt_copySong(copy, mt) != 0;
+	endStep("copy (unchanged)", copied);
+
+	beginStep();
+	bool saved = mt_saveSong(mt, tempFile.c_str()) != 0;
+	FILE *fp = fopen(tempFile.c_str(), "rb");
+	long size = 0;
+	if (fp)
+	{
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fclose(fp);
+	}
+	snprintf(details, sizeof(details), "%.1f MB", size / 1048576.f);
+	endStep("save", saved, details);
+
+	beginStep();
+	bool loadedOk = mt_loadSong(loaded, tempFile.c_str()) == 0;
+	endStep("load", loadedOk && sameCells(mt, loaded));
+	remove(tempFile.c_str());
+
+	static short buffer[1024 * 2];
+	unsigned frames = 0;
+
+	/* The editor freezes with the same copy each time : the second freeze follows an initial tempo change, which
+	the song starts with once the tempo effect of its first row is removed */
+	beginStep();
+	mt->pattern[0][0][0].fx = mt->pattern[0][0][0].fxdata = 0;
+	mt_cellsChanged(mt, 0);
+	mt_buildStateTable(mt, 0, mt->patternCount, 0, mt->channelCount);
+	bool frozen = freezeChannel(mt, copy, buffer, 1024);
+	mt_setTempo(mt, mt->initial_tempo < 200 ? mt->initial_tempo + 40 : mt->initial_tempo - 40);
+	frozen = frozen && freezeChannel(mt, copy, buffer, 1024);
+	endStep("freeze", frozen);
+
+	beginStep();
+	mt_play(mt);
+	while (frames < BENCHMARK_RENDER_SECONDS * mt->sampleRate)
+	{
+		mt_render(mt, buffer, 1024 * 2, MT_RENDER_16);
+		frames += 1024;
+	}
+	float seconds = stepClock.getElapsedTime().asSeconds();
+	snprintf(details, sizeof(details), "%d s of audio, %.0fx real time", BENCHMARK_RENDER_SECONDS, BENCHMARK_RENDER_SECONDS / seconds);
+	endStep("render", mt->playing != 0, details);
+
+	mt_destroy(mt);
+	mt_destroy(loaded);
+	mt_destroy(copy);
+	return failed;
+}
@@ -0,0 +1,21 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+
+/* Synthetic large-song benchmark
+
+	Started with --benchmark, without opening the window. A song of 'patterns' patterns of BENCHMARK_ROWS rows
+	(BENCHMARK_DEFAULT_PATTERNS by default, ten times the former 256 pattern limit) is generated with notes and
+	effects in every channel, then the operations going through the whole song are timed : state table, seeking,
+	channel and instrument usage scans, instrument cleanup, copy, save, load, channel freeze (checked
+	against the live render after an initial tempo change) and rendering. */
+
+#define BENCHMARK_ROWS 64
+#define BENCHMARK_DEFAULT_PATTERNS 2560
+
+/* Runs the benchmark, the song is saved to 'tempFile' then removed
+	@return 1 if a step failed, 0 otherwise (used as exit code) */
+int benchmark_run(unsigned patterns, const std::string &tempFile);
+
+#endif
@@ -0,0 +1,256 @@
+#include "freeze.hpp"
+#include "../globalFunctions.hpp"
+#include <atomic>
+#include <vector>
+
+/* Frames rendered between two checks of the cancel flag */
+#define FREEZE_STEP_FRAMES 8192
+
+/* The song must be left unchanged this long before a channel is rendered again */
+#define FREEZE_EDIT_DELAY_MS 1000
+
+/* Channels frozen by the user */
+static bool frozen[FM_ch];
+
+/* Freeze of each channel, owned by the GUI thread. NULL while it is rendered */
+static mtFreeze *freezes[FM_ch];
+
+/* Freeze of each channel, as the audio callback must attach it */
+static std::atomic<mtFreeze*> attached[FM_ch];
+
+/* Audio callbacks started so far. A detached freeze is freed once a callback started after the detach */
+static std::atomic<unsigned> renderCount(0);
+
+struct retiredFreeze{
+	mtFreeze *freeze;
+	unsigned renderCount;
+};
+static std::vector<retiredFreeze> retired;
+
+/* Render in progress. Only written by the GUI thread while the worker isn't running */
+static mtsynth *rendering;
+static mtFreeze *rendered;
+static int renderChannel = -1;
+static bool renderOutOfMemory;
+static std::atomic<bool> renderDone(false), renderCancel(false);
+
+/* Song changes since the last check */
+static unsigned checkedRevision, checkedSongRevision;
+static bool songEdited = false;
+static sf::Clock editClock;
+
+static void freezeFunc();
+static sf::Thread freezeThread(&freezeFunc);
+
+/* Runs in the worker thread */
+static void freezeFunc()
+{
+	mtFreeze *f = mt_freezeBegin(rendering, renderChannel);
+	int result = f ? 1 : -1;
+
+	while (result == 1 && !renderCancel)
+	{
+		result = mt_freezeStep(rendering, f, FREEZE_STEP_FRAMES);
+	}
+
+	if (f && (!mt_freezeEnd(rendering, f) || result < 0 || renderCancel))
+	{
+		result = -1;
+		mt_freezeDestroy(f);
+		f = NULL;
+	}
+
+	renderOutOfMemory = result < 0 && !renderCancel;
+	rendered = f;
+	renderDone = true;
+}
+
+static bool audioRunning()
+{
+	return audioInitialized && stream && Pa_IsStreamActive(stream) == 1;
+}
+
+/* Sets the freeze of a channel, the previous one is freed once the audio callback doesn't use it anymore */
+static void attach(unsigned ch, mtFreeze *f)
+{
+	mtFreeze *previous = freezes[ch];
+	freezes[ch] = f;
+	attached[ch] = f;
+
+	if (!audioRunning())
+	{
+		mt_setChannelFreeze(fm, ch, f);
+		mt_freezeDestroy(previous);
+	}
+	else if (previous)
+	{
+		retiredFreeze r = { previous, renderCount };
+		retired.push_back(r);
+	}
+}
+
+static void startRender(unsigned ch)
+{
+	if (!mt_copySong(rendering, fm) || rendering->sampleRate != fm->sampleRate && !mt_setSampleRate(rendering, fm->sampleRate))
+	{
+		error("Not enough memory to freeze the channel");
+		frozen[ch] = false;
+		return;
+	}
+
+	renderChannel = ch;
+	renderDone = false;
+	renderCancel = false;
+	freezeThread.launch();
+}
+
+void freeze_initialize()
+{
+	if (!(rendering = mt_create(44100)))
+	{
+		error("Can't initialize the channel freeze");
+	}
+}
+
+void freeze_exit()
+{
+	renderCancel = true;
+	freezeThread.wait();
+}
+
+void freeze_setChannel(unsigned ch, bool frozenChannel)
+{
+	if (ch >= FM_ch || !rendering || frozenChannel && ch >= fm->channelCount)
+		return;
+
+	frozen[ch] = frozenChannel;
+
+	if (!frozenChannel)
+	{
+		attach(ch, NULL);
+		if (renderChannel == (int)ch)
+			renderCancel = true;
+	}
+	else
+	{
+		/* Render now, without waiting for the end of the edits */
+		songEdited = false;
+	}
+}
+
+int freeze_channelState(unsigned ch)
+{
+	if (!frozen[ch])
+		return FREEZE_OFF;
+
+	return freezes[ch] && !freezes[ch]->stale ? FREEZE_ON : FREEZE_RENDERING;
+}
+
+void freeze_clear()
+{
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		freeze_setChannel(ch, false);
+	}
+}
+
+void freeze_render(mtsynth *mt)
+{
+	renderCount++;
+
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		mtFreeze *f = attached[ch];
+		if (mt->ch[ch].freeze != f)
+			mt_setChannelFreeze(mt, ch, f);
+	}
+}
+
+int freeze_update()
+{
+	int changes = 0;
+
+	/* Free the freezes the audio callback can't be using anymore */
+	for (unsigned i = 0; i < retired.size();)
+	{
+		if (renderCount != retired[i].renderCount || !audioRunning())
+		{
+			mt_freezeDestroy(retired[i].freeze);
+			retired.erase(retired.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	/* End of a render : kept if the channel didn't change in the meantime */
+	if (renderChannel >= 0 && renderDone)
+	{
+		freezeThread.wait();
+		unsigned ch = renderChannel;
+		renderChannel = -1;
+
+		if (renderOutOfMemory)
+		{
+			error("Not enough memory to freeze the channel");
+			frozen[ch] = false;
+		}
+
+		if (rendered && frozen[ch] && mt_freezeMatches(fm, rendered, 1))
+		{
+			attach(ch, rendered);
+		}
+		else
+		{
+			mt_freezeDestroy(rendered);
+		}
+		rendered = NULL;
+		changes++;
+	}
+
+	/* The song changed : outdated freezes are dropped, the channel is synthesized until it is rendered again.
+		Checking all the channels takes a few ms on long songs, once per edit */
+	if (songRevision != checkedRevision || fm->songRevision != checkedSongRevision)
+	{
+		/* Rendered again once the edits are over */
+		if (renderChannel >= 0)
+			renderCancel = true;
+
+		for (unsigned ch = 0; ch < FM_ch; ch++)
+		{
+			/* Removed channels are unfrozen */
+			if (frozen[ch] && ch >= fm->channelCount)
+			{
+				freeze_setChannel(ch, false);
+				changes++;
+			}
+			/* Stale freezes (tempo effects edited in another channel) are rendered again too */
+			else if (freezes[ch] && (freezes[ch]->stale || !mt_freezeMatches(fm, freezes[ch], 1)))
+			{
+				attach(ch, NULL);
+				changes++;
+			}
+		}
+
+		checkedRevision = songRevision;
+		checkedSongRevision = fm->songRevision;
+		songEdited = true;
+		editClock.restart();
+	}
+
+	/* Next channel to render */
+	if (renderChannel < 0 && (!songEdited || editClock.getElapsedTime().asMilliseconds() >= FREEZE_EDIT_DELAY_MS))
+	{
+		for (unsigned ch = 0; ch < fm->channelCount; ch++)
+		{
+			if (frozen[ch] && !freezes[ch])
+			{
+				startRender(ch);
+				changes++;
+				break;
+			}
+		}
+	}
+	return changes;
+}
@@ -0,0 +1,35 @@
+#ifndef FREEZE_H
+#define FREEZE_H
+
+#include "../mtengine/mtlib.h"
+
+/* Channel freeze
+
+	A frozen channel is rendered once for the whole song by a background thread (mt_freezeBegin, on a copy of the
+	song), then played back from memory instead of being synthesized : heavy songs stay playable on slow computers.
+	The freezes are checked every frame. When the cells or the instruments of a frozen channel change, the channel
+	is synthesized again, and once the song is left unchanged for a moment it is rendered again in the background. */
+
+enum freezeStates{ FREEZE_OFF, FREEZE_RENDERING, FREEZE_ON };
+
+void freeze_initialize();
+
+/* Stops the render in progress */
+void freeze_exit();
+
+/* Freezes or unfreezes a channel */
+void freeze_setChannel(unsigned ch, bool frozen);
+
+/* FREEZE_OFF, FREEZE_RENDERING (frozen, but synthesized until its render is ready) or FREEZE_ON */
+int freeze_channelState(unsigned ch);
+
+/* Unfreezes all the channels, when another song is opened */
+void freeze_clear();
+
+/* Called every frame from the main loop : checks the freezes and runs the renders. Returns 1 when a state changed */
+int freeze_update();
+
+/* Called by the audio callback before rendering a block, attaches the freezes to the channels */
+void freeze_render(mtsynth *mt);
+
+#endif
@@ -11,6 +11,12 @@
 #include "gui/mainmenu.hpp"
 #include "portaudio.h"
 #include "gui/sidebar.hpp"
+#include "rtcheck/rtcheck.hpp"
+#include "autosave/autosave.hpp"
+#include "library/instrumentLibrary.hpp"
+#include "startup/startup.hpp"
+#include "loader/songLoader.hpp"
+#include "freeze/freeze.hpp"
 
 #ifdef _WIN32
 #include <direct.h>
@@ -33,6 +39,7 @@ extern Text notePreview;
 bool windowTooSmall;
 string lastSongOpened;
 int isSongModified = 0;
+unsigned songRevision = 0;
 float frameTime60;
 static string note2name[129];
 string appdir, appconfigdir, instrDir, songDir;
@@ -204,7 +211,9 @@ void updateViews(int width, int height)
 
 	globalView.reset(FloatRect(0.f, 0.f, width, height));
 	
-	pianoRoll->resetView(width, height);
+	/* Pages built on their first visit (see Menu::goToPage) */
+	if (pianoRoll)
+		pianoRoll->resetView(width, height);
 
 	popup->updateWindow();
 
@@ -295,6 +304,8 @@ void songModified(int _modified)
 		window->setTitle(windowTitle);
 	}
 	isSongModified = _modified;
+	if (_modified)
+		songRevision++;
 }
 
 void setWindowTitle(string title)
@@ -347,8 +358,16 @@ sf::Color string2color(const char* s)
 static int patestCallback(const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer, const PaStreamCallbackTimeInfo* timeInfo,
 	PaStreamCallbackFlags statusFlags, void *userData)
 {
+	rtcheck_enterAudioCallback();
+
+	/* A song loaded in the background is swapped in between two blocks */
+	songLoader_render((mtsynth*)userData);
+
+	/* Frozen channels are attached and detached between two blocks too */
+	freeze_render((mtsynth*)userData);
+
 	char *out = (char*)outputBuffer;
-	mt_render((mtsynth*)userData, &out[0], framesPerBuffer * 2, MT_RENDER_16);
+	midi_render((mtsynth*)userData, &out[0], framesPerBuffer);
 
 	if (sidebar && songEditor)
 	{
@@ -356,7 +375,7 @@ static int patestCallback(const void *inputBuffer, void *outputBuffer, unsigned
 		{
 			sidebar->vuMeter->setValue(((short*)out)[i], ((short*)out)[i + 1]);
 
-			for (int ch = 0; ch < FM_ch; ch++)
+			for (unsigned ch = 0; ch < fm->channelCount; ch++)
 			{
 
 				songEditor->channelHead[ch].vu.setValue(fm->ch[ch].lastRender * !fm->ch[ch].muted);
@@ -364,12 +383,14 @@ static int patestCallback(const void *inputBuffer, void *outputBuffer, unsigned
 		}
 	}
 
+	rtcheck_leaveAudioCallback((mtsynth*)userData);
 
 	return 0;
 }
 
 
-void global_initialize()
+/* Config directory and preferences */
+static void global_loadConfig()
 {
 	/* Set config (preferences) directory */
 #ifdef _WIN32
@@ -395,44 +416,57 @@ void global_initialize()
 	mkdir(appconfigdir.c_str(),0774);
 #endif
 
+	rtcheck_initialize();
+
 	/* Load config files (preferences, last songs, midi instrument list..) */
 	iniparams_load();
+}
 
-	/* Initialize libraries and sound engine */
-	if (!(fm = mt_create(44100)))
-	{
-		error("Can't initialize the FM synthesizer");
-	}
+/* Preferences and instrument library, all a batch conversion needs */
+void global_initializeConfig()
+{
+	global_loadConfig();
 
-	if (Pm_Initialize() != pmNoError)
-	{
-		error("Can't initialize PortMidi");
-	}
+	instrumentLibrary_initialize();
+}
 
-	midiReceiveEnable(1);
+void global_initialize()
+{
+	global_loadConfig();
 
-	PaError err;
+	/* Slow parts of startup, done in the background (see startup.hpp) */
+	instrumentLibrary_initializeAsync();
+	startup_beginDevices();
 
-	if ((err = Pa_Initialize()) != paNoError)
-	{
-		error(Pa_GetErrorText(err));
-		error("Can't initialize PortAudio");
-	}
-	else
+	/* Initialize sound engine */
+	if (!(fm = mt_create(44100)))
 	{
-		audioInitialized = true;
+		error("Can't initialize the FM synthesizer");
 	}
 
+	midiReceiveEnable(1);
+
 	callbackFunc = (void*)&patestCallback;
 
 	computeNoteNames();
 
+	autosave_initialize();
+
+	songLoader_initialize();
+	freeze_initialize();
 }
 
 void global_exit()
 {
+	songLoader_exit();
+	freeze_exit();
+	autosave_exit();
+	instrumentLibrary_exit();
+	startup_waitDevices();
+
 	Pa_CloseStream(stream);
 	Pa_Terminate();
+	midi_exit();
 	Pm_Terminate();
 
 	config->save();
@@ -53,6 +53,8 @@ extern void* callbackFunc;
 
 extern View patternView, globalView, borderView, patternTopView, patNumView, instrView, pianorollView;
 extern int isSongModified;
+/* Incremented on every song modification */
+extern unsigned songRevision;
 extern string lastSongOpened;
 extern string songLoadedRequest;
 extern float frameTime60;
@@ -117,6 +119,7 @@ std::string dirnameOf(const std::string& fname);
 
 sf::Color string2color(const char* s);
 
+void global_initializeConfig();
 void global_initialize();
 
 void global_exit();
@@ -6,6 +6,12 @@
 extern mtsynth *phanoo;
 extern ListMenu *contextMenu;
 
+/* Buttons get wider past 2 digit numbers */
+static int buttonWidth(int id)
+{
+	return id < 100 ? 19 : 19 + 6 * ((int)std::to_string(id).size() - 2);
+}
+
 ButtonList::ButtonList(int _x, int _y) :selected(0), maxId(0)
 {
 	x = _x;
@@ -53,7 +59,7 @@ void ButtonList::draw()
 {
 
 	
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 	
 	if (selected)
 	{
@@ -71,7 +77,7 @@ void ButtonList::draw()
 void ButtonList::add(string text)
 {
 
-	buttons.push_back(Button(x + buttons.size() * 24, y, std::to_string(maxId), maxId < 100 ? 19 : 25));
+	buttons.push_back(Button(x + buttons.size() * 24, y, std::to_string(maxId), buttonWidth(maxId)));
 
 	maxId++;
 	updateButtonPos();
@@ -152,7 +158,7 @@ int ButtonList::isElementHovered(int index)
 
 void ButtonList::insert(int index, string text)
 {
-	buttons.insert(buttons.begin() + index, Button(x + index * 24, y, std::to_string(maxId), maxId < 100 ? 19 : 25));
+	buttons.insert(buttons.begin() + index, Button(x + index * 24, y, std::to_string(maxId), buttonWidth(maxId)));
 	maxId++;
 	updateButtonPos();
 }
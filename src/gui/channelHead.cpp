@@ -2,6 +2,7 @@
 #include "../mtengine/mtlib.h"
 #include "contextmenu/contextmenu.hpp"
 #include "drawBatcher.hpp"
+#include "../freeze/freeze.hpp"
 
 extern mtsynth *phanoo;
 
@@ -19,6 +20,10 @@ channelName(std::to_string(_channelIndex + 1), font, charSize), pressed(false),
 
 	channelName.setPosition(3 * 18 + 4 + 100 * channelIndex + 5, 4);
 	channelName.setFillColor(colors[TITLE]);
+
+	freezeIcon.setFont(font_symbols);
+	freezeIcon.setCharacterSize(charSize);
+	freezeIcon.setFillColor(colors[TITLE]);
 	selected = 0;
 }
 
@@ -48,6 +53,15 @@ void ChannelHead::draw()
 	drawBatcher.addItem(&channelName);
 	//window->draw(channelName);
 
+	/* Frozen channel : snowflake, or a clock while it is rendered */
+	int freezeState = freeze_channelState(channelIndex);
+	if (freezeState != FREEZE_OFF)
+	{
+		freezeIcon.setString(freezeState == FREEZE_ON ? ICON_MD_AC_UNIT : ICON_MD_ACCESS_TIME);
+		freezeIcon.setPosition(channelName.getPosition().x + channelName.getLocalBounds().width + 6, 6);
+		drawBatcher.addItem(&freezeIcon);
+	}
+
 	
 	
 }
@@ -126,7 +140,7 @@ void ChannelHead::update(unsigned *paramChanged, int *mutedChanged, int *channel
 			pressed = 0;
 			if (!hover() && *paramChanged == 0 && (mouse.pos.x < channelSelector.getPosition().x || mouse.pos.x > channelSelector.getPosition().x + channelSelector.getSize().x))
 			{
-				*channelSwapped = clamp(mouse.pos.x / CH_WIDTH, 0, FM_ch - 1);
+				*channelSwapped = clamp(mouse.pos.x / CH_WIDTH, 0, (int)fm->channelCount - 1);
 			}
 		}
 	}
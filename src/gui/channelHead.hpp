@@ -8,7 +8,7 @@
 
 class ChannelHead{
 
-	Text channelName;
+	Text channelName, freezeIcon;
 
 
 	sf::RectangleShape channelSelector;
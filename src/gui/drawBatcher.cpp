@@ -1,20 +1,20 @@
 #include "drawBatcher.hpp"
 #include "../globalFunctions.hpp"
+#include "../profiler/profiler.hpp"
 #include <math.h>
+#include <string.h>
 
 DrawBatcher drawBatcher;
 
 
-DrawBatcher::DrawBatcher() :itemCount(0), textCount(0), lineCount(0)
+DrawBatcher::DrawBatcher() :itemCount(0), textCount(0), lineCount(0), layer(NULL)
 {
-	items.setPrimitiveType(sf::Quads);
-	lines.setPrimitiveType(sf::Lines);
-
 }
 
 void DrawBatcher::addItemSingleColor(float x, float y, float w, float h, sf::Color color)
 {
-	items.resize(itemCount+4);
+	if (items.size() < itemCount+4)
+		items.resize(itemCount+4);
 	sf::Vertex *v = &items[itemCount];
 	v[0].position.x = x;
 	v[0].position.y = y;
@@ -37,7 +37,8 @@ void DrawBatcher::addItemSingleColor(float x, float y, float w, float h, sf::Col
 void DrawBatcher::addItemBicolor(float x, float y, float w, float h, sf::Color color, sf::Color color2)
 {
 
-	items.resize(itemCount+4);
+	if (items.size() < itemCount+4)
+		items.resize(itemCount+4);
 	sf::Vertex *v = &items[itemCount];
 	v[0].position.x = x;
 	v[0].position.y = y;
@@ -131,7 +132,8 @@ void DrawBatcher::addItem(Slider *s)
 
 void DrawBatcher::addItem(sf::VertexArray *v)
 {
-	items.resize(itemCount+4);
+	if (items.size() < itemCount+4)
+		items.resize(itemCount+4);
 
 	items[itemCount] = (*v)[0];
 	items[itemCount+1] = (*v)[1];
@@ -142,7 +144,8 @@ void DrawBatcher::addItem(sf::VertexArray *v)
 
 void DrawBatcher::addLine(sf::Vertex *l1, sf::Vertex *l2)
 {
-	lines.resize(lineCount+2);
+	if (lines.size() < lineCount+2)
+		lines.resize(lineCount+2);
 
 	lines[lineCount] = *l1;
 	lines[lineCount+1] = *l2;
@@ -234,33 +237,93 @@ void DrawBatcher::addItem(RectangleShape *r)
 }
 
 
-void DrawBatcher::initialize()
+void DrawBatcher::initialize(const void *owner)
 {
-	items.resize(0);
-	lines.resize(0);
-	texts.resize(0);
+	layer = &layers[owner];
 	itemCount=0;
 	textCount=0;
 	lineCount=0;
 }
 
+/* Uploads the primitives ('stride' vertices each) which differ from the previous upload */
+void DrawBatcher::upload(batchBuffer &b, sf::PrimitiveType type, const std::vector<sf::Vertex> &vertices, unsigned count, unsigned stride)
+{
+	if (b.buffer.getVertexCount() < count)
+	{
+		/* Grown buffers lose their content */
+		b.buffer.setPrimitiveType(type);
+		b.buffer.setUsage(sf::VertexBuffer::Dynamic);
+		if (!b.buffer.create(max<size_t>(count, b.buffer.getVertexCount() * 2)))
+			return;
+		b.uploaded.clear();
+	}
+
+	if (b.uploaded.size() < count)
+	{
+		unsigned known = b.uploaded.size() / stride * stride;
+		b.uploaded.resize(count);
+		b.buffer.update(&vertices[known], count - known, known);
+		memcpy(&b.uploaded[known], &vertices[known], sizeof(sf::Vertex) * (count - known));
+		count = known;
+	}
+
+	/* Consecutive changed primitives are uploaded at once */
+	unsigned first = 0;
+	bool dirty = false;
+
+	for (unsigned i = 0; i <= count; i += stride)
+	{
+		bool changed = i < count && memcmp(&b.uploaded[i], &vertices[i], sizeof(sf::Vertex) * stride) != 0;
+
+		if (changed && !dirty)
+		{
+			first = i;
+			dirty = true;
+		}
+		else if (!changed && dirty)
+		{
+			b.buffer.update(&vertices[first], i - first, first);
+			memcpy(&b.uploaded[first], &vertices[first], sizeof(sf::Vertex) * (i - first));
+			dirty = false;
+		}
+	}
+}
+
 void DrawBatcher::draw()
 {
 
-	items.resize(itemCount);
-	lines.resize(lineCount);
-	texts.resize(textCount);
+	if (sf::VertexBuffer::isAvailable() && layer)
+	{
+		if (itemCount > 0)
+		{
+			upload(layer->items, sf::Quads, items, itemCount, 4);
+			window->draw(layer->items.buffer, 0, itemCount);
+		}
+		if (lineCount > 0)
+		{
+			upload(layer->lines, sf::Lines, lines, lineCount, 2);
+			window->draw(layer->lines.buffer, 0, lineCount);
+		}
+	}
+	else
+	{
+		if (itemCount > 0)
+			window->draw(&items[0], itemCount, sf::Quads);
+		if (lineCount > 0)
+			window->draw(&lines[0], lineCount, sf::Lines);
+	}
+
+	profiler_countDraw(itemCount + lineCount, (itemCount > 0) + (lineCount > 0));
 
-	window->draw(items);
-	window->draw(lines);
 	for (unsigned i=0; i<textCount; i++)
-		window->draw(*texts[i]);
+		profiler_draw(window, *texts[i]);
 	
 }
 
 void DrawBatcher::addItem(sf::Text* text)
 {
-	texts.resize(textCount+1);
+	if (texts.size() < textCount+1)
+		texts.resize(textCount+1);
 	texts[textCount]=text;
 	textCount++;
 }
\ No newline at end of file
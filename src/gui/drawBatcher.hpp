@@ -3,6 +3,7 @@
 
 #include <SFML/Graphics.hpp>
 #include <vector>
+#include <map>
 #include "button/button.hpp"
 #include "slider/dataslider.hpp"
 #include "vumeter/vumeter.hpp"
@@ -11,16 +12,35 @@
 #include "operator/operator.hpp"
 #include "list/list.hpp"
 
+/* Vertices of a batch kept on the GPU between frames, with a copy of what was uploaded */
+struct batchBuffer{
+	sf::VertexBuffer buffer;
+	std::vector<sf::Vertex> uploaded;
+};
+
+/* The retained vertices of one owner (see DrawBatcher::initialize) */
+struct batchLayer{
+	batchBuffer items, lines;
+};
+
+/* Widgets are added in the same order every frame, so the n-th quad of a layer usually describes the same
+	widget part as in the previous frame. Only the quads and lines that changed since then are uploaded */
 class DrawBatcher{
-	sf::VertexArray items;
-	sf::VertexArray lines;
+	std::vector<sf::Vertex> items;
+	std::vector<sf::Vertex> lines;
 	std::vector<sf::Text*> texts;
 	int itemCount ,textCount, lineCount;
 
+	std::map<const void*, batchLayer> layers;
+	batchLayer *layer;
+
+	void upload(batchBuffer &b, sf::PrimitiveType type, const std::vector<sf::Vertex> &vertices, unsigned count, unsigned stride);
+
 	public:
 		DrawBatcher();
 		void draw();
-		void initialize();
+		/* Starts a batch. Each owner (the object drawing the batch) has its own vertex buffers */
+		void initialize(const void *owner);
 		void addItemSingleColor(float x, float y, float w, float h, sf::Color color);
 		void addItemBicolor(float x, float y, float w, float h, sf::Color color, sf::Color color2);
 		void addItem(Button *b);
@@ -56,7 +56,7 @@ void showInstrumentLights()
 	{
 		instrList->pings[i] = 0;
 	}
-	for (int i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < fm->channelCount; i++)
 	{
 		if (fm->ch[i].active && fm->ch[i].instrNumber < instrList->pings.size())
 			instrList->pings[fm->ch[i].instrNumber] = 1;
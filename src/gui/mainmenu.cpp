@@ -7,6 +7,7 @@
 #include "../views/pianoroll/pianoRoll.hpp"
 #include "../gui/popup/popup.hpp"
 #include "../views/pattern/songFileActions.hpp"
+#include "../startup/startup.hpp"
 
 Menu *menu;
 
@@ -185,9 +186,14 @@ void Menu::goToPage(int page)
 	switch (page)
 	{
 		case PAGE_CONFIG:
+			/* Device lists are filled once PortAudio/PortMidi are initialized */
+			startup_waitDevices();
 			state = config;
 			break;
 		case PAGE_GENERAL:
+			/* Pages not shown at startup are built on their first visit */
+			if (!generalEditor)
+				generalEditor = new GeneralEditor();
 			state = generalEditor;
 			break;
 		case PAGE_SONG:
@@ -197,6 +203,13 @@ void Menu::goToPage(int page)
 			state = instrEditor;
 			break;
 		case PAGE_PIANOROLL:
+			if (!pianoRoll)
+			{
+				/* Song loads skip it until then, the legend is built from the current song */
+				pianoRoll = new Pianoroll(0);
+				pianoRoll->updateFromFM();
+				pianoRoll->resetView(windowWidth, windowHeight);
+			}
 			state = pianoRoll;
 			break;
 	}
@@ -45,7 +45,7 @@ int Operator::update()
 
 	float maxVol = 0;
 
-	for (int i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < fm->channelCount; i++)
 	{
 		if (fm->ch[i].instrNumber == instrList->value && fm->ch[i].active)
 		{
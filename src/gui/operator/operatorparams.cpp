@@ -177,7 +177,7 @@ void OpGUI::draw()
 	
 
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 	drawBatcher.addItem(&bg);
 
 	for (unsigned i = 0; i < slider.size(); ++i)
@@ -402,7 +402,7 @@ void Popup::draw()
 			visible = 0;
 	}
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 	drawBatcher.addItem(&shadow);
 	drawBatcher.addItem(&bg);
 
@@ -26,7 +26,9 @@ enum popups{
 	POPUP_FIRSTSTART,
 	POPUP_OPENFAILED,
 	POPUP_WRONGVERSION,
-	POPUP_MULTITRACKEXPORT
+	POPUP_MULTITRACKEXPORT,
+	POPUP_RECOVERY,
+	POPUP_LOADING
 };
 
 
@@ -1,6 +1,8 @@
 ﻿#include "popup.hpp"
 #include "../contextmenu/contextmenu.hpp"
 #include "../../streamed/streamedExport.h"
+#include "../../autosave/autosave.hpp"
+#include "../../loader/songLoader.hpp"
 
 void setEffectList(List* list)
 {
@@ -375,9 +377,7 @@ void Popup::show(int _type, int param)
 			midiExportAssocChannels.resize(fm->instrumentCount, 0);
 			for (int i = oldSize; i < midiExportAssocChannels.size(); i++)
 			{
-				midiExportAssocChannels[i] = i % 16;
-				if (i == 9)
-					midiExportAssocChannels[i]++;
+				midi_defaultExportMapping(fm, i, midiExportAssoc[i], midiExportAssocChannels[i]);
 			}
 			setSize(850, 510);
 			title.setString("MIDI export");
@@ -548,6 +548,24 @@ void Popup::show(int _type, int param)
 			texts[0].setFillColor(colors[BLOCKTEXT]);
 			texts[0].setPosition(20, 20);
 			break;
+		case POPUP_RECOVERY:
+			setSize(600, 170);
+			title.setString("Recover autosaved song");
+			texts.push_back(Text(autosave_recoveryDescription(), font, charSize));
+			texts[0].setFillColor(colors[BLOCKTEXT]);
+			texts[0].setPosition(10, 10);
+			buttons.push_back(Button(w - 90, h - 50, "Recover", -1, 8));
+			buttons.push_back(Button(30, h - 50, "Discard", -1, 8));
+			break;
+		case POPUP_LOADING:
+			setSize(500, 200);
+			title.setString("Info");
+			texts.push_back(Text("Loading " + songLoader_fileName() + "...", font, charSize));
+			texts[0].setFillColor(colors[BLOCKTEXT]);
+			texts[0].setPosition(10, 20);
+			sliders.push_back(DataSlider(80, 70, 99, 0, "%", 0));
+			buttons.push_back(Button(50, h - 50, "Cancel", -1, 8));
+			break;
 		case POPUP_MULTITRACKEXPORT:
 			setSize(600, 450);
 			title.setString("Multi-track streamed audio export");
@@ -570,7 +588,7 @@ void Popup::show(int _type, int param)
 
 			
 
-			for (unsigned i = 0; i < FM_ch; i++)
+			for (unsigned i = 0; i < fm->channelCount; i++)
 			{
 				lists[1].add("Channel "+std::to_string(i+1));
 			}
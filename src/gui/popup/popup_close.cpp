@@ -7,6 +7,8 @@
 #include "tinyfiledialogs.h"
 #include "../../views/instrument/instrEditor.hpp"
 #include "../../views/pattern/songFileActions.hpp"
+#include "../../autosave/autosave.hpp"
+#include "../../loader/songLoader.hpp"
 
 
 
@@ -250,11 +252,31 @@ void Popup::buttonActions(int buttonID)
 					break;
 			}
 			break;
+		case POPUP_RECOVERY:
+			switch (buttonID)
+			{
+				case 0: // recover
+					close();
+					autosave_recover();
+					break;
+				case 1: // discard
+					autosave_discardRecovery();
+					close();
+					break;
+			}
+			break;
+		case POPUP_LOADING:
+			if (buttonID == 0)
+			{ // cancel button
+				songLoader_cancel();
+			}
+			close();
+			break;
 		case POPUP_DELETEINSTRUMENT:
 			if (buttonID == 0)
 			{ // yes button
 				instrEditor->removeInstrument();
-				for (unsigned ch = 0; ch < FM_ch; ++ch)
+				for (unsigned ch = 0; ch < fm->channelCount; ++ch)
 					songEditor->updateChannelData(ch);
 			}
 			close();
@@ -289,9 +311,15 @@ void Popup::buttonActions(int buttonID)
 				if (fileName)
 				{
 					string fileNameOk = forceExtension(fileName, "mid");
-					midiExport(fileNameOk.c_str());
-					popup->show(POPUP_SAVED);
-					close();
+					if (midiExport(fileNameOk.c_str()) == 0)
+					{
+						popup->show(POPUP_SAVED);
+						close();
+					}
+					else
+					{
+						popup->show(POPUP_SAVEFAILED);
+					}
 				}
 			}
 			if (buttonID == 1)
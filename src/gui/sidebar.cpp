@@ -79,7 +79,7 @@ void Sidebar::draw()
 	window->setView(borderView);
 
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 	drawBatcher.addItem(&borderRight);
 	drawBatcher.addItem(&currentInstr);
 	drawBatcher.addItem(&octave);
@@ -36,6 +36,11 @@ void StereoVuMeter::update()
 	vuRight.update();
 }
 
+bool StereoVuMeter::isMoving()
+{
+	return vuLeft.isMoving() || vuRight.isMoving();
+}
+
 void StereoVuMeter::draw()
 {
 	vuLeft.draw();
@@ -30,6 +30,11 @@ void MiniVuMeter::setValue(int _value)
 		value = abs(_value);
 }
 
+bool MiniVuMeter::isMoving()
+{
+	return value > 0;
+}
+
 void MiniVuMeter::setPosition(int _x, int _y)
 {
 	x=_x;
@@ -123,6 +128,11 @@ void VuMeter::update()
 
 }
 
+bool VuMeter::isMoving()
+{
+	return value > 0 || topValue > 0 || saturationTimer > 0;
+}
+
 void VuMeter::draw()
 {
 	window->draw(title);
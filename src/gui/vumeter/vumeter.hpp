@@ -17,6 +17,8 @@ public:
 	VuMeter(int x, int y, std::string title);
 	void update();
 	void draw();
+	/* Still animating : level or peak falling, saturation shown */
+	bool isMoving();
 };
 
 class MiniVuMeter{
@@ -35,6 +37,7 @@ class MiniVuMeter{
 	void setValue(int value);
 	void forceValue(int value);
 	void setPosition(int x, int y);
+	bool isMoving();
 };
 
 
@@ -48,6 +51,7 @@ class StereoVuMeter{
 	void setValue(int left, int right);
 	void draw();
 	void update();
+	bool isMoving();
 };
 
 #endif
\ No newline at end of file
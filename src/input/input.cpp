@@ -6,6 +6,7 @@
 #include "../gui/mainmenu.hpp"
 #include "../views/pattern/songFileActions.hpp"
 #include "../gui/sidebar.hpp"
+#include "../profiler/profiler.hpp"
 
 keyboard_ keyboard;
 mouse_ mouse;
@@ -17,8 +18,9 @@ extern Text notePreview;
 
 int textEnteredCount = 0;
 
-void input_update()
+int input_update()
 {
+	int events = 0;
 
 
 	memset(&keyboard, 0, sizeof(keyboard));
@@ -37,6 +39,7 @@ void input_update()
 
 	while (window->pollEvent(evt))
 	{
+		events++;
 		handleUnconditionalEvents();
 		if (!popup->visible)
 		{
@@ -51,6 +54,7 @@ void input_update()
 			}
 		}
 	}
+	return events;
 }
 
 Vector2i input_getmouse(View &view)
@@ -169,6 +173,9 @@ void handleUnconditionalEvents()
 						popup->close();
 						contextMenu=0;
 						break;
+					case Keyboard::F12:
+						profiler_toggleOverlay();
+						break;
 					default:
 						break;
 				}
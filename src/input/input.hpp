@@ -21,7 +21,8 @@ extern mouse_ mouse;
 extern sf::Vector2i mouseSidebar, mouseGlobal;
 
 extern int textEnteredCount;
-void input_update();
+/* Handles the window events, returns how many there were */
+int input_update();
 
 void handleNotePreview(int canPreview);
 
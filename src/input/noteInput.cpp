@@ -14,10 +14,51 @@ static vector<int> recordChannels;
 
 void configurePreviewChannel(int channel)
 {
-	fm->ch[channel].muted = 0;
-	fm->ch[channel].vol = 1;
-	fm->ch[channel].reverbSend = mt_volumeToExp(config->previewReverb.value);
-	fm->ch[channel].destPan = fm->ch[channel].pan = 127;
+	configurePreviewChannel(fm, channel, config->previewReverb.value);
+}
+
+void configurePreviewChannel(mtsynth *mt, int channel, int reverb)
+{
+	mt->ch[channel].muted = 0;
+	mt->ch[channel].vol = 1;
+	mt->ch[channel].reverbSend = mt_volumeToExp(reverb);
+	mt->ch[channel].destPan = mt->ch[channel].pan = 127;
+}
+
+/* Song editor : records the note into the first free record channel.
+	Returns the channel holding the note, 'channel' when not recording */
+static int recordNoteOn(int id, int volume, int isFromMidi, int channel)
+{
+	recordChannels.clear();
+
+	for (unsigned i = 0; i < fm->channelCount; i++)
+	{
+		if (songEditor->channelHead[i].record.selected)
+		{
+			recordChannels.push_back(i);
+		}
+	}
+
+	if (state == songEditor && !instrList->selected && recordChannels.size() > 0)
+	{
+		channel = 0;
+		while ((noteChn2[channel] > 0 || !songEditor->channelHead[channel].record.selected) && channel < (int)fm->channelCount - 1)
+		{
+			channel++;
+
+		}
+
+
+		if (channel>recordChannels[recordChannels.size() - 1])
+		{
+			channel = recordChannels[recordChannels.size() - 1];
+		}
+
+		songEditor->recordFromKeyboard(id, volume, channel, isFromMidi);
+
+	}
+
+	return channel;
 }
 
 void previewNote(int instrument, int id, int volume, int isFromMidi)
@@ -52,9 +93,9 @@ void previewNote(int instrument, int id, int volume, int isFromMidi)
 		int nbTries = 0;
 		do
 		{
-			channel = (channel + 1) % FM_ch;
+			channel = (channel + 1) % fm->channelCount;
 			nbTries++;
-		} while (fm->ch[channel].active && nbTries<FM_ch);
+		} while (fm->ch[channel].active && nbTries < (int)fm->channelCount);
 	}
 
 	if (channel == -1)
@@ -62,52 +103,31 @@ void previewNote(int instrument, int id, int volume, int isFromMidi)
 		int nbTries = 0;
 		do
 		{
-			channel = (channel + 1) % FM_ch;
+			channel = (channel + 1) % fm->channelCount;
 			nbTries++;
-		} while ((noteChn2[channel] > 0) && nbTries < FM_ch);
+		} while ((noteChn2[channel] > 0) && nbTries < (int)fm->channelCount);
 		return;
 	}
 
-	recordChannels.clear();
-
-	for (unsigned i = 0; i < FM_ch; i++)
-	{
-		if (songEditor->channelHead[i].record.selected)
-		{
-			recordChannels.push_back(i);
-		}
-	}
-
 	configurePreviewChannel(channel);
 	mt_playNote(fm, instrument, id, channel, volume);
 	noteChn[id] = channel;
 	noteChn3[channel] = id + 1;
 
-	// song editor : record notes
-	if (state == songEditor && !instrList->selected && recordChannels.size() > 0)
-	{
-		channel = 0;
-		while ((noteChn2[channel] > 0 || !songEditor->channelHead[channel].record.selected) && channel < FM_ch - 1)
-		{
-			channel++;
-
-		}
-
-
-		if (channel>recordChannels[recordChannels.size() - 1])
-		{
-			channel = recordChannels[recordChannels.size() - 1];
-		}
-
-		songEditor->recordFromKeyboard(id, volume, channel, isFromMidi);
-
-	}
-
-	noteChn2[channel] = id + 1;
-
+	noteChn2[recordNoteOn(id, volume, isFromMidi, channel)] = id + 1;
+}
 
+void recordNote(int id, int volume)
+{
+	int channel = recordNoteOn(id, volume, 1, -1);
 
+	if (channel >= 0)
+		noteChn2[channel] = id + 1;
+}
 
+float previewBendRatio(int value)
+{
+	return 1 - (float)(128 - value) * 9.2852373168154813872606848242328e-4;
 }
 
 void previewNoteBend(mtsynth *f, int value)
@@ -116,15 +136,13 @@ void previewNoteBend(mtsynth *f, int value)
 	{
 		if (noteChn2[ch]>0)
 		{
-			f->ch[ch].pitchBend = 1 - (float)(128 - value) * 9.2852373168154813872606848242328e-4;
+			f->ch[ch].pitchBend = previewBendRatio(value);
 		}
 	}
 }
 
-void previewNoteStop(int id, int isFromMidi)
+void recordNoteStop(int id, int isFromMidi)
 {
-
-	mt_stopNote(fm, noteChn[id]);
 	for (unsigned i = 0; i < FM_ch; i++)
 	{
 		if (id == noteChn2[i] - 1)
@@ -137,11 +155,25 @@ void previewNoteStop(int id, int isFromMidi)
 	}
 }
 
-void previewNoteStopAll()
+void previewNoteStop(int id, int isFromMidi)
+{
+	mt_stopNote(fm, noteChn[id]);
+	recordNoteStop(id, isFromMidi);
+}
+
+void recordNoteStopAll()
 {
 	for (unsigned i = 0; i < FM_ch; i++)
 	{
 		noteChn2[i] = 0;
+	}
+}
+
+void previewNoteStopAll()
+{
+	recordNoteStopAll();
+	for (unsigned i = 0; i < FM_ch; i++)
+	{
 		mt_stopNote(fm, i);
 	}
-}
\ No newline at end of file
+}
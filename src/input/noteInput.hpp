@@ -12,6 +12,19 @@ void previewNoteStopAll();
 
 void previewNoteBend(mtsynth *f, int value);
 
+/* Pitch bend value (0-255) to pitch ratio */
+float previewBendRatio(int value);
+
+/* Recording only, for the notes played by the MIDI input thread */
+void recordNote(int id, int volume);
+
+void recordNoteStop(int id, int isFromMidi);
+
+void recordNoteStopAll();
+
 void configurePreviewChannel(int channel);
 
+/* Same, without reading the preferences : for the audio thread */
+void configurePreviewChannel(mtsynth *mt, int channel, int reverb);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,348 @@
+#include "instrumentLibrary.hpp"
+#include "../globalFunctions.hpp"
+#define SI_CONVERT_GENERIC
+#include "SimpleIni.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* Pack layout : "MDTL", unused byte, pack version, 2 unused bytes, instrument count, record size (32-bit each),
+	stamp of the loose files (newest modification time, 64-bit, and file count, 32-bit), 4 unused bytes,
+	then the index (count names of LIBRARY_NAMESIZE bytes, sorted) and the records, in the index order */
+#define LIBRARY_HEADERSIZE 32
+#define LIBRARY_NAMESIZE 64
+#define LIBRARY_VERSION 2
+
+extern CSimpleIniA ini_gmlist;
+
+static const char *library;
+static size_t librarySize;
+static unsigned libraryCount;
+#ifdef _WIN32
+static HANDLE libraryFile = INVALID_HANDLE_VALUE, libraryMapping;
+#endif
+
+/* gmlist.ini entries, resolved once */
+static string gmMelodic[128], gmPercussion[128], gmPercussionXG[128], gmDefault;
+
+/* Loose files the pack was built from : it is rebuilt when one of them is added, removed or modified */
+struct libraryStamp{
+	int64_t newest;
+	uint32_t count;
+};
+
+/* Set while instrumentLibrary_initializeAsync runs */
+static bool libraryLoading = false;
+static sf::Mutex libraryMutex;
+static sf::Thread libraryThread(&instrumentLibrary_initialize);
+
+static string libraryFileName()
+{
+	return appconfigdir + "instruments.mdtl";
+}
+
+static string looseFileName(const string& name)
+{
+	return appdir + "instruments" + pathSeparator + name + ".mdti";
+}
+
+static time_t modificationTime(const string& file)
+{
+	struct stat st;
+	if (stat(file.c_str(), &st) != 0)
+		return 0;
+	return st.st_mtime;
+}
+
+static void unmapLibrary()
+{
+	if (!library)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(library);
+	CloseHandle(libraryMapping);
+	CloseHandle(libraryFile);
+	libraryFile = INVALID_HANDLE_VALUE;
+#else
+	munmap((void*)library, librarySize);
+#endif
+	library = NULL;
+	librarySize = libraryCount = 0;
+}
+
+static bool mapLibrary(const string& file, const libraryStamp& stamp)
+{
+#ifdef _WIN32
+	libraryFile = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (libraryFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(libraryFile, &size) || size.QuadPart < LIBRARY_HEADERSIZE
+		|| !(libraryMapping = CreateFileMappingA(libraryFile, NULL, PAGE_READONLY, 0, 0, NULL)))
+	{
+		CloseHandle(libraryFile);
+		libraryFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	librarySize = (size_t)size.QuadPart;
+	library = (const char*)MapViewOfFile(libraryMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!library)
+	{
+		CloseHandle(libraryMapping);
+		CloseHandle(libraryFile);
+		libraryFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+#else
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < LIBRARY_HEADERSIZE)
+	{
+		close(fd);
+		return false;
+	}
+
+	librarySize = st.st_size;
+	void *data = mmap(NULL, librarySize, PROT_READ, MAP_SHARED, fd, 0);
+	/* The mapping stays valid after the file is closed */
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+	library = (const char*)data;
+#endif
+
+	/* Check the header, the record size changes with the instrument format */
+	uint32_t count, recordSize;
+	libraryStamp packStamp;
+	memcpy(&count, library + 8, 4);
+	memcpy(&recordSize, library + 12, 4);
+	memcpy(&packStamp.newest, library + 16, 8);
+	memcpy(&packStamp.count, library + 24, 4);
+
+	if (memcmp(library, "MDTL", 4) != 0 || library[5] != LIBRARY_VERSION || recordSize != sizeof(fm_instrument)
+		|| packStamp.newest != stamp.newest || packStamp.count != stamp.count
+		|| count > (librarySize - LIBRARY_HEADERSIZE) / (LIBRARY_NAMESIZE + sizeof(fm_instrument)))
+	{
+		unmapLibrary();
+		return false;
+	}
+
+	libraryCount = count;
+	return true;
+}
+
+/* Instruments listed in gmlist.ini, sorted */
+static vector<string> libraryNames()
+{
+	vector<string> names;
+	for (int i = 0; i < 128; i++)
+	{
+		names.push_back(gmMelodic[i]);
+		names.push_back(gmPercussion[i]);
+		names.push_back(gmPercussionXG[i]);
+	}
+	names.push_back(gmDefault);
+
+	sort(names.begin(), names.end());
+	names.erase(unique(names.begin(), names.end()), names.end());
+	return names;
+}
+
+/* Only the modification times are read, gmlist.ini included */
+static libraryStamp looseFilesStamp(const vector<string>& names)
+{
+	libraryStamp stamp = { (int64_t)modificationTime(appdir + "gmlist.ini"), 0 };
+
+	for (unsigned i = 0; i < names.size(); i++)
+	{
+		if (names[i].empty())
+			continue;
+
+		time_t fileTime = modificationTime(looseFileName(names[i]));
+		if (fileTime != 0)
+		{
+			stamp.newest = max(stamp.newest, (int64_t)fileTime);
+			stamp.count++;
+		}
+	}
+	return stamp;
+}
+
+/* Packs the loose files of every instrument listed in gmlist.ini */
+static bool buildLibrary(const string& file, const vector<string>& names, const libraryStamp& stamp)
+{
+	vector<char> index, records;
+	char record[sizeof(fm_instrument) + 1];
+	uint32_t count = 0;
+
+	for (unsigned i = 0; i < names.size(); i++)
+	{
+		if (names[i].empty() || names[i].size() >= LIBRARY_NAMESIZE)
+			continue;
+
+		FILE *fp = fopen(looseFileName(names[i]).c_str(), "rb");
+		if (!fp)
+			continue;
+		size_t read = fread(record, 1, sizeof(record), fp);
+		fclose(fp);
+
+		if (read != sizeof(fm_instrument) || memcmp(record, "MDTI", 4) != 0)
+			continue;
+
+		char name[LIBRARY_NAMESIZE] = { 0 };
+		memcpy(name, names[i].c_str(), names[i].size());
+		index.insert(index.end(), name, name + LIBRARY_NAMESIZE);
+		records.insert(records.end(), record, record + sizeof(fm_instrument));
+		count++;
+	}
+
+	char header[LIBRARY_HEADERSIZE] = { 'M', 'D', 'T', 'L', 0, LIBRARY_VERSION, 0, 0 };
+	uint32_t recordSize = sizeof(fm_instrument);
+	memcpy(header + 8, &count, 4);
+	memcpy(header + 12, &recordSize, 4);
+	memcpy(header + 16, &stamp.newest, 8);
+	memcpy(header + 24, &stamp.count, 4);
+
+	string tmpFile = file + ".tmp";
+	FILE *fp = fopen(tmpFile.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	bool ok = fwrite(header, LIBRARY_HEADERSIZE, 1, fp) == 1
+		&& (count == 0 || fwrite(index.data(), index.size(), 1, fp) == 1 && fwrite(records.data(), records.size(), 1, fp) == 1);
+	ok = fclose(fp) == 0 && ok;
+
+	remove(file.c_str());
+	if (!ok || rename(tmpFile.c_str(), file.c_str()) != 0)
+	{
+		remove(tmpFile.c_str());
+		return false;
+	}
+	return true;
+}
+
+static int findRecord(const string& name)
+{
+	if (!library || name.size() >= LIBRARY_NAMESIZE)
+		return -1;
+
+	const char *index = library + LIBRARY_HEADERSIZE;
+	int low = 0, high = (int)libraryCount - 1;
+
+	while (low <= high)
+	{
+		int middle = (low + high) / 2;
+		int cmp = strncmp(name.c_str(), index + middle*LIBRARY_NAMESIZE, LIBRARY_NAMESIZE);
+
+		if (cmp == 0)
+			return middle;
+		else if (cmp < 0)
+			high = middle - 1;
+		else
+			low = middle + 1;
+	}
+	return -1;
+}
+
+void instrumentLibrary_initialize()
+{
+	for (int i = 0; i < 128; i++)
+	{
+		gmMelodic[i] = ini_gmlist.GetValue("melodic", int2str[i].c_str(), "");
+		gmPercussion[i] = ini_gmlist.GetValue("percussion", int2str[i].c_str(), "");
+		gmPercussionXG[i] = ini_gmlist.GetValue("percussion", string(int2str[i] + "XG").c_str(), "");
+	}
+	gmDefault = ini_gmlist.GetValue("melodic", "default", "");
+
+	string file = libraryFileName();
+	vector<string> names = libraryNames();
+	libraryStamp stamp = looseFilesStamp(names);
+
+	if (mapLibrary(file, stamp))
+		return;
+
+	/* Missing, outdated or unreadable pack : rebuild it from the loose files */
+	if (!buildLibrary(file, names, stamp) || !mapLibrary(file, stamp))
+	{
+		error("Can't build the instrument library, instruments will be loaded from separate files");
+	}
+}
+
+void instrumentLibrary_initializeAsync()
+{
+	libraryLoading = true;
+	libraryThread.launch();
+}
+
+/* Waits for instrumentLibrary_initializeAsync */
+static void waitLibrary()
+{
+	sf::Lock lock(libraryMutex);
+	if (libraryLoading)
+	{
+		libraryThread.wait();
+		libraryLoading = false;
+	}
+}
+
+void instrumentLibrary_exit()
+{
+	waitLibrary();
+	unmapLibrary();
+}
+
+int instrumentLibrary_load(mtsynth* mt, const string& name, unsigned slot)
+{
+	waitLibrary();
+
+	int record = findRecord(name);
+
+	if (record >= 0)
+	{
+		const char *data = library + LIBRARY_HEADERSIZE + libraryCount*LIBRARY_NAMESIZE + record*sizeof(fm_instrument);
+		return mt_loadInstrumentFromBuffer(mt, data, sizeof(fm_instrument), slot);
+	}
+
+	if (name.empty())
+		return MT_ERR_FILEIO;
+
+	return mt_loadInstrument(mt, looseFileName(name).c_str(), slot);
+}
+
+int instrumentLibrary_loadGM(mtsynth* mt, int id, int percussion, bool xg, unsigned slot)
+{
+	if (id < 0 || id > 127)
+		return MT_ERR_FILEIO;
+
+	waitLibrary();
+
+	if (!percussion)
+		return instrumentLibrary_load(mt, gmMelodic[id], slot);
+
+	return instrumentLibrary_load(mt, xg && id < 35 ? gmPercussionXG[id] : gmPercussion[id], slot);
+}
+
+int instrumentLibrary_loadDefault(mtsynth* mt, unsigned slot)
+{
+	waitLibrary();
+	return instrumentLibrary_load(mt, gmDefault, slot);
+}
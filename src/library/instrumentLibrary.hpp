@@ -0,0 +1,31 @@
+#ifndef INSTRUMENTLIBRARY_H
+#define INSTRUMENTLIBRARY_H
+
+#include <string>
+#include "../mtengine/mtlib.h"
+
+/* Packed instrument library
+
+	The instruments listed in gmlist.ini are packed into a single file in the config directory : a header, an index
+	of fixed-size names sorted alphabetically, then one fixed-size record per instrument holding the .mdti file image.
+	The pack is built from the loose .mdti files on the first start (or when gmlist.ini or the loose files changed,
+	their modification times are stamped in the pack) and memory mapped once, so loading a GM instrument is a binary search and a copy instead of a file read.
+	Instruments missing from the pack are loaded from the loose files. */
+
+void instrumentLibrary_initialize();
+
+/* Same, from a background thread : the functions below wait for it the first time they are called */
+void instrumentLibrary_initializeAsync();
+void instrumentLibrary_exit();
+
+/* Loads an instrument into slot, name is its path in the instruments directory without extension ("keyboards/piano").
+	Returns the mt_loadInstrument error codes */
+int instrumentLibrary_load(mtsynth* mt, const std::string& name, unsigned slot);
+
+/* Loads the instrument gmlist.ini associates to a MIDI program (percussion=0) or percussion note (percussion=1) */
+int instrumentLibrary_loadGM(mtsynth* mt, int id, int percussion, bool xg, unsigned slot);
+
+/* Loads the default melodic instrument of gmlist.ini */
+int instrumentLibrary_loadDefault(mtsynth* mt, unsigned slot);
+
+#endif
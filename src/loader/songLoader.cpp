@@ -0,0 +1,216 @@
+#include "songLoader.hpp"
+#include "../globalFunctions.hpp"
+#include "../midi/midi.h"
+#include "../gui/popup/popup.hpp"
+#include "../views/pattern/songFileActions.hpp"
+#include <atomic>
+
+/* Loads shorter than this don't show the popup */
+#define LOADER_POPUP_DELAY_MS 250
+
+/* Longest wait for the audio callback to swap the song in, it normally takes one audio buffer */
+#define LOADER_SWAP_TIMEOUT_MS 500
+
+/* Song loaded by the worker. After a swap, it holds the previous song until the next load */
+static mtsynth *loading;
+
+/* Song waiting for the audio callback */
+static std::atomic<mtsynth*> pendingSong(NULL);
+
+/* Set by the audio callback once mt_swapSong returned */
+static std::atomic<bool> swapDone(false);
+
+/* The load in progress. Only written by the GUI thread while the worker isn't running */
+static string loadingFile;
+static bool loadingFromAutoReload;
+static void (*loadedCallback)();
+static midiImportSettings importSettings;
+static midiImportProgress importProgress;
+static int loadResult;
+static std::atomic<bool> loadDone(false);
+
+/* GUI side : a load was started and not handled yet */
+static bool running = false, popupShown;
+static sf::Clock loadClock;
+
+static void loaderFunc();
+static sf::Thread loaderThread(&loaderFunc);
+
+/* Runs in the worker thread */
+static void loaderFunc()
+{
+	const char *filename = loadingFile.c_str();
+
+	if (checkExtension(filename, "mdts"))
+	{
+		loadResult = mt_loadSong(loading, filename);
+	}
+	else if (checkExtension(filename, "mid") || checkExtension(filename, "smf") || checkExtension(filename, "rmi"))
+	{
+		loadResult = midiImport(loading, filename, importSettings);
+	}
+	else if (checkExtension(filename, "mus"))
+	{
+		loadResult = musImport(loading, filename, importSettings);
+	}
+	else
+	{
+		loadResult = MT_ERR_FILEIO;
+	}
+	loadDone = true;
+}
+
+void songLoader_initialize()
+{
+	if (!(loading = mt_create(44100)))
+	{
+		error("Can't initialize the song loader");
+	}
+}
+
+void songLoader_exit()
+{
+	importProgress.cancel = true;
+	loaderThread.wait();
+	running = false;
+}
+
+void songLoader_start(const char *filename, bool fromAutoReload, void (*loaded)())
+{
+	/* A new load replaces the one in progress */
+	songLoader_exit();
+
+	loadingFile = filename;
+	loadingFromAutoReload = fromAutoReload;
+	loadedCallback = loaded;
+
+	importSettings = midi_importSettings();
+	importSettings.progress = &importProgress;
+	importProgress.percent = 0;
+	importProgress.cancel = false;
+
+	/* Imports keep the volume of the current song */
+	mt_setVolume(loading, fm->_globalVolume);
+	loading->readSeek = loading->totalFileSize = 0;
+
+	loadDone = false;
+	running = true;
+	popupShown = false;
+	loadClock.restart();
+	loaderThread.launch();
+}
+
+void songLoader_cancel()
+{
+	if (running)
+	{
+		importProgress.cancel = true;
+		running = false;
+	}
+}
+
+std::string songLoader_fileName()
+{
+	return loadingFile.substr(loadingFile.find_last_of("\\/") + 1);
+}
+
+/* Progress of the load in progress, in % */
+static int progress()
+{
+	if (checkExtension(loadingFile, "mdts"))
+	{
+		unsigned size = loading->totalFileSize;
+		return size > 0 ? min(99ull, (unsigned long long)loading->readSeek * 100 / size) : 0;
+	}
+	return importProgress.percent;
+}
+
+void songLoader_render(mtsynth *mt)
+{
+	mtsynth *song = pendingSong.exchange(NULL);
+	if (song)
+	{
+		mt_swapSong(mt, song);
+		swapDone = true;
+	}
+}
+
+/* Swaps the loaded song into fm, from the audio callback when it is running */
+static void swapSong()
+{
+	bool audioRunning = audioInitialized && stream && Pa_IsStreamActive(stream) == 1;
+
+	if (audioRunning)
+	{
+		swapDone = false;
+		pendingSong = loading;
+
+		sf::Clock clock;
+		while (!swapDone && clock.getElapsedTime().asMilliseconds() < LOADER_SWAP_TIMEOUT_MS)
+		{
+			sf::sleep(sf::milliseconds(1));
+		}
+	}
+
+	/* No audio callback, or it stopped before taking the song : swap here */
+	mtsynth *song = pendingSong.exchange(NULL);
+	if (song || !audioRunning)
+	{
+		mt_swapSong(fm, loading);
+		return;
+	}
+
+	/* The callback took the song, wait for the end of the swap */
+	while (!swapDone)
+	{
+		sf::sleep(sf::milliseconds(1));
+	}
+}
+
+int songLoader_update()
+{
+	if (!running)
+		return 0;
+
+	if (!loadDone)
+	{
+		if (popup->visible && popup->type == POPUP_LOADING)
+		{
+			popup->sliders[0].setValue(progress());
+		}
+		else if (!popupShown && !popup->visible && loadClock.getElapsedTime().asMilliseconds() > LOADER_POPUP_DELAY_MS)
+		{
+			popup->show(POPUP_LOADING);
+			popupShown = true;
+		}
+		return 1;
+	}
+
+	running = false;
+	loaderThread.wait();
+
+	if (popup->visible && popup->type == POPUP_LOADING)
+	{
+		popup->close();
+	}
+
+	/* Corrupted songs are opened anyway. MUS files that can't be converted leave the song untouched */
+	bool opened = loadResult == 0 || loadResult == MT_ERR_FILECORRUPTED && checkExtension(loadingFile, "mdts");
+
+	if (opened)
+	{
+		swapSong();
+	}
+
+	song_loaded(loadingFile.c_str(), loadResult, loadingFromAutoReload);
+
+	if (opened)
+	{
+		/* Release the previous song */
+		mt_clearSong(loading);
+
+		if (loadedCallback)
+			loadedCallback();
+	}
+	return 1;
+}
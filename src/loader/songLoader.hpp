@@ -0,0 +1,35 @@
+#ifndef SONGLOADER_H
+#define SONGLOADER_H
+
+#include <string>
+#include "../mtengine/mtlib.h"
+
+/* Background song loading
+
+	Songs (.mdts, or MIDI/MUS imports) are loaded into a separate synth by a worker thread, while the current song
+	stays on screen and keeps playing. Slow loads show a popup with the progress and a cancel button.
+	Once loaded, the song is handed to the audio callback, which swaps it into the live synth between two render
+	blocks (mt_swapSong). The GUI thread waits for the swap before updating the pages, so it never sees half a song. */
+
+void songLoader_initialize();
+
+/* Waits for a running load */
+void songLoader_exit();
+
+/* Starts loading a song, replacing the load in progress if any. Once swapped in, song_loaded is called,
+	then 'loaded' if the song was opened */
+void songLoader_start(const char *filename, bool fromAutoReload, void (*loaded)() = NULL);
+
+/* Stops the load in progress, the current song is kept */
+void songLoader_cancel();
+
+/* Called every frame from the main loop : progress and end of the load. Returns 1 while a load is in progress */
+int songLoader_update();
+
+/* Name of the file being loaded, without its directory */
+std::string songLoader_fileName();
+
+/* Called by the audio callback before rendering a block, swaps in the song waiting for it */
+void songLoader_render(mtsynth *mt);
+
+#endif
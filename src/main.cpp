@@ -22,6 +22,14 @@
 #include "gui/sidebar.hpp"
 #include "ProgramOptions.hxx"
 #include "whereami.h"
+#include "rtcheck/rtcheck.hpp"
+#include "autosave/autosave.hpp"
+#include "library/instrumentLibrary.hpp"
+#include "profiler/profiler.hpp"
+#include "startup/startup.hpp"
+#include "loader/songLoader.hpp"
+#include "freeze/freeze.hpp"
+#include "benchmark/benchmark.hpp"
 
 
 Uint32 textEntered[32];
@@ -34,6 +42,37 @@ void *focusedElement;
 State *state;
 int windowFocus = 1;
 
+/* Frames are only drawn when something may have changed on screen (see isActive), and during IDLE_GRACE_MS after it,
+	for the hover and double click timers. Otherwise the loop polls the events every IDLE_POLL_MS and still redraws
+	every IDLE_REDRAW_MS (text cursor, popups closing by themselves). In the background, it draws at most
+	one frame every UNFOCUSED_FRAME_MS */
+#define IDLE_GRACE_MS 500
+#define IDLE_POLL_MS 10
+#define IDLE_REDRAW_MS 500
+#define UNFOCUSED_FRAME_MS 100
+#define UNFOCUSED_REDRAW_MS 1000
+
+/* Input was received, or the song, the meters or a mouse drag are moving */
+static bool isActive(int events)
+{
+	if (events > 0 || fm->playing || mouse.clickLock2 > 0 || sidebar->vuMeter->isMoving())
+		return true;
+
+	if (windowFocus && (Mouse::isButtonPressed(Mouse::Left) || Mouse::isButtonPressed(Mouse::Right)))
+		return true;
+
+	/* Channel meters only fall while they are drawn */
+	if (state == songEditor)
+	{
+		for (int ch = songEditor->scrollX; ch < songEditor->scrollX2; ch++)
+		{
+			if (songEditor->channelHead[ch].vu.isMoving())
+				return true;
+		}
+	}
+	return false;
+}
+
 
 int main(int argc, char *argv[])
 {
@@ -43,6 +82,23 @@ int main(int argc, char *argv[])
 	std::string song_to_play;
 	po::option &song = parser["song"];
 	song.bind(song_to_play);
+	std::string directory_to_convert;
+	po::option &convert = parser["convert"];
+	convert.bind(directory_to_convert);
+	std::string directory_to_export;
+	po::option &export_midi = parser["export-midi"];
+	export_midi.bind(directory_to_export);
+	unsigned convert_jobs = 0;
+	po::option &jobs = parser["jobs"];
+	jobs.bind(convert_jobs);
+	std::string profile_trace;
+	po::option &profile = parser["profile"];
+	profile.bind(profile_trace);
+	po::option &startup_report = parser["startup-report"];
+	po::option &benchmark = parser["benchmark"];
+	unsigned benchmark_patterns = 0;
+	po::option &benchmark_patterns_opt = parser["benchmark-patterns"];
+	benchmark_patterns_opt.bind(benchmark_patterns);
 	po::option &unknown = parser[""];
 
 	if (!parser(argc, argv) || !app_dir.was_set())
@@ -61,51 +117,115 @@ int main(int argc, char *argv[])
 			appdir.push_back('/');
 	}
 
+	/* Batch MIDI/MUS conversion, without opening the window */
+	if (convert.was_set())
+	{
+		global_initializeConfig();
+		int failed = midi_batchConvert(directory_to_convert, midi_importSettings(), convert_jobs);
+		instrumentLibrary_exit();
+		return failed > 0;
+	}
+
+	/* Batch MIDI export of the songs of a directory */
+	if (export_midi.was_set())
+	{
+		global_initializeConfig();
+		int failed = midi_batchExport(directory_to_export, convert_jobs);
+		instrumentLibrary_exit();
+		return failed > 0;
+	}
+
+	/* Large song benchmark, without opening the window */
+	if (benchmark.was_set())
+	{
+		global_initializeConfig();
+		int failed = benchmark_run(benchmark_patterns, appconfigdir + "benchmark.mdts");
+		instrumentLibrary_exit();
+		return failed;
+	}
+
+	startup_initialize(startup_report.was_set());
+
 	global_initialize();
+	startup_mark("preferences and synth");
 
 	gui_initialize();
+	startup_mark("window and fonts");
 
 	/* Create main UI */
 	sidebar = new Sidebar();
 	menu = new Menu(14);
 
-	/* Create pages */
+	/* Create pages. The general page and the piano roll are created on their first visit */
 	config = new ConfigEditor();
 	songEditor = new SongEditor();
-	generalEditor = new GeneralEditor();
 	instrEditor = new InstrEditor(46);
 	popup = new Popup();
-	pianoRoll = new Pianoroll(0);
 
 	updateViews(WindowWidth, WindowHeight);
 
 	/* Start the app on the song editor */
 	menu->goToPage(PAGE_SONG);
 
-	/* Select a default sound device or the previous selected one */
-	config->selectBestSoundDevice();
-
 	/* Load recent songs list */
 	config->loadRecentSongs();
+	startup_mark("pages");
 
-
+	/* The song is loaded after the first frame */
 	if (song.was_set())
 	{
-		song_load(song_to_play.c_str(), false);
-	}
-	else
-	{
-		config->loadLastSong();
+		startup_setSong(song_to_play);
 	}
 
+	profiler_initialize(profile_trace);
+
+	sf::Clock activityClock, frameClock;
+	bool idle = false;
+
 	while (window->isOpen())
 	{
-
+		profiler_beginFrame(PROFILE_INPUT);
 		
-		midi_getEvents();
+		int events = startup_update();
+
+		events += midi_getEvents();
 
-		input_update();
+		events += input_update();
 
+		autosave_update();
+
+		events += songLoader_update();
+
+		events += freeze_update();
+
+		/* Pattern memory replaced by the edits, once the audio callback is done with it */
+		mt_freeRetired(fm, !(audioInitialized && stream && Pa_IsStreamActive(stream) == 1));
+
+		/* Skip the frame when nothing changed, or draw at a low rate in the background */
+		bool active = isActive(events);
+		if (active)
+			activityClock.restart();
+
+		if (!windowFocus || activityClock.getElapsedTime().asMilliseconds() > IDLE_GRACE_MS)
+		{
+			int period = windowFocus ? IDLE_REDRAW_MS : (active ? UNFOCUSED_FRAME_MS : UNFOCUSED_REDRAW_MS);
+
+			if (frameClock.getElapsedTime().asMilliseconds() < period)
+			{
+				sf::sleep(sf::milliseconds(IDLE_POLL_MS));
+				idle = true;
+				continue;
+			}
+		}
+		else if (idle)
+		{
+			/* Woken up by input : the frame timers shouldn't count the idle time */
+			mclock.restart();
+		}
+		idle = false;
+		frameClock.restart();
+
+		profiler_phase(PROFILE_UPDATE);
 
 
 
@@ -195,17 +315,22 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		profiler_phase(PROFILE_POPUPEVENTS);
 		popup->handleEvents();
 
 
 	drawing:
+		profiler_phase(PROFILE_STATEDRAW);
 		window->clear(colors[BACKGROUND]);
 
 		state->draw();
 
+		profiler_phase(PROFILE_SIDEBARDRAW);
 		sidebar->draw();
 		window->setView(globalView);
 
+		profiler_phase(PROFILE_POPUPDRAW);
+
 		showInstrumentLights();
 
 		if (popup->visible)
@@ -218,13 +343,17 @@ int main(int argc, char *argv[])
 			contextMenu->draw();
 		}
 
-	
+		profiler_draw();
+
+		profiler_phase(PROFILE_DISPLAY);
 		window->display();
 
 		updateMouseCursor();
 
+		profiler_endFrame();
 	}
 
+	profiler_exit();
 	global_exit();
-	return(0);
+	return(rtcheck_report());
 }
@@ -5,6 +5,7 @@
 #include <portmidi.h>
 #include "../views/settings/configEditor.hpp"
 #include <vector>
+#include <atomic>
 using namespace std;
 
 #include "midiInstrNames.h"
@@ -16,14 +17,59 @@ extern ConfigEditor *configEditor;
 extern vector<int> midiExportAssoc;
 extern vector<int> midiExportAssocChannels;
 
-void midi_getEvents();
+/* MIDI input is read by its own thread : the audio callback plays the notes with midi_render,
+	the GUI records them into the song with midi_getEvents, which returns the number of events received */
+int midi_getEvents();
+void midi_render(mtsynth *mt, char *buffer, unsigned long frames);
 void midi_selectDevice(int id);
 vector<string>* midi_refreshDevices();
-int addInstrument(int id, unsigned char type);
-int midiImport(const char* filename);
-int musImport(const char* filename);
+void midi_exit();
+/* Lets another thread follow a running import, and stop it (the import then returns MT_ERR_CANCELLED) */
+struct midiImportProgress{
+	std::atomic<int> percent;
+	std::atomic<bool> cancel;
+};
 
-void midiExport(const char* filename);
+/* MIDI import settings, copied from the preferences so imports can run outside of the GUI thread */
+struct midiImportSettings{
+	int patternSize, diviseur;
+	bool subquantize;
+	midiImportProgress *progress; // optional
+	int channels; // most tracker channels used, notes steal channels past it
+};
+
+midiImportSettings midi_importSettings();
+
+/* Import into any song, these can run concurrently on different songs */
+int midiImport(mtsynth *mt, const char* filename, const midiImportSettings &settings);
+int musImport(mtsynth *mt, const char* filename, const midiImportSettings &settings);
+
+/* Replaces the instruments with the General MIDI set */
+void midi_loadGMInstruments(mtsynth *mt);
+
+/* Converts every MIDI/MUS file of a directory to a .mdts song next to it, on 'threads' threads (0 : one per core).
+	Returns the number of files that failed */
+int midi_batchConvert(string directory, const midiImportSettings &settings, unsigned threads);
+
+/* MIDI program and channel of each instrument, for the export */
+struct midiExportSettings{
+	vector<int> program, channel;
+};
+
+/* Instruments named after a General MIDI program or percussion (as the MIDI import does) get it back,
+	the others use program 0 on channels 1-16 except the percussion one */
+void midi_defaultExportMapping(mtsynth *mt, unsigned instrument, int &program, int &channel);
+midiExportSettings midi_exportSettings(mtsynth *mt);
+
+/* Exports a format 1 MIDI file with a track per tracker channel. Returns 0 or MT_ERR_FILEIO */
+int midiExport(mtsynth *mt, const char* filename, const midiExportSettings &settings);
+
+/* Exports the current song with the instruments set in the MIDI export popup */
+int midiExport(const char* filename);
+
+/* Exports every .mdts song of a directory to a .mid file next to it, on 'threads' threads (0 : one per core).
+	Returns the number of files that failed */
+int midi_batchExport(string directory, unsigned threads);
 
 void midiReceiveEnable(int enabled);
 
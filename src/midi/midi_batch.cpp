@@ -0,0 +1,244 @@
+#include "midi.h"
+#include "../globalFunctions.hpp"
+#include <SFML/System.hpp>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+enum batchJobTypes{ BATCH_MIDI, BATCH_MUS, BATCH_EXPORT };
+
+struct batchJob{
+	string input, output;
+	int type;
+	int result;
+};
+
+/* Shared by the workers, each one takes the next file until there are none left */
+struct batchQueue{
+	vector<batchJob> jobs;
+	std::atomic<unsigned> next;
+	midiImportSettings settings;
+};
+
+struct batchWorker{
+	batchQueue *queue;
+	mtsynth *mt;
+};
+
+static void batchWorkerFunc(batchWorker *worker)
+{
+	batchQueue *queue = worker->queue;
+	unsigned job;
+
+	while ((job = queue->next++) < queue->jobs.size())
+	{
+		batchJob &j = queue->jobs[job];
+
+		switch (j.type)
+		{
+			case BATCH_MIDI:
+				j.result = midiImport(worker->mt, j.input.c_str(), queue->settings);
+				break;
+			case BATCH_MUS:
+				j.result = musImport(worker->mt, j.input.c_str(), queue->settings);
+				break;
+			case BATCH_EXPORT:
+				j.result = mt_loadSong(worker->mt, j.input.c_str());
+				if (j.result == 0)
+					j.result = midiExport(worker->mt, j.output.c_str(), midi_exportSettings(worker->mt));
+				break;
+		}
+
+		if (j.result == 0 && j.type != BATCH_EXPORT && !mt_saveSong(worker->mt, j.output.c_str()))
+			j.result = MT_ERR_FILEIO;
+	}
+}
+
+static vector<string> listFiles(const string& directory)
+{
+	vector<string> files;
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((directory + "*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE)
+		return files;
+	do
+	{
+		if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files.push_back(entry.cFileName);
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR *dir = opendir(directory.c_str());
+	if (!dir)
+		return files;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)))
+	{
+		struct stat st;
+		if (stat((directory + entry->d_name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+			files.push_back(entry->d_name);
+	}
+	closedir(dir);
+#endif
+	sort(files.begin(), files.end());
+	return files;
+}
+
+/* Runs the jobs on 'threads' threads (0 : one per core), prints the results and returns the number of failed jobs */
+static int runBatch(batchQueue &queue, unsigned threads)
+{
+	if (threads == 0)
+		threads = max(1u, std::thread::hardware_concurrency());
+	threads = min(threads, (unsigned)queue.jobs.size());
+
+	/* Songs are created here : mt_create also builds the synth tables, which is not thread safe */
+	vector<batchWorker> workers;
+	for (unsigned i = 0; i < threads; i++)
+	{
+		batchWorker worker = { &queue, mt_create(44100) };
+		if (worker.mt)
+			workers.push_back(worker);
+	}
+
+	if (workers.empty())
+	{
+		error("Can't initialize the FM synthesizer\n");
+		return queue.jobs.size();
+	}
+
+	vector<sf::Thread*> workerThreads;
+	for (unsigned i = 0; i < workers.size(); i++)
+	{
+		workerThreads.push_back(new sf::Thread(&batchWorkerFunc, &workers[i]));
+		workerThreads.back()->launch();
+	}
+
+	for (unsigned i = 0; i < workerThreads.size(); i++)
+	{
+		workerThreads[i]->wait();
+		delete workerThreads[i];
+		mt_destroy(workers[i].mt);
+	}
+
+	int failed = 0;
+	for (unsigned i = 0; i < queue.jobs.size(); i++)
+	{
+		const batchJob &job = queue.jobs[i];
+		if (job.result == 0)
+		{
+			printf("%s -> %s\n", job.input.c_str(), job.output.c_str());
+		}
+		else
+		{
+			const char *reason = job.result == MT_ERR_FILECORRUPTED ? "corrupted file" : job.result == MT_ERR_FILEVERSION ? "unsupported file version" : "can't read or write the file";
+			fprintf(stderr, "%s : %s\n", job.input.c_str(), reason);
+			failed++;
+		}
+	}
+	printf("%d/%d files converted\n", (int)queue.jobs.size() - failed, (int)queue.jobs.size());
+
+	return failed;
+}
+
+static string directoryPath(string directory)
+{
+	if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+		directory += pathSeparator;
+	return directory;
+}
+
+int midi_batchConvert(string directory, const midiImportSettings &settings, unsigned threads)
+{
+	directory = directoryPath(directory);
+
+	batchQueue queue;
+	queue.next = 0;
+	queue.settings = settings;
+
+	vector<string> files = listFiles(directory);
+	set<string> outputs;
+
+	for (unsigned i = 0; i < files.size(); i++)
+	{
+		/* Shorter than "x.mid" */
+		if (files[i].size() < 5)
+			continue;
+
+		batchJob job;
+		job.type = checkExtension(files[i], "mus") ? BATCH_MUS : BATCH_MIDI;
+
+		if (job.type == BATCH_MIDI && !checkExtension(files[i], "mid") && !checkExtension(files[i], "smf") && !checkExtension(files[i], "rmi"))
+			continue;
+
+		job.input = directory + files[i];
+		job.output = files[i].substr(0, files[i].find_last_of('.')) + ".mdts";
+
+		/* song.mid and song.mus : keep the full name of the second one */
+		if (!outputs.insert(job.output).second)
+			job.output = files[i] + ".mdts";
+
+		job.output = directory + job.output;
+		job.result = MT_ERR_FILEIO;
+		queue.jobs.push_back(job);
+	}
+
+	if (queue.jobs.empty())
+	{
+		error("No MIDI or MUS file to convert in " + directory + "\n");
+		return 0;
+	}
+
+	return runBatch(queue, threads);
+}
+
+int midi_batchExport(string directory, unsigned threads)
+{
+	directory = directoryPath(directory);
+
+	batchQueue queue;
+	queue.next = 0;
+
+	vector<string> files = listFiles(directory);
+	set<string> existing(files.begin(), files.end());
+
+	for (unsigned i = 0; i < files.size(); i++)
+	{
+		/* Shorter than "x.mdts" */
+		if (files[i].size() < 6 || !checkExtension(files[i], "mdts"))
+			continue;
+
+		batchJob job;
+		job.type = BATCH_EXPORT;
+		job.input = directory + files[i];
+		job.output = files[i].substr(0, files[i].find_last_of('.')) + ".mid";
+
+		/* Songs converted from song.mid : don't overwrite the original */
+		if (existing.count(job.output))
+			job.output = files[i] + ".mid";
+
+		job.output = directory + job.output;
+		job.result = MT_ERR_FILEIO;
+		queue.jobs.push_back(job);
+	}
+
+	if (queue.jobs.empty())
+	{
+		error("No song to export in " + directory + "\n");
+		return 0;
+	}
+
+	return runBatch(queue, threads);
+}
@@ -1,282 +1,431 @@
 #include "midi.h"
-#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+#include <SFML/System.hpp>
 
 vector<int> midiExportAssoc;
 vector<int> midiExportAssocChannels;
 
-void WriteVarLen(unsigned long value, ofstream* f)
-{
-	unsigned long buffer;
-	buffer = value & 0x7F;
-	while ((value >>= 7))
+/* Ticks per quarter note and per row (4 rows per beat) */
+#define MIDI_EXPORT_TICKS 32
+#define MIDI_EXPORT_ROW_TICKS 8
+
+/* Songs shorter than this (in rows) have their channel tracks built on the calling thread only */
+#define MIDI_PARALLEL_EXPORT_ROWS 4096
+
+/* Growing MIDI data buffer, events are given in absolute ticks */
+struct midiWriter{
+	vector<unsigned char> data;
+	long long lastTick;
+
+	midiWriter() : lastTick(0) {}
+
+	void put(unsigned char c)
 	{
-		buffer <<= 8;
-		buffer |= ((value & 0x7F) | 0x80);
+		data.push_back(c);
 	}
-	while (1)
+
+	void write(const void *bytes, size_t count)
 	{
-		f->write((char*)&buffer, 1);
-		if (buffer & 0x80)
-			buffer >>= 8;
-		else
-			break;
+		data.insert(data.end(), (const unsigned char*)bytes, (const unsigned char*)bytes + count);
 	}
-}
-
-
-void midi_writeTempo(ofstream *file, int tempo)
-{
-	tempo = 60000000 / (tempo*fm->diviseur / 4);
-
-	unsigned char tempo1 = (tempo & 0x00FF0000) >> 16;
-	unsigned char tempo2 = (tempo & 0x0000FF00) >> 8;
-	unsigned char tempo3 = (tempo & 0x000000FF);
-	file->put(0xFF);
-	file->put(0x51);
-	file->put(0x03);
-	file->write((char*)&tempo1, 1);
-	file->write((char*)&tempo2, 1);
-	file->write((char*)&tempo3, 1);
-}
 
+	void varLen(unsigned long value)
+	{
+		unsigned char bytes[4];
+		int count = 0;
 
-void midiExport(const char* filename)
-{
-	int chunksize, cpt = 0, channels2 = 0x0100;
-	int header_size = (6 >> 24) | (6 << 24);
-	int file_format = 0;
-	int delta_time_ticks = 32;
-	delta_time_ticks = (delta_time_ticks >> 8) | (delta_time_ticks << 8);
-	vector <int> lastnote(FM_ch, -1), lastinstr(FM_ch, -1), lastvol(FM_ch, -1);
+		do
+		{
+			bytes[count++] = value & 0x7F;
+			value >>= 7;
+		} while (value && count < 4);
 
-	int bufferChVol[FM_ch], bufferChPan[FM_ch], bufferChPitchbend[FM_ch];
+		while (--count > 0)
+			put(bytes[count] | 0x80);
+		put(bytes[0]);
+	}
 
-	for (int i = 0; i < FM_ch; i++)
+	void word(unsigned short value)
 	{
-		bufferChVol[i] = fm->ch[i].initial_vol;
-		bufferChPan[i] = fm->ch[i].initial_pan;
-		bufferChPitchbend[i] = -1;
+		put(value >> 8);
+		put(value & 0xFF);
 	}
 
+	void dword(unsigned value)
+	{
+		word(value >> 16);
+		word(value & 0xFFFF);
+	}
 
-	ofstream file(filename, ios::out | ios::binary);
-	file.write("MThd", 4);
-	file.write((char*)&header_size, 4);
-	file.write((char*)&file_format, 2);
-	file.write((char*)&channels2, 2);
-	file.write((char*)&delta_time_ticks, 2);
-	file.write("MTrk", 4);
-	file.write("", 4);
-
-
-	// write time signature
-	file.put(0x00);
-	file.put(0xFF);
-	file.put(0x58);
-	file.put(4);
-	file.put(4);
-	file.put(2);
-	file.put(25);
-	file.put(8);
-	file.put(0);
+	/* Delta time of an event at 'tick' */
+	void time(long long tick)
+	{
+		varLen(tick - lastTick);
+		lastTick = tick;
+	}
 
-	midi_writeTempo(&file, fm->initial_tempo);
+	void event(long long tick, unsigned char status, unsigned char data1)
+	{
+		time(tick);
+		put(status);
+		put(data1);
+	}
 
-	// write song name
-	if (strlen(fm->songName))
+	void event(long long tick, unsigned char status, unsigned char data1, unsigned char data2)
 	{
-		file.put(0x00);
-		file.put(0xFF);
-		file.put(0x03);
-		WriteVarLen(strlen(fm->songName), &file);
-		file.write(fm->songName, strlen(fm->songName));
+		event(tick, status, data1);
+		put(data2);
 	}
 
-	// write author
-	if (strlen(fm->author))
+	void meta(long long tick, unsigned char type, const void *bytes, size_t count)
 	{
-		file.put(0x00);
-		file.put(0xFF);
-		file.put(0x02);
-		WriteVarLen(strlen(fm->author), &file);
-		file.write(fm->author, strlen(fm->author));
+		time(tick);
+		put(0xFF);
+		put(type);
+		varLen(count);
+		write(bytes, count);
 	}
 
-	// write comments
-	if (strlen(fm->comments))
+	void text(long long tick, unsigned char type, const char *string)
 	{
-		file.put(0x00);
-		file.put(0xFF);
-		file.put(0x01);
-		WriteVarLen(strlen(fm->comments), &file);
-		file.write(fm->comments, strlen(fm->comments));
+		if (strlen(string))
+			meta(tick, type, string, strlen(string));
 	}
+};
+
+struct midiTempoChange{
+	long long tick;
+	int tempo;
+};
+
+/* Track of a tracker channel, built independently of the others */
+struct midiChannelTrack{
+	midiWriter writer;
+	vector<midiTempoChange> tempoChanges; // 'T' effects, written in the first track
+	bool used;
+};
+
+struct midiExportJob{
+	mtsynth *mt;
+	const midiExportSettings *settings;
+	vector<midiChannelTrack> *tracks;
+	std::atomic<unsigned> next;
+};
+
+static int midi_exportProgram(const midiExportSettings &settings, int instrument)
+{
+	return instrument >= 0 && instrument < (int)settings.program.size() ? settings.program[instrument] : 0;
+}
+
+static int midi_exportChannel(const midiExportSettings &settings, int instrument)
+{
+	return instrument >= 0 && instrument < (int)settings.channel.size() ? settings.channel[instrument] : 0;
+}
+
+static void midi_writeTempo(midiWriter &writer, long long tick, mtsynth *mt, int tempo)
+{
+	tempo = 60000000 / max(1, tempo*mt->diviseur / 4);
+
+	unsigned char data[3] = { (unsigned char)(tempo >> 16), (unsigned char)(tempo >> 8), (unsigned char)tempo };
+	writer.meta(tick, 0x51, data, 3);
+}
+
+/* Writes the notes and effects of a tracker channel, pattern after pattern */
+static void midi_buildChannelTrack(mtsynth *mt, const midiExportSettings &settings, int i, midiChannelTrack &track)
+{
+	midiWriter &w = track.writer;
+	int lastnote = -1, lastinstr = -1, lastvol = -1;
+	int bufferChVol = mt->ch[i].initial_vol, bufferChPan = mt->ch[i].initial_pan, bufferChPitchbend = -1;
+	long long tick = 0;
+
+	track.used = false;
 
+	/* Channel numbers are shown from 1 : lets the importer put this track back on the same channel */
+	char name[16];
+	snprintf(name, sizeof(name), "Channel %d", i + 1);
+	w.text(0, 0x03, name);
 
-	for (unsigned int k = 0; k < fm->patternCount; k++)
-	{ // for each order
-		for (unsigned int j = 0; j < fm->patternSize[k]; j++)
+	for (unsigned k = 0; k < mt->patternCount; k++)
+	{ // for each pattern
+		for (unsigned j = 0; j < mt->patternSize[k]; j++, tick += MIDI_EXPORT_ROW_TICKS)
 		{ // for each row
-			for (int i = 0; i<FM_ch; i++)
+			Cell &cell = mt->pattern[k][j][i];
+
+			if (cell.note != 255)
 			{
-				if (fm->pattern[k][j][i].note != 255)
+				// note off
+				if (lastnote != -1)
+				{
+					w.event(tick, 0x80 + midi_exportChannel(settings, lastinstr), lastnote, lastvol);
+					lastnote = -1;
+				}
+
+				if (cell.note < 128)
 				{
+					int instr = cell.instr != 255 ? cell.instr : max(0, lastinstr);
+					int channel = midi_exportChannel(settings, instr);
 
-					// note off
-					if (lastnote[i] != -1 && lastinstr[i]>-1)
+					// program change, percussion use the note number instead
+					if (lastinstr != instr && channel != 9)
 					{
-						WriteVarLen(cpt * 8, &file);
-						file.put(128 + midiExportAssocChannels[lastinstr[i]]);
-						file.write((char*)&lastnote[i], 1);
-						file.write((char*)&lastvol[i], 1);
-						cpt = 0;
-						lastnote[i] = -1;
+						w.event(tick, 0xC0 + channel, midi_exportProgram(settings, instr));
 					}
-					// program change
-					if (fm->pattern[k][j][i].note < 128 && lastinstr[i] != fm->pattern[k][j][i].instr && fm->pattern[k][j][i].instr != 255)
+					lastinstr = instr;
+
+					if (bufferChVol != -1)
 					{
-						WriteVarLen(cpt * 8, &file);
-						file.put(192 + midiExportAssocChannels[fm->pattern[k][j][i].instr]);
-						file.put(midiExportAssoc[fm->pattern[k][j][i].instr]);
-						lastinstr[i] = fm->pattern[k][j][i].instr;
-						cpt = 0;
+						w.event(tick, 0xB0 + channel, 0x07, bufferChVol);
+						bufferChVol = -1;
 					}
-					// note on
-					if (fm->pattern[k][j][i].note < 128)
+					if (bufferChPan != -1)
 					{
-						if (bufferChVol[i] != -1)
-						{
-							WriteVarLen(cpt * 8, &file);
-							file.put(0xB0 + midiExportAssocChannels[fm->pattern[k][j][i].instr]);
-							file.put(0x07);
-							file.put(bufferChVol[i]);
-							cpt = 0;
-							bufferChVol[i] = -1;
-						}
-						if (bufferChPan[i] != -1)
-						{
-							WriteVarLen(cpt * 8, &file);
-							file.put(0xB0 + midiExportAssocChannels[fm->pattern[k][j][i].instr]);
-							file.put(0x0A);
-							file.put(bufferChPan[i]);
-							cpt = 0;
-							bufferChPan[i] = -1;
-						}
-						if (bufferChPitchbend[i] != -1)
-						{
-							WriteVarLen(cpt * 8, &file);
-							file.put(0xE0 + midiExportAssocChannels[fm->pattern[k][j][i].instr]);
-							file.put(0x00); // ignore pitch bend fine byte
-							file.put(bufferChPitchbend[i]);
-							cpt = 0;
-							bufferChPitchbend[i] = -1;
-						}
-
-						// percussion
-						if (fm->pattern[k][j][i].instr < 255 && midiExportAssocChannels[fm->pattern[k][j][i].instr] == 9 ||
-							lastinstr[i] != -1 && midiExportAssocChannels[lastinstr[i]] == 9)
-						{
-							WriteVarLen(cpt * 8, &file);
-							file.put((char)(144 + 9));
-							lastnote[i] = 23 + midiExportAssoc[fm->pattern[k][j][i].instr]; // convert instrument to drumkit note
-						}
-						// melodic
-						else
-						{
-							WriteVarLen(cpt * 8, &file);
-							if (fm->pattern[k][j][i].instr<255)
-							lastinstr[i] = fm->pattern[k][j][i].instr;
-							
-							file.put(144 + midiExportAssocChannels[lastinstr[i]]);
-							lastnote[i] = fm->pattern[k][j][i].note;
-						}
-
-						if (fm->pattern[k][j][i].vol != 255)
-							lastvol[i] = fm->pattern[k][j][i].vol*1.282828;
-						else if (lastvol[i] == -1) // no volume = assume max
-							lastvol[i] = 127;
-
-						file.write((char*)&lastnote[i], 1);
-						file.write((char*)&lastvol[i], 1);
-						cpt = 0;
+						w.event(tick, 0xB0 + channel, 0x0A, bufferChPan);
+						bufferChPan = -1;
 					}
-
-
-					switch (fm->pattern[k][j][i].fx)
+					if (bufferChPitchbend != -1)
 					{
-						case 'T': // tempo
-							WriteVarLen(cpt * 8, &file);
-							midi_writeTempo(&file, fm->pattern[k][j][i].fxdata);
-							cpt = 0;
-							break;
-						case 'M': // ch volume
-							if (lastinstr[i] != -1)
-							{
-								WriteVarLen(cpt * 8, &file);
-								file.put(0xB0 + midiExportAssocChannels[lastinstr[i]]);
-								file.put(0x07);
-								file.put(fm->pattern[k][j][i].fxdata*1.282828);
-								cpt = 0;
-							}
-							else
-								bufferChVol[i] = fm->pattern[k][j][i].fxdata*1.282828;
-							break;
-						case 'X': // ch panning
-							if (lastinstr[i] != -1)
-							{
-								WriteVarLen(cpt * 8, &file);
-								file.put(0xB0 + midiExportAssocChannels[lastinstr[i]]);
-								file.put(0x0A);
-								file.put(fm->pattern[k][j][i].fxdata / 2);
-								cpt = 0;
-							}
-							else
-								bufferChPan[i] = fm->pattern[k][j][i].fxdata / 2;
-							break;
-						case 'I': // pitch bend
-							if (lastinstr[i] != -1)
-							{
-								WriteVarLen(cpt * 8, &file);
-								file.put(0xE0 + midiExportAssocChannels[lastinstr[i]]);
-								file.put(0x00); // ignore pitch bend fine byte
-								file.put(fm->pattern[k][j][i].fxdata / 2);
-								cpt = 0;
-							}
-							else
-								bufferChPitchbend[i] = fm->pattern[k][j][i].fxdata / 2;
-							break;
+						w.event(tick, 0xE0 + channel, 0x00, bufferChPitchbend); // ignore pitch bend fine byte
+						bufferChPitchbend = -1;
 					}
 
+					if (cell.vol != 255) // velocity 0 would be a note off
+						lastvol = max(1, min(127, (int)(cell.vol*1.282828)));
+					else if (lastvol == -1) // no volume = assume max
+						lastvol = 127;
 
+					// convert instrument to drumkit note
+					lastnote = channel == 9 ? min(127, 23 + midi_exportProgram(settings, instr)) : cell.note;
 
+					w.event(tick, 0x90 + channel, lastnote, lastvol);
+					track.used = true;
 				}
 			}
-			cpt++;
-		}
-		for (int i = 0; i < FM_ch; i++)
-		{
-			if (lastnote[i] != -1)
+
+			switch (cell.fx)
 			{
-				WriteVarLen(cpt * 8, &file);
-				file.put(128 + midiExportAssocChannels[lastinstr[i]]);
-				file.write((char*)&lastnote[i], 1);
-				file.write((char*)&lastvol[i], 1);
-				cpt = 0;
+				case 'T': // tempo
+				{
+					midiTempoChange change = { tick, cell.fxdata };
+					track.tempoChanges.push_back(change);
+					track.used = true;
+					break;
+				}
+				case 'M': // ch volume
+					if (lastinstr != -1)
+						w.event(tick, 0xB0 + midi_exportChannel(settings, lastinstr), 0x07, min(127, (int)(cell.fxdata*1.282828)));
+					else
+						bufferChVol = min(127, (int)(cell.fxdata*1.282828));
+					break;
+				case 'X': // ch panning
+					if (lastinstr != -1)
+						w.event(tick, 0xB0 + midi_exportChannel(settings, lastinstr), 0x0A, cell.fxdata / 2);
+					else
+						bufferChPan = cell.fxdata / 2;
+					break;
+				case 'I': // pitch bend
+					if (lastinstr != -1)
+						w.event(tick, 0xE0 + midi_exportChannel(settings, lastinstr), 0x00, cell.fxdata / 2);
+					else
+						bufferChPitchbend = cell.fxdata / 2;
+					break;
 			}
 		}
 
+		// notes stop at the end of each pattern
+		if (lastnote != -1)
+		{
+			w.event(tick, 0x80 + midi_exportChannel(settings, lastinstr), lastnote, lastvol);
+			lastnote = -1;
+		}
 	}
 
+	w.meta(tick, 0x2F, NULL, 0);
+}
+
+static void midi_exportWorker(midiExportJob *job)
+{
+	unsigned channel;
 
-	file.put(0x00);
+	while ((channel = job->next++) < job->tracks->size())
+	{
+		midi_buildChannelTrack(job->mt, *job->settings, channel, (*job->tracks)[channel]);
+	}
+}
+
+static bool midi_compareTempoChanges(const midiTempoChange &a, const midiTempoChange &b)
+{
+	return a.tick < b.tick;
+}
+
+/* Time signature, song informations and every tempo change */
+static void midi_buildConductorTrack(mtsynth *mt, const vector<midiChannelTrack> &tracks, midiWriter &w)
+{
+	long long songEnd = 0;
+	for (unsigned k = 0; k < mt->patternCount; k++)
+		songEnd += mt->patternSize[k] * MIDI_EXPORT_ROW_TICKS;
+
+	static const unsigned char timeSignature[4] = { 4, 2, 24, 8 };
+	w.meta(0, 0x58, timeSignature, 4);
+
+	midi_writeTempo(w, 0, mt, mt->initial_tempo);
+
+	w.text(0, 0x03, mt->songName);
+	w.text(0, 0x02, mt->author);
+	w.text(0, 0x01, mt->comments);
+
+	/* Channel order for tempo changes on the same row, as the player reads them */
+	vector<midiTempoChange> tempoChanges;
+	for (unsigned i = 0; i < tracks.size(); i++)
+		tempoChanges.insert(tempoChanges.end(), tracks[i].tempoChanges.begin(), tracks[i].tempoChanges.end());
+
+	stable_sort(tempoChanges.begin(), tempoChanges.end(), midi_compareTempoChanges);
+
+	for (unsigned i = 0; i < tempoChanges.size(); i++)
+		midi_writeTempo(w, tempoChanges[i].tick, mt, tempoChanges[i].tempo);
+
+	w.meta(songEnd, 0x2F, NULL, 0);
+}
+
+static void midi_writeChunk(midiWriter &file, const midiWriter &track)
+{
+	file.write("MTrk", 4);
+	file.dword(track.data.size());
+	file.write(track.data.data(), track.data.size());
+}
+
+int midiExport(mtsynth *mt, const char* filename, const midiExportSettings &settings)
+{
+	vector<midiChannelTrack> tracks(mt->channelCount);
+
+	unsigned rows = 0;
+	for (unsigned k = 0; k < mt->patternCount; k++)
+		rows += mt->patternSize[k];
+
+	unsigned threads = 1;
+	if (rows >= MIDI_PARALLEL_EXPORT_ROWS)
+		threads = min(mt->channelCount, max(1u, std::thread::hardware_concurrency()));
+
+	midiExportJob job;
+	job.mt = mt;
+	job.settings = &settings;
+	job.tracks = &tracks;
+	job.next = 0;
+
+	vector<sf::Thread*> exportThreads;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		exportThreads.push_back(new sf::Thread(&midi_exportWorker, &job));
+		exportThreads.back()->launch();
+	}
+
+	/* This thread builds tracks too */
+	midi_exportWorker(&job);
+
+	for (unsigned i = 0; i < exportThreads.size(); i++)
+	{
+		exportThreads[i]->wait();
+		delete exportThreads[i];
+	}
+
+	midiWriter conductor;
+	midi_buildConductorTrack(mt, tracks, conductor);
+
+	/* Format 1 : the conductor track, then one track per tracker channel playing notes */
+	unsigned short trackCount = 1;
+	size_t fileSize = 14 + 8 + conductor.data.size();
+	for (unsigned i = 0; i < tracks.size(); i++)
+	{
+		if (tracks[i].used)
+		{
+			trackCount++;
+			fileSize += 8 + tracks[i].writer.data.size();
+		}
+	}
+
+	midiWriter file;
+	file.data.reserve(fileSize);
+	file.write("MThd", 4);
+	file.dword(6);
+	file.word(1);
+	file.word(trackCount);
+	file.word(MIDI_EXPORT_TICKS);
+
+	midi_writeChunk(file, conductor);
+	for (unsigned i = 0; i < tracks.size(); i++)
+	{
+		if (tracks[i].used)
+			midi_writeChunk(file, tracks[i].writer);
+	}
+
+	FILE *fp = fopen(filename, "wb");
+	if (!fp)
+		return MT_ERR_FILEIO;
+
+	bool ok = fwrite(file.data.data(), file.data.size(), 1, fp) == 1;
+	ok = fclose(fp) == 0 && ok;
+
+	return ok ? 0 : MT_ERR_FILEIO;
+}
+
+/* Instruments named by the MIDI import get their General MIDI program back */
+static int midi_findInstrumentName(const char *name, const char **names, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (strncmp(name, names[i], sizeof(((fm_instrument*)0)->name) - 1) == 0)
+			return i;
+	}
+	return -1;
+}
+
+void midi_defaultExportMapping(mtsynth *mt, unsigned instrument, int &program, int &channel)
+{
+	const char *name = mt->instrument[instrument].name;
+	int id;
+
+	channel = instrument % 16;
+	if (channel == 9)
+		channel++;
+	program = 0;
+
+	if ((id = midi_findInstrumentName(name, midiProgramNames, 128)) >= 0)
+	{
+		program = id;
+	}
+	else if ((id = midi_findInstrumentName(name, midiPercussionNames, 65)) >= 0
+		|| (id = midi_findInstrumentName(name, midiXGPerc, 12)) >= 0)
+	{
+		program = id;
+		channel = 9;
+	}
+}
+
+midiExportSettings midi_exportSettings(mtsynth *mt)
+{
+	midiExportSettings settings;
+	settings.program.resize(mt->instrumentCount);
+	settings.channel.resize(mt->instrumentCount);
+
+	for (unsigned i = 0; i < mt->instrumentCount; i++)
+	{
+		midi_defaultExportMapping(mt, i, settings.program[i], settings.channel[i]);
+	}
+	return settings;
+}
+
+int midiExport(const char* filename)
+{
+	midiExportSettings settings = midi_exportSettings(fm);
 
+	/* Instruments set in the export popup */
+	for (unsigned i = 0; i < midiExportAssoc.size() && i < settings.program.size(); i++)
+		settings.program[i] = midiExportAssoc[i];
+	for (unsigned i = 0; i < midiExportAssocChannels.size() && i < settings.channel.size(); i++)
+		settings.channel[i] = midiExportAssocChannels[i];
 
-	file.put(0xFF);
-	file.put(0x2F);
-	file.put(0x00);
-	chunksize = (int)file.tellp() - 22;
-	file.seekp(18);
-	chunksize = (chunksize >> 24) | ((chunksize & 0x00ff0000) >> 8) | ((chunksize & 0x0000ff00) << 8) | (chunksize << 24);
-	file.write((char*)&chunksize, 4);
-	file.close();
+	return midiExport(fm, filename, settings);
 }
@@ -1,14 +1,21 @@
 #include "midi.h"
 #include <fstream>
 #include <math.h>
+#include <set>
+#include <atomic>
+#include <thread>
+#include <queue>
+#include <functional>
+#include <SFML/System.hpp>
 
 #include "../views/settings/configEditor.hpp"
 #include "Mus2Midi.h"
-#define SI_CONVERT_GENERIC
-#include "SimpleIni.h"
+#include "../library/instrumentLibrary.hpp"
 
 extern ConfigEditor* config;
-extern CSimpleIniA ini_gmlist;
+
+/* Files smaller than this are decoded on the calling thread only */
+#define MIDI_PARALLEL_DECODE_SIZE (256*1024)
 
 /* Tracker channel status */
 
@@ -24,13 +31,8 @@ struct trackerChannelProperties{
 	int lastNoteVol;
 	int midiTrackMappings;
 	int channelPBend;
-	int oldVol;
-	int oldPan;
-	int age;
-	int stolenUsed;
 };
 
-static trackerChannelProperties trackerCh[FM_ch];
 
 
 /* MIDI channel status */
@@ -50,60 +52,401 @@ struct midiChannelProperties{
 	int pitchBendRange;
 };
 
-static midiChannelProperties midiCh[16];
 
 
 
-static int patternSize, currentTempo;
-static int lastPos, isXG;
-static double realRow;
-static short midiFormat, tracks;
-static int maxOrder, currentTrack, lastNotePos, loopStart;
-static int order, row, tempoDivisor, totalLength;
 struct oldChannel{
-	int channel, age, priority;
+	int channel, priority;
 };
-static oldChannel oldestChannels[FM_ch]; // forward
 
 
-static int rpnSelect1, rpnSelect2;
 
-static int sortChannels(void const *a, void const *b)
+/* Positions (order*patternSize + row) of the notes and of the channel volume/panning effects written in each channel,
+	so the channel allocator finds the previous ones without walking the rows.
+	Notes and effects written by the importer go through setNote/setFx to keep them up to date */
+struct channelIndex{
+	set<int> notes, vol, pan;
+};
+
+
+/* Last indexed position <= pos, 0 if there is none (like a row walk stopping at the first row) */
+static int midi_previous(const set<int> &index, int pos)
 {
-	oldChannel *pa = (oldChannel*)a;
-	oldChannel *pb = (oldChannel*)b;
-	return (pb->priority) - (pa->priority);
+	set<int>::const_iterator it = index.upper_bound(pos);
+	if (it == index.begin())
+		return 0;
+	return *--it;
 }
 
-unsigned long ReadVarLen(istream &f)
-{
-	unsigned long value;
-	char c;
+/* Bounds-checked reader over a file loaded in memory. Reading past the end returns zeros and sets failed */
+struct midiReader{
+	const unsigned char *pos, *end;
+	bool failed;
+
+	midiReader(const unsigned char *data, size_t size) : pos(data), end(data + size), failed(false) {}
 
-	if ((value = f.get()) & 0x80)
+	unsigned char get()
 	{
-		value &= 0x7F;
+		if (pos >= end)
+		{
+			failed = true;
+			return 0;
+		}
+		return *pos++;
+	}
+
+	/* Returns the skipped bytes, NULL if there are not enough left */
+	const unsigned char* skip(unsigned long count)
+	{
+		if (count > (unsigned long)(end - pos))
+		{
+			pos = end;
+			failed = true;
+			return NULL;
+		}
+		pos += count;
+		return pos - count;
+	}
+
+	unsigned long varLen()
+	{
+		unsigned long value = 0;
+		unsigned char c;
+		int bytes = 0;
+
 		do
 		{
-			value = (value << 7) + ((c = f.get()) & 0x7F);
-		} while (c & 0x80);
+			c = get();
+			value = (value << 7) + (c & 0x7F);
+		} while (c & 0x80 && ++bytes < 4);
+
+		return value;
+	}
+
+	unsigned short word()
+	{
+		unsigned short value = get() << 8;
+		return value | get();
 	}
+};
+
+enum midiEventKinds{ MIDI_EVENT_CHANNEL, MIDI_EVENT_SYSEX, MIDI_EVENT_META };
+
+/* A track event, decoded before being written into the patterns */
+struct midiEvent{
+	long long tick; /* from the start of the song */
+	unsigned short track;
+	unsigned char kind;
+	unsigned char type, channel; /* channel event : status high and low nibbles. meta : type in 'type' */
+	unsigned char data1, data2;
+	unsigned length;
+	const unsigned char *data; /* sysex/meta content, points into the file buffer */
+};
+
+/* Decodes a track until its end of track event (included) or the end of the reader */
+static void midi_decodeTrack(midiReader &reader, vector<midiEvent> &events, unsigned short track)
+{
+	unsigned char lastStatus = 0;
+	long long tick = 0;
+	events.clear();
+
+	while (!reader.failed)
+	{
+		midiEvent event;
+		tick += reader.varLen();
+		event.tick = tick;
+		event.track = track;
+		event.length = 0;
+		event.data = NULL;
+		event.data1 = event.data2 = 0;
+
+		unsigned char status = reader.get();
 
-	return(value);
+		if (status < 0xF0)
+		{
+			event.kind = MIDI_EVENT_CHANNEL;
+
+			/* Running status reuses the previous status (as older versions did, also after a sysex/meta event) */
+			if (status < 0x80)
+			{
+				event.data1 = status;
+				status = lastStatus;
+			}
+			else
+			{
+				event.data1 = reader.get();
+				lastStatus = status;
+			}
+			event.type = status / 16;
+			event.channel = status % 16;
+
+			if (event.type != 0xC && event.type != 0xD)
+				event.data2 = reader.get();
+		}
+		else if (status % 16 < 8)
+		{
+			event.kind = MIDI_EVENT_SYSEX;
+			event.length = reader.varLen();
+			event.data = reader.skip(event.length);
+			lastStatus = status;
+		}
+		else
+		{
+			event.kind = MIDI_EVENT_META;
+			event.type = reader.get();
+			event.length = reader.varLen();
+			event.data = reader.skip(event.length);
+			lastStatus = event.type;
+		}
+
+		if (reader.failed)
+			break;
+
+		events.push_back(event);
+
+		if (event.kind == MIDI_EVENT_META && event.type == 0x2F)
+			break;
+	}
+}
+
+/* A track chunk of the file and its decoded events */
+struct midiTrackChunk{
+	const unsigned char *data;
+	size_t size;
+	bool decoded;
+	vector<midiEvent> events;
+};
+
+/* Chunk header : 4 letters or digits ("MTrk", "XFIH"...) and the length */
+static bool midi_isChunkHeader(const unsigned char *data, const unsigned char *end)
+{
+	if (end - data < 8)
+		return false;
+
+	for (unsigned i = 0; i < 4; i++)
+	{
+		if (!isalnum(data[i]))
+			return false;
+	}
+	return true;
+}
+
+/* Shared by the decoding threads, each one takes the next track until there are none left */
+struct midiDecodeQueue{
+	vector<midiTrackChunk> *chunks;
+	std::atomic<unsigned> next;
+};
+
+static void midi_decodeWorker(midiDecodeQueue *queue)
+{
+	unsigned track;
+
+	while ((track = queue->next++) < queue->chunks->size())
+	{
+		midiTrackChunk &chunk = (*queue->chunks)[track];
+		if (chunk.decoded)
+			continue;
+
+		midiReader reader(chunk.data, chunk.size);
+		midi_decodeTrack(reader, chunk.events, track);
+	}
+}
+
+/* Decodes every track (on several threads for big files) and merges them into a single stream ordered by time.
+	Simultaneous events keep the track order */
+static void midi_decodeTracks(vector<midiTrackChunk> &chunks, vector<midiEvent> &events)
+{
+	size_t size = 0, count = 0;
+	for (unsigned i = 0; i < chunks.size(); i++)
+	{
+		size += chunks[i].size;
+	}
+
+	unsigned threads = 1;
+	if (size >= MIDI_PARALLEL_DECODE_SIZE)
+		threads = min((unsigned)chunks.size(), max(1u, std::thread::hardware_concurrency()));
+
+	midiDecodeQueue queue;
+	queue.chunks = &chunks;
+	queue.next = 0;
+
+	vector<sf::Thread*> decodeThreads;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		decodeThreads.push_back(new sf::Thread(&midi_decodeWorker, &queue));
+		decodeThreads.back()->launch();
+	}
+
+	/* This thread decodes too */
+	midi_decodeWorker(&queue);
+
+	for (unsigned i = 0; i < decodeThreads.size(); i++)
+	{
+		decodeThreads[i]->wait();
+		delete decodeThreads[i];
+	}
+
+	for (unsigned i = 0; i < chunks.size(); i++)
+	{
+		count += chunks[i].events.size();
+	}
+
+	/* Merge : take the earliest next event of all the tracks, the lowest track first on equality */
+	typedef pair<long long, unsigned> nextEvent; // tick, track
+	priority_queue<nextEvent, vector<nextEvent>, greater<nextEvent> > next;
+	vector<unsigned> cursor(chunks.size(), 0);
+
+	for (unsigned i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].events.empty())
+			next.push(nextEvent(chunks[i].events[0].tick, i));
+	}
+
+	events.clear();
+	events.reserve(count);
+
+	while (!next.empty())
+	{
+		unsigned track = next.top().second;
+		next.pop();
+
+		const vector<midiEvent> &trackEvents = chunks[track].events;
+		events.push_back(trackEvents[cursor[track]++]);
+
+		if (cursor[track] < trackEvents.size())
+			next.push(nextEvent(trackEvents[cursor[track]].tick, track));
+	}
 }
-//////////////////
 
 typedef struct instrument{
 	unsigned char id, type;
 }instrument;
 
+static int isGlobalEffect(unsigned char fx)
+{
+	return (fx == 'T' || fx == 'B' || fx == 'C');
+}
 
-instrument* instrumentList;
+/* Import context : the whole conversion state, writing into its own song. Separate importers can run in parallel */
+class MidiImporter{
+	mtsynth *mt;
+	midiImportSettings settings;
+
+	trackerChannelProperties trackerCh[FM_ch];
+	midiChannelProperties midiCh[16];
+	oldChannel oldestChannels[FM_ch]; // forward
+	channelIndex channelIndexes[FM_ch];
+	vector<instrument> instrumentList;
+	vector<int> trackChannels; // tracker channel named by each track ("Channel n", as exported), -1 if none
+	unsigned channels; // tracker channels available, see midiImportSettings
+
+	int patternSize, currentTempo;
+	int isXG;
+	double realRow;
+	short midiFormat, tracks;
+	int maxOrder, currentTrack, loopStart;
+	int order, row, tempoDivisor, totalLength;
+	int rpnSelect1, rpnSelect2;
+
+	Cell* cellAt(int pos, int channel);
+	void setNote(int pos, int channel, unsigned char note);
+	void setVol(int pos, int channel, unsigned char vol);
+	void setFx(int pos, int channel, unsigned char fx);
+	void selectOldestChannel();
+	int instrumentExists(unsigned char id, unsigned char type);
+	int findoldestChannelBackward();
+	void writefx(int realChannel, int fx, int fxdata, int rowOffset = 0);
+	void effect(int midiChannel, unsigned char fx, unsigned char fxdata);
+	void updateChannelParams(int realChannel, int midiChannel);
+	bool isTrackChannel(int channel);
+	int reserveChannel(int note, int midiChannel);
+	int freeChannel(int note, int midiChannel);
+	int writeDelay(int channel);
+	void noteOff(int note, int midiChannel);
+	void noteOn(int note, int volume, int midiChannel, int instrument);
+	void globalEffect(unsigned char fx, unsigned char fxdata);
+	void expression(int midiChannel, int vol);
+	void handleEvents(int type, int midiChannel, unsigned char data, unsigned char data2);
+	int parseMidiRows(unsigned short delta_time_ticks, const vector<midiEvent> &events);
+	bool progress(int percent);
+
+public:
+	MidiImporter(mtsynth *mt, const midiImportSettings &settings);
+
+	int addInstrument(int id, unsigned char type);
+	int import(const unsigned char *data, size_t size);
+};
 
-int instrumentExists(unsigned char id, unsigned char type)
+MidiImporter::MidiImporter(mtsynth *mt, const midiImportSettings &settings) : mt(mt), settings(settings), trackerCh(), midiCh(), oldestChannels(),
+	channels(clamp(settings.channels, 1, FM_ch)), patternSize(settings.patternSize), currentTempo(0), isXG(0), realRow(0), midiFormat(0), tracks(0), maxOrder(-1), currentTrack(0),
+	loopStart(-1), order(0), row(0), tempoDivisor(1), totalLength(0), rpnSelect1(127), rpnSelect2(127)
 {
+}
 
-	for (unsigned i = 0; i < fm->instrumentCount; i++)
+/* Updates the progress of the import, false if it was cancelled */
+bool MidiImporter::progress(int percent)
+{
+	if (!settings.progress)
+		return true;
+
+	settings.progress->percent = percent;
+	return !settings.progress->cancel;
+}
+
+Cell* MidiImporter::cellAt(int pos, int channel)
+{
+	return &mt->pattern[pos / patternSize][pos % patternSize][channel];
+}
+
+void MidiImporter::setNote(int pos, int channel, unsigned char note)
+{
+	if (note == 255)
+		channelIndexes[channel].notes.erase(pos);
+	else
+		channelIndexes[channel].notes.insert(pos);
+
+	cellAt(pos, channel)->note = note;
+}
+
+void MidiImporter::setVol(int pos, int channel, unsigned char vol)
+{
+	cellAt(pos, channel)->vol = vol;
+}
+
+/* Also set the effect data after this */
+void MidiImporter::setFx(int pos, int channel, unsigned char fx)
+{
+	Cell *cell = cellAt(pos, channel);
+
+	if (cell->fx == 'M')
+		channelIndexes[channel].vol.erase(pos);
+	else if (cell->fx == 'X')
+		channelIndexes[channel].pan.erase(pos);
+
+	if (fx == 'M')
+		channelIndexes[channel].vol.insert(pos);
+	else if (fx == 'X')
+		channelIndexes[channel].pan.insert(pos);
+
+	cell->fx = fx;
+}
+
+/* Moves the channel with the highest priority to oldestChannels[0], the lowest channel number on equality */
+void MidiImporter::selectOldestChannel()
+{
+	int best = 0;
+	for (int i = 1; i < (int)channels; i++)
+	{
+		if (oldestChannels[i].priority > oldestChannels[best].priority)
+			best = i;
+	}
+	swap(oldestChannels[0], oldestChannels[best]);
+}
+
+int MidiImporter::instrumentExists(unsigned char id, unsigned char type)
+{
+
+	for (unsigned i = 0; i < mt->instrumentCount; i++)
 	{
 		if (instrumentList[i].id == id && instrumentList[i].type == type)
 			return i;
@@ -111,7 +454,7 @@ int instrumentExists(unsigned char id, unsigned char type)
 	return -1;
 }
 
-int addInstrument(int id, unsigned char type)
+int MidiImporter::addInstrument(int id, unsigned char type)
 {
 	// out of range values (stupid midis!)
 	if (type == 1 && (id<24 || id > 87))
@@ -125,38 +468,35 @@ int addInstrument(int id, unsigned char type)
 	int i;
 	if ((i = instrumentExists(id, type)) < 0)
 	{
-		string instrumentFile, instrumentName;
+		string instrumentName;
 		if (type == 0)
 		{
-			instrumentFile = ini_gmlist.GetValue("melodic", int2str[id].c_str(), "0");
 			instrumentName = midiProgramNames[id];
 		}
 		else
 		{
 			if (isXG && id < 35)
 			{
-				instrumentFile = ini_gmlist.GetValue("percussion", string(int2str[id] + "XG").c_str(), "0");
 				instrumentName = midiXGPerc[id - 23];
 			}
 			else
 			{
-				instrumentFile = ini_gmlist.GetValue("percussion", int2str[id].c_str(), "0");
 				instrumentName = midiPercussionNames[id - 23];
 			}
 		}
-		if (mt_loadInstrument(fm, string(string(appdir + "/instruments/") + instrumentFile + string(".mdti")).c_str(), fm->instrumentCount) < 0)
+		if (instrumentLibrary_loadGM(mt, id, type, isXG, mt->instrumentCount) < 0)
 		{
-			mt_resizeInstrumentList(fm, fm->instrumentCount+1);
+			mt_resizeInstrumentList(mt, mt->instrumentCount+1);
 		}
 
-		sprintf(&fm->instrument[fm->instrumentCount - 1].name[0], "%s", instrumentName.c_str());
+		sprintf(&mt->instrument[mt->instrumentCount - 1].name[0], "%s", instrumentName.c_str());
 
-		instrumentList = (instrument*)realloc(instrumentList, sizeof(instrument)*fm->instrumentCount);
+		instrumentList.resize(mt->instrumentCount);
 
-		instrumentList[fm->instrumentCount - 1].id = id; // if unknown percussion, still store its original ID to avoid adding it multiple times
-		instrumentList[fm->instrumentCount - 1].type = type;
+		instrumentList[mt->instrumentCount - 1].id = id; // if unknown percussion, still store its original ID to avoid adding it multiple times
+		instrumentList[mt->instrumentCount - 1].type = type;
 
-		return fm->instrumentCount - 1;
+		return mt->instrumentCount - 1;
 	}
 	else
 	{
@@ -166,26 +506,16 @@ int addInstrument(int id, unsigned char type)
 }
 
 
-int isGlobalEffect(unsigned char fx)
-{
-	return (fx == 'T' || fx == 'B' || fx == 'C');
-}
-
-
-int midi_findoldestChannelBackward()
+int MidiImporter::findoldestChannelBackward()
 {
 
-	for (unsigned i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < channels; i++)
 	{
 
-		int pos = order*patternSize + row;
-		while (pos>0 && fm->pattern[pos / patternSize][pos % patternSize][i].note == 255)
-		{
-			pos--;
-		}
+		int pos = midi_previous(channelIndexes[i].notes, order*patternSize + row);
 
 		// if we found a note instead of a note off, this channel is still playing !
-		if (fm->pattern[pos / patternSize][pos % patternSize][i].note <= 127 && trackerCh[i].midiChannelMappings != 9)
+		if (mt->pattern[pos / patternSize][pos % patternSize][i].note <= 127 && trackerCh[i].midiChannelMappings != 9)
 		{ // perc channel doesn't always have note off
 			oldestChannels[i].priority = 0;
 		}
@@ -198,124 +528,12 @@ int midi_findoldestChannelBackward()
 
 	}
 
-	qsort(oldestChannels, FM_ch, sizeof(oldChannel), sortChannels);
+	selectOldestChannel();
 
 	return oldestChannels[0].priority > 0;
 }
 
-int midi_findoldestChannelForward()
-{
-
-	for (unsigned i = 0; i < FM_ch; i++)
-	{
-		if (trackerCh[i].stolenUsed)
-		{
-			oldestChannels[i].priority = 0;
-			oldestChannels[i].channel = i;
-			continue;
-		}
-		/* Looking forward for the next note on/off command */
-
-		int pos = order*patternSize + row;
-		if (fm->pattern[pos / patternSize][pos % patternSize][i].note == 128)
-			pos++;
-
-		while (pos < fm->patternCount * patternSize - 1 && fm->pattern[pos / patternSize][pos % patternSize][i].note == 255)
-		{
-			pos++;
-		}
-
-
-		oldestChannels[i].age = pos - (order*patternSize + row);
-
-		/* Discard channels finishing with a note off (means that a note was playing */
-
-		if (fm->pattern[pos / patternSize][pos % patternSize][i].note == 128)
-		{
-			oldestChannels[i].age = 0;
-		}
-
-		oldestChannels[i].priority = oldestChannels[i].age;
-
-		if (oldestChannels[i].priority > 0)
-		{
-			/* Start walking backwards */
-			pos = order*patternSize + row;
-			while (pos > 0 && fm->pattern[pos / patternSize][pos % patternSize][i].note == 255)
-			{
-				pos--;
-			}
-
-			/* Note off found or drum : the channel is free */
-			if (fm->pattern[pos / patternSize][pos % patternSize][i].note == 128
-				|| fm->pattern[pos / patternSize][pos % patternSize][i].note < 128 && instrumentList[fm->pattern[pos / patternSize][pos % patternSize][i].instr].type == 1 && pos - (order*patternSize + row) < -3)
-			{
-				oldestChannels[i].priority += 1000;
-			}
-
-
-
-		}
-
-		oldestChannels[i].channel = i;
-
-	}
-
-	qsort(oldestChannels, FM_ch, sizeof(oldChannel), sortChannels);
-
-	if (oldestChannels[0].priority > 0)
-	{
-
-		/* Store last channel vol/pan to be able to restore it afterwards */
-
-		int pos = min(fm->patternCount * patternSize, order * patternSize + row + oldestChannels[0].age);
-		int volFound = 0;
-		int panFound = 0;
-		while (pos > 0 && (!volFound || !panFound))
-		{
-			if (fm->pattern[pos / patternSize][pos % patternSize][oldestChannels[0].channel].fx == 'M')
-			{
-				trackerCh[oldestChannels[0].channel].oldVol = fm->pattern[pos / patternSize][pos % patternSize][oldestChannels[0].channel].fx;
-				volFound = 1;
-			}
-			else if (fm->pattern[pos / patternSize][pos % patternSize][oldestChannels[0].channel].fx == 'X')
-			{
-				trackerCh[oldestChannels[0].channel].oldPan = fm->pattern[pos / patternSize][pos % patternSize][oldestChannels[0].channel].fx;
-				panFound = 1;
-			}
-			pos--;
-		}
-		if (pos == 0)
-		{
-			if (!volFound)
-			{
-				trackerCh[oldestChannels[0].channel].oldVol = fm->ch[oldestChannels[0].channel].initial_vol;
-			}
-			if (!panFound)
-			{
-				trackerCh[oldestChannels[0].channel].oldPan = fm->ch[oldestChannels[0].channel].initial_pan;
-			}
-		}
-
-		/* Cleanup the stolen channel */
-
-		for (int i = order * patternSize + row; i < min(fm->patternCount * patternSize, order * patternSize + row + oldestChannels[0].age); i++)
-		{
-
-			fm->pattern[i / patternSize][i % patternSize][oldestChannels[0].channel].vol = 255;
-			if (!isGlobalEffect(fm->pattern[i / patternSize][i % patternSize][oldestChannels[0].channel].fx))
-			{
-				fm->pattern[i / patternSize][i % patternSize][oldestChannels[0].channel].fx = 255;
-				fm->pattern[i / patternSize][i % patternSize][oldestChannels[0].channel].vol = 255;
-				fm->pattern[i / patternSize][i % patternSize][oldestChannels[0].channel].fxdata = 255;
-			}
-		}
-		return 1;
-	}
-	return 0;
-}
-
-void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
+void MidiImporter::writefx(int realChannel, int fx, int fxdata, int rowOffset)
 {
 
 
@@ -332,15 +550,12 @@ void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
 
 		/* The first channel volume command must be stored as initial_vol, not effect */
 
-		pos--;
-
-		while (pos > 0 && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 'M')
-			pos--;
+		pos = midi_previous(channelIndexes[realChannel].vol, pos - 1);
 
 		if (pos <= 0 && !trackerCh[realChannel].isInitialVolSet)
 		{
 			trackerCh[realChannel].isInitialVolSet = 1;
-			fm->ch[realChannel].initial_vol = fxdata;
+			mt->ch[realChannel].initial_vol = fxdata;
 			return;
 		}
 	}
@@ -354,15 +569,12 @@ void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
 
 		/* The first channel panning command must be stored as initial_pan, not effect */
 
-		pos--;
-
-		while (pos > 0 && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 'X')
-			pos--;
+		pos = midi_previous(channelIndexes[realChannel].pan, pos - 1);
 
 		if (pos <= 0 && !trackerCh[realChannel].isInitialPanSet)
 		{
 			trackerCh[realChannel].isInitialPanSet = 1;
-			fm->ch[realChannel].initial_pan = fxdata;
+			mt->ch[realChannel].initial_pan = fxdata;
 			return;
 		}
 	}
@@ -370,19 +582,19 @@ void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
 
 
 	// move already existing global event to another channel if needed
-	if (isGlobalEffect(fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx) && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
+	if (isGlobalEffect(mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx) && mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
 	{
 
-		for (unsigned ch = 0; ch < FM_ch; ch++)
+		for (unsigned ch = 0; ch < channels; ch++)
 		{
-			if (fm->pattern[pos / patternSize][pos%patternSize][ch].fx == 255)
+			if (mt->pattern[pos / patternSize][pos%patternSize][ch].fx == 255)
 			{
-				fm->pattern[pos / patternSize][pos%patternSize][ch].fx = fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx;
-				fm->pattern[pos / patternSize][pos%patternSize][ch].fxdata = fm->pattern[pos / patternSize][pos%patternSize][realChannel].fxdata;
-				fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx = 255;
+				setFx(pos, ch, mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx);
+				mt->pattern[pos / patternSize][pos%patternSize][ch].fxdata = mt->pattern[pos / patternSize][pos%patternSize][realChannel].fxdata;
+				setFx(pos, realChannel, 255);
 				break;
 			}
-			if (ch == FM_ch - 1)
+			if (ch == channels - 1)
 			{ // no free channel found : keep the global event, don't write the new effect
 				return;
 			}
@@ -392,14 +604,14 @@ void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
 	pos = order*patternSize + row + rowOffset;
 
 
-	if (fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
+	if (mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
 	{
 		/* write global effects to other patterns if another effect is already there */
 		if (isGlobalEffect(fx))
 		{
-			for (unsigned ch = 0; ch < FM_ch; ch++)
+			for (unsigned ch = 0; ch < channels; ch++)
 			{
-				if (fm->pattern[pos / patternSize][pos%patternSize][ch].fx == 255)
+				if (mt->pattern[pos / patternSize][pos%patternSize][ch].fx == 255)
 				{
 					realChannel = ch;
 					break;
@@ -411,15 +623,15 @@ void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
 		{
 
 			/* Try before */
-			if (pos > 0 && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 255 && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
+			if (pos > 0 && mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 255 && mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
 			{
 				pos--;
 				/* Try after */
-				if (pos < fm->patternCount*patternSize - 2 && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 255 && fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
+				if (pos < mt->patternCount*patternSize - 2 && mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 255 && mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != fx)
 				{
 					pos += 2;
 					/* Reset at initial position */
-					if (fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 255)
+					if (mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx != 255)
 					{
 						pos--;
 						/* Keep important channel volume 'M'/'I' effects, discard others */
@@ -431,66 +643,71 @@ void midi_writefx(int realChannel, int fx, int fxdata, int rowOffset = 0)
 		}
 		else
 		{
-			if (fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'M' && pos > 0)
+			if (mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'M' && pos > 0)
 			{
-				fm->pattern[(pos - 1) / patternSize][(pos - 1) % patternSize][realChannel].fx = fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx;
-				fm->pattern[(pos - 1) / patternSize][(pos - 1) % patternSize][realChannel].fxdata = fm->pattern[pos / patternSize][pos%patternSize][realChannel].fxdata;
+				setFx(pos - 1, realChannel, mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx);
+				mt->pattern[(pos - 1) / patternSize][(pos - 1) % patternSize][realChannel].fxdata = mt->pattern[pos / patternSize][pos%patternSize][realChannel].fxdata;
 			}
 		}
 	}
 	if (fx == 'D')
 	{
-		if (fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'M' || fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'X'
-			|| fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'I')
+		if (mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'M' || mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'X'
+			|| mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'I')
 		{
 			return;
 		}
 	}
 	else if (fx == 'I')
 	{
-		if (fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'M' || fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'X')
+		if (mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'M' || mt->pattern[pos / patternSize][pos%patternSize][realChannel].fx == 'X')
 		{
 			return;
 		}
 	}
 
-	fm->pattern[pos / patternSize][pos%patternSize][realChannel].fx = fx;
-	fm->pattern[pos / patternSize][pos%patternSize][realChannel].fxdata = fxdata;
+	setFx(pos, realChannel, fx);
+	mt->pattern[pos / patternSize][pos%patternSize][realChannel].fxdata = fxdata;
 }
 
-void midi_effect(int midiChannel, unsigned char fx, unsigned char fxdata)
+void MidiImporter::effect(int midiChannel, unsigned char fx, unsigned char fxdata)
 {
 
 	if (fx == 'M') { midiCh[midiChannel].vol = fxdata; }
 
 	if (fx == 'X') { midiCh[midiChannel].pan = fxdata; }
 
-	for (unsigned i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < channels; i++)
 	{
 		if (trackerCh[i].midiChannelMappings == midiChannel && trackerCh[i].midiTrackMappings == currentTrack)
 		{
-			midi_writefx(i, fx, fxdata);
+			writefx(i, fx, fxdata);
 		}
 	}
 
 }
 
-void updateChannelParams(int realChannel, int midiChannel)
+void MidiImporter::updateChannelParams(int realChannel, int midiChannel)
 {
 
-	midi_writefx(realChannel, 'X', midiCh[midiChannel].pan);
-	midi_writefx(realChannel, 'M', midiCh[midiChannel].vol);
+	writefx(realChannel, 'X', midiCh[midiChannel].pan);
+	writefx(realChannel, 'M', midiCh[midiChannel].vol);
 
 }
 
 
 
-int reserveChannel(int note, int midiChannel)
+bool MidiImporter::isTrackChannel(int channel)
+{
+	return find(trackChannels.begin(), trackChannels.end(), channel) != trackChannels.end();
+}
+
+int MidiImporter::reserveChannel(int note, int midiChannel)
 {
 
 	int channel = -1;
 
-	for (unsigned i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < channels; i++)
 	{
 		// same note already playing OR mono mode
 		if (trackerCh[i].midiChannelMappings == midiChannel && (trackerCh[i].noteOn == note + 1 || midiCh[midiChannel].channelPoly == 0) && trackerCh[i].midiTrackMappings == currentTrack)
@@ -502,7 +719,7 @@ int reserveChannel(int note, int midiChannel)
 
 	if (channel == -1)
 	{
-		for (unsigned i = 0; i < FM_ch; i++)
+		for (unsigned i = 0; i < channels; i++)
 		{
 			// channel previously used by the same instrument
 			if (trackerCh[i].midiChannelMappings == midiChannel && (trackerCh[i].noteOn == 0
@@ -517,45 +734,45 @@ int reserveChannel(int note, int midiChannel)
 
 	if (channel == -1)
 	{
-		for (unsigned i = 0; i < FM_ch; i++)
+		int trackChannel = currentTrack < (int)trackChannels.size() ? trackChannels[currentTrack] : -1;
+
+		// tracker channel this track was exported from : its notes never overlap, whatever their midi channel (percussion has no note off)
+		if (trackChannel >= 0 && (trackerCh[trackChannel].midiChannelMappings == -1 || trackerCh[trackChannel].midiTrackMappings == currentTrack
+			&& (trackerCh[trackChannel].noteOn == 0 || trackerCh[trackChannel].midiChannelMappings == 9)))
+		{
+			channel = trackChannel;
+		}
+		// unused channel, preferably not claimed by another track
+		for (unsigned pass = 0; pass < 2 && channel == -1; pass++)
 		{
-			// unused channel
-			if (trackerCh[i].midiChannelMappings == -1)
+			for (unsigned i = 0; i < channels; i++)
 			{
-				channel = i;
-				// copy midi channel vol/pan to the new allocated channel
-				trackerCh[i].firstNotePos = order*patternSize + row;
-				updateChannelParams(i, midiChannel);
-
-				break;
+				if (trackerCh[i].midiChannelMappings == -1 && (pass == 1 || !isTrackChannel(i)))
+				{
+					channel = i;
+					break;
+				}
 			}
 		}
+
+		if (channel >= 0)
+		{
+			// copy midi channel vol/pan to the new allocated channel
+			if (trackerCh[channel].midiChannelMappings == -1)
+				trackerCh[channel].firstNotePos = order*patternSize + row;
+			updateChannelParams(channel, midiChannel);
+		}
 	}
 
 	if (channel == -1)
 	{
 
-		/* MIDI format 0 */
-		if (tracks == 1)
-		{
-			if (midi_findoldestChannelBackward())
-			{
-				channel = oldestChannels[0].channel;
-				updateChannelParams(channel, midiChannel);
-			}
-		}
-		/* MIDI format 1 is far more complicated to handle */
-		else
+		/* Steal the channel that has been free for the longest time. All the tracks are merged,
+			so every note before the current row is already written */
+		if (findoldestChannelBackward())
 		{
-
-			if (midi_findoldestChannelForward() /*(16*(8.0/fm->diviseur)*(currentTempo/120.0))*/)
-			{ // only if long-time inactive channel
-
-				channel = oldestChannels[0].channel;
-				trackerCh[channel].stolenUsed = 1;
-				trackerCh[channel].age = oldestChannels[0].age;
-				updateChannelParams(channel, midiChannel);
-			}
+			channel = oldestChannels[0].channel;
+			updateChannelParams(channel, midiChannel);
 		}
 	}
 
@@ -569,10 +786,10 @@ int reserveChannel(int note, int midiChannel)
 	return channel;
 }
 
-int freeChannel(int note, int midiChannel)
+int MidiImporter::freeChannel(int note, int midiChannel)
 {
 
-	for (unsigned i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < channels; i++)
 	{
 
 		if (trackerCh[i].midiChannelMappings == midiChannel && trackerCh[i].noteOn - 1 == note && trackerCh[i].midiTrackMappings == currentTrack)
@@ -587,7 +804,7 @@ int freeChannel(int note, int midiChannel)
 	return -1;
 }
 
-int midi_writeDelay(int channel)
+int MidiImporter::writeDelay(int channel)
 {
 
 	float delay = abs(realRow - (int)realRow);
@@ -600,24 +817,20 @@ int midi_writeDelay(int channel)
 		}
 		else
 		{
-			midi_writefx(channel, 'D', (int)round(8 * delay));
+			writefx(channel, 'D', (int)round(8 * delay));
 		}
 	}
 
 	return 0;
 }
 
-void midi_noteOff(int note, int midiChannel)
+void MidiImporter::noteOff(int note, int midiChannel)
 {
 	if (midiChannel == 9)
 		return;
 	int channel;
 	if ((channel = freeChannel(note, midiChannel)) >= 0)
 	{
-
-		if (trackerCh[channel].stolenUsed)
-			trackerCh[channel].stolenUsed = 0;
-
 		if (midiCh[midiChannel].pedal)
 		{
 			trackerCh[channel].pedalCanRelease = note + 1;
@@ -626,32 +839,32 @@ void midi_noteOff(int note, int midiChannel)
 		trackerCh[channel].pedalCanRelease = 0;
 
 		/* fast note on/off : tracker quantification would put them on the same row... */
-		if (fm->pattern[order][row][channel].note == note)
+		if (mt->pattern[order][row][channel].note == note)
 		{
 			int pos = order*patternSize + row + 1;
-			if (pos / patternSize < fm->patternCount && fm->pattern[pos / patternSize][pos % patternSize][channel].note == 255)
+			if (pos / patternSize < mt->patternCount && mt->pattern[pos / patternSize][pos % patternSize][channel].note == 255)
 			{
-				fm->pattern[pos / patternSize][pos%patternSize][channel].note = 128;
+				setNote(pos, channel, 128);
 			}
 		}
 		/* free slot, just write the note off */
-		else if (fm->pattern[order][row][channel].note == 255)
+		else if (mt->pattern[order][row][channel].note == 255)
 		{
-			fm->pattern[order][row][channel].note = 128;
+			setNote(order*patternSize + row, channel, 128);
 		}
 		/* note with no instr : fake pitch bend, stop */
-		else if (fm->pattern[order][row][channel].instr == 255)
+		else if (mt->pattern[order][row][channel].instr == 255)
 		{
-			fm->pattern[order][row][channel].note = 128;
+			setNote(order*patternSize + row, channel, 128);
 		}
-		if (config->subquantize.checked && fm->pattern[order][row][channel].note == 128)
+		if (settings.subquantize && mt->pattern[order][row][channel].note == 128)
 		{
-			midi_writeDelay(channel);
+			writeDelay(channel);
 		}
 	}
 }
 
-void midi_noteOn(int note, int volume, int midiChannel, int instrument)
+void MidiImporter::noteOn(int note, int volume, int midiChannel, int instrument)
 {
 
 	if (midiCh[midiChannel].localKeyboard == 0)
@@ -659,7 +872,7 @@ void midi_noteOn(int note, int volume, int midiChannel, int instrument)
 	int channel;
 	if (volume == 0)
 	{
-		midi_noteOff(note, midiChannel);
+		noteOff(note, midiChannel);
 	}
 	else
 	{
@@ -680,42 +893,42 @@ void midi_noteOn(int note, int volume, int midiChannel, int instrument)
 		if ((channel = reserveChannel(note, midiChannel % 16)) >= 0)
 		{
 			// same row (happen in case of very fast note < quantization)
-			if (fm->pattern[order][row][channel].note < 128)
+			if (mt->pattern[order][row][channel].note < 128)
 			{
-				trackerCh[channel].noteOn = fm->pattern[order][row][channel].note + 1;
+				trackerCh[channel].noteOn = mt->pattern[order][row][channel].note + 1;
 				if ((channel = reserveChannel(note, midiChannel % 16)) < 0)
 					return;
 			}
 
 			trackerCh[channel].pedalCanRelease = 0;
 			int pos = order*patternSize + row + 1;
-			if (pos / patternSize == fm->patternCount)
+			if (pos / patternSize == mt->patternCount && !mt_insertPattern(mt, patternSize, mt->patternCount))
 			{
-				mt_insertPattern(fm, patternSize, fm->patternCount);
+				return;
 			}
-			if (fm->pattern[pos / patternSize][pos%patternSize][channel].note == 128)
+			if (mt->pattern[pos / patternSize][pos%patternSize][channel].note == 128)
 			{ // remove a note off that was added by a fast note on the same row (happen in case of very fast note < quantization)
-				fm->pattern[pos / patternSize][pos%patternSize][channel].note = 255;
+				setNote(pos, channel, 255);
 			}
 			trackerCh[channel].lastNoteVol = volume;
 
-			if (config->subquantize.checked && midi_writeDelay(channel))
+			if (settings.subquantize && writeDelay(channel))
 			{
 
-				fm->pattern[pos / patternSize][pos%patternSize][channel].note = addedPercussion >= 0 ? 60 : note;
-				fm->pattern[pos / patternSize][pos%patternSize][channel].vol = (volume / 1.282828)*midiCh[midiChannel].expression / 99.0;
+				setNote(pos, channel, addedPercussion >= 0 ? 60 : note);
+				setVol(pos, channel, (volume / 1.282828)*midiCh[midiChannel].expression / 99.0);
 
 				if (!midiCh[midiChannel].legato)
-					fm->pattern[pos / patternSize][pos%patternSize][channel].instr = addedPercussion >= 0 ? addedPercussion : instrument;
+					mt->pattern[pos / patternSize][pos%patternSize][channel].instr = addedPercussion >= 0 ? addedPercussion : instrument;
 
 			}
 			else
 			{
-				fm->pattern[order][row][channel].note = addedPercussion >= 0 ? 60 : note;
-				fm->pattern[order][row][channel].vol = (volume / 1.282828)*midiCh[midiChannel].expression / 99.0;
+				setNote(order*patternSize + row, channel, addedPercussion >= 0 ? 60 : note);
+				setVol(order*patternSize + row, channel, (volume / 1.282828)*midiCh[midiChannel].expression / 99.0);
 
 				if (!midiCh[midiChannel].legato)
-					fm->pattern[order][row][channel].instr = addedPercussion >= 0 ? addedPercussion : instrument;
+					mt->pattern[order][row][channel].instr = addedPercussion >= 0 ? addedPercussion : instrument;
 
 			}
 
@@ -725,7 +938,7 @@ void midi_noteOn(int note, int volume, int midiChannel, int instrument)
 }
 
 // global effects (tempo, loops...)
-void midi_globalEffect(unsigned char fx, unsigned char fxdata)
+void MidiImporter::globalEffect(unsigned char fx, unsigned char fxdata)
 {
 
 	int emptyChannel = 0;
@@ -734,73 +947,40 @@ void midi_globalEffect(unsigned char fx, unsigned char fxdata)
 	if (fx == 'B' || fx == 'C')
 		pos = max(0, pos - 1);
 
-	while (fm->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx != 255 && emptyChannel < FM_ch - 1 && fm->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx != fx)
+	while (mt->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx != 255 && emptyChannel < (int)channels - 1 && mt->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx != fx)
 	{
-		if (fx == fm->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx)
+		if (fx == mt->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx)
 			return;
 		emptyChannel++;
 	}
-	fm->pattern[pos / patternSize][pos%patternSize][emptyChannel].fx = fx;
-	fm->pattern[pos / patternSize][pos%patternSize][emptyChannel].fxdata = fxdata;
+	setFx(pos, emptyChannel, fx);
+	mt->pattern[pos / patternSize][pos%patternSize][emptyChannel].fxdata = fxdata;
 }
 
 
 
 
-void midi_expression(int midiChannel, int vol)
+void MidiImporter::expression(int midiChannel, int vol)
 {
 	if (midiCh[midiChannel].expression == (int)((midiCh[midiChannel].vol*0.0101010101010101)*vol / 1.282828))
 		return;
 
 	midiCh[midiChannel].expression = (midiCh[midiChannel].vol*0.0101010101010101)*vol / 1.282828; // 0-127 to 0-1 range
-	for (unsigned i = 0; i < FM_ch; i++)
+	for (unsigned i = 0; i < channels; i++)
 	{
 		if (trackerCh[i].midiChannelMappings == midiChannel && trackerCh[i].midiTrackMappings == currentTrack)
 		{
-			fm->pattern[order][row][i].vol = midiCh[midiChannel].expression*trackerCh[i].lastNoteVol / 127.0;
+			setVol(order*patternSize + row, i, midiCh[midiChannel].expression*trackerCh[i].lastNoteVol / 127.0);
 		}
 	}
 }
 
-void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &midifile)
+void MidiImporter::handleEvents(int type, int midiChannel, unsigned char data, unsigned char data2)
 {
-
-	/* Check if some stolen channels have expired */
-	for (unsigned i = 0; i < FM_ch; i++)
-	{
-
-
-		if (trackerCh[i].age > 0)
-		{
-
-			trackerCh[i].age -= order*patternSize + row - lastPos;
-
-			if (trackerCh[i].age <= 0)
-			{
-
-				trackerCh[i].stolenUsed = 0;
-
-				if (trackerCh[i].oldPan != trackerCh[i].pan)
-					midi_writefx(i, 'X', trackerCh[i].oldPan, trackerCh[i].age);
-				if (trackerCh[i].oldVol != trackerCh[i].vol)
-					midi_writefx(i, 'M', trackerCh[i].oldVol, trackerCh[i].age);
-
-				/* This channel is now available again, 99 (or any other fake value) to ensure those channels stays in 'stealing' mode */
-				trackerCh[i].midiChannelMappings = 99;
-				trackerCh[i].midiTrackMappings = 99;
-				trackerCh[i].noteOn = 0;
-			}
-		}
-	}
-	lastPos = order*patternSize + row;
-	unsigned char data2 = 0;
-	if (type != 0xC && type != 0xD)
-		data2 = midifile.get();
-
 	switch (type)
 	{
 		case 8: // note off
-			midi_noteOff(data, midiChannel);
+			noteOff(data, midiChannel);
 			break;
 		case 9: // note on
 
@@ -809,7 +989,7 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 			{
 				midiCh[midiChannel].currentInstr = 0;
 			}
-			midi_noteOn(data, data2, midiChannel, midiCh[midiChannel].currentInstr);
+			noteOn(data, data2, midiChannel, midiCh[midiChannel].currentInstr);
 
 			break;
 		case 0xA: // Polyphonic Key Pressure
@@ -819,7 +999,7 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 			switch (data)
 			{
 				case 0x01: // modulation (handled as vibrato)
-					midi_effect(midiChannel, 'H', 96 + data2 / 16);
+					effect(midiChannel, 'H', 96 + data2 / 16);
 					break;
 				case 0x06: // RPN param (1st part)
 					if (rpnSelect1 == 0 && rpnSelect2 == 0)
@@ -831,7 +1011,7 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 					}*/
 					if (rpnSelect1 == 0 && rpnSelect2 == 2)
 					{ // master coarse tuning
-						fm->transpose = data2 - 64;
+						mt->transpose = data2 - 64;
 					}
 					break;
 				case 0x26: // (38) RPN param (2nd part)
@@ -842,15 +1022,15 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 					break;
 				case 0x07: // channel volume
 
-					midi_effect(midiChannel, 'M', data2 / 1.282828);
+					effect(midiChannel, 'M', data2 / 1.282828);
 					break;
 				case 0x08: // channel balance
 				case 0x0A: // (10) channel panning
-					midi_effect(midiChannel, 'X', data2 * 2);
+					effect(midiChannel, 'X', data2 * 2);
 					break;
 				case 0x0B: // (11) expression controller -- handled as volume tracker commands
 
-					midi_expression(midiChannel, data2);
+					expression(midiChannel, data2);
 
 					break;
 				case 0x40: // (64) sustain pedal
@@ -859,24 +1039,24 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 					/* Releasing the pedal should stop the notes playing on this channel */
 					if (!midiCh[midiChannel].pedal)
 					{
-						for (unsigned i = 0; i < FM_ch; i++)
+						for (unsigned i = 0; i < channels; i++)
 						{
 							if (trackerCh[i].midiChannelMappings == midiChannel && trackerCh[i].midiTrackMappings == currentTrack && trackerCh[i].pedalCanRelease == trackerCh[i].noteOn)
 							{
 
 								/* Free cell */
-								if (fm->pattern[order][row][i].note == 255)
+								if (mt->pattern[order][row][i].note == 255)
 								{
-									fm->pattern[order][row][i].note = 128;
+									setNote(order*patternSize + row, i, 128);
 
 								}
 								/* Occupied cell : write into next row */
 								else
 								{
 									int pos = order*patternSize + row + 1;
-									if (pos / patternSize < fm->patternCount && fm->pattern[pos / patternSize][pos % patternSize][i].note == 255)
+									if (pos / patternSize < mt->patternCount && mt->pattern[pos / patternSize][pos % patternSize][i].note == 255)
 									{
-										fm->pattern[pos / patternSize][pos%patternSize][i].note = 128;
+										setNote(pos, i, 128);
 									}
 								}
 								trackerCh[i].noteOn = 0;
@@ -906,18 +1086,18 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 					break;
 				case 0x75: /* (117) loop end */
 				case 0x77: /* 119 */
-					midi_globalEffect('B', loopStart / patternSize);
-					midi_globalEffect('C', loopStart%patternSize);
+					globalEffect('B', loopStart / patternSize);
+					globalEffect('C', loopStart%patternSize);
 
 					loopStart = -1;
 					break;
 				case 0x78: // (120) all sound off */
 				case 0x7B: // (123) all notes off */
-					for (unsigned i = 0; i < FM_ch; i++)
+					for (unsigned i = 0; i < channels; i++)
 					{
 						if (trackerCh[i].midiChannelMappings == midiChannel && trackerCh[i].midiTrackMappings == currentTrack)
 						{
-							fm->pattern[order][row][i].note = 128;
+							setNote(order*patternSize + row, i, 128);
 							trackerCh[i].noteOn = 0;
 						}
 					};
@@ -951,27 +1131,27 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 			break;
 		case 14: /* Pitch Bend */
 			if (midiCh[midiChannel].pitchBendRange <= 2)
-				midi_effect(midiChannel, 'I', 2 * data2 + (data > 63)); /* use 1 bit from lsb for more precision (0-127 to 0-255 range) */
+				effect(midiChannel, 'I', 2 * data2 + (data > 63)); /* use 1 bit from lsb for more precision (0-127 to 0-255 range) */
 			else
 			{
-				for (unsigned i = 0; i < FM_ch; i++)
+				for (unsigned i = 0; i < channels; i++)
 				{
 					if (trackerCh[i].midiChannelMappings == midiChannel && trackerCh[i].midiTrackMappings == currentTrack && trackerCh[i].noteOn)
 					{
 						float ratio = (float)midiCh[midiChannel].pitchBendRange / 128;
-						if (fm->pattern[order][row][i].instr == 255 && fm->pattern[order][row][i].note == 255 ||
-							fm->pattern[order][row][i].instr == 255 && fm->pattern[order][row][i].note <128)
+						if (mt->pattern[order][row][i].instr == 255 && mt->pattern[order][row][i].note == 255 ||
+							mt->pattern[order][row][i].instr == 255 && mt->pattern[order][row][i].note <128)
 						{
 							int pitchBendNote = trackerCh[i].noteOn - 1 + (2 * data2 + (data>63) - 128) * ratio + 0.5;
 							pitchBendNote = clamp(pitchBendNote, 0, 127);
 							if (trackerCh[i].channelPBend != pitchBendNote)
 							{
 
-								fm->pattern[order][row][i].note = pitchBendNote;
+								setNote(order*patternSize + row, i, pitchBendNote);
 								trackerCh[i].channelPBend = pitchBendNote;
-								if (config->subquantize.checked)
+								if (settings.subquantize)
 								{
-									midi_writeDelay(i);
+									writeDelay(i);
 								}
 							}
 						}
@@ -983,16 +1163,15 @@ void midi_handleEvents(int type, int midiChannel, unsigned char data, istream &m
 }
 
 
-int parseMidiRows(unsigned short delta_time_ticks, istream &midifile)
+/* Quantizes the merged events of all the tracks into rows. Returns 0 if the song was too long, -1 if cancelled */
+int MidiImporter::parseMidiRows(unsigned short delta_time_ticks, const vector<midiEvent> &events)
 {
-	unsigned char eventType, eventData;
 	realRow = 0;
 	row = 0, order = -1;
-	int lastStatus = 0, temp = 0;
-	long long deltaAcc = 0;
+	long long deltaAcc = 0, lastTick = 0;
 
 	rpnSelect1 = rpnSelect2 = 127; /* rpn default is null */
-	patternSize = config->patternSize.value;
+	patternSize = settings.patternSize;
 
 	for (unsigned i = 0; i < 16; i++)
 	{
@@ -1007,22 +1186,27 @@ int parseMidiRows(unsigned short delta_time_ticks, istream &midifile)
 		midiCh[i].pedal = midiCh[i].firstNote = midiCh[i].legato = 0;
 	}
 
-	double roundRow = config->subquantize.checked ? 0 : 0.5;
+	double roundRow = settings.subquantize ? 0 : 0.5;
+
+	for (unsigned e = 0; e < events.size(); e++)
+	{
+		const midiEvent &event = events[e];
 
-	while (order >= -1 && !midifile.eof())
-	{ /* order set to -1 when end of track is found */
+		if (e % 4096 == 0 && !progress(50 + 45 * (long long)e / events.size()))
+			return -1;
 
-		deltaAcc += ReadVarLen(midifile) / tempoDivisor;
-		realRow = deltaAcc / (delta_time_ticks / (double)fm->diviseur) + roundRow;
+		deltaAcc += (event.tick - lastTick) / tempoDivisor;
+		lastTick = event.tick;
+		realRow = deltaAcc / (delta_time_ticks / (double)mt->diviseur) + roundRow;
 
 		while (realRow >= patternSize*(order + 1))
 		{
 			order++;
 			if (order > maxOrder)
 			{
-				if (order < 255)
+				/* One pattern is left for the note offs of the last row */
+				if (order < MT_MAX_PATTERNS - 1 && mt_insertPattern(mt, patternSize, mt->patternCount))
 				{
-					mt_insertPattern(fm, patternSize, fm->patternCount);
 					maxOrder = order;
 				}
 				else
@@ -1032,319 +1216,336 @@ int parseMidiRows(unsigned short delta_time_ticks, istream &midifile)
 			}
 		}
 		row = (int)(realRow) % patternSize;
-		eventType = midifile.get();
+		currentTrack = event.track;
 
-		// Running status !
-		if (eventType / 16 < 8)
+		if (event.kind == MIDI_EVENT_CHANNEL)
 		{
-
-			midi_handleEvents(lastStatus / 16, lastStatus % 16, eventType, midifile);
+			handleEvents(event.type, event.channel, event.data1, event.data2);
 		}
-		else
-		{ // New status
-			if (eventType / 16 < 15)
+		else if (event.kind == MIDI_EVENT_SYSEX)
+		{
+			if (event.length >= 7 && !memcmp(event.data, "\x43\x10\x4C\x00\x00\x7E\x00", 7))
 			{
-				eventData = midifile.get();
-				midi_handleEvents(eventType / 16, eventType % 16, eventData, midifile);
+				isXG = 1;
 			}
-			else
-			{ // Meta event
-				if (eventType % 16 < 8)
-				{ //sysex
-					temp = ReadVarLen(midifile);
-					char *sysex = (char*)malloc(temp);
-					midifile.read(sysex, temp);
-					if (temp >= 7 && !memcmp(sysex, "\x43\x10\x4C\x00\x00\x7E\x00", 7))
+		}
+		else
+		{
+			const char *d = (const char*)event.data;
+			int length = event.length;
+
+			switch (event.type)
+			{
+				case 0x01: // text
+				case 0x02: // copyright
+				case 0x03: // seq name
+				case 0x04: // instr name
+				case 0x05: // lyrics
+				case 0x06:// marker
+				case 0x07: // cue point
+				case 0x7F: // sequencer specific data
+					if (event.type == 0x03 && currentTrack == 0) // sequence name
 					{
-						isXG = 1;
+						strncpy(mt->songName, d, min(63, length));
 					}
-				}
-				else
-				{// meta 
-					eventType = midifile.get();
-					switch (eventType)
+					else if (event.type == 0x03) // track name
 					{
-						case 0x00: // seq number
-							midifile.ignore(3);
-							break;
-						case 0x01: // text
-						case 0x02: // copyright
-						case 0x03: // seq name
-						case 0x04: // instr name
-						case 0x05: // lyrics
-						case 0x06:// marker
-						case 0x07: // cue point
-						case 0x7F:{ // sequencer specific data
-									  temp = ReadVarLen(midifile);
-									  char* d = (char*)malloc(temp);
-									  midifile.read(d, temp);
-
-									  if (eventType == 0x03) // sequence name
-										  strncpy(fm->songName, d, min(63, temp));
-									  else if (eventType == 0x02) // copyright
-										  strncpy(fm->author, d, min(63, temp));
-									  else if (eventType == 0x01)
-									  { // text
-										  strncpy(fm->comments, d, min(255, temp));
-									  }
-									  else if (eventType == 0x06)
-									  {
-										  if (strncmp(d, "loopStart", temp) == 0)
-										  { // FF7's loop points
-											  loopStart = order*patternSize + row;
-										  }
-										  else if (strncmp(d, "loopEnd", temp) == 0)
-										  {
-											  midi_globalEffect('B', loopStart / patternSize);
-											  midi_globalEffect('C', loopStart%patternSize);
-										  }
-									  }
-									  free(d);
-						}break;
-
-						case 0x20: // MIDI currentChannelNumber Prefix
-						case 0x21: // prefix port
-							midifile.ignore(2);
-							break;
-						case 0x2F: // end of track
-							if (order*patternSize + row > totalLength)
+						if (length > 8 && length < 12 && strncmp(d, "Channel ", 8) == 0)
+						{
+							int channel = atoi(string(d + 8, length - 8).c_str()) - 1;
+							if (channel >= 0 && channel < (int)channels)
 							{
-								totalLength = order*patternSize + row;
+								trackChannels.resize(max((int)trackChannels.size(), currentTrack + 1), -1);
+								trackChannels[currentTrack] = channel;
 							}
+						}
+					}
+					else if (event.type == 0x02) // copyright
+						strncpy(mt->author, d, min(63, length));
+					else if (event.type == 0x01)
+					{ // text
+						strncpy(mt->comments, d, min(255, length));
+					}
+					else if (event.type == 0x06)
+					{
+						if (strncmp(d, "loopStart", length) == 0)
+						{ // FF7's loop points
+							loopStart = order*patternSize + row;
+						}
+						else if (strncmp(d, "loopEnd", length) == 0)
+						{
+							globalEffect('B', loopStart / patternSize);
+							globalEffect('C', loopStart%patternSize);
+						}
+					}
+					break;
+				case 0x2F: // end of track
+					if (order*patternSize + row > totalLength)
+					{
+						totalLength = order*patternSize + row;
+					}
+					break;
+				case 0x51:{ // (81) tempo
+					if (length < 3)
+						break;
 
-							midifile.ignore(1);
-							order = -2;
-							break;
-						case 0x51:{ // (81) tempo
-									  midifile.ignore(1);
-									  unsigned char tempoRaw[3];
-									  midifile.read((char*)&tempoRaw, 3);
-
-									  int tempo = 60000000 / ((tempoRaw[0] << 16) | (tempoRaw[1] << 8) | tempoRaw[2]);
-
-									  // tempo > 255 : scale import speed to handle it
-									  tempoDivisor = 1;
-									  while (tempo > 255)
-									  {
-										  tempoDivisor *= 2;
-										  tempo *= 0.5;
-									  }
-
-									  if (order == 0 && row == 0)
-									  {
-										  fm->initial_tempo = tempo;
-									  }
-									  else if (tempo != currentTempo)
-									  {
-										  midi_globalEffect('T', tempo);
-									  }
-									  currentTempo = tempo;
-						}break;
-						case 0x54: // smpte offset (dunno whats this shit)
-							midifile.ignore(6);
-							break;
-						case 0x58: // time
-							midifile.ignore(5);
-							break;
-
-						case 0x59: // key
-							midifile.ignore(3);
-							break;
+					int tempo = 60000000 / max(1, (event.data[0] << 16) | (event.data[1] << 8) | event.data[2]);
 
+					// tempo > 255 : scale import speed to handle it
+					tempoDivisor = 1;
+					while (tempo > 255)
+					{
+						tempoDivisor *= 2;
+						tempo *= 0.5;
 					}
-				}
+
+					if (order == 0 && row == 0)
+					{
+						mt->initial_tempo = tempo;
+					}
+					else if (tempo != currentTempo)
+					{
+						globalEffect('T', tempo);
+					}
+					currentTempo = tempo;
+				}break;
 			}
-			lastStatus = eventType;
 		}
 	}
 
 	return 1;
 }
 
-int musImport(const char* filename)
+/* Converts a MIDI file loaded in memory into the importer's song */
+int MidiImporter::import(const unsigned char *data, size_t size)
 {
-	ifstream musfile;
-	musfile.open(filename, ios::binary);
-	if (!musfile.is_open())
-		return MT_ERR_FILEIO;
-
-	ostringstream midiostream;
-
-	if (!mus2mid(musfile, midiostream))
-	{
-		musfile.close();
-		return MT_ERR_FILECORRUPTED;
-	}
-	else
-	{
-		midiostream.flush();
-    	musfile.close();
-	}
-
-	istringstream midiistream(midiostream.str());
-
-	int currentVol = fm->_globalVolume;
-	mt_clearSong(fm);
-	mt_resizeInstrumentList(fm, 0);
+	int currentVol = mt->_globalVolume;
+	mt_clearSong(mt);
+	mt_setChannelCount(mt, channels);
+	mt_resizeInstrumentList(mt, 0);
+	/* The instruments take about the first 40% of the import */
 	for (int i = 0; i < 128; ++i)
 	{
 		addInstrument(i, 0);
+		if (!progress(i * 40 / 192))
+			return MT_ERR_CANCELLED;
 	}
 	for (int i = 24; i < 88; ++i)
 	{
 		addInstrument(i, 1);
+		if (!progress((128 + i - 24) * 40 / 192))
+			return MT_ERR_CANCELLED;
 	}
-	fm->diviseur = config->diviseur.value;
-	mt_setVolume(fm, currentVol);
-	fm->initial_tempo = 120;
+	mt->diviseur = settings.diviseur;
+	mt_setVolume(mt, currentVol);
+	mt->initial_tempo = 120;
 	loopStart = -1;
 
 	totalLength = 0;
 	tempoDivisor = 1;
 	for (unsigned i = 0; i < FM_ch; i++)
 	{
-		fm->ch[i].initial_reverb = 20;
+		mt->ch[i].initial_reverb = 20;
 		trackerCh[i].firstNotePos = -1;
 		trackerCh[i].midiChannelMappings = -1;
 		trackerCh[i].midiTrackMappings = -1;
 		trackerCh[i].noteOn = 0;
-		trackerCh[i].age = -1;
 		trackerCh[i].pan = -1;
 		trackerCh[i].vol = -1;
 		trackerCh[i].channelPBend = -1;
 		trackerCh[i].isInitialPanSet = 0;
 		trackerCh[i].isInitialVolSet = 0;
-		trackerCh[i].stolenUsed = 0;
+		channelIndexes[i] = channelIndex();
 	}
 
 	isXG = 0;
-	unsigned short delta_time_ticks;
-
-	char temp[4];
-	midiistream.read((char*)&temp, 4);
-	midiistream.ignore(4); // MThd + chuckSize
-	midiistream.read((char*)&midiFormat, 2);
-	midiFormat = (midiFormat >> 8) | (midiFormat << 8);
-	midiistream.read((char*)&tracks, 2); // nb of tracks
-	tracks = (tracks >> 8) | (tracks << 8);
-	midiistream.read((char*)&delta_time_ticks, 2);
-	delta_time_ticks = (delta_time_ticks >> 8) | (delta_time_ticks << 8);
 
-	maxOrder = -1;
-	midiistream.ignore(8); // expecting MTrk + chunk size, we dont need them
-	parseMidiRows(delta_time_ticks, midiistream);
+	midiReader reader(data, size);
 
-	// no instrument (unlikely?) : avoid crash
-	if (fm->instrumentCount == 0)
+	if (size >= 4 && memcmp(data, "RIFF", 4) == 0)
 	{
-		if (mt_loadInstrument(fm, "instruments/keyboards/piano.mdti", 0) < 0)
-		{
-			mt_resizeInstrumentList(fm, 1);
-		}
+		reader.skip(20);
 	}
-	instrList->select(0);
 
-	mt_buildStateTable(fm, 0, fm->patternCount, 0, FM_ch);
+	reader.skip(8); // MThd + chuckSize
+	midiFormat = reader.word();
+	tracks = reader.word(); // nb of tracks
+	unsigned short delta_time_ticks = reader.word();
 
-	return 0;
-}
+	maxOrder = -1;
 
-int midiImport(const char* filename)
-{
-	ifstream midifile;
-	midifile.open(filename, ios::binary);
-	if (!midifile.is_open())
-		return MT_ERR_FILEIO;
+	/* Locate the track chunks from their lengths, skipping unknown chunks */
+	vector<midiTrackChunk> chunks;
+	const unsigned char *firstChunk = reader.pos;
+	bool wrongLengths = false;
 
-	int currentVol = fm->_globalVolume;
-	mt_clearSong(fm);
-	mt_resizeInstrumentList(fm, 0);
-	for (int i = 0; i < 128; ++i)
+	while (chunks.size() < (unsigned short)tracks && reader.pos < reader.end)
 	{
-		addInstrument(i, 0);
-	}
-	for (int i = 24; i < 88; ++i)
-	{
-		addInstrument(i, 1);
-	}
-	fm->diviseur = config->diviseur.value;
-	mt_setVolume(fm, currentVol);
-	fm->initial_tempo = 120;
-	loopStart = -1;
+		const unsigned char *header = reader.skip(8);
+		size_t length = header ? ((unsigned long)header[4] << 24) | (header[5] << 16) | (header[6] << 8) | header[7] : 0;
+		const unsigned char *chunkData = header ? reader.skip(length) : NULL;
 
-	totalLength = 0;
-	tempoDivisor = 1;
-	for (unsigned i = 0; i < FM_ch; i++)
-	{
-		fm->ch[i].initial_reverb = 20;
-		trackerCh[i].firstNotePos = -1;
-		trackerCh[i].midiChannelMappings = -1;
-		trackerCh[i].midiTrackMappings = -1;
-		trackerCh[i].noteOn = 0;
-		trackerCh[i].age = -1;
-		trackerCh[i].pan = -1;
-		trackerCh[i].vol = -1;
-		trackerCh[i].channelPBend = -1;
-		trackerCh[i].isInitialPanSet = 0;
-		trackerCh[i].isInitialVolSet = 0;
-		trackerCh[i].stolenUsed = 0;
-	}
+		/* The next chunk must follow */
+		if (!chunkData || reader.pos < reader.end && !midi_isChunkHeader(reader.pos, reader.end))
+		{
+			wrongLengths = true;
+			break;
+		}
 
-	isXG = 0;
-	unsigned short delta_time_ticks;
+		if (memcmp(header, "MTrk", 4) == 0)
+		{
+			midiTrackChunk chunk;
+			chunk.data = chunkData;
+			chunk.size = length;
+			chunk.decoded = false;
+			chunks.push_back(chunk);
+		}
+	}
 
-	char temp[4];
-	midifile.read((char*)&temp, 4);
-	if (strncmp(temp, "RIFF", 4) == 0)
+	/* Broken chunk lengths : like older versions, each track is read until its end of track event, one after the other */
+	if (wrongLengths)
 	{
-		midifile.ignore(20);
-	}
+		chunks.clear();
+		reader.pos = firstChunk;
+		reader.failed = false;
 
-	midifile.ignore(4); // MThd + chuckSize
-	midifile.read((char*)&midiFormat, 2);
-	midiFormat = (midiFormat >> 8) | (midiFormat << 8);
-	midifile.read((char*)&tracks, 2); // nb of tracks
-	tracks = (tracks >> 8) | (tracks << 8);
-	midifile.read((char*)&delta_time_ticks, 2);
-	delta_time_ticks = (delta_time_ticks >> 8) | (delta_time_ticks << 8);
+		for (unsigned track = 0; track < (unsigned short)tracks && !reader.failed; track++)
+		{
+			reader.skip(8); // expecting MTrk + chunk size
 
-	maxOrder = -1;
+			midiTrackChunk chunk;
+			chunk.data = reader.pos;
+			chunk.decoded = true;
 
-	for (currentTrack = 0; currentTrack < tracks; currentTrack++)
-	{
-		midifile.ignore(8); // expecting MTrk + chunk size, we dont need them
+			midiReader trackReader(reader.pos, reader.end - reader.pos);
+			midi_decodeTrack(trackReader, chunk.events, track);
+			chunk.size = trackReader.pos - chunk.data;
+			reader.skip(chunk.size);
 
-		if (!parseMidiRows(delta_time_ticks, midifile))
-			break;
+			chunks.push_back(chunk);
+		}
 	}
+
+	vector<midiEvent> events;
+	midi_decodeTracks(chunks, events);
+
+	if (!progress(50) || parseMidiRows(delta_time_ticks, events) < 0)
+		return MT_ERR_CANCELLED;
+
 	/* rpg maker loop point , */
 	if (loopStart >= 0)
 	{
 		row = totalLength%patternSize;
 		order = totalLength / patternSize;
-		midi_globalEffect('B', loopStart / patternSize);
-		midi_globalEffect('C', loopStart%patternSize);
+		globalEffect('B', loopStart / patternSize);
+		globalEffect('C', loopStart%patternSize);
 		loopStart = -1;
 	}
 
+	// no instrument (unlikely?) : avoid crash
+	if (mt->instrumentCount == 0)
+	{
+		if (instrumentLibrary_load(mt, "keyboards/piano", 0) < 0)
+		{
+			mt_resizeInstrumentList(mt, 1);
+		}
+	}
+	/* Songs get the usual channel count when they use less, the channels past the last used one are dropped */
+	mt_setChannelCount(mt, min(channels, (unsigned)FM_chDefault));
+	mt_buildStateTable(mt, 0, mt->patternCount, 0, mt->channelCount);
+	mt_cellsChanged(mt, -1);
 
-	/*if (fm->pattern[order][row].note[i]==255 && trackerCh[i].noteOn>0)
-		fm->pattern[order][row].note[i]=128;*/
+	return 0;
+}
 
+/* Reads a whole file, empty if it can't be read */
+static vector<unsigned char> readFile(const char* filename)
+{
+	vector<unsigned char> data;
 
+	FILE *fp = fopen(filename, "rb");
+	if (!fp)
+		return data;
 
-	// no instrument (unlikely?) : avoid crash
-	if (fm->instrumentCount == 0)
+	if (fseek(fp, 0, SEEK_END) == 0)
 	{
-		if (mt_loadInstrument(fm, "instruments/keyboards/piano.mdti", 0) < 0)
+		long size = ftell(fp);
+		if (size > 0)
 		{
-			mt_resizeInstrumentList(fm, 1);
+			data.resize(size);
+			fseek(fp, 0, SEEK_SET);
+			if (fread(data.data(), size, 1, fp) != 1)
+				data.clear();
 		}
 	}
-	instrList->select(0);
-	midifile.close();
+	fclose(fp);
+	return data;
+}
 
-	mt_buildStateTable(fm, 0, fm->patternCount, 0, FM_ch);
+midiImportSettings midi_importSettings()
+{
+	midiImportSettings settings;
+	settings.progress = NULL;
 
-	return 0;
-}
\ No newline at end of file
+	if (config)
+	{
+		settings.patternSize = config->patternSize.value;
+		settings.diviseur = config->diviseur.value;
+		settings.subquantize = config->subquantize.checked;
+		settings.channels = config->importChannels.value;
+	}
+	else
+	{ /* no GUI (batch conversion) : same defaults as the config page */
+		settings.patternSize = clamp(atoi(ini_config.GetValue("config", "defaultPatternSize", "128")), 8, MT_MAX_ROWS);
+		settings.diviseur = clamp(atoi(ini_config.GetValue("config", "rowsPerQuarterNote", "8")), 1, 32);
+		settings.subquantize = atoi(ini_config.GetValue("config", "preserveUnquantizedNotes", "1")) != 0;
+		settings.channels = clamp(atoi(ini_config.GetValue("config", "midiImportChannels", std::to_string(FM_ch).c_str())), 1, FM_ch);
+	}
+	return settings;
+}
+
+int midiImport(mtsynth *mt, const char* filename, const midiImportSettings &settings)
+{
+	vector<unsigned char> data = readFile(filename);
+
+	if (data.empty())
+		return MT_ERR_FILEIO;
+
+	MidiImporter importer(mt, settings);
+	return importer.import(data.data(), data.size());
+}
+
+int musImport(mtsynth *mt, const char* filename, const midiImportSettings &settings)
+{
+	ifstream musfile;
+	musfile.open(filename, ios::binary);
+	if (!musfile.is_open())
+		return MT_ERR_FILEIO;
+
+	ostringstream midiostream;
+
+	if (!mus2mid(musfile, midiostream))
+	{
+		return MT_ERR_FILECORRUPTED;
+	}
+
+	const string &midi = midiostream.str();
+
+	MidiImporter importer(mt, settings);
+	return importer.import((const unsigned char*)midi.data(), midi.size());
+}
+
+void midi_loadGMInstruments(mtsynth *mt)
+{
+	MidiImporter importer(mt, midi_importSettings());
+
+	mt_resizeInstrumentList(mt, 0);
+	for (int i = 0; i < 128; ++i)
+	{
+		importer.addInstrument(i, 0);
+	}
+	for (int i = 24; i < 88; ++i)
+	{
+		importer.addInstrument(i, 1);
+	}
+}
@@ -1,92 +1,368 @@
 #include "midi.h"
 #include "../input/noteInput.hpp"
 #include "../views/instrument/instrEditor.hpp"
+#include <SFML/System.hpp>
+#include <atomic>
+#include <chrono>
 
-PmTimestamp midithru_time_proc(void *info);
+/* Events read per PortMidi call and size of the queues to the audio and GUI threads (a power of two) */
+#define MIDI_INPUT_BUFFER 64
+#define MIDI_QUEUE_SIZE 1024
 
+/* Single producer, single consumer ring buffer : the MIDI input thread pushes, the audio or GUI thread pops, without locks */
+template<typename T, unsigned size>
+class midiQueue{
+	T items[size];
+	std::atomic<unsigned> head, tail; // next write, next read
 
-int selectedMidiDevice;
-PortMidiStream* midiStream;
-PmEvent midiBuffer[3];
-PmTimestamp current_timestamp;
-vector<int> midiDeviceIds;
-vector<string> midiDeviceNames;
-int midiReady, midiReceive, midiPedal;
+public:
+	midiQueue() : head(0), tail(0) {}
 
-void midi_getEvents()
+	bool push(const T& item)
+	{
+		unsigned h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == size)
+			return false;
+
+		items[h % size] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool peek(T& item)
+	{
+		unsigned t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+
+		item = items[t % size];
+		return true;
+	}
+
+	void pop()
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void clear()
+	{
+		tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+};
+
+struct midiInputEvent{
+	long long time; // midi_clock() when received
+	PmMessage message;
+	int instrument; // for note on
+};
+
+static PortMidiStream* midiStream;
+static vector<int> midiDeviceIds;
+static vector<string> midiDeviceNames;
+static int midiReady, midiPedal;
+static std::atomic<int> midiReceive;
+
+/* Program change received by the input thread and not selected yet by the GUI */
+static std::atomic<int> pendingProgram(-1);
+
+/* Selected instrument and note preview reverb, published every frame by the GUI thread for the input and audio threads */
+static std::atomic<int> liveInstrument(0), liveReverb(14);
+
+static midiQueue<midiInputEvent, MIDI_QUEUE_SIZE> audioQueue, guiQueue;
+
+static void midiInputFunc();
+static sf::Thread midiInputThread(&midiInputFunc);
+static std::atomic<bool> midiInputRunning(false);
+
+/* Audio thread state : channel playing each note, note played by each channel (+1), sustain pedal, start of the last rendered block */
+static int liveNoteChannel[128];
+static int liveChannelNote[FM_ch];
+static int livePedal;
+static long long lastBlockTime;
+
+static long long midi_clock()
 {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* PortMidi can't wait for events : poll every millisecond */
+static void midiInputFunc()
+{
+	PmEvent buffer[MIDI_INPUT_BUFFER];
 
-	if (midiReady && Pm_Poll(midiStream))
+	while (midiInputRunning)
 	{
+		int count = Pm_Poll(midiStream) == TRUE ? Pm_Read(midiStream, buffer, MIDI_INPUT_BUFFER) : 0;
+
+		if (count <= 0)
+		{
+			sf::sleep(sf::milliseconds(1));
+			continue;
+		}
+
+		if (!midiReceive)
+			continue;
 
-		int count = Pm_Read(midiStream, midiBuffer, 3);
-		if (midiReceive)
+		long long time = midi_clock();
+
+		for (int i = 0; i < count; i++)
 		{
-			for (int i = 0; i < count; i++)
+			midiInputEvent event = { time, buffer[i].message, 0 };
+
+			switch (Pm_MessageStatus(event.message) / 16)
+			{
+				case 9: // note on
+					/* A program change just before the note is not selected by the GUI yet */
+					event.instrument = pendingProgram >= 0 ? pendingProgram.load() : liveInstrument.load();
+					break;
+				case 0xC: // program change
+					pendingProgram = Pm_MessageData1(event.message);
+					break;
+			}
+
+			audioQueue.push(event);
+			guiQueue.push(event);
+		}
+	}
+}
+
+static void midi_startInput()
+{
+	audioQueue.clear();
+	guiQueue.clear();
+	midiInputRunning = true;
+	midiInputThread.launch();
+}
+
+static void midi_stopInput()
+{
+	midiInputRunning = false;
+	midiInputThread.wait();
+}
+
+/* Audio thread : plays an event on the channels not used by the song preview */
+static void midi_playEvent(mtsynth *mt, const midiInputEvent& event)
+{
+	int note = Pm_MessageData1(event.message);
+	int value = Pm_MessageData2(event.message);
+
+	switch (Pm_MessageStatus(event.message) / 16)
+	{
+		case 9: // note on
+			if (value > 0)
 			{
-				switch (Pm_MessageStatus(midiBuffer[i].message) / 16)
+				int channel = -1;
+
+				// if the same note is already playing, overwrite it
+				for (unsigned i = 0; i < FM_ch; i++)
 				{
-					case 8: // note off
-						if (!midiPedal)
-							previewNoteStop(Pm_MessageData1(midiBuffer[i].message), 1);
-						break;
-					case 9: // note on
-						previewNote(instrList->value, Pm_MessageData1(midiBuffer[i].message), Pm_MessageData2(midiBuffer[i].message) / 1.282828, 1);
+					if (liveChannelNote[i] == note + 1)
+					{
+						channel = i;
 						break;
-					case 0xB: // cc
-						switch (Pm_MessageData1(midiBuffer[i].message))
+					}
+				}
+
+				if (channel == -1)
+				{
+					int nbTries = 0;
+					do
+					{
+						channel = (channel + 1) % mt->channelCount;
+						nbTries++;
+					} while (mt->ch[channel].active && nbTries < (int)mt->channelCount);
+				}
+
+				configurePreviewChannel(mt, channel, liveReverb);
+				mt_playNote(mt, event.instrument, note, channel, value / 1.282828);
+				liveNoteChannel[note] = channel;
+				liveChannelNote[channel] = note + 1;
+				break;
+			}
+			// note on with a zero velocity is a note off
+		case 8: // note off
+			if (!livePedal && liveChannelNote[liveNoteChannel[note]] == note + 1)
+			{
+				mt_stopNote(mt, liveNoteChannel[note]);
+				liveChannelNote[liveNoteChannel[note]] = 0;
+			}
+			break;
+		case 0xB: // cc
+			switch (note)
+			{
+				case 64: // sustain pedal
+					livePedal = value > 63;
+					if (!livePedal)
+					{
+						for (unsigned i = 0; i < FM_ch; i++)
 						{
-							case 64: // sustain pedal
-								midiPedal = (Pm_MessageData2(midiBuffer[i].message) > 63);
-								if (!midiPedal)
-								{
-									previewNoteStopAll();
-								}
-								break;
-							case 0x78: // (120) all sound off
-								mt_stopSound(fm);
-								break;
-							case 0x7B: // all notes off
-								for (unsigned i = 0; i < FM_ch; i++)
-								{
-									mt_stopNote(fm, i);
-								}
-								break;
+							if (liveChannelNote[i])
+							{
+								mt_stopNote(mt, i);
+								liveChannelNote[i] = 0;
+							}
 						}
-						break;
-					case 0xC: // Program Change
-						instrList->select(Pm_MessageData1(midiBuffer[i].message));
+					}
+					break;
+				case 0x78: // (120) all sound off
+					mt_stopSound(mt);
+					break;
+				case 0x7B: // all notes off
+					for (unsigned i = 0; i < FM_ch; i++)
+					{
+						mt_stopNote(mt, i);
+						liveChannelNote[i] = 0;
+					}
+					break;
+			}
+			break;
+		case 14: // Pitch Bend
+			for (unsigned i = 0; i < FM_ch; i++)
+			{
+				if (liveChannelNote[i])
+				{
+					mt->ch[i].pitchBend = previewBendRatio(2 * value + (note > 63));
+				}
+			}
+			break;
+	}
+}
 
-						break;
-					case 14: // Pitch Bend
-						previewNoteBend(fm, 2 * Pm_MessageData2(midiBuffer[i].message) + (Pm_MessageData1(midiBuffer[i].message) > 63));
-						break;
+void midi_render(mtsynth *mt, char *buffer, unsigned long frames)
+{
+	long long now = midi_clock();
+	long long blockStart = lastBlockTime;
+	long long expectedLength = max(1ll, (long long)frames * 1000000 / mt->sampleRate);
+	lastBlockTime = now;
 
-				}
+	/* First block, or the stream was stopped (WAV export) : the events received meanwhile are too old to be played */
+	if (now - blockStart > 2 * expectedLength)
+	{
+		blockStart = now - expectedLength;
+	}
+	long long blockLength = max(1ll, now - blockStart);
 
-			}
+	unsigned long frame = 0;
+	midiInputEvent event;
+
+	/* Events received during the previous block are played at the same position in this one :
+		the latency is one block, without the jitter of playing them all at its start */
+	while (audioQueue.peek(event) && event.time < now)
+	{
+		/* Stale notes are dropped, the note offs and controllers still apply */
+		if (event.time < blockStart - blockLength && Pm_MessageStatus(event.message) / 16 == 9)
+		{
+			audioQueue.pop();
+			continue;
+		}
+
+		unsigned long offset = event.time <= blockStart ? 0 : (unsigned long)((event.time - blockStart) * frames / blockLength);
+
+		/* The engine updates its controls every 8 frames */
+		offset = min(offset & ~7ul, frames);
+
+		if (offset > frame)
+		{
+			mt_render(mt, &buffer[frame * 4], (offset - frame) * 2, MT_RENDER_16);
+			frame = offset;
+		}
+
+		midi_playEvent(mt, event);
+		audioQueue.pop();
+	}
+
+	if (frame < frames)
+	{
+		mt_render(mt, &buffer[frame * 4], (frames - frame) * 2, MT_RENDER_16);
+	}
+}
+
+int midi_getEvents()
+{
+	midiInputEvent event;
+	int count = 0;
+
+	if (instrList)
+		liveInstrument = instrList->value;
+	if (config)
+		liveReverb = config->previewReverb.value;
+
+	/* Only recording and instrument selection here, the notes are already played by the audio thread */
+	while (guiQueue.peek(event))
+	{
+		guiQueue.pop();
+		count++;
+
+		int data1 = Pm_MessageData1(event.message);
+		int data2 = Pm_MessageData2(event.message);
+
+		switch (Pm_MessageStatus(event.message) / 16)
+		{
+			case 9: // note on
+				if (data2 > 0)
+				{
+					recordNote(data1, data2 / 1.282828);
+					break;
+				}
+			case 8: // note off
+				if (!midiPedal)
+					recordNoteStop(data1, 1);
+				break;
+			case 0xB: // cc
+				if (data1 == 64) // sustain pedal
+				{
+					midiPedal = (data2 > 63);
+					if (!midiPedal)
+					{
+						recordNoteStopAll();
+					}
+				}
+				break;
+			case 0xC: // Program Change
+				instrList->select(data1);
+				pendingProgram.compare_exchange_strong(data1, -1);
+				break;
 		}
 	}
+	return count;
 }
 
 void midi_selectDevice(int id)
 {
+	if (midiReady)
+	{
+		midi_stopInput();
+	}
 
-	if (midiStream || id < 0)
+	if (midiStream)
 	{
 		Pm_Close(midiStream);
-		midiReady = 0;
+		midiStream = NULL;
 	}
+	midiReady = 0;
 	if (id >= 0)
 	{
-		Pm_OpenInput(&midiStream, id, 0, 32, 0, 0);
+		if (Pm_OpenInput(&midiStream, id, 0, 32, 0, 0) != pmNoError)
+		{
+			midiStream = NULL;
+			return;
+		}
 		Pm_SetFilter(midiStream, PM_FILT_ACTIVE | PM_FILT_SYSEX | PM_FILT_CLOCK);
 		midiReady = 1;
+		midi_startInput();
 	}
 }
 
 vector<string>* midi_refreshDevices()
 {
+	/* Pm_Terminate closes the stream */
+	if (midiReady)
+	{
+		midi_stopInput();
+		midiReady = 0;
+	}
+	midiStream = NULL;
+
 	Pm_Terminate();
 	Pm_Initialize();
 	int nbdevices = Pm_CountDevices();
@@ -117,4 +393,9 @@ vector<string>* midi_refreshDevices()
 void midiReceiveEnable(int enabled)
 {
 	midiReceive = enabled;
-}
\ No newline at end of file
+}
+
+void midi_exit()
+{
+	midi_selectDevice(-1);
+}
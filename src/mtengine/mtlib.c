@@ -5,9 +5,21 @@
 #include <xmmintrin.h>
 #include <float.h>
 #include <math.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 /* Current version of instrument/song formats */
 #define MUDTRACKER_VERSION 1
+/* Song format revision. 1 : raw cells and instruments, 2 : columnar patterns, see mt_savePatterns,
+	3 : channel count, 4 : 32 bit pattern count and 16 bit pattern sizes.
+	Songs are saved with the oldest revision able to store them (see mt_songVersion), for the previous versions */
+#define MUDTRACKER_SONG_VERSION 4
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -27,6 +39,31 @@
 #define max(a, b) ((a) > (b) ? (a) : (b))
 #define clamp(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
 
+/* Pattern storage, see mt_compactPatterns */
+static int mt_slabRebuild(mtsynth* mt, unsigned rows, unsigned stride);
+static int mt_reshapePatterns(mtsynth* mt, unsigned channels);
+static int mt_slabAllocPattern(mtsynth* mt, unsigned order, unsigned rows);
+static int mt_resizePatternTables(mtsynth* mt, unsigned count);
+static void mt_updatePatternStarts(mtsynth* mt, unsigned from);
+
+/* Playlists, see mt_queueSong */
+static void mt_playQueuedSong(mtsynth* mt, mtsynth* next);
+
+/* Samples rendered per step in mt_render. Must be a multiple of 16 (8 stereo frames per control step) so chunking doesn't change the output */
+#define MT_RENDER_CHUNK 1024
+
+/* MXCSR bits set while rendering : flush denormals to zero (FTZ) and treat denormal inputs as zero (DAZ) */
+#define MT_MXCSR_FTZ 0x8000
+#define MT_MXCSR_DAZ 0x0040
+#define MT_MXCSR_ROUND_DOWN 0x2000
+#define MT_MXCSR_ROUND_MASK 0x6000
+#ifdef _WIN32
+#define MT_MXCSR_RENDER (MT_MXCSR_FTZ | MT_MXCSR_DAZ | MT_MXCSR_ROUND_DOWN)
+#else
+#define MT_MXCSR_RENDER (MT_MXCSR_FTZ | MT_MXCSR_DAZ)
+#endif
+#define MT_MXCSR_MASK (MT_MXCSR_FTZ | MT_MXCSR_DAZ | MT_MXCSR_ROUND_MASK)
+
 /* Sine wave lookup table size */
 
 #define LUTsize 2048
@@ -41,6 +78,9 @@
 #define REVERB_ALLPASS2 1.5*1170 // 5.5
 #define REVERB_ALLPASS1 1.5*2508 // 7.7ms
 
+/* Biggest room size reachable from the UI and the 'S' effect. The reverb buffer is allocated once for it. */
+#define REVERB_MAX_ROOMSIZE 1.0
+
 
 static float wavetable[8][LUTsize];
 
@@ -109,18 +149,23 @@ float sqr(float x, float theta) { return 2 * atan(sin(2 * M_PI* x) / theta) / M_
 
 float swt(float x, float theta) { return (1 + trg((2 * x - 1) / 4, theta) * sqr(x / 2, theta)) / 2; }
 
+static void mt_setChannelDefaults(mtsynth* mt, unsigned ch)
+{
+	mt->ch[ch].note = 255;
+	mt->ch[ch].instrNumber = 255;
+	mt->ch[ch].vol = expVol[99];
+	mt->ch[ch].initial_vol = 99;
+	mt->ch[ch].reverbSend = 0;
+	mt->ch[ch].destPan = mt->ch[ch].pan = mt->ch[ch].initial_pan = 127;
+	mt->ch[ch].noteVol = 99;
+}
+
 void mt_setDefaults(mtsynth* mt)
 {
 
 	for (unsigned ch = 0; ch < FM_ch; ++ch)
 	{
-		mt->ch[ch].note = 255;
-		mt->ch[ch].instrNumber = 255;
-		mt->ch[ch].vol = expVol[99];
-		mt->ch[ch].initial_vol = 99;
-		mt->ch[ch].reverbSend = 0;
-		mt->ch[ch].destPan = mt->ch[ch].pan = mt->ch[ch].initial_pan = 127;
-		mt->ch[ch].noteVol = 99;
+		mt_setChannelDefaults(mt, ch);
 	}
 
 	mt_setVolume(mt, 60);
@@ -131,6 +176,7 @@ void mt_setDefaults(mtsynth* mt)
 	mt->looping = -1;
 	mt->channelStatesDone = 0;
 	mt->playbackVolume = 1;
+	mt->channelCount = FM_chDefault;
 }
 
 
@@ -144,14 +190,19 @@ int fast_rand(void)
 
 void mt_destroy(mtsynth* mt)
 {
+	mt_freeRetired(mt, 1);
+	free(mt->retired);
+	free(mt->retiredRenderCount);
 	free(mt->revBuf);
 	free(mt->instrument);
-	for (unsigned i = 0; i < mt->patternCount; i++)
-	{
-		free(mt->pattern[i]);
-		free(mt->channelStates[i]);
-	}
+	free(mt->cellSlab);
+	free(mt->rowSlab);
+	free(mt->stateSlab);
+	free(mt->mixSlab);
 	free(mt->patternSize);
+	free(mt->patternStart);
+	free(mt->patternOffset);
+	free(mt->patternCapacity);
 	free(mt->pattern);
 	free(mt->channelStates);
 	free(mt);
@@ -237,20 +288,28 @@ mtsynth* mt_create(int _sampleRate)
 	return mt;
 }
 
-int mt_initReverb(mtsynth *mt, float roomSize)
+/* Length of each reverb delay line for a given room size, in samples */
+static void mt_reverbDelays(mtsynth *mt, float roomSize, unsigned mods[6])
 {
-	/* Initialize reverb parameters and buffers */
-
-	mt->reverbPhaseL = mt->reverbPhaseL2 = mt->reverbPhaseR = mt->reverbPhaseR2 = mt->allpassPhaseL = mt->allpassPhaseR = mt->allpassPhaseL2 = mt->allpassPhaseR2 = 0;
+	mods[0] = roomSize*REVERB_DELAY_L1 / mt->sampleRateRatio; // 85ms
+	mods[1] = roomSize*REVERB_DELAY_L2 / mt->sampleRateRatio; // 72
+	mods[2] = roomSize*REVERB_DELAY_R1 / mt->sampleRateRatio; // 79
+	mods[3] = roomSize*REVERB_DELAY_R2 / mt->sampleRateRatio; // 69
+	mods[4] = (roomSize*REVERB_ALLPASS1) / mt->sampleRateRatio; // 5.5
+	mods[5] = (roomSize*REVERB_ALLPASS2) / mt->sampleRateRatio; // 7.7ms
+
+	for (unsigned i = 0; i < 6; i++)
+		mods[i] = max(1, mods[i]);
+}
 
-	unsigned mod1 = roomSize*REVERB_DELAY_L1 / mt->sampleRateRatio; // 85ms
-	unsigned mod2 = roomSize* REVERB_DELAY_L2 / mt->sampleRateRatio; // 72 
-	unsigned mod3 = roomSize*REVERB_DELAY_R1 / mt->sampleRateRatio; // 79
-	unsigned mod4 = roomSize*REVERB_DELAY_R2 / mt->sampleRateRatio; // 69
-	unsigned mod5 = (roomSize*REVERB_ALLPASS1) / mt->sampleRateRatio; // 5.5
-	unsigned mod6 = (roomSize*REVERB_ALLPASS2) / mt->sampleRateRatio; // 7.7ms
+/* Allocate the reverb buffer for the biggest room size. Each delay line gets a fixed partition of it,
+so room size changes never need to reallocate or clear it. Only called on sample rate changes. */
+static int mt_allocReverb(mtsynth *mt)
+{
+	unsigned mods[6];
+	mt_reverbDelays(mt, REVERB_MAX_ROOMSIZE, mods);
 
-	unsigned revBufSize = mod1 + mod2 + mod3 + mod4 + 2 * (mod5 + mod6);
+	unsigned revBufSize = mods[0] + mods[1] + mods[2] + mods[3] + 2 * (mods[4] + mods[5]);
 
 	float* newR = realloc(mt->revBuf, sizeof(float)*revBufSize);
 
@@ -259,27 +318,56 @@ int mt_initReverb(mtsynth *mt, float roomSize)
 		return 0;
 	}
 
-	mt->reverbRoomSize = roomSize;
 	mt->revBufSize = revBufSize;
 	mt->revBuf = newR;
 
 	memset(mt->revBuf, 0, sizeof(float)*revBufSize);
 
+	mt->revOffset1 = mods[0];
+	mt->revOffset2 = mt->revOffset1 + mods[1];
+	mt->revOffset3 = mt->revOffset2 + mods[2];
+	mt->revOffset4 = mt->revOffset3 + mods[3];
+	mt->revOffset5 = mt->revOffset4 + mods[4];
+	mt->revOffset6 = mt->revOffset5 + mods[4];
+	mt->revOffset7 = mt->revOffset6 + mods[5];
+
+	mt->reverbPhaseL = mt->reverbPhaseL2 = mt->reverbPhaseR = mt->reverbPhaseR2 = mt->allpassPhaseL = mt->allpassPhaseR = mt->allpassPhaseL2 = mt->allpassPhaseR2 = 0;
+	return 1;
+}
+
+int mt_initReverb(mtsynth *mt, float roomSize)
+{
+	/* Shorten/lengthen the delay lines inside their preallocated partitions. O(1) and allocation free, so
+	it can be used from the audio thread ('S' effect). The lines keep their content, so there is no cut in the reverb tail. */
+
+	if (!mt->revBuf)
+	{
+		return 0;
+	}
+
+	roomSize = clamp(roomSize, 0, REVERB_MAX_ROOMSIZE);
 
+	unsigned mods[6];
+	mt_reverbDelays(mt, roomSize, mods);
 
-	mt->reverbMod1 = mod1;
-	mt->reverbMod2 = mod2;
-	mt->reverbMod3 = mod3;
-	mt->reverbMod4 = mod4;
-	mt->allpassMod = mod5;
-	mt->allpassMod2 = mod6;
+	mt->reverbRoomSize = roomSize;
 
-	mt->revOffset2 = mt->reverbMod1 + mt->reverbMod2;
-	mt->revOffset3 = mt->revOffset2 + mt->reverbMod3;
-	mt->revOffset4 = mt->revOffset3 + mt->reverbMod4;
-	mt->revOffset5 = mt->revOffset4 + mt->allpassMod;
-	mt->revOffset6 = mt->revOffset5 + mt->allpassMod;
-	mt->revOffset7 = mt->revOffset6 + mt->allpassMod2;
+	mt->reverbMod1 = mods[0];
+	mt->reverbMod2 = mods[1];
+	mt->reverbMod3 = mods[2];
+	mt->reverbMod4 = mods[3];
+	mt->allpassMod = mods[4];
+	mt->allpassMod2 = mods[5];
+
+	/* Keep the read/write positions inside the new line lengths */
+	mt->reverbPhaseL %= mt->reverbMod1;
+	mt->reverbPhaseL2 %= mt->reverbMod2;
+	mt->reverbPhaseR %= mt->reverbMod3;
+	mt->reverbPhaseR2 %= mt->reverbMod4;
+	mt->allpassPhaseL %= mt->allpassMod;
+	mt->allpassPhaseR %= mt->allpassMod;
+	mt->allpassPhaseL2 %= mt->allpassMod2;
+	mt->allpassPhaseR2 %= mt->allpassMod2;
 	return 1;
 }
 
@@ -299,6 +387,9 @@ int mt_setSampleRate(mtsynth* mt, int sampleRate)
 	for (unsigned ch = 0; ch < FM_ch; ++ch)
 		mt->ch[ch].cInstr = 0;
 
+	if (!mt_allocReverb(mt))
+		return 0;
+
 	return mt_initReverb(mt, mt->initialReverbRoomSize);
 }
 
@@ -354,9 +445,11 @@ void mt_initChannels(mtsynth* mt)
 
 	for (unsigned ch = 0; ch < FM_ch; ++ch)
 	{
+		/* The states only hold the channels of the song */
+		ChannelState* state = &mt->channelStates[mt->order][mt->row];
 		mt->ch[ch].cInstr = 0;
-		mt->ch[ch].pan = mt->ch[ch].destPan = mt->channelStates[mt->order][mt->row].pan[ch];
-		mt->ch[ch].vol = expVol[mt->channelStates[mt->order][mt->row].vol[ch]];
+		mt->ch[ch].pan = mt->ch[ch].destPan = ch < mt->channelCount ? state->pan[ch] : mt->ch[ch].initial_pan;
+		mt->ch[ch].vol = expVol[ch < mt->channelCount ? state->vol[ch] : mt->ch[ch].initial_vol];
 		mt->ch[ch].reverbSend = expVol[mt->ch[ch].initial_reverb];
 		mt->ch[ch].pitchBend = 1;
 		mt->ch[ch].fadeFrom=0;
@@ -368,6 +461,131 @@ void mt_initChannels(mtsynth* mt)
 
 
 
+/* Synthesizes one sample of an active channel, before panning */
+static float mt_renderChannel(mtsynth* mt, unsigned ch)
+{
+	/* FM calculations, unrolled to be sure the compiler doesn't generate a loop */
+
+	mt->ch[ch].op[0].phase += mt->ch[ch].op[0].pitch;
+	mt->ch[ch].op[0].amp += mt->ch[ch].op[0].ampDelta;
+	mt->ch[ch].op[0].out = mt->ch[ch].op[0].waveform[((mt->ch[ch].op[0].phase >> 10) + (unsigned)*mt->ch[ch].op[0].connect + (unsigned)*mt->ch[ch].op[0].connect2 + (unsigned)(*mt->ch[ch].feedbackSource*mt->ch[ch].feedbackLevel)) % LUTsize] * mt->ch[ch].op[0].amp;
+
+
+	mt->ch[ch].op[1].phase += mt->ch[ch].op[1].pitch;
+	mt->ch[ch].op[1].amp += mt->ch[ch].op[1].ampDelta;
+	mt->ch[ch].op[1].out = mt->ch[ch].op[1].waveform[((mt->ch[ch].op[1].phase >> 10) + (unsigned)*mt->ch[ch].op[1].connect + (unsigned)*mt->ch[ch].op[1].connect2) % LUTsize] * mt->ch[ch].op[1].amp;
+
+
+	mt->ch[ch].op[2].phase += mt->ch[ch].op[2].pitch;
+	mt->ch[ch].op[2].amp += mt->ch[ch].op[2].ampDelta;
+	mt->ch[ch].op[2].out = mt->ch[ch].op[2].waveform[((mt->ch[ch].op[2].phase >> 10) + (unsigned)*mt->ch[ch].op[2].connect + (unsigned)*mt->ch[ch].op[2].connect2) % LUTsize] * mt->ch[ch].op[2].amp;
+
+
+	mt->ch[ch].op[3].phase += mt->ch[ch].op[3].pitch;
+	mt->ch[ch].op[3].amp += mt->ch[ch].op[3].ampDelta;
+	mt->ch[ch].op[3].out = mt->ch[ch].op[3].waveform[((mt->ch[ch].op[3].phase >> 10) + (unsigned)*mt->ch[ch].op[3].connect + (unsigned)*mt->ch[ch].op[3].connect2) % LUTsize] * mt->ch[ch].op[3].amp;
+
+
+	mt->ch[ch].op[4].phase += mt->ch[ch].op[4].pitch;
+	mt->ch[ch].op[4].amp += mt->ch[ch].op[4].ampDelta;
+	mt->ch[ch].op[4].out = mt->ch[ch].op[4].waveform[((mt->ch[ch].op[4].phase >> 10) + (unsigned)*mt->ch[ch].op[4].connect + (unsigned)*mt->ch[ch].op[4].connect2) % LUTsize] * mt->ch[ch].op[4].amp;
+
+
+	mt->ch[ch].op[5].phase += mt->ch[ch].op[5].pitch;
+	mt->ch[ch].op[5].amp += mt->ch[ch].op[5].ampDelta;
+	mt->ch[ch].op[5].out = mt->ch[ch].op[5].waveform[((mt->ch[ch].op[5].phase >> 10) + (unsigned)*mt->ch[ch].op[5].connect + (unsigned)*mt->ch[ch].op[5].connect2) % LUTsize] * mt->ch[ch].op[5].amp;
+
+
+	mt->ch[ch].mixer = *mt->ch[ch].op[0].toMix + *mt->ch[ch].op[1].toMix + *mt->ch[ch].op[2].toMix + *mt->ch[ch].op[3].toMix;
+
+	float rendu = (*mt->ch[ch].op[0].connectOut + *mt->ch[ch].op[1].connectOut + *mt->ch[ch].op[2].connectOut + *mt->ch[ch].op[3].connectOut + *mt->ch[ch].op[4].connectOut + *mt->ch[ch].op[5].connectOut)*mt->ch[ch].vol*mt->ch[ch].instrVol;
+
+	mt->ch[ch].lastRender2 = mt->ch[ch].lastRender;
+	mt->ch[ch].lastRender = rendu;
+
+	/* Is a smooth transition needed between two notes ? */
+
+	if (mt->ch[ch].fade > 0.00001)
+	{
+		rendu = rendu*(1 - mt->ch[ch].fade) + mt->ch[ch].fadeFrom*mt->ch[ch].fade;
+		mt->ch[ch].fadeFrom += mt->ch[ch].delta*mt->ch[ch].fade;
+		mt->ch[ch].fade *= mt->ch[ch].fadeIncr;
+	}
+
+	return rendu;
+}
+
+/* Output of a channel with a freeze : records the synthesized sample, or plays the frozen one back.
+	Returns 0 if the channel is silent */
+static int mt_freezeSample(mtsynth* mt, unsigned ch, float* rendu)
+{
+	mtFreeze *f = mt->ch[ch].freeze;
+
+	if (f->recording)
+	{
+		*rendu = mt->ch[ch].active && !mt->ch[ch].muted ? mt_renderChannel(mt, ch) : 0;
+		if (f->length < f->capacity)
+			f->record[f->length++] = *rendu;
+		return 1;
+	}
+
+	if (mt->ch[ch].muted)
+		return 0;
+
+	/* Notes played outside of the song, or the song changed since the freeze : synthesize */
+	if (!mt->playing || f->stale)
+	{
+		if (!mt->ch[ch].active)
+			return 0;
+		*rendu = mt_renderChannel(mt, ch);
+		return 1;
+	}
+
+	*rendu = 0;
+	if (f->position < f->length)
+	{
+		short *block = f->blocks[f->position >> MT_FREEZE_BLOCK_BITS];
+		if (block)
+			*rendu = block[f->position & (MT_FREEZE_BLOCK - 1)] * f->scale;
+		f->position++;
+	}
+	mt->ch[ch].lastRender2 = mt->ch[ch].lastRender;
+	mt->ch[ch].lastRender = *rendu;
+	return 1;
+}
+
+/* Called on each row tick : records where the row starts in the frozen channels, or seeks to it for playback.
+	A row played at another tempo than when it was recorded (tempo effects edited in other channels, tempo changed
+	by hand) makes the freeze stale : the channel is synthesized again until it is frozen again */
+static void mt_freezeRows(mtsynth* mt)
+{
+	unsigned row = mt->patternStart[mt->order] + mt->row;
+
+	for (unsigned ch = 0; ch < mt->channelCount; ++ch)
+	{
+		mtFreeze *f = mt->ch[ch].freeze;
+		if (!f)
+			continue;
+
+		if (f->recording)
+		{
+			if (row < f->rows && f->rowOffset[row] == MT_FREEZE_NOROW)
+			{
+				f->rowOffset[row] = f->length;
+				f->rowTempo[row] = mt->tempo;
+			}
+		}
+		else if (row >= f->rows || f->rowOffset[row] == MT_FREEZE_NOROW || f->rowTempo[row] != mt->tempo || f->sampleRate != mt->sampleRate)
+		{
+			f->stale = 1;
+		}
+		else
+		{
+			f->position = f->rowOffset[row];
+		}
+	}
+}
+
 void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 {
 
@@ -381,7 +599,7 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 			if (mt->frameTimer == 0)
 			{
 
-				for (unsigned ch = 0; ch < FM_ch; ++ch)
+				for (unsigned ch = 0; ch < mt->channelCount; ++ch)
 				{
 					Cell* row = &mt->pattern[mt->order][mt->row][ch];
 					mt->ch[ch].fxActive = 0;
@@ -627,12 +845,16 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 					}
 
 				}
+
+				/* Frozen channels follow the song position */
+				mt_freezeRows(mt);
 			}
 			mt->frameTimer += 8;
 			if (mt->frameTimer >= (60.0 / mt->diviseur) * mt->sampleRate / mt->tempo)
 			{
 
 				mt->frameTimer = 0;
+				unsigned char loopCount = mt->loopCount;
 
 				if (++mt->row >= mt->patternSize[mt->order])
 				{ // jump to next pattern
@@ -659,9 +881,19 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 					mt->order = 0;
 				}
 
-				if (mt->looping != -1 && mt->loopCount > mt->looping)
+				/* End of the song, or of one of its loops */
+				if (mt->loopCount != loopCount)
 				{
-					mt->playing = 0;
+					mtsynth *next = mt->queuedSong;
+
+					if (next && (mt->looping == -1 || mt->loopCount > mt->looping))
+					{
+						mt_playQueuedSong(mt, next);
+					}
+					else if (mt->looping != -1 && mt->loopCount > mt->looping)
+					{
+						mt->playing = 0;
+					}
 				}
 
 			}
@@ -669,7 +901,7 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 			if (mt->frameTimerFx >= 0.005*(60.0 / mt->diviseur) * mt->sampleRate / mt->tempo)
 			{
 
-				for (unsigned ch = 0; ch < FM_ch; ++ch)
+				for (unsigned ch = 0; ch < mt->channelCount; ++ch)
 				{
 					switch (mt->ch[ch].fxActive)
 					{
@@ -758,7 +990,7 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 		}
 
 
-		for (unsigned ch = 0; ch < FM_ch; ++ch)
+		for (unsigned ch = 0; ch < mt->channelCount; ++ch)
 		{
 			if (!mt->ch[ch].active)
 				continue;
@@ -914,57 +1146,19 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 		{
 			float rendu = 0, renduL = 0, renduR = 0, fxL = 0, fxR = 0;
 
-			for (unsigned ch = 0; ch < FM_ch; ++ch)
+			for (unsigned ch = 0; ch < mt->channelCount; ++ch)
 			{
-				if (!mt->ch[ch].active || mt->ch[ch].muted)
-					continue;
-
-				/* FM calculations, unrolled to be sure the compiler doesn't generate a loop */
-
-				mt->ch[ch].op[0].phase += mt->ch[ch].op[0].pitch;
-				mt->ch[ch].op[0].amp += mt->ch[ch].op[0].ampDelta;
-				mt->ch[ch].op[0].out = mt->ch[ch].op[0].waveform[((mt->ch[ch].op[0].phase >> 10) + (unsigned)*mt->ch[ch].op[0].connect + (unsigned)*mt->ch[ch].op[0].connect2 + (unsigned)(*mt->ch[ch].feedbackSource*mt->ch[ch].feedbackLevel)) % LUTsize] * mt->ch[ch].op[0].amp;
-
-
-				mt->ch[ch].op[1].phase += mt->ch[ch].op[1].pitch;
-				mt->ch[ch].op[1].amp += mt->ch[ch].op[1].ampDelta;
-				mt->ch[ch].op[1].out = mt->ch[ch].op[1].waveform[((mt->ch[ch].op[1].phase >> 10) + (unsigned)*mt->ch[ch].op[1].connect + (unsigned)*mt->ch[ch].op[1].connect2) % LUTsize] * mt->ch[ch].op[1].amp;
-
-
-				mt->ch[ch].op[2].phase += mt->ch[ch].op[2].pitch;
-				mt->ch[ch].op[2].amp += mt->ch[ch].op[2].ampDelta;
-				mt->ch[ch].op[2].out = mt->ch[ch].op[2].waveform[((mt->ch[ch].op[2].phase >> 10) + (unsigned)*mt->ch[ch].op[2].connect + (unsigned)*mt->ch[ch].op[2].connect2) % LUTsize] * mt->ch[ch].op[2].amp;
-
-
-				mt->ch[ch].op[3].phase += mt->ch[ch].op[3].pitch;
-				mt->ch[ch].op[3].amp += mt->ch[ch].op[3].ampDelta;
-				mt->ch[ch].op[3].out = mt->ch[ch].op[3].waveform[((mt->ch[ch].op[3].phase >> 10) + (unsigned)*mt->ch[ch].op[3].connect + (unsigned)*mt->ch[ch].op[3].connect2) % LUTsize] * mt->ch[ch].op[3].amp;
-
-
-				mt->ch[ch].op[4].phase += mt->ch[ch].op[4].pitch;
-				mt->ch[ch].op[4].amp += mt->ch[ch].op[4].ampDelta;
-				mt->ch[ch].op[4].out = mt->ch[ch].op[4].waveform[((mt->ch[ch].op[4].phase >> 10) + (unsigned)*mt->ch[ch].op[4].connect + (unsigned)*mt->ch[ch].op[4].connect2) % LUTsize] * mt->ch[ch].op[4].amp;
-
-
-				mt->ch[ch].op[5].phase += mt->ch[ch].op[5].pitch;
-				mt->ch[ch].op[5].amp += mt->ch[ch].op[5].ampDelta;
-				mt->ch[ch].op[5].out = mt->ch[ch].op[5].waveform[((mt->ch[ch].op[5].phase >> 10) + (unsigned)*mt->ch[ch].op[5].connect + (unsigned)*mt->ch[ch].op[5].connect2) % LUTsize] * mt->ch[ch].op[5].amp;
-
-
-				mt->ch[ch].mixer = *mt->ch[ch].op[0].toMix + *mt->ch[ch].op[1].toMix + *mt->ch[ch].op[2].toMix + *mt->ch[ch].op[3].toMix;
-
-				rendu = (*mt->ch[ch].op[0].connectOut + *mt->ch[ch].op[1].connectOut + *mt->ch[ch].op[2].connectOut + *mt->ch[ch].op[3].connectOut + *mt->ch[ch].op[4].connectOut + *mt->ch[ch].op[5].connectOut)*mt->ch[ch].vol*mt->ch[ch].instrVol;
-
-				mt->ch[ch].lastRender2 = mt->ch[ch].lastRender;
-				mt->ch[ch].lastRender = rendu;
-
-				/* Is a smooth transition needed between two notes ? */
-
-				if (mt->ch[ch].fade > 0.00001)
+				if (mt->ch[ch].freeze)
+				{
+					if (!mt_freezeSample(mt, ch, &rendu))
+						continue;
+				}
+				else
 				{
-					rendu = rendu*(1 - mt->ch[ch].fade) + mt->ch[ch].fadeFrom*mt->ch[ch].fade;
-					mt->ch[ch].fadeFrom += mt->ch[ch].delta*mt->ch[ch].fade;
-					mt->ch[ch].fade *= mt->ch[ch].fadeIncr;
+					if (!mt->ch[ch].active || mt->ch[ch].muted)
+						continue;
+
+					rendu = mt_renderChannel(mt, ch);
 				}
 
 				float trenduL = rendu*wavetable[0][LUTsize / 4 + (unsigned)mt->ch[ch].pan*LUTratio];
@@ -990,9 +1184,9 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 
 			/* Two comb filters, left */
 
-			mt->outL = ((mt->revBuf[mt->reverbPhaseL] + mt->revBuf[mt->reverbMod1 + mt->reverbPhaseL2]))*0.5;
+			mt->outL = ((mt->revBuf[mt->reverbPhaseL] + mt->revBuf[mt->revOffset1 + mt->reverbPhaseL2]))*0.5;
 			mt->revBuf[mt->reverbPhaseL] =  fxR + (mt->revBuf[mt->reverbPhaseL] + mt->revBuf[prevPhaseL])*0.5*mt->reverbLength;
-			mt->revBuf[mt->reverbMod1 + mt->reverbPhaseL2] =fxL + (mt->revBuf[mt->reverbMod1 + mt->reverbPhaseL2] + mt->revBuf[mt->reverbMod1 + prevPhaseL2])*0.5*mt->reverbLength;
+			mt->revBuf[mt->revOffset1 + mt->reverbPhaseL2] =fxL + (mt->revBuf[mt->revOffset1 + mt->reverbPhaseL2] + mt->revBuf[mt->revOffset1 + prevPhaseL2])*0.5*mt->reverbLength;
 
 			/* Two comb filters, right */
 
@@ -1033,7 +1227,7 @@ void _mt_render(mtsynth* mt, float* buffer, unsigned length)
 
 void mt_playNote(mtsynth* mt, unsigned _instrument, unsigned note, unsigned ch, unsigned volume)
 {
-	if (ch >= FM_ch || _instrument == 255 && !mt->ch[ch].instr || _instrument != 255 && _instrument >= mt->instrumentCount)
+	if (ch >= mt->channelCount || _instrument == 255 && !mt->ch[ch].instr || _instrument != 255 && _instrument >= mt->instrumentCount)
 		return;
 
 	/* Instrument changed, update parameters */
@@ -1167,22 +1361,29 @@ void mt_buildStateTable(mtsynth* mt, unsigned orderStart, unsigned orderEnd, uns
 
 	orderStart = clamp(orderStart, 0, mt->patternCount);
 	orderEnd = clamp(orderEnd, 0, mt->patternCount);
-	channelStart = clamp(channelStart, 0, FM_ch);
-	channelEnd = clamp(channelEnd, 0, FM_ch);
+	channelStart = clamp(channelStart, 0, mt->channelCount);
+	channelEnd = clamp(channelEnd, 0, mt->channelCount);
 
 
+	/* Summed in double : adding float row durations drifts by seconds over long songs */
+	double time = 0;
+
 	for (int order = orderStart; order < orderEnd; order++)
 	{
 
 		if (order == 0)
 		{
-			for (unsigned ch = 0; ch < FM_ch; ch++)
+			for (unsigned ch = 0; ch < mt->channelCount; ch++)
 			{
 				mt->channelStates[order][0].pan[ch] = mt->ch[ch].initial_pan;
 				mt->channelStates[order][0].vol[ch] = mt->ch[ch].initial_vol;
 			}
 			mt->channelStates[order][0].tempo = mt->initial_tempo;
-			mt->channelStates[order][0].time = 0;
+			mt->channelStates[order][0].time = time = 0;
+		}
+		else if (order == orderStart)
+		{
+			time = mt->channelStates[order - 1][mt->patternSize[order - 1] - 1].time;
 		}
 		for (int j = 0; j < mt->patternSize[order]; j++)
 		{
@@ -1191,12 +1392,14 @@ void mt_buildStateTable(mtsynth* mt, unsigned orderStart, unsigned orderEnd, uns
 			if (j>0)
 			{
 				mt->channelStates[order][j].tempo = mt->channelStates[order][j - 1].tempo;
-				mt->channelStates[order][j].time = mt->channelStates[order][j - 1].time + 60.f / (mt->channelStates[order][j].tempo*mt->diviseur);
+				time += 60.0 / (mt->channelStates[order][j].tempo*mt->diviseur);
+				mt->channelStates[order][j].time = time;
 			}
 			else if (order > 0)
 			{
 				mt->channelStates[order][j].tempo = mt->channelStates[order - 1][mt->patternSize[order - 1] - 1].tempo;
-				mt->channelStates[order][j].time = mt->channelStates[order - 1][mt->patternSize[order - 1] - 1].time + 60.f / (mt->channelStates[order][j].tempo*mt->diviseur);
+				time += 60.0 / (mt->channelStates[order][j].tempo*mt->diviseur);
+				mt->channelStates[order][j].time = time;
 			}
 			for (unsigned ch = channelStart; ch< channelEnd; ch++)
 			{
@@ -1232,21 +1435,14 @@ void mt_buildStateTable(mtsynth* mt, unsigned orderStart, unsigned orderEnd, uns
 
 
 
-void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
+/* Converts rendered float samples to the requested output format, at sample position 'offset' of the output buffer */
+static void mt_convertRender(const float* rendered, void* buffer, unsigned offset, unsigned length, unsigned type)
 {
-
-	float *rendered = malloc(4*length); // float = 4bytes
-
-	if (!rendered)
-		return;
-
-	_mt_render(mt, (float*)rendered, length);
-
 	switch (type%64)
 	{
 		case MT_RENDER_FLOAT:
 		{
-			float *buf_f = buffer;
+			float *buf_f = (float*)buffer + offset;
 			for (unsigned i = 0; i < length; i++)
 			{
 				buf_f[i] = clamp(rendered[i]/32768,-1.0,1.0);
@@ -1257,7 +1453,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 		{
 			if(type & MT_RENDER_PAD32)
 			{
-				int *buf_32 = buffer;
+				int *buf_32 = (int*)buffer + offset;
 				for (unsigned i = 0; i < length; i++)
 				{
 					buf_32[i] = (clamp((signed char)(rendered[i]/256), -128,127));
@@ -1265,7 +1461,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 			}
 			else
 			{
-				unsigned char *buf_8 = buffer;
+				unsigned char *buf_8 = (unsigned char*)buffer + offset;
 				for (unsigned i = 0; i < length; i++)
 				{
 					buf_8[i] = clamp(128+rendered[i]/256, 0,255);
@@ -1277,7 +1473,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 		case MT_RENDER_16:{
 			if(type & MT_RENDER_PAD32)
 			{
-				int *buf_32 = buffer;
+				int *buf_32 = (int*)buffer + offset;
 				for (unsigned i = 0; i < length; i++)
 				{
 					buf_32[i] = clamp(rendered[i], -32768,32767);
@@ -1285,7 +1481,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 			}
 			else
 			{
-				signed short *buf_16 = buffer;
+				signed short *buf_16 = (signed short*)buffer + offset;
 				for (unsigned i = 0; i < length; i++)
 				{
 					buf_16[i] = clamp(rendered[i], -32768,32767);
@@ -1300,6 +1496,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 
 			if(type & MT_RENDER_PAD32)
 			{
+				buf_24 += offset*4;
 				for (unsigned i = 0; i < length; i++)
 				{
 					int val = clamp(rendered[i]*256, -8388608,8388607);
@@ -1316,6 +1513,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 			}
 			else
 			{
+				buf_24 += offset*3;
 				for (unsigned i = 0; i < length; i++)
 				{
 					int val = clamp(rendered[i]*256, -8388608,8388607);
@@ -1330,7 +1528,7 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 		}
 		case MT_RENDER_32:
 		{
-			int *buf_32 = buffer;
+			int *buf_32 = (int*)buffer + offset;
 			for (unsigned i = 0; i < length; i++)
 			{
 				buf_32[i] = (signed int)clamp(((double)rendered[i]*256*256),-2147483648.f,2147483647.f);
@@ -1338,8 +1536,42 @@ void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
 			break;
 		}
 	}
+}
+
+/* Sets the floating point environment of the render, returns the previous one for mt_restoreFpEnv.
+	The render thread is usually not the one that created the synth (audio callbacks, freeze workers), so it has
+	to be set on every call. Restored on exit for library users. */
+static unsigned mt_setRenderFpEnv(void)
+{
+	unsigned int csr = _mm_getcsr();
+	_mm_setcsr((csr & ~MT_MXCSR_MASK) | MT_MXCSR_RENDER);
+	return csr;
+}
+
+static void mt_restoreFpEnv(unsigned csr)
+{
+	_mm_setcsr(csr);
+}
+
+void mt_render(mtsynth* mt, void* buffer, unsigned length, unsigned type)
+{
+	unsigned csr = mt_setRenderFpEnv();
+
+	/* Render through a stack buffer to avoid any allocation in the audio thread */
+	float rendered[MT_RENDER_CHUNK];
+
+	/* Memory retired before this call can't be read anymore once it returns */
+	mt->renderCount++;
+
+	for (unsigned offset = 0; offset < length; offset += MT_RENDER_CHUNK)
+	{
+		unsigned count = min(MT_RENDER_CHUNK, length - offset);
+
+		_mt_render(mt, rendered, count);
+		mt_convertRender(rendered, buffer, offset, count, type);
+	}
 
-	free(rendered);
+	mt_restoreFpEnv(csr);
 }
 
 void mt_stopNote(mtsynth* mt, unsigned ch)
@@ -1366,20 +1598,26 @@ void mt_stopNote(mtsynth* mt, unsigned ch)
 
 }
 
+/* Silences a channel at once */
+static void mt_cutChannel(mtsynth* mt, unsigned ch)
+{
+	mt->ch[ch].active = 0;
+	mt->ch[ch].lastRender = mt->ch[ch].lastRender2 = 0;
+	mt->ch[ch].note = 255;
+	mt->ch[ch].cInstr = 0;
+	mt->ch[ch].instrNumber = 255;
+	mt->ch[ch].currentEnvLevel = 0;
+	for (unsigned op = 0; op < FM_op; ++op)
+	{
+		mt->ch[ch].op[op].state = mt->ch[ch].op[op].env = mt->ch[ch].op[op].amp = 0;
+	}
+}
+
 void mt_stopSound(mtsynth* mt)
 {
 	for (unsigned ch = 0; ch < FM_ch; ++ch)
 	{
-		mt->ch[ch].active = 0;
-		mt->ch[ch].lastRender = mt->ch[ch].lastRender2 = 0;
-		mt->ch[ch].note = 255;
-		mt->ch[ch].cInstr = 0;
-		mt->ch[ch].instrNumber = 255;
-		mt->ch[ch].currentEnvLevel = 0;
-		for (unsigned op = 0; op < FM_op; ++op)
-		{
-			mt->ch[ch].op[op].state = mt->ch[ch].op[op].env = mt->ch[ch].op[op].amp = 0;
-		}
+		mt_cutChannel(mt, ch);
 	}
 	memset(mt->revBuf, 0, mt->revBufSize*sizeof(float));
 }
@@ -1432,146 +1670,410 @@ void mt_setPosition(mtsynth* mt, int order, int row, int cutNotes)
 
 #include <stdint.h>
 
-static uint32_t adler32(const void *buf, size_t buflength)
+/* Largest block for which the Adler-32 sums can't overflow 32 bits before the modulo (same as zlib) */
+#define ADLER_BLOCK 5552
+
+static void adler32Update(uint32_t *a, uint32_t *b, const void *buf, size_t buflength)
 {
 	const uint8_t *buffer = (const uint8_t*)buf;
+	uint32_t s1 = *a, s2 = *b;
 
-	uint32_t s1 = 1;
-	uint32_t s2 = 0;
-
-	for (size_t n = 0; n < buflength; n++)
+	while (buflength > 0)
 	{
-		s1 = (s1 + buffer[n]) % 65521;
-		s2 = (s2 + s1) % 65521;
+		size_t block = min(buflength, ADLER_BLOCK);
+		buflength -= block;
+
+		while (block >= 8)
+		{
+			s1 += buffer[0]; s2 += s1;
+			s1 += buffer[1]; s2 += s1;
+			s1 += buffer[2]; s2 += s1;
+			s1 += buffer[3]; s2 += s1;
+			s1 += buffer[4]; s2 += s1;
+			s1 += buffer[5]; s2 += s1;
+			s1 += buffer[6]; s2 += s1;
+			s1 += buffer[7]; s2 += s1;
+			buffer += 8;
+			block -= 8;
+		}
+		while (block--)
+		{
+			s1 += *buffer++;
+			s2 += s1;
+		}
+		s1 %= 65521;
+		s2 %= 65521;
 	}
-	return (s2 << 16) | s1;
+	*a = s1;
+	*b = s2;
 }
 
-int mt_saveSong(mtsynth* mt, const char* filename)
+static uint32_t adler32(const void *buf, size_t buflength)
 {
-	FILE *fp = fopen(filename, "wb+");
-	if (!fp)
-	{
-		return 0;
-	}
-	fputc('M', fp);
-	fputc('D', fp);
-	fputc('T', fp);
-	fputc('S', fp);
-	fputc(0x00, fp); // unused byte
-	fputc(MUDTRACKER_VERSION, fp); // version
-	unsigned char temp = strlen(&mt->songName[0]);
-	fwrite(&temp, sizeof(temp), 1, fp);
-	fwrite(&mt->songName[0], temp, 1, fp);
-
-	temp = strlen(&mt->author[0]);
-	fwrite(&temp, sizeof(temp), 1, fp);
-	fwrite(&mt->author[0], temp, 1, fp);
+	uint32_t s1 = 1;
+	uint32_t s2 = 0;
 
-	temp = strlen(&mt->comments[0]);
-	fwrite(&temp, sizeof(temp), 1, fp);
-	fwrite(&mt->comments[0], temp, 1, fp);
+	adler32Update(&s1, &s2, buf, buflength);
+	return (s2 << 16) | s1;
+}
 
-	fwrite(&mt->initial_tempo, sizeof(mt->initial_tempo), 1, fp); // tempo
-	fwrite(&mt->diviseur, sizeof(mt->diviseur), 1, fp); // quarter note
-	fwrite(&mt->_globalVolume, sizeof(mt->_globalVolume), 1, fp);
-	fwrite(&mt->transpose, sizeof(mt->transpose), 1, fp);
+/* Buffered file writer, keeping the Adler-32 of everything written so far */
 
-	temp = round(mt->initialReverbLength * 160);
-	fwrite(&temp, sizeof(temp), 1, fp);
+#define MT_WRITER_BUFFER 65536
 
-	temp = round(mt->initialReverbRoomSize * 160);
-	fwrite(&temp, sizeof(temp), 1, fp);
+typedef struct mtWriter{
+	FILE *fp;
+	unsigned char *buffer;
+	unsigned used;
+	uint32_t s1, s2;
+	int failed;
+}mtWriter;
 
-	for (unsigned ch = 0; ch < FM_ch; ++ch)
+static int mt_writerOpen(mtWriter *w, const char *filename)
+{
+	w->buffer = malloc(MT_WRITER_BUFFER);
+	w->fp = w->buffer ? fopen(filename, "wb") : 0;
+	w->used = 0;
+	w->s1 = 1;
+	w->s2 = 0;
+	w->failed = 0;
+
+	if (!w->fp)
 	{
-		fwrite(&mt->ch[ch].initial_pan, sizeof(mt->ch[ch].initial_pan), 1, fp); // ch panning
-		fwrite(&mt->ch[ch].initial_vol, sizeof(mt->ch[ch].initial_vol), 1, fp); // ch volume
-		fwrite(&mt->ch[ch].initial_reverb, sizeof(mt->ch[ch].initial_reverb), 1, fp); // ch volume
+		free(w->buffer);
+		return 0;
 	}
+	return 1;
+}
 
-	temp = mt->patternCount;
-
-	fwrite(&temp, sizeof(temp), 1, fp);
-	for (unsigned i = 0; i < mt->patternCount; i++)
-	{
-		temp = mt->patternSize[i];
-		fwrite(&temp, sizeof(temp), 1, fp);
-		fwrite((char*)&mt->pattern[i][0], sizeof(Cell)*mt->patternSize[i] * FM_ch, 1, fp);
-	}
-	fwrite(&mt->instrumentCount, 1, 1, fp);
+static void mt_writerFlush(mtWriter *w)
+{
+	adler32Update(&w->s1, &w->s2, w->buffer, w->used);
+	if (w->used > 0 && fwrite(w->buffer, w->used, 1, w->fp) != 1)
+		w->failed = 1;
+	w->used = 0;
+}
 
+static void mt_writerWrite(mtWriter *w, const void *data, unsigned len)
+{
+	const unsigned char *src = (const unsigned char*)data;
 
-	for (int slot = 0; slot < mt->instrumentCount; slot++)
+	while (len > 0)
 	{
-		mt->instrument[slot].version = MUDTRACKER_VERSION;
+		if (w->used == MT_WRITER_BUFFER)
+			mt_writerFlush(w);
+
+		unsigned chunk = min(len, MT_WRITER_BUFFER - w->used);
+		memcpy(&w->buffer[w->used], src, chunk);
+		w->used += chunk;
+		src += chunk;
+		len -= chunk;
 	}
+}
 
-	fwrite((char*)&mt->instrument[0], sizeof(fm_instrument)*mt->instrumentCount, 1, fp);
+static void mt_writerPut(mtWriter *w, unsigned char c)
+{
+	if (w->used == MT_WRITER_BUFFER)
+		mt_writerFlush(w);
+	w->buffer[w->used++] = c;
+}
 
-	int totalSize = ftell(fp);
-	char *all = malloc(totalSize);
-	fseek(fp, 0, SEEK_SET);
-	if (fread(all, totalSize, 1, fp) != 1)
-		return 0;
+/* Checksum of all the data written so far */
+static uint32_t mt_writerChecksum(mtWriter *w)
+{
+	mt_writerFlush(w);
+	return (w->s2 << 16) | w->s1;
+}
 
-	unsigned checksum = adler32(all, totalSize);
+/* Flushes the data to the disk and closes the file. Returns 1 if everything was written */
+static int mt_writerClose(mtWriter *w)
+{
+	mt_writerFlush(w);
+	if (fflush(w->fp) != 0)
+		w->failed = 1;
+#ifdef _WIN32
+	if (_commit(_fileno(w->fp)) != 0)
+		w->failed = 1;
+#else
+	if (fsync(fileno(w->fp)) != 0)
+		w->failed = 1;
+#endif
+	if (fclose(w->fp) != 0)
+		w->failed = 1;
+	free(w->buffer);
+	return !w->failed;
+}
 
-	fseek(fp, 0, SEEK_END);
-	fwrite((char*)&checksum, 4, 1, fp);
+/* Replaces 'filename' by 'tempName' in a single step, so the file is always either the old or the new version */
+static int mt_replaceFile(const char *tempName, const char *filename)
+{
+#ifdef _WIN32
+	return MoveFileExA(tempName, filename, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(tempName, filename) == 0;
+#endif
+}
 
-	fclose(fp);
+/* Song format 2
 
-	return 1;
-}
+	Pattern rows are stored by channel and by column (note, instrument, volume, effect, effect value) :
+	- patternCount (16 bits), then rows - 1 of every pattern (1 byte each).
+	  From format 4 : patternCount (32 bits), then rows - 1 of every pattern (16 bits each)
+	- for each pattern : a bitmap of the channels having at least one non-empty cell
+	- for each of those channels : a bitmap of the non-empty rows, followed by the 5 columns of these rows.
+	  Notes are stored as the difference with the previous note of the channel.
+	Columns and the instrument list are run-length encoded (see mt_rleWrite). */
 
-void mt_patternClear(mtsynth* mt)
+#define MT_CELL_FIELDS 5
+
+/* Run-length encoding. Control byte c < 128 : c + 1 literal bytes follow, c >= 128 : the next byte is repeated c - 126 times.
+	The output is at most count + count / 128 + 1 bytes */
+static void mt_rleWrite(mtWriter *w, const unsigned char* src, unsigned count)
 {
-	if (mt->pattern && mt->patternCount > 0)
-	{
+	unsigned i = 0;
 
-		mt->row = mt->order = 0;
+	while (i < count)
+	{
+		unsigned run = 1;
+		while (i + run < count && run < 129 && src[i + run] == src[i])
+			run++;
 
-		for (unsigned i = 0; i < mt->patternCount; i++)
+		/* Runs shorter than 3 are cheaper as literals, this bounds the output size */
+		if (run >= 3)
 		{
-			free(mt->pattern[i]);
-			free(mt->channelStates[i]);
+			mt_writerPut(w, 126 + run);
+			mt_writerPut(w, src[i]);
+			i += run;
+		}
+		else
+		{
+			unsigned start = i, length = 0;
+			while (i < count && length < 128 && (i + 2 >= count || src[i + 1] != src[i] || src[i + 2] != src[i]))
+			{
+				i++;
+				length++;
+			}
+			mt_writerPut(w, length - 1);
+			mt_writerWrite(w, &src[start], length);
 		}
-
-		mt->patternCount = 0;
 	}
 }
 
-void mt_instrumentRecovery(fm_instrument * i)
+static int mt_isCellEmpty(const Cell* c)
 {
-	i->magic[0] = 'F';
-	i->magic[1] = 'M';
-	i->magic[2] = 'C';
-	i->magic[3] = 'I';
+	return c->note == 255 && c->instr == 255 && c->vol == 255 && c->fx == 255 && c->fxdata == 255;
+}
 
-	i->lfoWaveform = clamp(i->lfoWaveform, 0, 19);
-	i->volume = clamp(i->volume, 0, 99);
-	i->feedbackSource = clamp(i->feedbackSource, 0, 5);
-	i->transpose = clamp(i->transpose, -12, 12);
-	i->tuning = clamp(i->tuning, -100, 100);
+/* Oldest song format revision able to store the song */
+static unsigned mt_songVersion(mtsynth* mt)
+{
+	if (mt->patternCount > 256)
+		return 4;
 
-	int nbOuts = 0;
+	for (unsigned i = 0; i < mt->patternCount; i++)
+	{
+		if (mt->patternSize[i] > 256)
+			return 4;
+	}
+	return mt->channelCount == FM_chDefault ? 2 : 3;
+}
 
-	for (int j = 0; j < 4; j++)
-		i->toMix[j] = clamp(i->toMix[j], -1, 5);
+static void mt_savePatterns(mtsynth* mt, mtWriter *w, unsigned version)
+{
+	unsigned char column[MT_MAX_ROWS];
+	unsigned char bitmap[MT_MAX_ROWS / 8];
 
-	for (int op = 0; op < 6; op++)
+	mt_writerPut(w, mt->patternCount & 255);
+	mt_writerPut(w, mt->patternCount >> 8 & 255);
+	if (version >= 4)
 	{
-		i->op[op].vol = clamp(i->op[op].vol, 0, 99);
-		i->op[op].delay = clamp(i->op[op].delay, 0, 70);
-		i->op[op].a = clamp(i->op[op].a, 0, 99);
-		i->op[op].h = clamp(i->op[op].h, 0, 80);
-		i->op[op].d = clamp(i->op[op].d, 0, 99);
-		i->op[op].s = clamp(i->op[op].s, 0, 99);
-		i->op[op].r = clamp(i->op[op].r, -99, 99);
-		if (i->op[op].fixedFreq)
-			i->op[op].mult = clamp(i->op[op].mult, 0, 255);
-		else
+		mt_writerPut(w, mt->patternCount >> 16 & 255);
+		mt_writerPut(w, mt->patternCount >> 24);
+	}
+
+	for (unsigned i = 0; i < mt->patternCount; i++)
+	{
+		mt_writerPut(w, (mt->patternSize[i] - 1) & 255);
+		if (version >= 4)
+			mt_writerPut(w, (mt->patternSize[i] - 1) >> 8);
+	}
+
+	for (unsigned i = 0; i < mt->patternCount; i++)
+	{
+		unsigned rows = mt->patternSize[i];
+		unsigned char channels[FM_ch / 8] = { 0 };
+
+		for (unsigned ch = 0; ch < mt->channelCount; ch++)
+		{
+			for (unsigned row = 0; row < rows; row++)
+			{
+				if (!mt_isCellEmpty(&mt->pattern[i][row][ch]))
+				{
+					channels[ch / 8] |= 1 << (ch % 8);
+					break;
+				}
+			}
+		}
+		mt_writerWrite(w, channels, (mt->channelCount + 7) / 8);
+
+		for (unsigned ch = 0; ch < mt->channelCount; ch++)
+		{
+			if (!(channels[ch / 8] & (1 << (ch % 8))))
+				continue;
+
+			unsigned used = 0;
+			memset(bitmap, 0, sizeof(bitmap));
+			for (unsigned row = 0; row < rows; row++)
+			{
+				if (!mt_isCellEmpty(&mt->pattern[i][row][ch]))
+				{
+					bitmap[row / 8] |= 1 << (row % 8);
+					used++;
+				}
+			}
+			mt_writerWrite(w, bitmap, (rows + 7) / 8);
+
+			for (unsigned field = 0; field < MT_CELL_FIELDS; field++)
+			{
+				unsigned count = 0;
+				unsigned char previous = 0;
+				for (unsigned row = 0; row < rows; row++)
+				{
+					if (bitmap[row / 8] & (1 << (row % 8)))
+					{
+						unsigned char value = ((unsigned char*)&mt->pattern[i][row][ch])[field];
+						column[count++] = field == 0 ? value - previous : value;
+						previous = value;
+					}
+				}
+				mt_rleWrite(w, column, used);
+			}
+		}
+	}
+}
+
+int mt_saveSong(mtsynth* mt, const char* filename)
+{
+	/* Write to a temporary file first : a failed or interrupted save leaves the previous file untouched */
+	char *tempName = malloc(strlen(filename) + 5);
+	if (!tempName)
+	{
+		return 0;
+	}
+	sprintf(tempName, "%s.tmp", filename);
+
+	mtWriter w;
+	if (!mt_writerOpen(&w, tempName))
+	{
+		free(tempName);
+		return 0;
+	}
+
+	mt_writerWrite(&w, "MDTS", 4);
+	mt_writerPut(&w, 0x00); // unused byte
+	unsigned version = mt_songVersion(mt);
+	mt_writerPut(&w, version);
+	unsigned char temp = strlen(&mt->songName[0]);
+	mt_writerPut(&w, temp);
+	mt_writerWrite(&w, &mt->songName[0], temp);
+
+	temp = strlen(&mt->author[0]);
+	mt_writerPut(&w, temp);
+	mt_writerWrite(&w, &mt->author[0], temp);
+
+	temp = strlen(&mt->comments[0]);
+	mt_writerPut(&w, temp);
+	mt_writerWrite(&w, &mt->comments[0], temp);
+
+	mt_writerWrite(&w, &mt->initial_tempo, sizeof(mt->initial_tempo)); // tempo
+	mt_writerWrite(&w, &mt->diviseur, sizeof(mt->diviseur)); // quarter note
+	mt_writerWrite(&w, &mt->_globalVolume, sizeof(mt->_globalVolume));
+	mt_writerWrite(&w, &mt->transpose, sizeof(mt->transpose));
+
+	mt_writerPut(&w, round(mt->initialReverbLength * 160));
+	mt_writerPut(&w, round(mt->initialReverbRoomSize * 160));
+
+	if (version >= 3)
+	{
+		mt_writerPut(&w, mt->channelCount);
+	}
+
+	for (unsigned ch = 0; ch < mt->channelCount; ++ch)
+	{
+		mt_writerWrite(&w, &mt->ch[ch].initial_pan, sizeof(mt->ch[ch].initial_pan)); // ch panning
+		mt_writerWrite(&w, &mt->ch[ch].initial_vol, sizeof(mt->ch[ch].initial_vol)); // ch volume
+		mt_writerWrite(&w, &mt->ch[ch].initial_reverb, sizeof(mt->ch[ch].initial_reverb)); // ch volume
+	}
+
+	mt_savePatterns(mt, &w, version);
+
+	mt_writerPut(&w, mt->instrumentCount);
+
+	for (int slot = 0; slot < mt->instrumentCount; slot++)
+	{
+		mt->instrument[slot].version = MUDTRACKER_VERSION;
+	}
+
+	mt_rleWrite(&w, (unsigned char*)&mt->instrument[0], sizeof(fm_instrument)*mt->instrumentCount);
+
+	uint32_t checksum = mt_writerChecksum(&w);
+	mt_writerWrite(&w, &checksum, 4);
+
+	int success = mt_writerClose(&w) && mt_replaceFile(tempName, filename);
+	if (!success)
+	{
+		remove(tempName);
+	}
+	free(tempName);
+
+	return success;
+}
+
+void mt_patternClear(mtsynth* mt)
+{
+	if (mt->pattern && mt->patternCount > 0)
+	{
+
+		mt->row = mt->order = 0;
+
+		/* Pattern data lives in the slabs, which are kept for the next song */
+		mt->slabUsedRows = 0;
+
+		mt->patternCount = 0;
+		mt_updatePatternStarts(mt, 0);
+	}
+}
+
+void mt_instrumentRecovery(fm_instrument * i)
+{
+	i->magic[0] = 'F';
+	i->magic[1] = 'M';
+	i->magic[2] = 'C';
+	i->magic[3] = 'I';
+
+	i->lfoWaveform = clamp(i->lfoWaveform, 0, 19);
+	i->volume = clamp(i->volume, 0, 99);
+	i->feedbackSource = clamp(i->feedbackSource, 0, 5);
+	i->transpose = clamp(i->transpose, -12, 12);
+	i->tuning = clamp(i->tuning, -100, 100);
+
+	int nbOuts = 0;
+
+	for (int j = 0; j < 4; j++)
+		i->toMix[j] = clamp(i->toMix[j], -1, 5);
+
+	for (int op = 0; op < 6; op++)
+	{
+		i->op[op].vol = clamp(i->op[op].vol, 0, 99);
+		i->op[op].delay = clamp(i->op[op].delay, 0, 70);
+		i->op[op].a = clamp(i->op[op].a, 0, 99);
+		i->op[op].h = clamp(i->op[op].h, 0, 80);
+		i->op[op].d = clamp(i->op[op].d, 0, 99);
+		i->op[op].s = clamp(i->op[op].s, 0, 99);
+		i->op[op].r = clamp(i->op[op].r, -99, 99);
+		if (i->op[op].fixedFreq)
+			i->op[op].mult = clamp(i->op[op].mult, 0, 255);
+		else
 			i->op[op].mult = clamp(i->op[op].mult, 0, 40);
 		i->op[op].finetune = clamp(i->op[op].finetune, 0, 24);
 		i->op[op].detune = clamp(i->op[op].detune, -100, 100);
@@ -1629,7 +2131,7 @@ void mt_instrumentRecovery(fm_instrument * i)
 
 static int readFromMemory(mtsynth *mt, char *dst, int len, char *from)
 {
-	if (mt->readSeek >= mt->totalFileSize)
+	if (mt->readSeek >= mt->totalFileSize || len > mt->totalFileSize - mt->readSeek)
 		return 0;
 
 	memcpy(dst, from + mt->readSeek, len);
@@ -1639,29 +2141,229 @@ static int readFromMemory(mtsynth *mt, char *dst, int len, char *from)
 
 static char* readFromMemoryPtr(mtsynth *mt, int len, char *from)
 {
-	if (mt->readSeek >= mt->totalFileSize)
+	if (mt->readSeek >= mt->totalFileSize || len > mt->totalFileSize - mt->readSeek)
 		return 0;
 
 	mt->readSeek += len;
 	return &from[mt->readSeek - len];
 }
 
+/* Reads a length-prefixed string, truncated to the destination size */
+static void readStringFromMemory(mtsynth *mt, char *dst, unsigned size, char *from)
+{
+	unsigned char len = 0;
+	readFromMemory(mt, (char *)&len, 1, from);
+
+	unsigned kept = min(len, size - 1);
+	if (!readFromMemory(mt, dst, kept, from))
+		kept = 0;
+	dst[kept] = 0;
+	mt->readSeek += len - kept;
+}
+
+/* Allocates all the patterns of a song being loaded at once, contiguously, and clears them */
+static int mt_allocSongPatterns(mtsynth* mt, const unsigned* rows, unsigned count)
+{
+	unsigned totalRows = 0;
+	for (unsigned i = 0; i < count; i++)
+		totalRows += rows[i];
+
+	/* The previous song is dropped, its patterns aren't copied if the slabs are rebuilt */
+	mt->patternCount = 0;
+	mt->slabUsedRows = 0;
+
+	if (!mt_resizePatternTables(mt, count)
+		|| ((totalRows > mt->slabRows || mt->slabStride != mt->channelCount) && !mt_slabRebuild(mt, totalRows, mt->channelCount)))
+		return 0;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		mt->patternCount = i + 1;
+		mt->patternSize[i] = mt->patternCapacity[i] = 0;
+		if (!mt_slabAllocPattern(mt, i, rows[i]))
+			return 0;
+		mt->patternSize[i] = rows[i];
+		mt_clearPattern(mt, i, 0, rows[i]);
+	}
+	mt_updatePatternStarts(mt, 0);
+	return 1;
+}
+
+/* Song format 1 : raw cells. Returns 1 if success, 0 if corrupted, MT_ERR_FILEIO if out of memory */
+static int mt_loadPatternsV1(mtsynth* mt, char* data)
+{
+	unsigned char nbOrd, nbRow;
+	unsigned rows[256];
+
+	readFromMemory(mt, (char *)&nbOrd, sizeof(nbOrd), data);
+
+	/* Walk the pattern headers first, so the whole song is allocated at once */
+	unsigned seek = mt->readSeek;
+	for (unsigned i = 0; i < nbOrd; i++)
+	{
+		nbRow = seek < mt->totalFileSize ? data[seek] : 1;
+		rows[i] = max(1, nbRow);
+		seek += 1 + sizeof(Cell) * FM_chDefault * rows[i];
+	}
+
+	if (!mt_allocSongPatterns(mt, rows, nbOrd))
+		return MT_ERR_FILEIO;
+
+	for (unsigned i = 0; i < nbOrd; i++)
+	{
+		readFromMemory(mt, (char *)&nbRow, sizeof(nbRow), data);
+		for (unsigned row = 0; row < mt->patternSize[i]; row++)
+		{
+			readFromMemory(mt, (char*)&mt->pattern[i][row][0], sizeof(Cell) * FM_chDefault, data);
+		}
+	}
+	return 1;
+}
+
+/* Reads count bytes written by mt_rleWrite. Returns 0 if the data is corrupted */
+static int mt_rleDecode(mtsynth* mt, unsigned char* dst, unsigned count, const char* data)
+{
+	unsigned out = 0;
+	const unsigned char* src = (const unsigned char*)data;
+
+	while (out < count)
+	{
+		if (mt->readSeek + 2 > mt->totalFileSize)
+			return 0;
+
+		unsigned char control = src[mt->readSeek++];
+		if (control >= 128)
+		{
+			unsigned run = control - 126;
+			if (out + run > count)
+				return 0;
+			memset(&dst[out], src[mt->readSeek++], run);
+			out += run;
+		}
+		else
+		{
+			unsigned length = control + 1;
+			if (out + length > count || mt->readSeek + length > mt->totalFileSize)
+				return 0;
+			memcpy(&dst[out], &src[mt->readSeek], length);
+			mt->readSeek += length;
+			out += length;
+		}
+	}
+	return 1;
+}
+
+/* Decodes the cells of the patterns, once they are allocated. Returns 1 if success, 0 if corrupted */
+static int mt_decodePatterns(mtsynth* mt, char* data, const unsigned* rows, unsigned count)
+{
+	const unsigned char* src = (const unsigned char*)data;
+	unsigned char column[MT_MAX_ROWS];
+	unsigned channelBytes = (mt->channelCount + 7) / 8;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (mt->readSeek + channelBytes > mt->totalFileSize)
+			return 0;
+
+		const unsigned char* channels = &src[mt->readSeek];
+		mt->readSeek += channelBytes;
+
+		for (unsigned ch = 0; ch < mt->channelCount; ch++)
+		{
+			if (!(channels[ch / 8] & (1 << (ch % 8))))
+				continue;
+
+			if (mt->readSeek + (rows[i] + 7) / 8 > mt->totalFileSize)
+				return 0;
+
+			const unsigned char* bitmap = &src[mt->readSeek];
+			mt->readSeek += (rows[i] + 7) / 8;
+
+			unsigned used = 0;
+			for (unsigned row = 0; row < rows[i]; row++)
+			{
+				used += (bitmap[row / 8] >> (row % 8)) & 1;
+			}
+
+			for (unsigned field = 0; field < MT_CELL_FIELDS; field++)
+			{
+				if (!mt_rleDecode(mt, column, used, data))
+					return 0;
+
+				unsigned n = 0;
+				unsigned char previous = 0;
+				for (unsigned row = 0; row < rows[i]; row++)
+				{
+					if (bitmap[row / 8] & (1 << (row % 8)))
+					{
+						unsigned char value = field == 0 ? column[n++] + previous : column[n++];
+						((unsigned char*)&mt->pattern[i][row][ch])[field] = value;
+						previous = value;
+					}
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/* Song formats 2 to 4 : columnar patterns (see mt_savePatterns). Cells are decoded straight into the pattern storage */
+static int mt_loadPatternsV2(mtsynth* mt, char* data, unsigned version)
+{
+	const unsigned char* src = (const unsigned char*)data;
+	unsigned countBytes = version >= 4 ? 4 : 2, sizeBytes = version >= 4 ? 2 : 1;
+
+	if (mt->readSeek + countBytes > mt->totalFileSize)
+		return 0;
+
+	unsigned count = 0;
+	for (unsigned i = 0; i < countBytes; i++)
+	{
+		count |= (unsigned)src[mt->readSeek++] << 8 * i;
+	}
+
+	if (count > MT_MAX_PATTERNS || mt->readSeek + count * sizeBytes > mt->totalFileSize)
+		return 0;
+
+	unsigned *rows = malloc(sizeof(unsigned) * max(1, count));
+	if (!rows)
+		return MT_ERR_FILEIO;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		rows[i] = src[mt->readSeek++] + 1;
+		if (sizeBytes == 2)
+			rows[i] += src[mt->readSeek++] << 8;
+
+		if (rows[i] > MT_MAX_ROWS)
+		{
+			free(rows);
+			return 0;
+		}
+	}
+
+	int result = mt_allocSongPatterns(mt, rows, count) ? mt_decodePatterns(mt, data, rows, count) : MT_ERR_FILEIO;
+	free(rows);
+	return result;
+}
+
 int mt_loadSongFromMemory(mtsynth* mt, char* data, unsigned len)
 {
 	mt->totalFileSize = len;
-	unsigned char nbOrd, nbRow, temp;
+	unsigned char temp, version;
 	unsigned int error = 0;
 
-	if (mt->totalFileSize < 3 * FM_ch + 6)
+	/* Header of a song with a single channel */
+	if (mt->totalFileSize < 3 + 6)
 	{
 		return 2;
 	}
 
 
 	mt->readSeek = 5;
-	readFromMemory(mt, (char *)&temp, 1, data);
+	readFromMemory(mt, (char *)&version, 1, data);
 
-	if (temp != MUDTRACKER_VERSION)
+	if (version < 1 || version > MUDTRACKER_SONG_VERSION)
 	{
 		return MT_ERR_FILEVERSION;
 	}
@@ -1670,18 +2372,9 @@ int mt_loadSongFromMemory(mtsynth* mt, char* data, unsigned len)
 	mt->order = mt->row = 0;
 	mt_patternClear(mt);
 
-	readFromMemory(mt, (char *)&temp, 1, data);
-
-	readFromMemory(mt, &mt->songName[0], temp, data);
-	mt->songName[temp] = 0;
-
-	readFromMemory(mt, (char *)&temp, 1, data);
-	readFromMemory(mt, &mt->author[0], temp, data);
-	mt->author[temp] = 0;
-
-	readFromMemory(mt, (char *)&temp, 1, data);
-	readFromMemory(mt, &mt->comments[0], temp, data);
-	mt->comments[temp] = 0;
+	readStringFromMemory(mt, &mt->songName[0], sizeof(mt->songName), data);
+	readStringFromMemory(mt, &mt->author[0], sizeof(mt->author), data);
+	readStringFromMemory(mt, &mt->comments[0], sizeof(mt->comments), data);
 
 
 
@@ -1702,11 +2395,20 @@ int mt_loadSongFromMemory(mtsynth* mt, char* data, unsigned len)
 	mt->initialReverbLength = (float)temp / 160;
 
 	readFromMemory(mt, (char *)&temp, sizeof(temp), data);
-	mt->initialReverbRoomSize = (float)temp / 160;
+	mt->initialReverbRoomSize = min((float)temp / 160, REVERB_MAX_ROOMSIZE);
 
 	mt_initReverb(mt, mt->initialReverbRoomSize);
+	memset(mt->revBuf, 0, mt->revBufSize*sizeof(float));
 
-	for (unsigned ch = 0; ch < FM_ch; ++ch)
+	mt->channelCount = FM_chDefault;
+	if (version >= 3)
+	{
+		temp = FM_chDefault;
+		readFromMemory(mt, (char *)&temp, sizeof(temp), data);
+		mt->channelCount = clamp(temp, 1, FM_ch);
+	}
+
+	for (unsigned ch = 0; ch < mt->channelCount; ++ch)
 	{
 		mt->ch[ch].cInstr = 0;
 		readFromMemory(mt, (char *)&mt->ch[ch].initial_pan, sizeof(mt->ch[ch].initial_pan), data); // ch panning
@@ -1718,31 +2420,34 @@ int mt_loadSongFromMemory(mtsynth* mt, char* data, unsigned len)
 		mt->ch[ch].initial_reverb = min(mt->ch[ch].initial_reverb, 99);
 	}
 
-	readFromMemory(mt, (char *)&nbOrd, sizeof(nbOrd), data);
-	mt_resizePatterns(mt, nbOrd);
-
-	for (unsigned i = 0; i < nbOrd; i++)
+	int loaded = version == 1 ? mt_loadPatternsV1(mt, data) : mt_loadPatternsV2(mt, data, version);
+	if (loaded < 0)
 	{
-		readFromMemory(mt, (char *)&nbRow, sizeof(nbRow), data);
-
-		mt_resizePattern(mt, i, max(1, nbRow), 0);
-
-		readFromMemory(mt, (char*)&mt->pattern[i][0], sizeof(Cell) * mt->patternSize[i] * FM_ch, data);
+		return loaded;
 	}
+	error += !loaded;
 
-	readFromMemory(mt, (char *)&mt->instrumentCount, 1, data);
-	mt_resizeInstrumentList(mt, mt->instrumentCount);
-
-	if (mt->instrumentCount <= 0 || mt->instrumentCount > 255)
+	/* Read the count aside : a corrupted count of 0 would free the instrument list */
+	temp = 0;
+	readFromMemory(mt, (char *)&temp, 1, data);
+	if (!mt_resizeInstrumentList(mt, max(1, temp)))
 	{
-		mt_resizeInstrumentList(mt, 1);
+		return MT_ERR_FILEIO;
 	}
+
 	if (mt->patternCount == 0)
 	{
 		mt_resizePatterns(mt, 1);
 	}
 
-	readFromMemory(mt, (char*)&mt->instrument[0], sizeof(fm_instrument) * mt->instrumentCount, data);
+	if (version == 1)
+	{
+		readFromMemory(mt, (char*)&mt->instrument[0], sizeof(fm_instrument) * mt->instrumentCount, data);
+	}
+	else if (!mt_rleDecode(mt, (unsigned char*)&mt->instrument[0], sizeof(fm_instrument) * mt->instrumentCount, data))
+	{
+		error++;
+	}
 
 	unsigned checksum;
 
@@ -1821,6 +2526,418 @@ void mt_clearSong(mtsynth* mt)
 	memset(mt->comments, 0, 256);
 }
 
+int mt_copySong(mtsynth* dst, mtsynth* src)
+{
+	memcpy(dst->songName, src->songName, sizeof(dst->songName));
+	memcpy(dst->author, src->author, sizeof(dst->author));
+	memcpy(dst->comments, src->comments, sizeof(dst->comments));
+
+	/* The settings the state table is built from */
+	if (dst->initial_tempo != src->initial_tempo || dst->diviseur != src->diviseur || dst->channelCount != src->channelCount)
+		dst->channelStatesDone = 0;
+	for (unsigned ch = 0; ch < src->channelCount; ch++)
+	{
+		if (dst->ch[ch].initial_pan != src->ch[ch].initial_pan || dst->ch[ch].initial_vol != src->ch[ch].initial_vol)
+			dst->channelStatesDone = 0;
+	}
+
+	dst->initial_tempo = src->initial_tempo;
+	dst->diviseur = src->diviseur;
+	dst->_globalVolume = src->_globalVolume;
+	dst->transpose = src->transpose;
+	dst->initialReverbLength = src->initialReverbLength;
+	dst->initialReverbRoomSize = src->initialReverbRoomSize;
+	if (!mt_reshapePatterns(dst, src->channelCount))
+		return 0;
+
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		dst->ch[ch].initial_pan = src->ch[ch].initial_pan;
+		dst->ch[ch].initial_vol = src->ch[ch].initial_vol;
+		dst->ch[ch].initial_reverb = src->ch[ch].initial_reverb;
+	}
+
+	if (src->patternCount != dst->patternCount && !mt_resizePatterns(dst, src->patternCount))
+		return 0;
+
+	/* Patterns left untouched since the previous copy are kept as they are */
+	for (unsigned i = 0; i < src->patternCount; i++)
+	{
+		unsigned size = sizeof(Cell)*src->channelCount*src->patternSize[i];
+
+		if (dst->patternSize[i] != src->patternSize[i])
+		{
+			if (!mt_resizePattern(dst, i, src->patternSize[i], 0))
+				return 0;
+		}
+		else if (memcmp(dst->pattern[i][0], src->pattern[i][0], size) == 0)
+		{
+			continue;
+		}
+		memcpy(dst->pattern[i][0], src->pattern[i][0], size);
+		dst->songRevision++;
+		dst->channelStatesDone = 0;
+	}
+
+	/* Rebuilt only if something it depends on changed, so unchanged copies stay cheap */
+	if (!dst->channelStatesDone)
+		mt_buildStateTable(dst, 0, dst->patternCount, 0, dst->channelCount);
+
+	if (src->instrumentCount != dst->instrumentCount && !mt_resizeInstrumentList(dst, src->instrumentCount))
+		return 0;
+
+	memcpy(dst->instrument, src->instrument, sizeof(fm_instrument)*src->instrumentCount);
+	return 1;
+}
+
+/* Exchanges two variables or arrays of the same type */
+#define MT_SWAP(a, b) { char swap[sizeof(a)]; memcpy(swap, &(a), sizeof(a)); memcpy(&(a), &(b), sizeof(a)); memcpy(&(b), swap, sizeof(a)); }
+
+/* Exchanges the song data of mt and song, the playback state of mt is left as is */
+static void mt_exchangeSong(mtsynth* mt, mtsynth* song)
+{
+	MT_SWAP(mt->songName, song->songName);
+	MT_SWAP(mt->author, song->author);
+	MT_SWAP(mt->comments, song->comments);
+
+	MT_SWAP(mt->initial_tempo, song->initial_tempo);
+	MT_SWAP(mt->diviseur, song->diviseur);
+	MT_SWAP(mt->_globalVolume, song->_globalVolume);
+	MT_SWAP(mt->transpose, song->transpose);
+	MT_SWAP(mt->initialReverbLength, song->initialReverbLength);
+	MT_SWAP(mt->initialReverbRoomSize, song->initialReverbRoomSize);
+	MT_SWAP(mt->channelCount, song->channelCount);
+
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		MT_SWAP(mt->ch[ch].initial_pan, song->ch[ch].initial_pan);
+		MT_SWAP(mt->ch[ch].initial_vol, song->ch[ch].initial_vol);
+		MT_SWAP(mt->ch[ch].initial_reverb, song->ch[ch].initial_reverb);
+	}
+
+	MT_SWAP(mt->instrument, song->instrument);
+	MT_SWAP(mt->instrumentCount, song->instrumentCount);
+
+	MT_SWAP(mt->pattern, song->pattern);
+	MT_SWAP(mt->channelStates, song->channelStates);
+	MT_SWAP(mt->channelStatesDone, song->channelStatesDone);
+	MT_SWAP(mt->patternCount, song->patternCount);
+	MT_SWAP(mt->patternSize, song->patternSize);
+	MT_SWAP(mt->patternStart, song->patternStart);
+	MT_SWAP(mt->cellSlab, song->cellSlab);
+	MT_SWAP(mt->rowSlab, song->rowSlab);
+	MT_SWAP(mt->stateSlab, song->stateSlab);
+	MT_SWAP(mt->mixSlab, song->mixSlab);
+	MT_SWAP(mt->slabStride, song->slabStride);
+	MT_SWAP(mt->slabRows, song->slabRows);
+	MT_SWAP(mt->slabUsedRows, song->slabUsedRows);
+	MT_SWAP(mt->patternOffset, song->patternOffset);
+	MT_SWAP(mt->patternCapacity, song->patternCapacity);
+	MT_SWAP(mt->patternTableSize, song->patternTableSize);
+
+	/* Both songs changed for the song indexes */
+	mt->songRevision++;
+	song->songRevision++;
+
+	/* The channels keep their own copy of the instrument of the previous song : notes still sounding (or
+	volume changes on them) can go on after the previous song is cleared. The next note reloads from the new song */
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		if (mt->ch[ch].instr && mt->ch[ch].instr != &mt->ch[ch].songSwitchInstr)
+		{
+			mt->ch[ch].songSwitchInstr = *mt->ch[ch].instr;
+			mt->ch[ch].instr = &mt->ch[ch].songSwitchInstr;
+		}
+		mt->ch[ch].cInstr = 0;
+
+		/* Freezes were made for the previous song */
+		if (mt->ch[ch].freeze)
+			mt->ch[ch].freeze->stale = 1;
+
+		/* Not rendered anymore if the new song has less channels */
+		if (ch >= mt->channelCount)
+			mt_cutChannel(mt, ch);
+	}
+
+	mt_setVolume(mt, mt->_globalVolume);
+}
+
+void mt_swapSong(mtsynth* mt, mtsynth* song)
+{
+	mt_exchangeSong(mt, song);
+	mt_initReverb(mt, mt->initialReverbRoomSize);
+	mt_setPosition(mt, 0, 0, 2);
+}
+
+/* Called by the render at the end of the playing song : the queued song takes over without cutting the notes */
+static void mt_playQueuedSong(mtsynth* mt, mtsynth* next)
+{
+	mt_exchangeSong(mt, next);
+	mt->queuedSong = NULL;
+
+	/* Reverb settings of the new song. The delay lines aren't cleared, the tail of the previous song goes on */
+	mt->reverbLength = mt->initialReverbLength;
+	if (mt->reverbRoomSize != mt->initialReverbRoomSize)
+		mt_initReverb(mt, mt->initialReverbRoomSize);
+
+	mt->tempRow = mt->tempOrder = -1;
+	mt->loopCount = 0;
+	mt_setPosition(mt, 0, 0, 0);
+}
+
+int mt_queueSong(mtsynth* mt, mtsynth* next)
+{
+	if (!next)
+	{
+		mt->queuedSong = NULL;
+		return 1;
+	}
+
+	if (next->patternCount == 0)
+		return 0;
+
+	/* Built here, so the render only exchanges pointers */
+	if (!next->channelStatesDone)
+		mt_buildStateTable(next, 0, next->patternCount, 0, FM_ch);
+
+	mt->queuedSong = next;
+	return 1;
+}
+
+int mt_isSongQueued(mtsynth* mt)
+{
+	return mt->queuedSong != NULL;
+}
+
+/* Checksum of the cells of a channel, also lists the instruments they use */
+static unsigned mt_freezeCellSignature(mtsynth* mt, unsigned channel, unsigned char* usedInstruments)
+{
+	uint32_t s1 = 1, s2 = 0;
+
+	memset(usedInstruments, 0, 32);
+
+	adler32Update(&s1, &s2, &mt->patternCount, sizeof(mt->patternCount));
+	for (unsigned order = 0; order < mt->patternCount; order++)
+	{
+		adler32Update(&s1, &s2, &mt->patternSize[order], sizeof(mt->patternSize[order]));
+		for (unsigned row = 0; row < mt->patternSize[order]; row++)
+		{
+			Cell *cell = &mt->pattern[order][row][channel];
+			adler32Update(&s1, &s2, cell, sizeof(Cell));
+			if (cell->instr != 255)
+				usedInstruments[cell->instr / 8] |= 1 << cell->instr % 8;
+		}
+	}
+	return (s2 << 16) | s1;
+}
+
+/* Checksum of the instruments used by a frozen channel and the song settings */
+static unsigned mt_freezeSettingsSignature(mtsynth* mt, mtFreeze* f)
+{
+	uint32_t s1 = 1, s2 = 0;
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		if (!(f->usedInstruments[i / 8] & 1 << i % 8))
+			continue;
+
+		/* Notes with a missing instrument aren't played */
+		unsigned char exists = i < mt->instrumentCount;
+		adler32Update(&s1, &s2, &exists, 1);
+		if (exists)
+			adler32Update(&s1, &s2, &mt->instrument[i], sizeof(fm_instrument));
+	}
+
+	adler32Update(&s1, &s2, &mt->initial_tempo, sizeof(mt->initial_tempo));
+	adler32Update(&s1, &s2, &mt->diviseur, sizeof(mt->diviseur));
+	adler32Update(&s1, &s2, &mt->transpose, sizeof(mt->transpose));
+	adler32Update(&s1, &s2, &mt->ch[f->channel].initial_vol, sizeof(mt->ch[f->channel].initial_vol));
+	adler32Update(&s1, &s2, &mt->sampleRate, sizeof(mt->sampleRate));
+	return (s2 << 16) | s1;
+}
+
+int mt_freezeMatches(mtsynth* mt, mtFreeze* f, int checkCells)
+{
+	if (mt_freezeSettingsSignature(mt, f) != f->settingsSignature)
+		return 0;
+
+	if (checkCells)
+	{
+		/* The channel was removed from the song */
+		if (f->channel >= mt->channelCount)
+			return 0;
+
+		unsigned char usedInstruments[32];
+		if (mt_freezeCellSignature(mt, f->channel, usedInstruments) != f->cellSignature)
+			return 0;
+	}
+	return 1;
+}
+
+mtFreeze* mt_freezeBegin(mtsynth* mt, unsigned channel)
+{
+	if (channel >= mt->channelCount || mt->patternCount == 0)
+		return NULL;
+
+	mtFreeze *f = calloc(1, sizeof(mtFreeze));
+	if (!f)
+		return NULL;
+
+	f->rows = mt->patternStart[mt->patternCount];
+	f->rowOffset = malloc(f->rows * sizeof(unsigned));
+	f->rowTempo = malloc(f->rows);
+	if (!f->rowOffset || !f->rowTempo)
+	{
+		mt_freezeDestroy(f);
+		return NULL;
+	}
+	memset(f->rowOffset, 0xFF, f->rows * sizeof(unsigned));
+
+	f->channel = channel;
+	f->sampleRate = mt->sampleRate;
+	f->cellSignature = mt_freezeCellSignature(mt, channel, f->usedInstruments);
+	f->settingsSignature = mt_freezeSettingsSignature(mt, f);
+	f->recording = 1;
+
+	mt_stopSound(mt);
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		mt->ch[ch].muted = ch != channel;
+		mt->ch[ch].freeze = NULL;
+	}
+	mt->ch[channel].freeze = f;
+
+	/* mt_play only rewinds a playing song, the synth may still be where the previous freeze stopped */
+	mt_setPosition(mt, 0, 0, 0);
+	mt_play(mt);
+	/* Stop at the end of the song, or at its first loop */
+	mt->looping = 0;
+	return f;
+}
+
+int mt_freezeStep(mtsynth* mt, mtFreeze* f, unsigned frames)
+{
+	float buffer[MT_RENDER_CHUNK];
+
+	/* The render works by 8 frames */
+	frames = (frames + 7) & ~7u;
+
+	if (f->length + frames > f->capacity)
+	{
+		unsigned capacity = max(f->capacity + f->capacity / 2, f->length + frames);
+		float *record = realloc(f->record, capacity * sizeof(float));
+		if (!record)
+			return -1;
+		f->record = record;
+		f->capacity = capacity;
+	}
+
+	/* Recorded like the live render, denormals included */
+	unsigned csr = mt_setRenderFpEnv();
+	while (frames > 0)
+	{
+		unsigned chunk = min(frames, MT_RENDER_CHUNK / 2);
+		_mt_render(mt, buffer, chunk * 2);
+		frames -= chunk;
+	}
+	mt_restoreFpEnv(csr);
+	return mt->playing ? 1 : 0;
+}
+
+static void mt_freezeFreeBlocks(mtFreeze* f)
+{
+	if (f->blocks)
+	{
+		for (unsigned b = 0; b < f->blockCount; b++)
+			free(f->blocks[b]);
+		free(f->blocks);
+	}
+	f->blocks = NULL;
+	f->blockCount = 0;
+}
+
+int mt_freezeEnd(mtsynth* mt, mtFreeze* f)
+{
+	mt_stop(mt, 1);
+	mt->ch[f->channel].freeze = NULL;
+	f->recording = 0;
+
+	float peak = 0;
+	for (unsigned i = 0; i < f->length; i++)
+	{
+		peak = max(peak, fabsf(f->record[i]));
+	}
+	f->scale = peak > 0 ? peak / 32767 : 1;
+
+	/* 16 bit blocks, without the silent ones */
+	f->blockCount = (f->length + MT_FREEZE_BLOCK - 1) / MT_FREEZE_BLOCK;
+	f->blocks = calloc(max(1, f->blockCount), sizeof(short*));
+
+	for (unsigned b = 0; f->blocks && b < f->blockCount; b++)
+	{
+		short block[MT_FREEZE_BLOCK];
+		int silent = 1;
+
+		for (unsigned i = 0; i < MT_FREEZE_BLOCK; i++)
+		{
+			unsigned pos = b * MT_FREEZE_BLOCK + i;
+			float sample = pos < f->length ? f->record[pos] / f->scale : 0;
+			block[i] = (short)(sample >= 0 ? sample + 0.5f : sample - 0.5f);
+			silent &= block[i] == 0;
+		}
+
+		if (silent)
+			continue;
+
+		if (!(f->blocks[b] = malloc(sizeof(block))))
+		{
+			mt_freezeFreeBlocks(f);
+			break;
+		}
+		memcpy(f->blocks[b], block, sizeof(block));
+	}
+
+	int success = f->blocks != NULL;
+	if (!success)
+	{
+		f->length = 0;
+		f->stale = 1;
+	}
+
+	free(f->record);
+	f->record = NULL;
+	f->capacity = 0;
+	return success;
+}
+
+void mt_freezeDestroy(mtFreeze* f)
+{
+	if (!f)
+		return;
+
+	mt_freezeFreeBlocks(f);
+	free(f->record);
+	free(f->rowOffset);
+	free(f->rowTempo);
+	free(f);
+}
+
+void mt_setChannelFreeze(mtsynth* mt, unsigned channel, mtFreeze* f)
+{
+	if (channel >= FM_ch)
+		return;
+
+	/* Continue from the current position, the next rows seek by themselves */
+	if (f)
+	{
+		unsigned row = mt->order < mt->patternCount ? mt->patternStart[mt->order] + mt->row : f->rows;
+		f->position = row < f->rows && f->rowOffset[row] != MT_FREEZE_NOROW ? f->rowOffset[row] + mt->frameTimer : f->length;
+	}
+	mt->ch[channel].freeze = f;
+}
+
+#undef MT_SWAP
+
 void mt_createDefaultInstrument(mtsynth* mt, unsigned slot)
 {
 	strncpy((char*)&mt->instrument[slot].name[0], "Default", 7);
@@ -1842,7 +2959,7 @@ void mt_createDefaultInstrument(mtsynth* mt, unsigned slot)
 
 int mt_resizeInstrumentList(mtsynth* mt, unsigned size)
 {
-	if (size > 255)
+	if (size > MT_MAX_INSTRUMENTS)
 	{
 		return 0;
 	}
@@ -1873,42 +2990,342 @@ int mt_resizeInstrumentList(mtsynth* mt, unsigned size)
 	return 1;
 }
 
-int mt_resizePatterns(mtsynth* mt, unsigned count)
+/* Pattern storage
+
+	The cells and channel states of every pattern live in slabs, indexed by row : pattern i uses the rows
+	patternOffset[i] to patternOffset[i] + patternCapacity[i]. A row holds slabStride cells in cellSlab and
+	2 * slabStride bytes (volumes then pannings) in mixSlab, the stride being the song's channel count : the rows
+	of a pattern are contiguous. rowSlab points to the cells of each row and stateSlab to its states, mt->pattern[i]
+	and mt->channelStates[i] point inside them and are updated whenever the slabs are rebuilt, so pattern numbers
+	are the stable handles.
+
+	Patterns that grow beyond their capacity are moved at the end of the slabs, leaving unused rows behind.
+	mt_compactPatterns rewrites all patterns contiguously in song order, freeing those rows. */
+
+#define MT_SLAB_MIN_ROWS 256
+
+/* Pattern storage is edited by the GUI thread while the audio thread renders the song : replaced slabs and tables
+	are kept until a later mt_render call started, the render in progress may still read them. Synths never
+	rendered free them right away */
+static void mt_retire(mtsynth* mt, void* block)
+{
+	if (!block)
+		return;
+
+	if (mt->renderCount == 0)
+	{
+		free(block);
+		return;
+	}
+
+	mt_freeRetired(mt, 0);
+
+	if (mt->retiredCount == mt->retiredSize)
+	{
+		unsigned size = max(16, 2 * mt->retiredSize);
+		void** newRetired = realloc(mt->retired, sizeof(void*)*size);
+		if (newRetired)
+			mt->retired = newRetired;
+		unsigned* newCounts = realloc(mt->retiredRenderCount, sizeof(unsigned)*size);
+		if (newCounts)
+			mt->retiredRenderCount = newCounts;
+
+		/* Leaked rather than freed under the audio thread */
+		if (!newRetired || !newCounts)
+			return;
+		mt->retiredSize = size;
+	}
+
+	mt->retired[mt->retiredCount] = block;
+	mt->retiredRenderCount[mt->retiredCount] = mt->renderCount;
+	mt->retiredCount++;
+}
+
+void mt_freeRetired(mtsynth* mt, int notRendering)
+{
+	unsigned kept = 0;
+	unsigned renderCount = mt->renderCount;
+
+	for (unsigned i = 0; i < mt->retiredCount; i++)
+	{
+		if (notRendering || mt->retiredRenderCount[i] != renderCount)
+		{
+			free(mt->retired[i]);
+		}
+		else
+		{
+			mt->retired[kept] = mt->retired[i];
+			mt->retiredRenderCount[kept] = mt->retiredRenderCount[i];
+			kept++;
+		}
+	}
+	mt->retiredCount = kept;
+}
+
+/* Grows a table the audio thread may be reading : the new one is filled before it replaces the old one */
+static void* mt_growTable(mtsynth* mt, void* table, size_t oldSize, size_t newSize)
+{
+	void* grown = malloc(newSize);
+	if (grown && table)
+		memcpy(grown, table, oldSize);
+	return grown;
+}
+
+/* Copies the tempo, time and the volumes/pannings of 'channels' channels of 'rows' rows, the vol and pan
+	pointers of dst are kept */
+static void mt_copyStates(ChannelState* dst, ChannelState* src, unsigned rows, unsigned channels)
+{
+	for (unsigned row = 0; row < rows; row++)
+	{
+		dst[row].time = src[row].time;
+		dst[row].tempo = src[row].tempo;
+		memcpy(dst[row].vol, src[row].vol, channels);
+		memcpy(dst[row].pan, src[row].pan, channels);
+	}
+}
+
+/* Copies all patterns contiguously, in song order, into new slabs of 'rows' rows of 'stride' channels.
+	Channels past the previous stride are cleared */
+static int mt_slabRebuild(mtsynth* mt, unsigned rows, unsigned stride)
 {
-	if (count > 256)
+	rows = max(1, rows);
+	stride = max(1, stride);
+
+	/* Followed by FM_ch empty cells and states : a render started before the channel count was lowered
+	can still read the previous count of channels in the last row */
+	Cell* newCells = malloc(sizeof(Cell)*(stride*rows + FM_ch));
+	Cell** newRows = malloc(sizeof(Cell*)*rows);
+	ChannelState* newStates = malloc(sizeof(ChannelState)*rows);
+	unsigned char* newMix = malloc(2 * stride*rows + FM_ch);
+
+	if (!newCells || !newRows || !newStates || !newMix)
+	{
+		free(newCells);
+		free(newRows);
+		free(newStates);
+		free(newMix);
 		return 0;
+	}
 
-	if (mt->patternCount > 0 && count == 0)
+	memset(&newCells[stride*rows], 255, sizeof(Cell)*FM_ch);
+	memset(&newMix[2 * stride*rows], 255, FM_ch);
+	for (unsigned row = 0; row < rows; row++)
 	{
-		mt->patternCount = 0;
-		return 1;
+		newRows[row] = &newCells[row*stride];
+		newStates[row].vol = &newMix[2 * row*stride];
+		newStates[row].pan = &newMix[2 * row*stride + stride];
 	}
 
-	if (count < mt->patternCount && mt->pattern)
+	unsigned channels = min(stride, mt->slabStride);
+	unsigned used = 0;
+	for (unsigned i = 0; i < mt->patternCount; i++)
 	{
-		for (unsigned i = count; i < mt->patternCount; i++)
+		unsigned size = mt->patternSize[i];
+		if (size > 0)
 		{
-			free(mt->pattern[i]);
-			free(mt->channelStates[i]);
+			if (mt->slabStride == stride)
+			{
+				memcpy(newRows[used], mt->pattern[i][0], sizeof(Cell)*stride*size);
+			}
+			else
+			{
+				for (unsigned row = 0; row < size; row++)
+				{
+					memcpy(newRows[used + row], mt->pattern[i][row], sizeof(Cell)*channels);
+					memset(&newRows[used + row][channels], 255, sizeof(Cell)*(stride - channels));
+				}
+				memset(newStates[used].vol, 255, 2 * stride*size);
+			}
+			mt_copyStates(&newStates[used], mt->channelStates[i], size, channels);
 		}
-		if (mt->order >= count)
-			mt->order = max(0, count - 1);
+		mt->pattern[i] = &newRows[used];
+		mt->channelStates[i] = &newStates[used];
+		mt->patternOffset[i] = used;
+		mt->patternCapacity[i] = size;
+		used += size;
+	}
+
+	mt_retire(mt, mt->cellSlab);
+	mt_retire(mt, mt->rowSlab);
+	mt_retire(mt, mt->stateSlab);
+	mt_retire(mt, mt->mixSlab);
+	mt->cellSlab = newCells;
+	mt->rowSlab = newRows;
+	mt->stateSlab = newStates;
+	mt->mixSlab = newMix;
+	mt->slabStride = stride;
+	mt->slabRows = rows;
+	mt->slabUsedRows = used;
+	return 1;
+}
+
+/* Makes sure 'rows' more rows can be allocated without rebuilding the slabs */
+static int mt_slabReserve(mtsynth* mt, unsigned rows)
+{
+	if (mt->slabUsedRows + rows <= mt->slabRows && mt->slabStride == mt->channelCount)
+		return 1;
+
+	unsigned liveRows = 0;
+	for (unsigned i = 0; i < mt->patternCount; i++)
+		liveRows += mt->patternSize[i];
+
+	/* Growing also compacts, unused rows are not copied */
+	return mt_slabRebuild(mt, max(MT_SLAB_MIN_ROWS, 2 * (liveRows + rows)), mt->channelCount);
+}
+
+/* Gives a pattern a capacity of 'rows' rows, keeping its current content */
+static int mt_slabAllocPattern(mtsynth* mt, unsigned order, unsigned rows)
+{
+	/* Last pattern of the slab : grow in place */
+	if (mt->patternCapacity[order] > 0 && mt->patternOffset[order] + mt->patternCapacity[order] == mt->slabUsedRows
+		&& mt->patternOffset[order] + rows <= mt->slabRows && mt->slabStride == mt->channelCount)
+	{
+		mt->slabUsedRows = mt->patternOffset[order] + rows;
+		mt->patternCapacity[order] = rows;
+		return 1;
+	}
+
+	if (!mt_slabReserve(mt, rows))
+		return 0;
+
+	unsigned offset = mt->slabUsedRows;
+	unsigned keep = min(mt->patternSize[order], rows);
+
+	if (keep > 0)
+	{
+		memcpy(mt->rowSlab[offset], mt->pattern[order][0], sizeof(Cell)*mt->slabStride*keep);
+		mt_copyStates(&mt->stateSlab[offset], mt->channelStates[order], keep, mt->slabStride);
+	}
+
+	mt->pattern[order] = &mt->rowSlab[offset];
+	mt->channelStates[order] = &mt->stateSlab[offset];
+	mt->patternOffset[order] = offset;
+	mt->patternCapacity[order] = rows;
+	mt->slabUsedRows += rows;
+	return 1;
+}
+
+int mt_compactPatterns(mtsynth* mt)
+{
+	unsigned liveRows = 0;
+	for (unsigned i = 0; i < mt->patternCount; i++)
+		liveRows += mt->patternSize[i];
+
+	return mt_slabRebuild(mt, max(MT_SLAB_MIN_ROWS, liveRows), mt->channelCount);
+}
+
+/* Gives the pattern rows a stride of 'channels' cells and sets the channel count. The audio thread reads the
+	channels below the count : they are added after the rows grew, and removed before they shrink */
+static int mt_reshapePatterns(mtsynth* mt, unsigned channels)
+{
+	if (channels < mt->channelCount)
+		mt->channelCount = channels;
+
+	if (mt->slabStride != channels)
+	{
+		unsigned liveRows = 0;
+		for (unsigned i = 0; i < mt->patternCount; i++)
+			liveRows += mt->patternSize[i];
+
+		if (!mt_slabRebuild(mt, max(MT_SLAB_MIN_ROWS, liveRows), channels))
+			return 0;
 	}
 
-	unsigned int* newPs = realloc(mt->patternSize, sizeof(unsigned)*count);
-	Cell(** newPa)[24] = realloc(mt->pattern, sizeof(Cell*)*count);
-	ChannelState** newC = realloc(mt->channelStates, sizeof(ChannelState*)*count);
+	mt->channelCount = channels;
+	return 1;
+}
+
+/* Makes the per pattern index tables hold 'count' patterns. They grow by doubling and never shrink :
+	MIDI imports add thousands of patterns one by one */
+static int mt_resizePatternTables(mtsynth* mt, unsigned count)
+{
+	if (count <= mt->patternTableSize)
+		return 1;
+
+	unsigned size = max(count, 2 * mt->patternTableSize);
+	unsigned oldSize = mt->patternTableSize;
 
-	if (!newPs || !newPa || !newC)
+	unsigned int* newPs = mt_growTable(mt, mt->patternSize, sizeof(unsigned)*oldSize, sizeof(unsigned)*size);
+	unsigned int* newPst = mt_growTable(mt, mt->patternStart, sizeof(unsigned)*(oldSize + 1), sizeof(unsigned)*(size + 1));
+	unsigned int* newPo = mt_growTable(mt, mt->patternOffset, sizeof(unsigned)*oldSize, sizeof(unsigned)*size);
+	unsigned int* newPc = mt_growTable(mt, mt->patternCapacity, sizeof(unsigned)*oldSize, sizeof(unsigned)*size);
+	Cell*** newPa = mt_growTable(mt, mt->pattern, sizeof(Cell**)*oldSize, sizeof(Cell**)*size);
+	ChannelState** newC = mt_growTable(mt, mt->channelStates, sizeof(ChannelState*)*oldSize, sizeof(ChannelState*)*size);
+
+	if (!newPs || !newPst || !newPo || !newPc || !newPa || !newC)
 	{
+		free(newPs);
+		free(newPst);
+		free(newPo);
+		free(newPc);
+		free(newPa);
+		free(newC);
 		return 0;
 	}
 
+	mt_retire(mt, mt->patternSize);
+	mt_retire(mt, mt->patternStart);
+	mt_retire(mt, mt->patternOffset);
+	mt_retire(mt, mt->patternCapacity);
+	mt_retire(mt, mt->pattern);
+	mt_retire(mt, mt->channelStates);
 	mt->patternSize = newPs;
+	mt->patternStart = newPst;
+	mt->patternOffset = newPo;
+	mt->patternCapacity = newPc;
 	mt->pattern = newPa;
 	mt->channelStates = newC;
 
+	mt->patternTableSize = size;
+	return 1;
+}
+
+/* Updates the song positions of the patterns following 'from', whose size or place changed */
+static void mt_updatePatternStarts(mtsynth* mt, unsigned from)
+{
+	if (!mt->patternStart)
+		return;
+
+	if (from == 0)
+		mt->patternStart[0] = 0;
+
+	for (unsigned i = from; i < mt->patternCount; i++)
+		mt->patternStart[i + 1] = mt->patternStart[i] + mt->patternSize[i];
+
+	mt->songRevision++;
+}
+
+int mt_resizePatterns(mtsynth* mt, unsigned count)
+{
+	if (count > MT_MAX_PATTERNS)
+		return 0;
+
+	if (mt->patternCount > 0 && count == 0)
+	{
+		mt->patternCount = 0;
+		mt->slabUsedRows = 0;
+		mt_updatePatternStarts(mt, 0);
+		return 1;
+	}
+
+	if (count < mt->patternCount && mt->pattern)
+	{
+		if (mt->order >= count)
+			mt->order = max(0, count - 1);
+	}
+
+	if (!mt_resizePatternTables(mt, count))
+	{
+		return 0;
+	}
+
 	unsigned oldPatternCount = mt->patternCount;
+
+	if (count > oldPatternCount && !mt_slabReserve(mt, count - oldPatternCount))
+	{
+		return 0;
+	}
+
 	mt->patternCount = count;
 
 	if (count > oldPatternCount)
@@ -1918,6 +3335,8 @@ int mt_resizePatterns(mtsynth* mt, unsigned count)
 			mt->pattern[i] = 0;
 			mt->channelStates[i] = 0;
 			mt->patternSize[i] = 0;
+			mt->patternCapacity[i] = 0;
+			mt->patternOffset[i] = 0;
 			if (!mt_resizePattern(mt, i, 1, 0))
 			{
 				return 0;
@@ -1925,7 +3344,7 @@ int mt_resizePatterns(mtsynth* mt, unsigned count)
 		}
 	}
 
-
+	mt_updatePatternStarts(mt, min(oldPatternCount, count));
 	mt->channelStatesDone = 0;
 	return 1;
 }
@@ -1933,11 +3352,20 @@ int mt_resizePatterns(mtsynth* mt, unsigned count)
 
 int mt_clearPattern(mtsynth* mt, unsigned pattern, unsigned rowStart, unsigned count)
 {
-	if (pattern >= mt->patternCount || rowStart > 255 || count > 256)
+	if (pattern >= mt->patternCount || rowStart + count > mt->patternCapacity[pattern])
 		return 0;
-	memset(&mt->pattern[pattern][rowStart], 255, count*sizeof(Cell)*FM_ch);
-	memset(&mt->channelStates[pattern][rowStart], 255, count*sizeof(ChannelState));
+	if (count == 0)
+		return 1;
+
+	/* The rows of a pattern are contiguous in the slabs */
+	memset(mt->pattern[pattern][rowStart], 255, count*sizeof(Cell)*mt->slabStride);
+	memset(mt->channelStates[pattern][rowStart].vol, 255, 2 * count*mt->slabStride);
+	for (unsigned row = rowStart; row < rowStart + count; row++)
+	{
+		mt->channelStates[pattern][row].tempo = 255;
+	}
 	mt->channelStatesDone = 0;
+	mt->songRevision++;
 	return 1;
 }
 
@@ -1948,17 +3376,24 @@ int mt_insertPattern(mtsynth* mt, unsigned rows, unsigned pos)
 		if (pos > mt->patternCount || !mt_resizePatterns(mt, mt->patternCount + 1))
 		return 0;
 	}
-	Cell(*newPtr)[24] = mt->pattern[mt->patternCount - 1];
+	Cell** newPtr = mt->pattern[mt->patternCount - 1];
 	ChannelState* newPtri = mt->channelStates[mt->patternCount - 1];
+	unsigned newOffset = mt->patternOffset[mt->patternCount - 1];
+	unsigned newCapacity = mt->patternCapacity[mt->patternCount - 1];
 
 	for (unsigned i = mt->patternCount - 1; i > pos; i--)
 	{
 		mt->pattern[i] = mt->pattern[i - 1];
 		mt->channelStates[i] = mt->channelStates[i - 1];
 		mt->patternSize[i] = mt->patternSize[i - 1];
+		mt->patternOffset[i] = mt->patternOffset[i - 1];
+		mt->patternCapacity[i] = mt->patternCapacity[i - 1];
 	}
 	mt->pattern[pos] = newPtr;
 	mt->channelStates[pos] = newPtri;
+	mt->patternSize[pos] = 1;
+	mt->patternOffset[pos] = newOffset;
+	mt->patternCapacity[pos] = newCapacity;
 
 	if (!mt_resizePattern(mt, pos, rows, 0))
 		return 0;
@@ -1978,16 +3413,20 @@ int mt_removePattern(mtsynth* mt, unsigned order)
 	}
 	else
 	{
-		free(mt->pattern[order]);
-		free(mt->channelStates[order]);
+		/* Give the rows back if it was the last pattern of the slabs, otherwise they wait for the next compaction */
+		if (mt->patternOffset[order] + mt->patternCapacity[order] == mt->slabUsedRows)
+			mt->slabUsedRows = mt->patternOffset[order];
+
 		for (unsigned i = order; i < mt->patternCount - 1; i++)
 		{
 			mt->pattern[i] = mt->pattern[i + 1];
 			mt->channelStates[i] = mt->channelStates[i + 1];
 			mt->patternSize[i] = mt->patternSize[i + 1];
+			mt->patternOffset[i] = mt->patternOffset[i + 1];
+			mt->patternCapacity[i] = mt->patternCapacity[i + 1];
 		}
 		mt->patternCount--;
-
+		mt_updatePatternStarts(mt, order);
 	}
 	mt->order = min(mt->order, mt->patternCount - 1);
 	mt->row = min(mt->row, mt->patternSize[mt->order] - 1);
@@ -2004,7 +3443,7 @@ int mt_resizePattern(mtsynth* mt, unsigned order, unsigned size, unsigned scaleC
 
 	int oldPatternSize = mt->patternSize[order];
 
-	size = clamp(size, 1, 256);
+	size = clamp(size, 1, MT_MAX_ROWS);
 
 	float scaleRatio = 0;
 	if (scaleContent)
@@ -2017,20 +3456,12 @@ int mt_resizePattern(mtsynth* mt, unsigned order, unsigned size, unsigned scaleC
 	{
 		for (int i = 0; i < mt->patternSize[order]; i++)
 		{
-			for (int ch = 0; ch < FM_ch; ch++)
+			for (int ch = 0; ch < mt->channelCount; ch++)
 				mt->pattern[order][(unsigned)round(i*0.5)][ch] = mt->pattern[order][i][ch];
 		}
 	}
 
-	Cell(*newP)[24] = realloc(mt->pattern[order], sizeof(Cell)*size*FM_ch);
-	ChannelState* newC = realloc(mt->channelStates[order], sizeof(ChannelState)*size);
-
-	if (newP && newC)
-	{
-		mt->pattern[order] = newP;
-		mt->channelStates[order] = newC;
-	}
-	else
+	if (size > mt->patternCapacity[order] && !mt_slabAllocPattern(mt, order, size))
 	{
 		return 0;
 	}
@@ -2048,12 +3479,14 @@ int mt_resizePattern(mtsynth* mt, unsigned order, unsigned size, unsigned scaleC
 	{
 		for (int i = oldPatternSize - 1; i >= 0; i--)
 		{
-			for (int ch = 0; ch < FM_ch; ch++)
+			for (int ch = 0; ch < mt->channelCount; ch++)
 				mt->pattern[order][(unsigned)(i*scaleRatio)][ch] = mt->pattern[order][i][ch];
 
-			memset(&mt->pattern[order][(unsigned)round(i*scaleRatio) + 1], 255, sizeof(Cell)*FM_ch);
+			if ((unsigned)round(i*scaleRatio) + 1 < size)
+				memset(mt->pattern[order][(unsigned)round(i*scaleRatio) + 1], 255, sizeof(Cell)*mt->slabStride);
 		}
 	}
+	mt_updatePatternStarts(mt, order);
 	mt->channelStatesDone = 0;
 	return 1;
 }
@@ -2142,6 +3575,14 @@ int mt_loadInstrumentFromMemory(mtsynth* mt, char *data, unsigned slot)
 	return 0;
 }
 
+int mt_loadInstrumentFromBuffer(mtsynth* mt, const char *data, unsigned len, unsigned slot)
+{
+	mt->readSeek = 0;
+	mt->totalFileSize = len;
+
+	return mt_loadInstrumentFromMemory(mt, (char*)data, slot);
+}
+
 
 int mt_loadInstrument(mtsynth* mt, const char* filename, unsigned slot)
 {
@@ -2231,7 +3672,7 @@ void mt_removeInstrument(mtsynth* mt, unsigned slot, int removeOccurences)
 		{
 			for (unsigned j = 0; j < mt->patternSize[i]; j++)
 			{
-				for (unsigned ch = 0; ch < FM_ch; ch++)
+				for (unsigned ch = 0; ch < mt->channelCount; ch++)
 				{
 					if (mt->pattern[i][j][ch].instr == slot)
 					{
@@ -2244,6 +3685,7 @@ void mt_removeInstrument(mtsynth* mt, unsigned slot, int removeOccurences)
 				}
 			}
 		}
+		mt->songRevision++;
 	}
 
 	if (mt->instrumentCount == 1)
@@ -2300,7 +3742,7 @@ void mt_movePattern(mtsynth* mt, int from, int to)
 	for (int j = from; j >to; j--)
 	{
 
-		Cell(*ptr)[24] = mt->pattern[j];
+		Cell** ptr = mt->pattern[j];
 		mt->pattern[j] = mt->pattern[j - 1];
 		mt->pattern[j - 1] = ptr;
 
@@ -2311,12 +3753,20 @@ void mt_movePattern(mtsynth* mt, int from, int to)
 		unsigned int size = mt->patternSize[j];
 		mt->patternSize[j] = mt->patternSize[j - 1];
 		mt->patternSize[j - 1] = size;
+
+		unsigned int offset = mt->patternOffset[j];
+		mt->patternOffset[j] = mt->patternOffset[j - 1];
+		mt->patternOffset[j - 1] = offset;
+
+		unsigned int capacity = mt->patternCapacity[j];
+		mt->patternCapacity[j] = mt->patternCapacity[j - 1];
+		mt->patternCapacity[j - 1] = capacity;
 	}
 
 	for (int j = from; j < to; j++)
 	{
 
-		Cell(*ptr)[24] = mt->pattern[j];
+		Cell** ptr = mt->pattern[j];
 		mt->pattern[j] = mt->pattern[j + 1];
 		mt->pattern[j + 1] = ptr;
 
@@ -2327,13 +3777,22 @@ void mt_movePattern(mtsynth* mt, int from, int to)
 		unsigned int size = mt->patternSize[j];
 		mt->patternSize[j] = mt->patternSize[j + 1];
 		mt->patternSize[j + 1] = size;
+
+		unsigned int offset = mt->patternOffset[j];
+		mt->patternOffset[j] = mt->patternOffset[j + 1];
+		mt->patternOffset[j + 1] = offset;
+
+		unsigned int capacity = mt->patternCapacity[j];
+		mt->patternCapacity[j] = mt->patternCapacity[j + 1];
+		mt->patternCapacity[j + 1] = capacity;
 	}
+	mt_updatePatternStarts(mt, min(from, to));
 	mt->channelStatesDone = 0;
 }
 
 void mt_moveChannels(mtsynth* mt, int from, int to)
 {
-	if (from < 0 || from >= FM_ch || to < 0 || to >= FM_ch)
+	if (from < 0 || from >= mt->channelCount || to < 0 || to >= mt->channelCount)
 		return;
 
 	/* Move pattern contents */
@@ -2398,7 +3857,20 @@ void mt_moveChannels(mtsynth* mt, int from, int to)
 		mt->ch[ch + 1] = channel;
 	}
 
+	/* Channels still playing the instrument copy of a song switch point to it in their previous slot */
+	for (int ch = min(from, to); ch <= max(from, to); ch++)
+	{
+		for (int j = min(from, to); j <= max(from, to); j++)
+		{
+			if (mt->ch[ch].instr == &mt->ch[j].songSwitchInstr)
+			{
+				mt->ch[ch].instr = &mt->ch[ch].songSwitchInstr;
+				break;
+			}
+		}
+	}
 
+	mt->songRevision++;
 	mt->channelStatesDone = 0;
 }
 
@@ -2424,6 +3896,59 @@ void mt_setChannelReverb(mtsynth *mt, int channel, int reverb)
 	mt->ch[channel].reverbSend = expVol[reverb];
 }
 
+unsigned mt_getUsedChannels(mtsynth* mt)
+{
+	unsigned used = 0;
+
+	for (unsigned i = 0; i < mt->patternCount; i++)
+	{
+		for (unsigned row = 0; row < mt->patternSize[i]; row++)
+		{
+			for (unsigned ch = mt->channelCount; ch > used; ch--)
+			{
+				if (!mt_isCellEmpty(&mt->pattern[i][row][ch - 1]))
+				{
+					used = ch;
+					break;
+				}
+			}
+		}
+	}
+	return used;
+}
+
+unsigned mt_setChannelCount(mtsynth* mt, unsigned count)
+{
+	count = clamp(count, max(1, mt_getUsedChannels(mt)), FM_ch);
+
+	/* The render skips the channels past the count : removed channels are cut, added ones start from the defaults */
+	for (unsigned ch = count; ch < mt->channelCount; ch++)
+	{
+		mt_cutChannel(mt, ch);
+	}
+	for (unsigned ch = mt->channelCount; ch < count; ch++)
+	{
+		mt_cutChannel(mt, ch);
+		mt_setChannelDefaults(mt, ch);
+		mt->ch[ch].initial_reverb = 0;
+	}
+
+	if (count != mt->channelCount)
+	{
+		int added = count > mt->channelCount;
+
+		/* Pattern rows hold one cell per channel, they are copied to the new count */
+		if (!mt_reshapePatterns(mt, count))
+			return mt->channelCount;
+		mt->songRevision++;
+
+		/* The tempo of each row depends on all the channels, the states are rebuilt for all of them */
+		if (added)
+			mt_buildStateTable(mt, 0, mt->patternCount, 0, count);
+	}
+	return count;
+}
+
 void mt_setTempo(mtsynth* mt, int tempo)
 {
 	tempo = clamp(tempo, 1, 255);
@@ -2449,10 +3974,11 @@ float mt_volumeToExp(int volume)
 
 int mt_write(mtsynth *mt, unsigned pattern, unsigned row, unsigned channel, Cell data)
 {
-	if (pattern >= mt->patternCount || row >= mt->patternSize[pattern] || channel >= FM_ch)
+	if (pattern >= mt->patternCount || row >= mt->patternSize[pattern] || channel >= mt->channelCount)
 		return 0;
 
 	struct Cell *current = &mt->pattern[pattern][row][channel];
+	mt->channelRevision[channel]++;
 
 	if (data.note != 255)
 		current->note = data.note;
@@ -2485,9 +4011,58 @@ int mt_getPatternSize(mtsynth *mt, int pattern)
 	return mt->patternSize[pattern];
 }
 
+int mt_getSongPosition(mtsynth *mt, unsigned pattern, int row)
+{
+	if (!mt->patternStart)
+		return row;
+	return mt->patternStart[min(pattern, mt->patternCount)] + row;
+}
+
+int mt_getPatternRow(mtsynth *mt, int position, unsigned *pattern, unsigned *row)
+{
+	if (mt->patternCount == 0)
+		return 0;
+
+	if (position <= 0)
+	{
+		*pattern = *row = 0;
+		return 1;
+	}
+
+	if (position >= mt->patternStart[mt->patternCount])
+	{
+		*pattern = mt->patternCount - 1;
+		*row = mt->patternSize[*pattern] - 1;
+		return 1;
+	}
+
+	/* Last pattern starting at or before the position */
+	unsigned first = 0, last = mt->patternCount - 1;
+	while (first < last)
+	{
+		unsigned middle = (first + last + 1) / 2;
+		if (mt->patternStart[middle] <= position)
+			first = middle;
+		else
+			last = middle - 1;
+	}
+
+	*pattern = first;
+	*row = position - mt->patternStart[first];
+	return 1;
+}
+
+void mt_cellsChanged(mtsynth *mt, int channel)
+{
+	if (channel >= 0 && channel < FM_ch)
+		mt->channelRevision[channel]++;
+	else
+		mt->songRevision++;
+}
+
 int mt_insertRows(mtsynth *mt, unsigned pattern, unsigned row, unsigned count)
 {
-	if (pattern >= mt->patternCount || row >= mt->patternSize[pattern] || mt->patternSize[pattern] + count > 256)
+	if (pattern >= mt->patternCount || row >= mt->patternSize[pattern] || mt->patternSize[pattern] + count > MT_MAX_ROWS)
 		return 0;
 
 	if (!mt_resizePattern(mt, pattern, mt->patternSize[pattern] + count, 0))
@@ -2495,11 +4070,11 @@ int mt_insertRows(mtsynth *mt, unsigned pattern, unsigned row, unsigned count)
 
 	mt->channelStatesDone = 0;
 
-	for (int i = mt->patternSize[pattern] - 1; i >= row; i--)
+	for (int i = mt->patternSize[pattern] - 1; i >= (int)(row + count); i--)
 	{
-		for (unsigned ch = 0; ch < FM_ch; ch++)
+		for (unsigned ch = 0; ch < mt->channelCount; ch++)
 		{
-			mt->pattern[mt->order][i][ch] = mt->pattern[mt->order][i - count][ch];
+			mt->pattern[pattern][i][ch] = mt->pattern[pattern][i - count][ch];
 		}
 	}
 
@@ -2515,7 +4090,7 @@ int mt_removeRows(mtsynth *mt, unsigned pattern, unsigned row, unsigned count)
 
 	for (int i = row; i < mt->patternSize[pattern] - count; i++)
 	{
-		for (unsigned ch = 0; ch < FM_ch; ch++)
+		for (unsigned ch = 0; ch < mt->channelCount; ch++)
 		{
 			mt->pattern[pattern][i][ch] = mt->pattern[pattern][i + count][ch];
 		}
@@ -2531,18 +4106,92 @@ int mt_removeRows(mtsynth *mt, unsigned pattern, unsigned row, unsigned count)
 
 int mt_isInstrumentUsed(mtsynth *mt, unsigned id)
 {
-	unsigned instrCount=0;
-
 	for (int j = 0; j < mt->patternCount; j++)
 	{
 		for (int k = 0; k < mt->patternSize[j]; k++)
 		{
-			for (int l = 0; l < FM_ch; l++)
+			for (int l = 0; l < mt->channelCount; l++)
 			{
 				if (mt->pattern[j][k][l].instr == id)
-					instrCount++;
+					return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+void mt_getUsedInstruments(mtsynth *mt, unsigned char used[32])
+{
+	memset(used, 0, 32);
+
+	for (unsigned i = 0; i < mt->patternCount; i++)
+	{
+		for (unsigned row = 0; row < mt->patternSize[i]; row++)
+		{
+			for (unsigned ch = 0; ch < mt->channelCount; ch++)
+			{
+				unsigned char instr = mt->pattern[i][row][ch].instr;
+				used[instr / 8] |= 1 << instr % 8;
+			}
+		}
+	}
+	/* 255 is an empty cell */
+	used[31] &= 0x7F;
+}
+
+unsigned mt_removeUnusedInstruments(mtsynth *mt, unsigned char removed[32])
+{
+	unsigned char used[32], newNumber[256];
+	unsigned kept = 0;
+
+	mt_getUsedInstruments(mt, used);
+
+	if (removed)
+		memset(removed, 0, 32);
+
+	/* A song using none keeps its first instrument */
+	unsigned usedCount = 0;
+	for (unsigned i = 0; i < mt->instrumentCount; i++)
+		usedCount += used[i / 8] >> i % 8 & 1;
+
+	if (usedCount == 0)
+		used[0] |= 1;
+
+	for (unsigned i = 0; i < 256; i++)
+	{
+		newNumber[i] = i;
+		if (i >= mt->instrumentCount)
+			continue;
+
+		if (used[i / 8] & 1 << i % 8)
+		{
+			mt->instrument[kept] = mt->instrument[i];
+			newNumber[i] = kept++;
+		}
+		else if (removed)
+		{
+			removed[i / 8] |= 1 << i % 8;
+		}
+	}
+
+	unsigned count = mt->instrumentCount - kept;
+	if (count == 0)
+		return 0;
+
+	/* Renumber the cells. Cells with an instrument past the list are left as they are */
+	for (unsigned i = 0; i < mt->patternCount; i++)
+	{
+		for (unsigned row = 0; row < mt->patternSize[i]; row++)
+		{
+			for (unsigned ch = 0; ch < mt->channelCount; ch++)
+			{
+				Cell *cell = &mt->pattern[i][row][ch];
+				cell->instr = newNumber[cell->instr];
 			}
 		}
 	}
-	return instrCount >0;
+	mt->songRevision++;
+
+	mt_resizeInstrumentList(mt, kept);
+	return count;
 }
@@ -5,14 +5,20 @@ extern "C"{
 #ifndef MTLIB_H
 #define MTLIB_H
 
-	/* Number of channels (polyphony) */
-#define FM_ch 24
+	/* Maximum number of channels (polyphony). Each song uses mt->channelCount of them, see mt_setChannelCount */
+#define FM_ch 64
+	/* Channels of new songs, and of the songs saved before the channel count was stored */
+#define FM_chDefault 24
 	/* Number of operators */
 #define FM_op 6
+	/* Song size limits. Instruments are numbered with a byte in the cells, 255 meaning no instrument */
+#define MT_MAX_PATTERNS 65536
+#define MT_MAX_ROWS 1024
+#define MT_MAX_INSTRUMENTS 255
 
 
 	enum{ FM_NOTE, FM_INSTR, FM_VOL, FM_FXTYPE, FM_FXVALUE };
-	enum { MT_ERR_FILEIO = -1, MT_ERR_FILECORRUPTED = -2, MT_ERR_FILEVERSION = -3 };
+	enum { MT_ERR_FILEIO = -1, MT_ERR_FILECORRUPTED = -2, MT_ERR_FILEVERSION = -3, MT_ERR_CANCELLED = -4 };
 	enum fmInstrumentFlags{FM_INSTR_LFORESET=1, FM_INSTR_SMOOTH=2, FM_INSTR_TRANSPOSABLE=4};
 	enum mtRenderTypes{MT_RENDER_8, MT_RENDER_16, MT_RENDER_24, MT_RENDER_32, MT_RENDER_FLOAT, MT_RENDER_PAD32=64};
 	typedef struct fm_instrument_operator
@@ -89,11 +95,13 @@ extern "C"{
 	}Cell;
 
 
+	/* Playback state at the start of a row. vol and pan hold one entry per channel of the song, they point into
+		mtsynth.mixSlab */
 	typedef struct ChannelState{
 		float time;
 		unsigned char tempo;
-		unsigned char vol[FM_ch];
-		unsigned char pan[FM_ch];
+		unsigned char *vol;
+		unsigned char *pan;
 	}ChannelState;
 
 	typedef struct fm_operator{
@@ -128,6 +136,42 @@ extern "C"{
 	}fm_operator;
 
 
+	/* Not reached row in mtFreeze.rowOffset */
+#define MT_FREEZE_NOROW 0xFFFFFFFF
+
+	/* Samples per block of a freeze */
+#define MT_FREEZE_BLOCK_BITS 12
+#define MT_FREEZE_BLOCK (1 << MT_FREEZE_BLOCK_BITS)
+
+	/* Frozen channel : the output of a channel rendered once for the whole song, played back instead of synthesizing
+		the channel (see mt_freezeBegin). Samples are taken before panning and reverb send, which are still applied live.
+		They are stored as 16 bit blocks of MT_FREEZE_BLOCK samples, silent blocks aren't allocated (NULL) */
+	typedef struct mtFreeze{
+		short **blocks;
+		unsigned blockCount;
+		float scale;
+		unsigned length, position;
+
+		/* First sample and tempo of each song row (patternStart[order] + row), MT_FREEZE_NOROW if not reached */
+		unsigned *rowOffset;
+		unsigned char *rowTempo;
+		unsigned rows;
+
+		unsigned channel, sampleRate;
+		int stale;
+
+		/* What the recording depends on (see mt_freezeMatches) : checksums of the channel cells, and of the instruments
+		they use (usedInstruments bits) with the song settings */
+		unsigned cellSignature, settingsSignature;
+		unsigned char usedInstruments[32];
+
+		/* While recording : float samples, converted to 16 bit by mt_freezeEnd */
+		int recording;
+		float *record;
+		unsigned capacity;
+	}mtFreeze;
+
+
 	typedef struct fm_channel{
 		int newNote;
 
@@ -178,6 +222,13 @@ extern "C"{
 		fm_instrument* cInstr;
 		fm_operator op[FM_op];
 
+		/* Copy of the channel instrument, made when the song is switched (mt_swapSong, mt_queueSong) so the notes
+		still sounding don't use the instruments of the previous song */
+		fm_instrument songSwitchInstr;
+
+		/* Freeze played back or recorded by the channel, NULL when the channel is synthesized */
+		mtFreeze *freeze;
+
 	}fm_channel;
 
 
@@ -200,7 +251,7 @@ extern "C"{
 		unsigned allpassPhaseL, allpassPhaseR, allpassPhaseL2, allpassPhaseR2;
 
 		unsigned allpassMod, allpassMod2, reverbMod1, reverbMod2, reverbMod3, reverbMod4;
-		unsigned revOffset2, revOffset3, revOffset4, revOffset5, revOffset6, revOffset7;
+		unsigned revOffset1, revOffset2, revOffset3, revOffset4, revOffset5, revOffset6, revOffset7;
 
 		float reverbRoomSize, initialReverbRoomSize;
 		float reverbLength, initialReverbLength;
@@ -210,9 +261,38 @@ extern "C"{
 
 		float noConnect;
 		ChannelState **channelStates;
-		Cell(**pattern)[FM_ch];
+		Cell ***pattern;
 		unsigned patternCount;
 		unsigned *patternSize;
+
+		/* Song position (in rows) of the first row of each pattern : patternCount+1 entries, the last one being
+		the song length. Kept up to date by the functions changing pattern sizes or order */
+		unsigned *patternStart;
+
+		/* Bumped when pattern cells change, so song wide indexes only rebuild what changed : songRevision when
+		any channel may have changed (pattern operations, loading), channelRevision[ch] for single channel edits */
+		unsigned songRevision, channelRevision[FM_ch];
+
+		/* Pattern storage : all cells and channel states are stored in slabs (see mt_compactPatterns), with rows of
+		slabStride cells (the song's channelCount). pattern[i] and channelStates[i] point into them, at row patternOffset[i] */
+		Cell *cellSlab;
+		Cell **rowSlab;
+		ChannelState *stateSlab;
+		unsigned char *mixSlab;
+		unsigned slabStride, slabRows, slabUsedRows;
+		unsigned *patternOffset, *patternCapacity;
+
+		/* Entries allocated in the per pattern tables, they grow by doubling */
+		unsigned patternTableSize;
+
+		/* Slabs and tables replaced while the audio thread may still be reading them, with the renderCount at
+		the time. They are freed once a later mt_render call started (see mt_freeRetired) */
+		void **retired;
+		unsigned *retiredRenderCount;
+		unsigned retiredCount, retiredSize;
+
+		/* mt_render calls so far */
+		volatile unsigned renderCount;
 		unsigned frameTimer;
 		float frameTimerFx;
 
@@ -227,9 +307,16 @@ extern "C"{
 
 		fm_channel ch[FM_ch];
 
+		/* Channels used by the song, 1 to FM_ch. Only these are read, rendered and saved : the other ones stay
+		silent and their cells empty, so a song costs what it uses */
+		unsigned channelCount;
+
 		float transitionSpeed;
 		int tempRow, tempOrder;
 		unsigned readSeek, totalFileSize;
+
+		/* Song taking over at the end of the playing one (mt_queueSong). Read by the render once per row */
+		struct mtsynth *volatile queuedSong;
 	}mtsynth;
 
 
@@ -285,13 +372,13 @@ extern "C"{
 	/** Play a note
 		@param instrument : instrument number, 0-255
 		@param note : midi note number, 0-127 (C0 - G10)
-		@param channel : channel number, 0-23
+		@param channel : channel number, below mt->channelCount
 		@param volume : volume, 0-99
 		*/
 	void mt_playNote(mtsynth* mt, unsigned instrument, unsigned note, unsigned channel, unsigned volume);
 
 	/** Stops a note on a channel
-		@param channel : channel number, 0-23
+		@param channel : channel number, below mt->channelCount
 		*/
 	void mt_stopNote(mtsynth* mt, unsigned channel);
 
@@ -335,20 +422,31 @@ extern "C"{
 		*/
 	int mt_setSampleRate(mtsynth* mt, int samplerate);
 
+	/** Set the number of channels used by the song. It can't be lowered below the last channel having cells,
+		the notes playing on the removed channels are cut. Pattern rows hold one cell per channel : changing the count
+		copies the patterns
+		@param count : 1 to FM_ch
+		@return the channel count set
+		*/
+	unsigned mt_setChannelCount(mtsynth* mt, unsigned count);
+
+	/* Number of channels having cells, 0 if the song is empty */
+	unsigned mt_getUsedChannels(mtsynth* mt);
+
 	/** Set channel volume
-		@param channel : channel number, 0-23
+		@param channel : channel number, below mt->channelCount
 		@param volume : volume, 0-99
 		*/
 	void mt_setChannelVolume(mtsynth *mt, int channel, int volume);
 
 	/** Set channel panning
-		@param channel : channel number, 0-23
+		@param channel : channel number, below mt->channelCount
 		@param panning : panning, 0-255
 		*/
 	void mt_setChannelPanning(mtsynth *mt, int channel, int panning);
 
 	/** Set channel reverb
-		@param channel : channel number, 0-23
+		@param channel : channel number, below mt->channelCount
 		@param panning : reverb amount, 0-99
 		*/
 	void mt_setChannelReverb(mtsynth *mt, int channel, int reverb);
@@ -364,9 +462,9 @@ extern "C"{
 	int mt_write(mtsynth *mt, unsigned pattern, unsigned row, unsigned channel, Cell data);
 
 	/** Create a new pattern at the desired position
-		@param rows : number of rows
+		@param rows : number of rows, up to MT_MAX_ROWS
 		@param position : the position where to insert the pattern
-		@return 1 if success, 0 if failed
+		@return 1 if success, 0 if failed (out of memory, or MT_MAX_PATTERNS patterns)
 		*/
 	int mt_insertPattern(mtsynth* mt, unsigned rows, unsigned position);
 
@@ -378,7 +476,7 @@ extern "C"{
 
 	/** Resize a pattern. Contents are not stretched/scaled.
 		@param pattern : the pattern number
-		@param size : the new size
+		@param size : the new size, clamped to 1-MT_MAX_ROWS
 		@return 1 if success, 0 if failed
 		*/
 	int mt_resizePattern(mtsynth* mt, unsigned pattern, unsigned size, unsigned scaleContent);
@@ -400,14 +498,42 @@ extern "C"{
 
 	int mt_getPatternSize(mtsynth *mt, int pattern);
 
+	/** Song position of a pattern row, in rows from the song start
+		@param row : may be out of the pattern, positions before/after it are counted from its first row
+		*/
+	int mt_getSongPosition(mtsynth *mt, unsigned pattern, int row);
+
+	/** Pattern and row at a song position. Positions out of the song are clamped to its first/last row
+		@return 1 if success, 0 if the song has no pattern
+		*/
+	int mt_getPatternRow(mtsynth *mt, int position, unsigned *pattern, unsigned *row);
+
+	/** Marks cells written directly into mt->pattern as changed
+		@param channel : the edited channel, -1 if any channel may have changed
+		*/
+	void mt_cellsChanged(mtsynth *mt, int channel);
+
 	int mt_resizeInstrumentList(mtsynth* mt, unsigned size);
 	void mt_portamento(mtsynth* mt, unsigned channel, float value);
 
 
 	void mt_patternClear(mtsynth* mt);
 	int mt_resizePatterns(mtsynth* mt, unsigned count);
+
+	/** Store all patterns contiguously in song order, releasing the rows left unused by pattern resizes/moves
+		@return 1 if success, 0 if failed (out of memory, patterns are kept as they were)
+		*/
+	int mt_compactPatterns(mtsynth* mt);
+
+	/** Frees the pattern memory replaced by edits (growing slabs and tables) once the audio thread can't be reading it
+		anymore. Call regularly from the thread editing the song
+		@param notRendering : set when no audio callback is running, everything is freed
+		*/
+	void mt_freeRetired(mtsynth* mt, int notRendering);
 	int mt_loadInstrument(mtsynth* mt, const char *filename, unsigned slot);
 	int mt_loadInstrumentFromMemory(mtsynth* mt, char *data, unsigned slot);
+	/* Loads an instrument from the image of a .mdti file of length len */
+	int mt_loadInstrumentFromBuffer(mtsynth* mt, const char *data, unsigned len, unsigned slot);
 	int mt_loadInstrumentBank(mtsynth* mt, const char *filename);
 	int mt_loadInstrumentBankFromMemory(mtsynth* mt, char *data);
 	int mt_saveInstrument(mtsynth* mt, const char* filename, unsigned slot);
@@ -416,6 +542,49 @@ extern "C"{
 	void mt_movePattern(mtsynth* mt, int from, int to);
 	/* Saves the song to file */
 	int mt_saveSong(mtsynth* mt, const char* filename);
+	/* Copies the song data (settings, patterns and instruments) of src into dst. Patterns that didn't change since
+		the previous copy into dst are not rewritten, so copying repeatedly into the same dst is cheap. The state table
+		of dst is rebuilt when the cells or settings it depends on changed, so dst can be played or seeked right away
+		@return 1 if success, 0 if failed (out of memory) */
+	int mt_copySong(mtsynth* dst, mtsynth* src);
+	/* Exchanges the song data (settings, patterns and instruments) of mt and song, and rewinds mt to the song start
+		with a hard cut. Only pointers are exchanged : nothing is allocated or copied, so a song loaded into another synth
+		can be swapped in from the audio thread between two render blocks. The old song is left in 'song' */
+	void mt_swapSong(mtsynth* mt, mtsynth* song);
+	/** Queues the song loaded into 'next' to follow the playing song without a gap (playlists, game music).
+		Load 'next' with mt_loadSong from any thread but the audio one, then queue it : its state table is built here.
+		When the playing song ends (after mt->looping loops, or at the first loop if looping is -1), the render swaps
+		the songs at that row like mt_swapSong, but without cutting the notes : release tails and reverb go on into the
+		new song, which starts at its first row on the next tick with its own tempo, volumes and reverb settings. Nothing is allocated on the audio thread.
+		Once the switch is done, mt_isSongQueued returns 0 and 'next' holds the previous song, ready to load the following one.
+		@param next : the song to play next, NULL to cancel the queued song
+		@return 1 if queued, 0 if 'next' has no patterns */
+	int mt_queueSong(mtsynth* mt, mtsynth* next);
+	/* Returns 1 while a song queued with mt_queueSong is waiting for the end of the playing one */
+	int mt_isSongQueued(mtsynth* mt);
+
+	/** Starts freezing a channel : the song is played from the start with the other channels muted, and the output
+		of the channel is recorded by mt_freezeStep. Use a copy of the song (mt_copySong), so it can be done in a
+		background thread while the song is edited and played.
+		@return the freeze being recorded, NULL if out of memory */
+	mtFreeze* mt_freezeBegin(mtsynth* mt, unsigned channel);
+	/** Records the next 'frames' samples of the frozen channel
+		@return 1 while the song plays, 0 at the end of the song, -1 if out of memory */
+	int mt_freezeStep(mtsynth* mt, mtFreeze* freeze, unsigned frames);
+	/** Ends the recording : the samples are converted to 16 bit and the freeze is detached from mt
+		@return 1 if success, 0 if out of memory (the freeze is then stale) */
+	int mt_freezeEnd(mtsynth* mt, mtFreeze* freeze);
+	/* Frees a freeze. It must not be attached to a channel anymore */
+	void mt_freezeDestroy(mtFreeze* freeze);
+	/** Sets the freeze played back by a channel, NULL to synthesize it again. Call it from the audio thread, or while
+		mt isn't rendered. While the song plays, the channel plays the freeze instead of synthesizing its notes. Rows
+		played at another tempo than when they were recorded make the freeze stale : the channel is synthesized again */
+	void mt_setChannelFreeze(mtsynth* mt, unsigned channel, mtFreeze* freeze);
+	/** Checks if a freeze still matches the song : its instruments and the song settings are always checked, the cells
+		of the channel (which takes longer) only if checkCells is set. Tempo changes in other channels aren't checked,
+		they make the freeze stale when played.
+		@return 1 if the freeze matches, 0 if it is outdated */
+	int mt_freezeMatches(mtsynth* mt, mtFreeze* freeze, int checkCells);
 
 
 	void mt_buildStateTable(mtsynth* mt, unsigned orderStart, unsigned orderEnd, unsigned channelStart, unsigned channelEnd);
@@ -432,6 +601,18 @@ extern "C"{
 	float mt_volumeToExp(int volume);
 
 	int mt_isInstrumentUsed(mtsynth *mt, unsigned id);
+
+	/** Lists the instruments used in the cells, in a single pass over the song
+		@param used : bitmap of MT_MAX_INSTRUMENTS bits, bit i set if instrument i is used
+		*/
+	void mt_getUsedInstruments(mtsynth *mt, unsigned char used[32]);
+
+	/** Removes the instruments no cell uses and renumbers the cells, in two passes over the song whatever the
+		number of instruments removed. At least one instrument is kept
+		@param removed : if not NULL, bitmap of the removed instruments, by their number before the removal
+		@return the number of instruments removed
+		*/
+	unsigned mt_removeUnusedInstruments(mtsynth *mt, unsigned char removed[32]);
 	void mt_createDefaultInstrument(mtsynth* mt, unsigned slot);
 #endif
 
@@ -0,0 +1,200 @@
+#include "profiler.hpp"
+#include "../gui/gui.hpp"
+#include "../globalFunctions.hpp"
+#include <stdio.h>
+
+/* Frames kept for the averages and the histogram */
+#define PROFILER_HISTORY 120
+
+/* Histogram scale, and the frame time of a 60 Hz display shown as a line */
+#define PROFILER_PIXELS_PER_MS 3
+#define PROFILER_TARGET_MS 16.667f
+
+bool profilerEnabled = false;
+unsigned profilerDrawCalls = 0, profilerVertices = 0;
+
+static const char *phaseNames[PROFILE_PHASES] = { "input", "update", "popup events", "state draw", "sidebar draw", "popup draw", "display" };
+
+static bool overlayVisible = false;
+static FILE *trace = NULL;
+static bool traceFirstEvent = true;
+
+static sf::Clock profileClock;
+static sf::Int64 frameStart, phaseStart;
+static int currentPhase = -1;
+
+/* Last frames, in ms : frameTimes[history] and phaseTimes[history][phase] */
+static float frameTimes[PROFILER_HISTORY];
+static float phaseTimes[PROFILER_HISTORY][PROFILE_PHASES];
+static unsigned history = 0, historyCount = 0;
+static unsigned lastDrawCalls, lastVertices;
+
+static void updateEnabled()
+{
+	profilerEnabled = overlayVisible || trace;
+}
+
+static void traceEvent(const char *name, sf::Int64 start, sf::Int64 duration)
+{
+	fprintf(trace, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"dur\":%lld}", traceFirstEvent ? "" : ",\n",
+		name, (long long)start, (long long)duration);
+	traceFirstEvent = false;
+}
+
+void profiler_initialize(const std::string &traceFile)
+{
+	if (traceFile.empty())
+		return;
+
+	trace = fopen(traceFile.c_str(), "w");
+	if (!trace)
+	{
+		fprintf(stderr, "profiler: can't write %s\n", traceFile.c_str());
+		return;
+	}
+	fprintf(trace, "{\"traceEvents\":[\n");
+	updateEnabled();
+}
+
+void profiler_exit()
+{
+	if (trace)
+	{
+		fprintf(trace, "\n]}\n");
+		fclose(trace);
+		trace = NULL;
+	}
+	updateEnabled();
+}
+
+void profiler_toggleOverlay()
+{
+	overlayVisible = !overlayVisible;
+	historyCount = 0;
+	updateEnabled();
+}
+
+void profiler_beginFrame(int phase)
+{
+	if (!profilerEnabled)
+		return;
+
+	frameStart = phaseStart = profileClock.getElapsedTime().asMicroseconds();
+	currentPhase = phase;
+	profilerDrawCalls = profilerVertices = 0;
+
+	for (unsigned i = 0; i < PROFILE_PHASES; i++)
+		phaseTimes[history][i] = 0;
+}
+
+void profiler_phase(int phase)
+{
+	if (!profilerEnabled || currentPhase < 0)
+		return;
+
+	sf::Int64 now = profileClock.getElapsedTime().asMicroseconds();
+
+	phaseTimes[history][currentPhase] += (now - phaseStart) / 1000.f;
+	if (trace)
+		traceEvent(phaseNames[currentPhase], phaseStart, now - phaseStart);
+
+	phaseStart = now;
+	currentPhase = phase;
+}
+
+void profiler_endFrame()
+{
+	if (!profilerEnabled || currentPhase < 0)
+		return;
+
+	profiler_phase(-1);
+
+	sf::Int64 now = profileClock.getElapsedTime().asMicroseconds();
+	frameTimes[history] = (now - frameStart) / 1000.f;
+
+	if (trace)
+	{
+		traceEvent("frame", frameStart, now - frameStart);
+		fprintf(trace, ",\n{\"name\":\"draws\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%lld,\"args\":{\"calls\":%u,\"vertices\":%u}}",
+			(long long)frameStart, profilerDrawCalls, profilerVertices);
+	}
+
+	lastDrawCalls = profilerDrawCalls;
+	lastVertices = profilerVertices;
+
+	history = (history + 1) % PROFILER_HISTORY;
+	historyCount = min(historyCount + 1, PROFILER_HISTORY);
+}
+
+void profiler_draw()
+{
+	if (!overlayVisible || historyCount == 0)
+		return;
+
+	unsigned last = (history + PROFILER_HISTORY - 1) % PROFILER_HISTORY;
+
+	float average[PROFILE_PHASES] = {0};
+	float frameAverage = 0, frameMax = 0;
+
+	for (unsigned i = 0; i < historyCount; i++)
+	{
+		unsigned index = (history + PROFILER_HISTORY - 1 - i) % PROFILER_HISTORY;
+		for (unsigned p = 0; p < PROFILE_PHASES; p++)
+			average[p] += phaseTimes[index][p] / historyCount;
+		frameAverage += frameTimes[index] / historyCount;
+		frameMax = max(frameMax, frameTimes[index]);
+	}
+
+	char line[128];
+	string s;
+	snprintf(line, sizeof(line), "frame         %6.2f ms  avg %6.2f  max %6.2f\n\n", frameTimes[last], frameAverage, frameMax);
+	s += line;
+	for (unsigned p = 0; p < PROFILE_PHASES; p++)
+	{
+		snprintf(line, sizeof(line), "%-13s %6.2f ms  avg %6.2f\n", phaseNames[p], phaseTimes[last][p], average[p]);
+		s += line;
+	}
+	snprintf(line, sizeof(line), "\n%u draw calls, %u vertices", lastDrawCalls, lastVertices);
+	s += line;
+
+	const int width = PROFILER_HISTORY * 3;
+	const int graphHeight = 100;
+	int x = windowWidth - width - 20;
+	int y = 40;
+
+	Text text(s, font, charSize);
+	text.setFillColor(colors[BLOCKTEXT]);
+	text.setPosition(x + 8, y + 8);
+
+	RectangleShape bg(Vector2f(width + 16, text.getLocalBounds().height + graphHeight + 40));
+	bg.setPosition(x, y);
+	bg.setFillColor(Color(0, 0, 0, 200));
+
+	/* Frame time histogram, oldest frame first. Frames slower than a 60 Hz refresh are highlighted */
+	int graphBottom = y + bg.getSize().y - 8;
+	VertexArray bars(sf::Quads, historyCount * 4 + 4);
+
+	for (unsigned i = 0; i < historyCount; i++)
+	{
+		unsigned index = (history + PROFILER_HISTORY - historyCount + i) % PROFILER_HISTORY;
+		float h = min<float>(graphHeight, frameTimes[index] * PROFILER_PIXELS_PER_MS);
+		Color c = frameTimes[index] > PROFILER_TARGET_MS ? colors[VUMETERBARHIGH] : colors[VUMETERBARLOW];
+		float bx = x + 8 + i * 3;
+
+		bars[i * 4] = Vertex(Vector2f(bx, graphBottom - h), c);
+		bars[i * 4 + 1] = Vertex(Vector2f(bx + 2, graphBottom - h), c);
+		bars[i * 4 + 2] = Vertex(Vector2f(bx + 2, graphBottom), c);
+		bars[i * 4 + 3] = Vertex(Vector2f(bx, graphBottom), c);
+	}
+
+	float targetY = graphBottom - PROFILER_TARGET_MS * PROFILER_PIXELS_PER_MS;
+	Vertex *target = &bars[historyCount * 4];
+	target[0] = Vertex(Vector2f(x + 8, targetY), colors[BLOCKTEXT]);
+	target[1] = Vertex(Vector2f(x + 8 + width, targetY), colors[BLOCKTEXT]);
+	target[2] = Vertex(Vector2f(x + 8 + width, targetY + 1), colors[BLOCKTEXT]);
+	target[3] = Vertex(Vector2f(x + 8, targetY + 1), colors[BLOCKTEXT]);
+
+	window->draw(bg);
+	window->draw(bars);
+	window->draw(text);
+}
@@ -0,0 +1,80 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <SFML/Graphics.hpp>
+#include <string>
+
+/* GUI frame profiler
+
+	The main loop marks the phases of each frame. F12 toggles an overlay with the time spent in each phase
+	(last frame and average), a histogram of the recent frame times and the draw calls/vertices of the last frame.
+	Started with --profile <file>, every frame is also written to a trace file in the Chrome trace event format
+	(chrome://tracing, ui.perfetto.dev). When neither is enabled, marking phases and counting draws costs a test. */
+
+enum profilerPhases{
+	PROFILE_INPUT,
+	PROFILE_UPDATE,
+	PROFILE_POPUPEVENTS,
+	PROFILE_STATEDRAW,
+	PROFILE_SIDEBARDRAW,
+	PROFILE_POPUPDRAW,
+	PROFILE_DISPLAY,
+	PROFILE_PHASES
+};
+
+/* Set while the overlay is shown or a trace is written */
+extern bool profilerEnabled;
+
+/* Starts writing the trace file, empty : no trace */
+void profiler_initialize(const std::string &traceFile);
+
+/* Closes the trace file */
+void profiler_exit();
+
+void profiler_toggleOverlay();
+
+/* Starts a frame, in its first phase */
+void profiler_beginFrame(int phase);
+
+/* Ends the current phase and starts the next one */
+void profiler_phase(int phase);
+
+void profiler_endFrame();
+
+extern unsigned profilerDrawCalls, profilerVertices;
+
+/* Counts draw calls sent to the window this frame */
+inline void profiler_countDraw(unsigned vertices, unsigned calls = 1)
+{
+	if (profilerEnabled)
+	{
+		profilerDrawCalls += calls;
+		profilerVertices += vertices;
+	}
+}
+
+/* Counts a drawable, with the vertices SFML sends for it (sf::Text : 6 per character, an approximation
+	as spaces and new lines have none. Shapes with an outline take two calls) */
+inline void profiler_count(const sf::VertexArray &v) { profiler_countDraw(v.getVertexCount()); }
+inline void profiler_count(const sf::Text &t) { profiler_countDraw(t.getString().getSize() * 6); }
+inline void profiler_count(const sf::Sprite &s) { profiler_countDraw(4); }
+inline void profiler_count(const sf::Shape &s)
+{
+	if (s.getOutlineThickness() != 0)
+		profiler_countDraw(s.getPointCount() + 2 + (s.getPointCount() + 1) * 2, 2);
+	else
+		profiler_countDraw(s.getPointCount() + 2);
+}
+
+/* target->draw, counted by the profiler */
+template <class T>
+inline void profiler_draw(sf::RenderTarget *target, const T &drawable)
+{
+	target->draw(drawable);
+	profiler_count(drawable);
+}
+
+/* Draws the overlay, in the current view */
+void profiler_draw();
+
+#endif
@@ -0,0 +1,162 @@
+#ifdef MUDTRACKER_RT_CHECK
+
+#include "rtcheck.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <unistd.h>
+
+/* glibc entry points, used to forward the interposed allocator calls */
+extern "C" {
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t count, size_t size);
+	void *__libc_realloc(void *ptr, size_t size);
+	void __libc_free(void *ptr);
+}
+
+enum rtViolations{ RT_MALLOC, RT_CALLOC, RT_REALLOC, RT_FREE, RT_MUTEX, RT_VIOLATIONS };
+
+static const char *violationNames[RT_VIOLATIONS] = { "malloc", "calloc", "realloc", "free", "pthread_mutex_lock" };
+
+static std::atomic<unsigned long> violations[RT_VIOLATIONS];
+static std::atomic<unsigned long> denormals, callbacks;
+
+/* Set while the current thread runs the audio callback */
+static __thread int inAudioCallback;
+/* Avoid reporting the allocations made while reporting */
+static __thread int reporting;
+
+static int(*real_pthread_mutex_lock)(pthread_mutex_t*);
+static int abortOnViolation;
+
+static void rtcheck_violation(int type)
+{
+	if (!inAudioCallback || reporting)
+		return;
+
+	reporting = 1;
+	violations[type]++;
+
+	char message[128];
+	int length = snprintf(message, sizeof(message), "rtcheck: %s called from the audio callback\n", violationNames[type]);
+	if (write(STDERR_FILENO, message, length) < 0)
+		length = 0;
+
+	void *frames[32];
+	int frameCount = backtrace(frames, 32);
+	backtrace_symbols_fd(frames, frameCount, STDERR_FILENO);
+
+	if (abortOnViolation)
+		abort();
+
+	reporting = 0;
+}
+
+extern "C" void *malloc(size_t size)
+{
+	rtcheck_violation(RT_MALLOC);
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	rtcheck_violation(RT_CALLOC);
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+	rtcheck_violation(RT_REALLOC);
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+	if (ptr)
+		rtcheck_violation(RT_FREE);
+	__libc_free(ptr);
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	rtcheck_violation(RT_MUTEX);
+
+	if (!real_pthread_mutex_lock)
+		real_pthread_mutex_lock = (int(*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+
+	return real_pthread_mutex_lock(mutex);
+}
+
+/* Looks at the bits, because comparisons are unreliable if the thread has DAZ enabled */
+static inline int isDenormal(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return (bits & 0x7f800000) == 0 && (bits & 0x007fffff) != 0;
+}
+
+void rtcheck_initialize()
+{
+	const char *mode = getenv("MUDTRACKER_RT_CHECK");
+	abortOnViolation = mode && strcmp(mode, "abort") == 0;
+
+	real_pthread_mutex_lock = (int(*)(pthread_mutex_t*))dlsym(RTLD_NEXT, "pthread_mutex_lock");
+
+	/* The first backtrace() call loads the unwinder, which allocates : do it now rather than in the audio thread */
+	void *frames[4];
+	backtrace(frames, 4);
+
+	fprintf(stderr, "rtcheck: real-time checker enabled%s\n", abortOnViolation ? ", aborting on violation" : "");
+}
+
+void rtcheck_enterAudioCallback()
+{
+	inAudioCallback = 1;
+}
+
+void rtcheck_leaveAudioCallback(mtsynth *mt)
+{
+	unsigned long count = 0;
+
+	for (unsigned i = 0; i < mt->revBufSize; i++)
+	{
+		count += isDenormal(mt->revBuf[i]);
+	}
+
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		fm_channel *c = &mt->ch[ch];
+		count += isDenormal(c->lastRender) + isDenormal(c->fadeFrom) + isDenormal(c->lfo) + isDenormal(c->currentEnvLevel);
+
+		for (unsigned op = 0; op < FM_op; op++)
+		{
+			count += isDenormal(c->op[op].out) + isDenormal(c->op[op].env) + isDenormal(c->op[op].amp) + isDenormal(c->op[op].ampDelta);
+		}
+	}
+
+	denormals += count;
+	callbacks++;
+	inAudioCallback = 0;
+}
+
+int rtcheck_report()
+{
+	unsigned long total = 0;
+
+	fprintf(stderr, "rtcheck: %lu audio callbacks checked\n", callbacks.load());
+	for (int i = 0; i < RT_VIOLATIONS; i++)
+	{
+		fprintf(stderr, "rtcheck: %-20s %lu\n", violationNames[i], violations[i].load());
+		total += violations[i];
+	}
+	fprintf(stderr, "rtcheck: %-20s %lu\n", "denormals", denormals.load());
+
+	return total > 0 || denormals > 0;
+}
+
+#endif
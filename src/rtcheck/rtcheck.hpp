@@ -0,0 +1,32 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+#include "../mtengine/mtlib.h"
+
+/* Real-time safety checker for the audio callback, enabled with the MUDTRACKER_RT_CHECK CMake option.
+	While the audio thread is inside the callback, any malloc/calloc/realloc/free or mutex lock is reported
+	with a stack trace, and denormal floats left in the synth state are counted.
+	Without the option, everything compiles to nothing. */
+
+#ifdef MUDTRACKER_RT_CHECK
+
+void rtcheck_initialize();
+
+void rtcheck_enterAudioCallback();
+
+void rtcheck_leaveAudioCallback(mtsynth *mt);
+
+/* Prints a summary of the violations
+	@return 1 if any violation or denormal was found, 0 otherwise (used as exit code) */
+int rtcheck_report();
+
+#else
+
+inline void rtcheck_initialize() {}
+inline void rtcheck_enterAudioCallback() {}
+inline void rtcheck_leaveAudioCallback(mtsynth *mt) {}
+inline int rtcheck_report() { return 0; }
+
+#endif
+
+#endif
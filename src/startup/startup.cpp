@@ -0,0 +1,158 @@
+#include "startup.hpp"
+#include "../globalFunctions.hpp"
+#include "../views/settings/configEditor.hpp"
+#include "../views/pattern/songFileActions.hpp"
+#include "../autosave/autosave.hpp"
+#include "portmidi.h"
+#include <atomic>
+#include <stdio.h>
+#include <vector>
+
+struct startupStep{
+	const char *name;
+	sf::Int64 time;
+};
+
+static bool report = false;
+static sf::Clock startupClock;
+static std::vector<startupStep> steps;
+
+static string songToLoad;
+static bool firstFrame = true, songLoaded = false, complete = false;
+
+/* Written by the device thread, read once it is done */
+static PmError midiError;
+static PaError audioError;
+static sf::Int64 devicesTime;
+static std::atomic<bool> devicesReady(false);
+static bool devicesStarted = false;
+
+static void devicesFunc()
+{
+	sf::Clock clock;
+	midiError = Pm_Initialize();
+	audioError = Pa_Initialize();
+	devicesTime = clock.getElapsedTime().asMicroseconds();
+	devicesReady = true;
+}
+
+static sf::Thread devicesThread(&devicesFunc);
+
+void startup_initialize(bool _report)
+{
+	report = _report;
+	startupClock.restart();
+}
+
+void startup_mark(const char *step)
+{
+	startupStep s;
+	s.name = step;
+	s.time = startupClock.getElapsedTime().asMicroseconds();
+	steps.push_back(s);
+}
+
+void startup_beginDevices()
+{
+	devicesStarted = true;
+	devicesThread.launch();
+}
+
+void startup_waitDevices()
+{
+	if (!devicesStarted)
+		return;
+
+	devicesThread.wait();
+	devicesStarted = false;
+
+	if (midiError != pmNoError)
+	{
+		error("Can't initialize PortMidi");
+	}
+
+	if (audioError != paNoError)
+	{
+		error(Pa_GetErrorText(audioError));
+		error("Can't initialize PortAudio");
+	}
+	else
+	{
+		audioInitialized = true;
+	}
+
+	if (config)
+	{
+		/* List the devices and select a default sound device or the previous selected one */
+		config->refresh();
+		config->selectBestSoundDevice();
+	}
+	startup_mark("sound and MIDI devices");
+}
+
+void startup_setSong(const std::string &song)
+{
+	songToLoad = song;
+}
+
+static void printReport()
+{
+	sf::Int64 previous = 0;
+
+	printf("Startup            step (ms)  total (ms)\n");
+	for (unsigned i = 0; i < steps.size(); i++)
+	{
+		printf("%-24s %8.1f  %10.1f\n", steps[i].name, (steps[i].time - previous) / 1000.f, steps[i].time / 1000.f);
+		previous = steps[i].time;
+	}
+	printf("%-24s %8.1f  (background)\n", "PortAudio/PortMidi init", devicesTime / 1000.f);
+	fflush(stdout);
+}
+
+int startup_update()
+{
+	if (complete)
+		return 0;
+
+	/* Nothing is on screen yet */
+	if (firstFrame)
+	{
+		firstFrame = false;
+		return 0;
+	}
+
+	int changes = 0;
+
+	if (!songLoaded)
+	{
+		songLoaded = true;
+		startup_mark("first frame");
+
+		if (!songToLoad.empty())
+		{
+			song_load(songToLoad.c_str(), false);
+		}
+		else
+		{
+			config->loadLastSong();
+		}
+
+		autosave_offerRecovery();
+		startup_mark("song load started");
+		changes++;
+	}
+
+	if (devicesStarted && devicesReady)
+	{
+		startup_waitDevices();
+		changes++;
+	}
+
+	if (!devicesStarted)
+	{
+		complete = true;
+		if (report)
+			printReport();
+	}
+	return changes;
+}
@@ -0,0 +1,32 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <string>
+
+/* Application startup
+
+	Only what the first frame needs is done before the main loop : preferences, the synth, the window and the pages
+	shown every frame. PortAudio/PortMidi are initialized by a background thread (scanning the sound and MIDI
+	devices can take a while), the instrument library is mapped or built by another one, and the song is loaded
+	after the first frame is displayed. The piano roll and general pages are built on their first visit.
+	Started with --startup-report, the time of each step is printed once startup is complete. */
+
+void startup_initialize(bool report);
+
+/* Records the end of a startup step for the report */
+void startup_mark(const char *step);
+
+/* Starts initializing PortAudio and PortMidi in the background */
+void startup_beginDevices();
+
+/* Waits for the device thread, then lists the devices and opens the sound device. Called before using PortAudio */
+void startup_waitDevices();
+
+/* Song loaded after the first frame, empty : the last song opened, as set in the preferences */
+void startup_setSong(const std::string &song);
+
+/* Called at the start of every loop iteration, the first one being before the first frame.
+	Runs the startup steps left when they are ready, returns how many were run */
+int startup_update();
+
+#endif
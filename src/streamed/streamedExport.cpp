@@ -5,6 +5,7 @@
 #include "../views/settings/configEditor.hpp"
 #include "portaudio.h"
 #include "tinyfiledialogs.h"
+#include "../startup/startup.hpp"
 
 extern mtsynth *phanoo; 
 extern Popup *popup;
@@ -30,6 +31,7 @@ void promptStreamedExport()
 		
 		string fileNameOk = forceExtension(fileName, "wav");
 		song_stop();
+		startup_waitDevices();
 		Pa_StopStream(stream);
 		Pa_CloseStream(stream);
 		popup->show(POPUP_WORKING);
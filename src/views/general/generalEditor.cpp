@@ -1,5 +1,6 @@
 ﻿#include "generalEditor.hpp"
 #include "../../gui/drawBatcher.hpp"
+#include "../pattern/songEditor.hpp"
 
 GeneralEditor* generalEditor;
 
@@ -14,6 +15,7 @@ diviseurText("1 quarter note =", font, charSize),
 reverbLength(550, 50, 40, 0, "Room reverberation", 4),
 roomSize(550, 80, 40, 1, "Room size", 5),
 transpose(800, 50, 12, -12, "Transpose (semitones)", 0),
+channels(800, 80, FM_ch, 1, "Channels", FM_chDefault),
 rows("rows", font, charSize)
 {
 	fm->tempo = tempo.value;
@@ -29,7 +31,7 @@ void GeneralEditor::draw()
 {
 	window->setView(globalView);
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 
 	drawBatcher.addItem(&tempo);
 	
@@ -42,6 +44,7 @@ void GeneralEditor::draw()
 	drawBatcher.addItem(&reverbLength);
 	drawBatcher.addItem(&roomSize);
 	drawBatcher.addItem(&transpose);
+	drawBatcher.addItem(&channels);
 
 	drawBatcher.addItem(&rows);
 	drawBatcher.addItem(&diviseurText);
@@ -55,7 +58,7 @@ void GeneralEditor::update()
 	if (mouse.pos.x > (int)windowWidth - 215)
 		return;
 
-	static int tempoUpdated = 0;
+	static int tempoUpdated = 0, channelsUpdated = 0;
 
 	if (tempo.update())
 	{
@@ -68,10 +71,26 @@ void GeneralEditor::update()
 		mt_setTempo(fm, tempo.value);
 		songModified(1);
 
-		mt_buildStateTable(fm, 0, fm->patternCount, 0, FM_ch);
+		mt_buildStateTable(fm, 0, fm->patternCount, 0, fm->channelCount);
 
 	}
 
+	if (channels.update())
+	{
+		channelsUpdated = 1;
+	}
+	/* Channels holding notes can't be removed, the slider goes back to the count actually set */
+	if ((mouse.clickgReleased || mouse.scroll) && channelsUpdated)
+	{
+		channelsUpdated = 0;
+		if (channels.value != (int)fm->channelCount)
+		{
+			channels.setValue(mt_setChannelCount(fm, channels.value));
+			songEditor->updateFromFM();
+			songModified(1);
+		}
+	}
+
 
 	else if (globalVolume.update() || diviseur.update() || transpose.update() || reverbLength.update())
 	{
@@ -119,6 +138,7 @@ void GeneralEditor::updateFromFM()
 	transpose.setValue(fm->transpose);
 	reverbLength.setValue((fm->initialReverbLength - 0.5) * 80 + 0.5);
 	roomSize.setValue(fm->initialReverbRoomSize * 40 + 0.5);
+	channels.setValue(fm->channelCount);
 	/*for(unsigned ch = 0; ch< FM_chCount; ++ch){
 		surround[ch].setValue(fm->surround[ch]*-1);
 		}*/
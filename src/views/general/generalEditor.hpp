@@ -9,7 +9,7 @@
 #include "../../state.hpp"
 
 class GeneralEditor : public State{
-	DataSlider tempo, globalVolume/*, surround[FM_chCount]*/, reverbLength, transpose;
+	DataSlider tempo, globalVolume/*, surround[FM_chCount]*/, reverbLength, transpose, channels;
 
 	Text reverb, effects, echo, /*chsurround,*/ effectsvol /*chn, bitcrush*/, rows;
 	DataSlider chDry[FM_ch], roomSize, damping, stereoWidth, bits, rate;
@@ -1,14 +1,12 @@
 #include "instrEditor.hpp"
 #include "../../input/noteInput.hpp"
 #include "algoPresets.hpp"
-#define SI_CONVERT_GENERIC
-#include "SimpleIni.h"
+#include "../../library/instrumentLibrary.hpp"
 #include "../pattern/songEditor.hpp"
 #include "../settings/configEditor.hpp"
 #include "../../gui/sidebar.hpp"
 #include "../../gui/drawBatcher.hpp"
 
-extern CSimpleIniA ini_gmlist;
 extern void *focusedElement;
 InstrEditor* instrEditor;
 
@@ -38,10 +36,10 @@ temperament(806 + 6, y + 657 + 6, "Temperament", -1, 6), k_fx1(806, y + 627, 7,
 	lfoOffsetBar.setFillColor(colors[WAVEFORMOFFSETBAR]);
 
 	/* Try to load default piano sound*/
-	if (mt_loadInstrument(fm, string(appdir + "/instruments/" + config->defaultPreloadedSound + ".mdti").c_str(), 0) < 0)
+	if (instrumentLibrary_load(fm, config->defaultPreloadedSound, 0) < 0)
 	{
 		/* Fallback to the default melodic*/
-		if (mt_loadInstrument(fm, string(string(appdir + "/instruments/") + ini_gmlist.GetValue("melodic", "default", "0") + string(".mdti")).c_str(), 0) < 0)
+		if (instrumentLibrary_loadDefault(fm, 0) < 0)
 		{
 
 			mt_resizeInstrumentList(fm, 1);
@@ -168,7 +166,7 @@ void InstrEditor::update()
 	if (add.clicked())
 	{
 
-		if (mt_loadInstrument(fm, string(string("instruments/") + ini_gmlist.GetValue("melodic", "default", "0") + string(".mdti")).c_str(), fm->instrumentCount)<0)
+		if (instrumentLibrary_loadDefault(fm, fm->instrumentCount) < 0)
 		{
 			mt_resizeInstrumentList(fm, fm->instrumentCount+1);
 		}
@@ -430,7 +428,7 @@ void InstrEditor::draw()
 	
 
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 
 
 	drawBatcher.addItem(&save);
@@ -571,20 +569,17 @@ void InstrEditor::resetView(int width, int height)
 
 void InstrEditor::cleanupInstruments()
 {
-	for (int i = 0; i < fm->instrumentCount; i++)
+	/* Two passes over the song, however many instruments are removed */
+	unsigned char removed[32];
+	if (!mt_removeUnusedInstruments(fm, removed))
+		return;
+
+	for (int i = min<int>(history.size(), MT_MAX_INSTRUMENTS) - 1; i >= 0; i--)
 	{
-		if (!mt_isInstrumentUsed(fm, i))
+		if (removed[i / 8] & 1 << i % 8)
 		{
-			if (i < history.size())
-			{
-				history.erase(history.begin() + i);
-				currentHistoryPos.erase(currentHistoryPos.begin() + i);
-			}
-			mt_removeInstrument(fm, i, 1);
-			/* Because instruments after the removed one are re-numbered, we need to check again the same i (it's the next instrument) */
-			if (fm->instrumentCount==1)
-				break;
-			i--;
+			history.erase(history.begin() + i);
+			currentHistoryPos.erase(currentHistoryPos.begin() + i);
 		}
 	}
 	updateInstrListFromFM();
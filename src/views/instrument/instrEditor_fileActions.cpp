@@ -27,15 +27,7 @@ void InstrEditor::instrument_open()
 }
 void InstrEditor::instrument_load_default_gm()
 {
-	mt_resizeInstrumentList(fm, 0);
-	for (int i = 0; i < 128; ++i)
-	{
-		addInstrument(i, 0);
-	}
-	for (int i = 24; i < 88; ++i)
-	{
-		addInstrument(i, 1);
-	}
+	midi_loadGMInstruments(fm);
 	updateFromFM();
 	updateInstrListFromFM();
 	updateToFM();
@@ -65,7 +65,7 @@ void InstrEditor::handleGlobalEvents()
 		{
 			for (unsigned j = 0; j < fm->patternSize[i]; j++)
 			{
-				for (unsigned ch = 0; ch < FM_ch; ch++)
+				for (unsigned ch = 0; ch < fm->channelCount; ch++)
 				{
 					if (fm->pattern[i][j][ch].instr != 255)
 					{
@@ -74,6 +74,7 @@ void InstrEditor::handleGlobalEvents()
 				}
 			}
 		}
+		mt_cellsChanged(fm, -1);
 
 		songModified(1);
 		updateFromFM();
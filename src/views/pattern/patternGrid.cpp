@@ -0,0 +1,189 @@
+#include "patternGrid.hpp"
+#include "../../gui/gui.hpp"
+#include "../../profiler/profiler.hpp"
+#include <string.h>
+
+PatternGrid::PatternGrid() : rows(0), channels(0), capacity(0), characterSize(0), channelWidth(0)
+{
+	notes.setPrimitiveType(sf::Quads);
+	values.setPrimitiveType(sf::Quads);
+
+	noteFont.font = &font;
+	valueFont.font = &font_condensed;
+
+	columnColors[0] = colors[PATTERNNOTE];
+	columnColors[1] = colors[PATTERNINSTRUMENT];
+	columnColors[2] = colors[PATTERNVOLUME];
+	columnColors[3] = colors[PATTERNEFFECT];
+
+	memset(columnX, 0, sizeof(columnX));
+}
+
+void PatternGrid::setLayout(unsigned _characterSize, float _channelWidth, const float _columnX[4])
+{
+	characterSize = _characterSize;
+	channelWidth = _channelWidth;
+	memcpy(columnX, _columnX, sizeof(columnX));
+
+	gridFont *fonts[2] = { &noteFont, &valueFont };
+	for (unsigned i = 0; i < 2; i++)
+	{
+		memset(fonts[i]->loaded, 0, sizeof(fonts[i]->loaded));
+		fonts[i]->lineSpacing = fonts[i]->font->getLineSpacing(characterSize);
+		fonts[i]->spaceWidth = fonts[i]->font->getGlyph(' ', characterSize, false).advance;
+	}
+
+	// every glyph moves
+	stale.assign(stale.size(), true);
+}
+
+const Glyph& PatternGrid::glyph(gridFont &f, char c)
+{
+	unsigned char index = c;
+
+	if (index >= 128)
+		return f.font->getGlyph(index, characterSize, false);
+
+	if (!f.loaded[index])
+	{
+		f.glyphs[index] = f.font->getGlyph(index, characterSize, false);
+		f.loaded[index] = true;
+	}
+	return f.glyphs[index];
+}
+
+/* Same glyph placement as sf::Text, the first baseline being at the character size */
+void PatternGrid::layoutString(Vertex *quads, unsigned maxGlyphs, const char *s, gridFont &f, Vector2f position, Color color)
+{
+	const float padding = 1;
+	float x = 0;
+	char previous = 0;
+	unsigned i = 0;
+
+	for (; *s && i < maxGlyphs; s++)
+	{
+		x += f.font->getKerning(previous, *s, characterSize);
+		previous = *s;
+
+		if (*s == ' ')
+		{
+			x += f.spaceWidth;
+			continue;
+		}
+
+		const Glyph &g = glyph(f, *s);
+		float left = position.x + x + g.bounds.left - padding;
+		float top = position.y + characterSize + g.bounds.top - padding;
+		float right = position.x + x + g.bounds.left + g.bounds.width + padding;
+		float bottom = position.y + characterSize + g.bounds.top + g.bounds.height + padding;
+
+		float u1 = g.textureRect.left - padding;
+		float v1 = g.textureRect.top - padding;
+		float u2 = g.textureRect.left + g.textureRect.width + padding;
+		float v2 = g.textureRect.top + g.textureRect.height + padding;
+
+		Vertex *quad = &quads[i * 4];
+		quad[0] = Vertex(Vector2f(left, top), color, Vector2f(u1, v1));
+		quad[1] = Vertex(Vector2f(right, top), color, Vector2f(u2, v1));
+		quad[2] = Vertex(Vector2f(right, bottom), color, Vector2f(u2, v2));
+		quad[3] = Vertex(Vector2f(left, bottom), color, Vector2f(u1, v2));
+
+		x += g.advance;
+		i++;
+	}
+
+	// unused glyphs are drawn as empty quads
+	for (; i < maxGlyphs; i++)
+	{
+		Vertex *quad = &quads[i * 4];
+		quad[0] = quad[1] = quad[2] = quad[3] = Vertex();
+	}
+}
+
+void PatternGrid::layoutCell(unsigned channel, unsigned row, const Cell &cell)
+{
+	unsigned index = channel*capacity + row;
+	float x = channel*channelWidth;
+	char fx[8] = "";
+
+	if (cell.fx < 255)
+	{
+		fx[0] = cell.fx;
+		strcpy(&fx[1], int2str[cell.fxdata].c_str());
+	}
+
+	layoutString(&notes[index * GRID_NOTE_GLYPHS * 4], GRID_NOTE_GLYPHS, cell.note < 255 ? noteName(cell.note).c_str() : "",
+		noteFont, Vector2f(x + columnX[0], row*noteFont.lineSpacing), columnColors[0]);
+
+	Vertex *quads = &values[index * GRID_VALUE_GLYPHS * 4];
+	float y = row*valueFont.lineSpacing;
+
+	layoutString(&quads[0], 3, cell.instr < 255 ? int2str[cell.instr].c_str() : "", valueFont, Vector2f(x + columnX[1], y), columnColors[1]);
+	layoutString(&quads[3 * 4], 3, cell.vol < 255 ? int2str[cell.vol].c_str() : "", valueFont, Vector2f(x + columnX[2], y), columnColors[2]);
+	layoutString(&quads[6 * 4], 4, fx, valueFont, Vector2f(x + columnX[3], y), columnColors[3]);
+}
+
+void PatternGrid::update(mtsynth *mt, unsigned pattern, int channel)
+{
+	if (pattern >= mt->patternCount)
+	{
+		rows = 0;
+		return;
+	}
+
+	rows = mt->patternSize[pattern];
+	channels = mt->channelCount;
+
+	/* Longer pattern or more channels than ever shown : the cells are stored channel after channel, lay them all out
+		again. Only the channels of the song are allocated, long patterns take a lot of quads */
+	if (rows > capacity || channels * max(rows, capacity) > shown.size())
+	{
+		capacity = max(rows, capacity);
+		notes.resize(channels * capacity * GRID_NOTE_GLYPHS * 4);
+		values.resize(channels * capacity * GRID_VALUE_GLYPHS * 4);
+		shown.assign(channels * capacity, Cell());
+		stale.assign(channels * capacity, true);
+	}
+
+	unsigned firstChannel = channel < 0 ? 0 : channel;
+	unsigned lastChannel = channel < 0 ? channels : channel + 1;
+
+	for (unsigned ch = firstChannel; ch < lastChannel; ++ch)
+	{
+		for (unsigned row = 0; row < rows; ++row)
+		{
+			const Cell &cell = mt->pattern[pattern][row][ch];
+			unsigned index = ch*capacity + row;
+
+			if (!stale[index] && memcmp(&shown[index], &cell, sizeof(Cell)) == 0)
+				continue;
+
+			shown[index] = cell;
+			stale[index] = false;
+			layoutCell(ch, row, cell);
+		}
+	}
+}
+
+void PatternGrid::draw(unsigned firstChannel, unsigned lastChannel, int firstRow, int lastRow)
+{
+	firstRow = max(0, firstRow);
+	lastRow = min((int)rows, lastRow);
+
+	if (firstRow >= lastRow)
+		return;
+
+	RenderStates noteStates(&font.getTexture(characterSize));
+	RenderStates valueStates(&font_condensed.getTexture(characterSize));
+
+	/* One draw call per channel and font, for the visible rows */
+	for (unsigned ch = firstChannel; ch < lastChannel && ch < channels; ++ch)
+	{
+		unsigned first = ch*capacity + firstRow;
+		unsigned count = lastRow - firstRow;
+
+		window->draw(&notes[first * GRID_NOTE_GLYPHS * 4], count * GRID_NOTE_GLYPHS * 4, sf::Quads, noteStates);
+		window->draw(&values[first * GRID_VALUE_GLYPHS * 4], count * GRID_VALUE_GLYPHS * 4, sf::Quads, valueStates);
+		profiler_countDraw(count * (GRID_NOTE_GLYPHS + GRID_VALUE_GLYPHS) * 4, 2);
+	}
+}
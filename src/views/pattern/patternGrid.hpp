@@ -0,0 +1,53 @@
+#ifndef PATTERNGRID_H
+#define PATTERNGRID_H
+
+#include "../../globalFunctions.hpp"
+#include "../../mtengine/mtlib.h"
+#include <vector>
+
+/* Glyphs reserved per cell : note ("C#10"), then instrument, volume and effect ("T255") */
+#define GRID_NOTE_GLYPHS 4
+#define GRID_VALUE_GLYPHS 10
+
+/* Font glyphs looked up once per character size */
+struct gridFont{
+	Font *font;
+	Glyph glyphs[128];
+	bool loaded[128];
+	float lineSpacing, spaceWidth;
+};
+
+/* Pattern text drawn from the font glyph textures. Every cell has fixed quads in two vertex arrays
+	(the note column uses the main font, the other columns the condensed one) which are only laid out again
+	when the cell content changes, so edits, pattern switches and scrolling don't rebuild the whole text */
+class PatternGrid{
+	VertexArray notes, values;
+	gridFont noteFont, valueFont;
+
+	/* Content laid out in each cell (channel after channel), and the cells to lay out again */
+	vector<Cell> shown;
+	vector<bool> stale;
+	unsigned rows, channels, capacity;
+
+	unsigned characterSize;
+	float channelWidth, columnX[4];
+	Color columnColors[4];
+
+	const Glyph& glyph(gridFont &f, char c);
+	void layoutString(Vertex *quads, unsigned maxGlyphs, const char *s, gridFont &f, Vector2f position, Color color);
+	void layoutCell(unsigned channel, unsigned row, const Cell &cell);
+
+public:
+	PatternGrid();
+
+	/* Character size and column positions, relative to the channel, of the note, instrument, volume and effect */
+	void setLayout(unsigned characterSize, float channelWidth, const float columnX[4]);
+
+	/* Shows 'pattern', for one channel or all of them (-1). Only the changed cells are laid out */
+	void update(mtsynth *mt, unsigned pattern, int channel = -1);
+
+	/* Draws the visible channels and rows, in the current view */
+	void draw(unsigned firstChannel, unsigned lastChannel, int firstRow, int lastRow);
+};
+
+#endif
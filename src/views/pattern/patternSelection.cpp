@@ -73,6 +73,10 @@ void PatternSelection::getBounds(int *x1, int *x2, int *y1, int *y2)
 		*y1 = 0;
 	}
 
+	/* Pattern rows only hold the channels of the song */
+	*x2 = max(*x1, min(*x2, 4 * (int)fm->channelCount));
+	*y2 = max(*y1, min(*y2, (int)fm->patternSize[fm->order]));
+
 }
 
 
@@ -87,7 +91,7 @@ void PatternSelection::resizeRelative(int x, int y)
 	int oldPosX = (int)round(bg.getPosition().x) / COL_WIDTH;
 	int oldPosY = (int)round(bg.getPosition().y) / ROW_HEIGHT;
 
-	int newSizeX = clamp(oldSizeX + x, -oldPosX, 4 * FM_ch - oldPosX);
+	int newSizeX = clamp(oldSizeX + x, -oldPosX, 4 * (int)fm->channelCount - oldPosX);
 	int newSizeY = clamp(oldSizeY + y, -oldPosY, (int)fm->patternSize[fm->order] - oldPosY);
 
 	int newPosX = oldPosX;
@@ -123,7 +127,7 @@ void PatternSelection::resizeRelative(int x, int y)
 	{
 		newSizeX++;
 	}
-	else if (newPosX + newSizeX > 4 * FM_ch)
+	else if (newPosX + newSizeX > 4 * (int)fm->channelCount)
 	{
 		newSizeX--;
 	}
@@ -145,7 +149,7 @@ void PatternSelection::resizeRelative(int x, int y)
 
 void PatternSelection::resizeAbsolute(int xOrigin, int yOrigin, int x, int y)
 {
-	int mouseXpat2 = clamp(x / COL_WIDTH, 0, FM_ch * 4 - 1);
+	int mouseXpat2 = clamp(x / COL_WIDTH, 0, (int)fm->channelCount * 4 - 1);
 	int mouseYpat2 = clamp(y / ROW_HEIGHT, 0, (int)fm->patternSize[fm->order] - 1);
 
 
@@ -169,7 +173,7 @@ void PatternSelection::resizeAbsolute(int xOrigin, int yOrigin, int x, int y)
 
 	if (mouseYpat2 < yOrigin && yOrigin >0)
 	{
-		bg.setSize(Vector2f((int)(max<int>(1, min<int>(x, CH_WIDTH*FM_ch - 1)) - bg.getPosition().x) / COL_WIDTH*COL_WIDTH + deltaX, ((int)(max<int>(0, min<int>((int)fm->patternSize[fm->order] - 1, mouseYpat2))*ROW_HEIGHT - yOrigin*ROW_HEIGHT) / ROW_HEIGHT)*ROW_HEIGHT - ROW_HEIGHT));
+		bg.setSize(Vector2f((int)(max<int>(1, min<int>(x, CH_WIDTH*(int)fm->channelCount - 1)) - bg.getPosition().x) / COL_WIDTH*COL_WIDTH + deltaX, ((int)(max<int>(0, min<int>((int)fm->patternSize[fm->order] - 1, mouseYpat2))*ROW_HEIGHT - yOrigin*ROW_HEIGHT) / ROW_HEIGHT)*ROW_HEIGHT - ROW_HEIGHT));
 
 		if (deltaY != ROW_HEIGHT)
 		{
@@ -179,7 +183,7 @@ void PatternSelection::resizeAbsolute(int xOrigin, int yOrigin, int x, int y)
 	}
 	else
 	{
-		bg.setSize(Vector2f((int)(max<int>(1, min<int>(x, CH_WIDTH*FM_ch - 1)) - bg.getPosition().x) / COL_WIDTH*COL_WIDTH + deltaX, ((int)(max<int>(0, min<int>((int)fm->patternSize[fm->order] - 1, mouseYpat2))*ROW_HEIGHT - yOrigin*ROW_HEIGHT) / ROW_HEIGHT)*ROW_HEIGHT + ROW_HEIGHT));
+		bg.setSize(Vector2f((int)(max<int>(1, min<int>(x, CH_WIDTH*(int)fm->channelCount - 1)) - bg.getPosition().x) / COL_WIDTH*COL_WIDTH + deltaX, ((int)(max<int>(0, min<int>((int)fm->patternSize[fm->order] - 1, mouseYpat2))*ROW_HEIGHT - yOrigin*ROW_HEIGHT) / ROW_HEIGHT)*ROW_HEIGHT + ROW_HEIGHT));
 
 		if (deltaY != 0)
 		{
@@ -3,6 +3,7 @@
 #include <ctype.h>
 #include "../../gui/drawBatcher.hpp"
 #include "../../gui/sidebar.hpp"
+#include "../../profiler/profiler.hpp"
 
 
 SongEditor *songEditor;
@@ -11,7 +12,7 @@ SongEditor *songEditor;
 
 SongEditor::SongEditor() : rowNumbers("", font, charSize), playCursor(Vector2f(CH_WIDTH*FM_ch, ROW_HEIGHT))
 , scroll(0), add(0, 52, ICON_MD_ADD,14,0), patText("Patterns", font, charSize)
-, patSize(1070, 700, 256, 1, "Pattern size", 128, 150), resize(1230, 700, "Resize"), patSlider(0, 255, 0, 0.1, 1050 - 1, 169, 600, false)
+, patSize(1070, 700, MT_MAX_ROWS, 1, "Pattern size", 128, 150), resize(1230, 700, "Resize"), patSlider(0, 255, 0, 0.1, 1050 - 1, 169, 600, false)
 , movePat(-1), selectedRow(0), selectedChannel(0), selectedType(0), scrollX(0),
 expand(1070, 730, "Scale x2"), shrink(1150, 730, "Scale /2"), resetMute(0, 89, ICON_MD_CLOSE,14), mouseXpat(0), mouseYpat(0), searched(false),
 selected(false), patternList(120, 52), zoom(1),
@@ -28,26 +29,6 @@ patHSlider(0, 255, 0, 0.1, 0, 169, 600, false, true)
 	for (unsigned ch = 0; ch < FM_ch; ++ch)
 	{
 		channelHead[ch] = ChannelHead(ch);
-
-		text[ch][0].setCharacterSize(charSize);
-		text[ch][1].setCharacterSize(charSize);
-		text[ch][2].setCharacterSize(charSize);
-		text[ch][3].setCharacterSize(charSize);
-
-
-		text[ch][0].setFont(font);
-		text[ch][1].setFont(font_condensed);
-		text[ch][2].setFont(font_condensed);
-		text[ch][3].setFont(font_condensed);
-
-		text[ch][0].setPosition(ch*CH_WIDTH, 0);
-		text[ch][1].setPosition(ch*CH_WIDTH + 33, 0);
-		text[ch][2].setPosition(ch*CH_WIDTH + 50, 0);
-		text[ch][3].setPosition(ch*CH_WIDTH + 70, 0);
-		text[ch][0].setFillColor(colors[PATTERNNOTE]);
-		text[ch][1].setFillColor(colors[PATTERNINSTRUMENT]);
-		text[ch][2].setFillColor(colors[PATTERNVOLUME]);
-		text[ch][3].setFillColor(colors[PATTERNEFFECT]);
 	}
 	channelHead[0].record.selected = 1;
 
@@ -64,18 +45,18 @@ patHSlider(0, 255, 0, 0.1, 0, 169, 600, false, true)
 	setZoom(0.1*atoi(ini_config.GetValue("config", "patternZoomLevel", "10")));
 	bars.setPrimitiveType(sf::Quads);
 	
-	bars.resize(4*FM_ch+4*(mt_getPatternSize(fm,fm->order)/config->rowHighlight.value));
+	bars.resize(4*(int)fm->channelCount+4*(mt_getPatternSize(fm,fm->order)/config->rowHighlight.value));
 }
 
 void SongEditor::updatePatternLines()
 {
 	int iters = (int)round(ceil((float)mt_getPatternSize(fm,fm->order)/config->rowHighlight.value));
-	bars.resize(4*FM_ch+4*iters+4);
+	bars.resize(4*(int)fm->channelCount+4*iters+4);
 
 	sf::Vertex *quad = &bars[0];
 	quad[0].position = Vector2f(0,0);
-	quad[1].position = Vector2f(CH_WIDTH*FM_ch,0);
-	quad[2].position = Vector2f(CH_WIDTH*FM_ch,mt_getPatternSize(fm, fm->order)*ROW_HEIGHT);
+	quad[1].position = Vector2f(CH_WIDTH*(int)fm->channelCount,0);
+	quad[2].position = Vector2f(CH_WIDTH*(int)fm->channelCount,mt_getPatternSize(fm, fm->order)*ROW_HEIGHT);
 	quad[3].position = Vector2f(0,mt_getPatternSize(fm, fm->order)*ROW_HEIGHT);
 
 	quad[0].color = colors[PATTERNBG];
@@ -88,8 +69,8 @@ void SongEditor::updatePatternLines()
 
 		sf::Vertex *quad = &bars[i*4+4];
 		quad[0].position = Vector2f(0,i*config->rowHighlight.value*ROW_HEIGHT);
-		quad[1].position = Vector2f(CH_WIDTH*FM_ch,i*config->rowHighlight.value*ROW_HEIGHT);
-		quad[2].position = Vector2f(CH_WIDTH*FM_ch,i*config->rowHighlight.value*ROW_HEIGHT+ROW_HEIGHT);
+		quad[1].position = Vector2f(CH_WIDTH*(int)fm->channelCount,i*config->rowHighlight.value*ROW_HEIGHT);
+		quad[2].position = Vector2f(CH_WIDTH*(int)fm->channelCount,i*config->rowHighlight.value*ROW_HEIGHT+ROW_HEIGHT);
 		quad[3].position = Vector2f(0,i*config->rowHighlight.value*ROW_HEIGHT+ROW_HEIGHT);
 
 		quad[0].color = colors[PATTERNBGODD];
@@ -98,7 +79,7 @@ void SongEditor::updatePatternLines()
 		quad[3].color = colors[PATTERNBGODD];
 	}
 
-	for (unsigned i = 0; i < FM_ch; ++i)
+	for (unsigned i = 0; i < fm->channelCount; ++i)
 	{
 		sf::Vertex *quad = &bars[4*iters+i*4+4];
 		quad[0].position = Vector2f(i*CH_WIDTH,0);
@@ -162,7 +143,7 @@ void SongEditor::draw()
 		patternList.select(fm->order);
 
 		currentPattern = fm->order;
-		for (unsigned ch = 0; ch < FM_ch; ++ch)
+		for (unsigned ch = 0; ch < fm->channelCount; ++ch)
 			updateChannelData(ch);
 
 		patSize.setValue(mt_getPatternSize(fm, fm->order));
@@ -174,7 +155,7 @@ void SongEditor::draw()
 
 	window->setView(patternTopView);
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 	for (unsigned ch = scrollX; ch < scrollX2; ++ch)
 	{
 		channelHead[ch].draw();
@@ -185,25 +166,24 @@ void SongEditor::draw()
 	window->setView(patternView);
 
 
-	window->draw(bars);
+	profiler_draw(window, bars);
 
 
-	for (unsigned ch = scrollX; ch < scrollX2; ++ch)
-	for (unsigned j = 0; j < 4; ++j)
-		window->draw(text[ch][j]);
+	int firstRow = (int)(scroll - halfPatternHeightView) - 1;
+	grid.draw(scrollX, scrollX2, firstRow, firstRow + (int)windowHeight / ROW_HEIGHT + 2);
 
-	window->draw(playCursor);
+	profiler_draw(window, playCursor);
 	selection.draw();
 
 	window->setView(patNumView);
 	
-	window->draw(rowNumbers);
+	profiler_draw(window, rowNumbers);
 
 	window->setView(globalView);
 	patHSlider.draw();
 	resetMute.draw();
 	add.draw();
-	window->draw(patText);
+	profiler_draw(window, patText);
 	patternList.draw();
 }
 
@@ -284,20 +264,18 @@ void SongEditor::update()
 
 
 	// add pattern
-	if (add.clicked())
+	if (add.clicked() && mt_insertPattern(fm, patSize.value, fm->patternCount))
 	{
-		mt_insertPattern(fm, patSize.value, fm->patternCount);
+		historyInsertPattern(fm->patternCount - 1);
 		mt_setPosition(fm, fm->patternCount - 1, 0, 0);
 		moveY(0);
-		history.push_back(vector<historyElem>());
-		currentHistoryPos.push_back(0);
 		patternList.add(std::to_string(patternList.elementCount()));
 		patternList.select((int)patternList.elementCount() - 1);
 		songModified(1);
 	}
 	else if (resetMute.clicked())
 	{
-		for (unsigned ch = 0; ch < FM_ch; ++ch)
+		for (unsigned ch = 0; ch < fm->channelCount; ++ch)
 		{
 			channelHead[ch].mute.selected = 0;
 			channelHead[ch].solo.selected = 0;
@@ -364,7 +342,7 @@ void SongEditor::update()
 	mouse.pos = input_getmouse(globalView);
 	if (patHSlider.update())
 	{
-		setXscroll(patHSlider.value*(FM_ch*CH_WIDTH - ((int)(windowWidth - 231))+32) / 255, false);
+		setXscroll(patHSlider.value*((int)fm->channelCount*CH_WIDTH - ((int)(windowWidth - 231))+32) / 255, false);
 	}
 
 	// border events
@@ -382,42 +360,36 @@ void SongEditor::update()
 	patSize.update();
 	if (resize.clicked())
 	{ // resize pattern
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
+		historyBegin();
 		mt_resizePattern(fm, fm->order, patSize.value, 0);
 
 		updateScrollbar();
 		updateFromFM();
 		songModified(1);
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
+		historyEnd();
 	}
 
 
 
-	if (expand.clicked() && mt_getPatternSize(fm, fm->order) <= 128)
+	if (expand.clicked() && mt_getPatternSize(fm, fm->order) * 2 <= MT_MAX_ROWS)
 	{
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
+		historyBegin();
 		mt_resizePattern(fm, fm->order, mt_getPatternSize(fm, fm->order) * 2, 1);
 
 		updateScrollbar();
 		updateFromFM();
 		songModified(1);
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
+		historyEnd();
 	}
 	else if (shrink.clicked() && mt_getPatternSize(fm, fm->order) >= 2)
 	{
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
+		historyBegin();
 
 		mt_resizePattern(fm, fm->order, mt_getPatternSize(fm, fm->order) / 2, 1);
 		updateFromFM();
 		updateScrollbar();
 		songModified(1);
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
-		saveToHistory(0, mt_getPatternSize(fm, fm->order));
+		historyEnd();
 	}
 }
 
@@ -451,16 +423,18 @@ void SongEditor::updateMutedChannels()
 
 void SongEditor::setXscroll(int value, bool updateSlider)
 {
-	scrollXsmooth=clamp(value,0,FM_ch*CH_WIDTH - ((int)(windowWidth - 231))+32*zoom);
+	/* Songs with few channels fit in the window, and aren't scrolled */
+	int scrollWidth = max(1, (int)((int)fm->channelCount*CH_WIDTH - ((int)(windowWidth - 231))+32*zoom));
+	scrollXsmooth=clamp(value,0,scrollWidth);
 	scrollX = scrollXsmooth/CH_WIDTH;
-	scrollX2 = min(FM_ch, scrollX + (windowWidth - 231) / CH_WIDTH + 2);
+	scrollX2 = min((int)fm->channelCount, scrollX + (windowWidth - 231) / CH_WIDTH + 2);
 
 	patternView.setCenter((float)windowWidth / 2 + scrollXsmooth, patternView.getCenter().y);
 	patternTopView.setCenter((float)windowWidth / 2 + scrollXsmooth, (float)windowHeight / 2 - 85);
 
 
 	if (updateSlider)
-		patHSlider.setValue((float)scrollXsmooth / (FM_ch*CH_WIDTH - ((int)(windowWidth - 231))+32*zoom) * 255);
+		patHSlider.setValue((float)scrollXsmooth / scrollWidth * 255);
 
 	//setXscroll(patHSlider.value*(FM_ch-((int)windowWidth-231)/CH_WIDTH)/255);
 }
@@ -469,7 +443,7 @@ void SongEditor::recordFromKeyboard(int note, int volume, int channel, int isFro
 {
 	//channel+=selectedChannel;
 
-	if (channel >= FM_ch)
+	if (channel >= (int)fm->channelCount)
 		return;
 
 	if ((!isFromMidi && !Keyboard::isKeyPressed(Keyboard::LControl) || isFromMidi) && selectedType == 0 && focusedElement != instrList)
@@ -481,8 +455,7 @@ void SongEditor::recordFromKeyboard(int note, int volume, int channel, int isFro
 		{
 			moveCursorAfterDataEntered();
 
-			saveToHistory(fm->row, 1);
-			saveToHistory(fm->row, 1);
+			historyBegin(channel, channel + 1, fm->row, fm->row + 1);
 
 			unsigned char newVol = fm->pattern[fm->order][fm->row][channel].vol;
 
@@ -499,8 +472,7 @@ void SongEditor::recordFromKeyboard(int note, int volume, int channel, int isFro
 				(unsigned char)255
 			});
 
-			saveToHistory(fm->row, 1);
-			saveToHistory(fm->row, 1);
+			historyEnd();
 			songModified(1);
 
 			if (sidebar->editingStep.value != 0)
@@ -571,7 +543,7 @@ void SongEditor::moveY(int pos)
 
 void SongEditor::setX(int channel)
 {
-	int pos = clamp(channel, 0, FM_ch * 4 - 1);
+	int pos = clamp(channel, 0, (int)fm->channelCount * 4 - 1);
 
 	mouseXpat = pos;
 	selectedChannel = pos / 4;
@@ -626,7 +598,7 @@ void SongEditor::updateScrollbar()
 	halfPatternHeightView = (int)round((windowHeight - 169)*0.33) / ROW_HEIGHT;
 	patSlider.setScrollableContent((mt_getPatternSize(fm, fm->order) + 6)*ROW_HEIGHT + (windowHeight - 169) / 2, windowHeight - 169);
 
-	patHSlider.setScrollableContent(CH_WIDTH*FM_ch, windowWidth - 231);
+	patHSlider.setScrollableContent(CH_WIDTH*(int)fm->channelCount, windowWidth - 231);
 	patSize.setValue(mt_getPatternSize(fm, fm->order)); //printf("selectedRow %d", selectedRow);
 
 	if (selectedRow > mt_getPatternSize(fm, fm->order) - 1)
@@ -662,29 +634,25 @@ void SongEditor::setZoom(float _zoom)
 	ROW_HEIGHT = font.getLineSpacing(charSize*zoom);
 	CH_WIDTH = (int)round(100 * zoom) / 4 * 4;
 	COL_WIDTH = round(CH_WIDTH / 4);
+	const float columnX[4] = { 0, (float)(int)(1.25*COL_WIDTH), (float)(int)(2 * COL_WIDTH), (float)round(2.75*COL_WIDTH) };
+	grid.setLayout(charSize*zoom, CH_WIDTH, columnX);
 	for (unsigned ch = 0; ch < FM_ch; ++ch)
 	{
-		for (unsigned i = 0; i < 4; i++)
-		{
-			text[ch][i].setCharacterSize(charSize*zoom);
-		}
-		text[ch][0].setPosition(ch*CH_WIDTH, 0);
-		text[ch][1].setPosition(round(ch*CH_WIDTH + (int)(1.25*COL_WIDTH)), 0);
-		text[ch][2].setPosition(round(ch*CH_WIDTH + (int)(2 * COL_WIDTH)), 0);
-		text[ch][3].setPosition(round(ch*CH_WIDTH + 2.75*COL_WIDTH), 0);
 		channelHead[ch].updateZoom();
 	}
+	for (unsigned ch = 0; ch < fm->channelCount; ++ch)
+		updateChannelData(ch);
 	rowNumbers.setCharacterSize(charSize*zoom);
 
 
-	playCursor.setSize(Vector2f(CH_WIDTH*FM_ch, ROW_HEIGHT));
+	playCursor.setSize(Vector2f(CH_WIDTH*(int)fm->channelCount, ROW_HEIGHT));
 	playCursor.setPosition(0, fm->row*ROW_HEIGHT);
 
 	patternView.setViewport(FloatRect((32 * zoom) / windowWidth, 0.22f * 768 / windowHeight, 1, 1));
 	patternTopView.setViewport(FloatRect((32 * zoom) / windowWidth, 0, 1, 1));
 	updateScrollbar();
 	setXscroll(scrollXsmooth);
-	selection.bg.setPosition(clamp((mouseXpat+(selectionW<0))*COL_WIDTH, 0, FM_ch*CH_WIDTH), clamp((selectedRow+(selectionH<0))*ROW_HEIGHT, 0, (fm->patternSize[fm->order] - 1)*ROW_HEIGHT));
+	selection.bg.setPosition(clamp((mouseXpat+(selectionW<0))*COL_WIDTH, 0, (int)fm->channelCount*CH_WIDTH), clamp((selectedRow+(selectionH<0))*ROW_HEIGHT, 0, (fm->patternSize[fm->order] - 1)*ROW_HEIGHT));
 	selection.bg.setSize(Vector2f(COL_WIDTH*selectionW, selectionH*ROW_HEIGHT));
 
 }
@@ -5,6 +5,7 @@
 
 #include "../../mtengine/mtlib.h"
 #include <vector>
+#include <deque>
 #include "../../globalFunctions.hpp"
 #include "../settings/configEditor.hpp"
 #include <math.h>
@@ -17,6 +18,7 @@
 #include "../../gui/channelHead.hpp"
 #include "../../gui/contextmenu/contextmenu.hpp"
 #include "patternSelection.hpp"
+#include "patternGrid.hpp"
 
 extern List *instrList;
 extern int prevNote;
@@ -24,10 +26,24 @@ extern int prevNote;
 extern View borderView, patternTopView, patNumView;
 extern void *focusedElement;
 
+/* Undo journal memory limit, oldest actions are forgotten beyond it */
+#define HISTORY_MEMORY_BUDGET (16 * 1024 * 1024)
+
+enum historyActions{ HISTORY_CELLS, HISTORY_INSERTPATTERN, HISTORY_REMOVEPATTERN, HISTORY_MOVEPATTERN };
+
+/* A cell changed by an action. Rows outside a pattern count as empty cells */
+struct historyCell{
+	unsigned short row;
+	unsigned char ch;
+	Cell before, after;
+};
+
+/* One undoable action of the song-wide journal */
 struct historyElem{
-	vector< vector< Cell >>  data;
-	int y;
-	unsigned char patternSize; 
+	int type;
+	int pattern, destination; /* destination : HISTORY_MOVEPATTERN only */
+	int sizeBefore, sizeAfter;
+	vector<historyCell> cells;
 };
 
 
@@ -73,7 +89,6 @@ class SongEditor : public State{
 	bool searched;
 	int halfPatternHeightView;
 	int patternHeightView;
-	string s0,s1,s2,s3;
 	Vector2i mousePattern;
 	Vector2i patternViewBaseSize;
 	
@@ -84,7 +99,8 @@ public:
 	float zoom;
 	ButtonList patternList;
 	ChannelHead channelHead[FM_ch];
-	Text text[FM_ch][4], rowNumbers, patText;
+	PatternGrid grid;
+	Text rowNumbers, patText;
 	RectangleShape playCursor;
 	int selectedRow, selectedType, selectedChannel;
 	Button add;
@@ -104,9 +120,17 @@ public:
 	
 	ListMenu patMenu, patListMenu, editTools;
 	
-	vector< vector< historyElem>  > history;
-	
-	vector<int> currentHistoryPos;
+	/* Undo journal : history[0..historyPos-1] are the actions that can be undone, the next ones can be redone */
+	deque<historyElem> history;
+	unsigned historyPos;
+	size_t historyMemory;
+
+	/* Cells saved by historyBegin (channels historyChannel1..historyChannel2-1, rows historyRow1..historyRow2-1),
+	compared to the new content by historyEnd */
+	bool historyPending;
+	int historyPendingPattern, historyPendingSize;
+	int historyChannel1, historyChannel2, historyRow1, historyRow2;
+	vector<Cell> historyBefore;
 
 	float scroll;
 	int scrollX, scrollX2, scrollXsmooth;
@@ -135,13 +159,19 @@ public:
 	void leftMouseRelease();
 	void wrappingValue();
 	void selectionDisappear();
-	void saveToHistory(int _y, int size);
-	void udpatePatternFromHistory();
 	void moveCursor(bool updateRecordChannels=true);
 	void setXscroll(int value, bool updateSlider=true);
 	void reset();
 
-	void addHistory();
+	void historyBegin();
+	void historyBegin(int channel1, int channel2, int row1, int row2);
+	void historyBeginPaste(patternSelection* copiedData, int channel, int ypos);
+	void historyEnd();
+	void historyInsertPattern(int pattern);
+	void historyRemovePattern(int pattern);
+	void historyMovePattern(int from, int to);
+	void historyPush(historyElem &elem);
+	void historyApply(const historyElem &elem, bool undo);
 	void resetHistory();
 
 	void handlePatternListContextMenu();
@@ -6,7 +6,7 @@ void SongEditor::handleChannelHeads()
 	static unsigned paramChanged = 0;
 	static int channelChanged = -1;
 
-	for (unsigned ch = 0; ch<FM_ch; ++ch)
+	for (unsigned ch = 0; ch<fm->channelCount; ++ch)
 	{
 		int mutedChanged = 0;
 		int channelSwapped = -1;
@@ -21,7 +21,7 @@ void SongEditor::handleChannelHeads()
 		if (channelSwapped > -1)
 		{
 			mt_moveChannels(fm, ch, channelSwapped);
-			for (unsigned ch2 = 0; ch2 < FM_ch; ++ch2)
+			for (unsigned ch2 = 0; ch2 < fm->channelCount; ++ch2)
 			{
 				channelHead[ch2].updateFromFM();
 				updateChannelData(ch2);
@@ -37,7 +37,7 @@ void SongEditor::handleChannelHeads()
 			/* Holding ctrl/shift changes all the values */
 			if ((keyboard.ctrl || keyboard.shift) && mouse.cursor == CURSOR_NORMAL)
 			{
-				for (unsigned ch2 = 0; ch2 < FM_ch; ++ch2)
+				for (unsigned ch2 = 0; ch2 < fm->channelCount; ++ch2)
 				{
 					if (paramChanged == 1)
 					{
@@ -1,4 +1,5 @@
 #include "songEditor.hpp"
+#include "../../freeze/freeze.hpp"
 
 void SongEditor::buildContextMenus()
 {
@@ -14,6 +15,7 @@ void SongEditor::buildContextMenus()
 	patMenu.add("Effects...");
 	patMenu.add("Insert rows...");
 	patMenu.add("Remove rows...");
+	patMenu.add("Freeze channel");
 
 	/* Pattern buttons menu */
 
@@ -79,11 +81,9 @@ void SongEditor::handlePatternContextMenu()
 			break;
 
 		case 1:
-			saveToHistory(fm->row, copiedSelection.data[0].size());
-			saveToHistory(fm->row, copiedSelection.data[0].size());
+			historyBeginPaste(&copiedSelection, selectedChannel, selectedRow);
 			patPaste(&copiedSelection, selectedChannel, selectedRow);
-			saveToHistory(fm->row, copiedSelection.data[0].size());
-			saveToHistory(fm->row, copiedSelection.data[0].size());
+			historyEnd();
 			break;
 
 		case 2:
@@ -136,6 +136,10 @@ void SongEditor::handlePatternContextMenu()
 				popup->sliders[0].setValue(y2 - y1);
 			}
 			break;
+
+		case 9:
+			freeze_setChannel(selectedChannel, !freeze_channelState(selectedChannel));
+			break;
 	}
 
 }
@@ -1,122 +1,242 @@
 #include "songEditor.hpp"
 
+static const Cell emptyCell = { 255, 255, 255, 255, 255 };
 
-void SongEditor::udpatePatternFromHistory()
+/* Copies channels channel1..channel2-1 of rows row1..row2-1 that exist in the pattern, channels past the song's count read as empty cells */
+static void copyCells(vector<Cell> &cells, mtsynth *fm, int pattern, int channel1, int channel2, int row1, int row2)
 {
-
-	/* Data to restore bigger than actual pattern size : resize pattern */
-	if (history[fm->order][currentHistoryPos[fm->order]].data.size() > fm->patternSize[fm->order])
-	{
-		mt_resizePattern(fm, fm->order, history[fm->order][currentHistoryPos[fm->order]].data.size(), 0);
-		patSize.setValue(fm->patternSize[fm->order]);
-		updateRowCount();
-	}
-	/* Data to restore smaller than pattern size : the pattern was resized*/
-	else if (history[fm->order][currentHistoryPos[fm->order]].patternSize != fm->patternSize[fm->order])
+	cells.clear();
+	for (int row = row1; row < min(row2, (int)fm->patternSize[pattern]); row++)
 	{
-		mt_resizePattern(fm, fm->order, history[fm->order][currentHistoryPos[fm->order]].patternSize, 0);
-		patSize.setValue(fm->patternSize[fm->order]);
-		updateRowCount();
-		setScroll(scroll);
+		for (int ch = channel1; ch < channel2; ch++)
+		{
+			cells.push_back(ch < (int)fm->channelCount ? fm->pattern[pattern][row][ch] : emptyCell);
+		}
 	}
+}
 
+/* Adds the cells that differ between two copies of the same rectangle, starting at (channel, row). Missing rows count as empty cells */
+static void diffCells(vector<historyCell> &cells, int channel, int row, int width, const vector<Cell> &before, const vector<Cell> &after)
+{
+	if (width <= 0)
+		return;
 
-	if (currentHistoryPos[fm->order] >= 0)
-	{
+	int beforeRows = before.size() / width;
+	int afterRows = after.size() / width;
 
-		/* Eviter d'�crire des donn�es en dehors du pattern */
-		int maxy = history[fm->order][currentHistoryPos[fm->order]].data.size();
-		if (maxy + history[fm->order][currentHistoryPos[fm->order]].y > fm->patternSize[fm->order])
+	for (int r = 0; r < max(beforeRows, afterRows); r++)
+	{
+		for (int c = 0; c < width; c++)
 		{
-			maxy = -history[fm->order][currentHistoryPos[fm->order]].y + fm->patternSize[fm->order];
-		}
+			const Cell *b = r < beforeRows ? &before[r*width + c] : &emptyCell;
+			const Cell *a = r < afterRows ? &after[r*width + c] : &emptyCell;
 
-
-		for (unsigned y = 0; y < maxy; y++)
-		{
-			for (int ch = 0; ch < FM_ch; ch++)
+			if (memcmp(b, a, sizeof(Cell)) != 0)
 			{
-				fm->pattern[fm->order][history[fm->order][currentHistoryPos[fm->order]].y + y][ch] = history[fm->order][currentHistoryPos[fm->order]].data[y][ch];
-
+				cells.push_back({ (unsigned short)(row + r), (unsigned char)(channel + c), *b, *a });
 			}
 		}
 	}
 }
 
-void SongEditor::saveToHistory(int _y, int size)
+void SongEditor::historyPush(historyElem &elem)
 {
-
-	/* Handle selections outside pattern (ignore) */
-	if (_y < 0)
+	/* A new action drops the redo list */
+	while (history.size() > historyPos)
 	{
-		size -= _y;
-		_y = 0;
+		historyMemory -= sizeof(historyElem) + history.back().cells.capacity() * sizeof(historyCell);
+		history.pop_back();
 	}
 
-	if (size<0)
+	history.push_back(historyElem());
+	history.back().type = elem.type;
+	history.back().pattern = elem.pattern;
+	history.back().destination = elem.destination;
+	history.back().sizeBefore = elem.sizeBefore;
+	history.back().sizeAfter = elem.sizeAfter;
+	history.back().cells.assign(elem.cells.begin(), elem.cells.end());
+	historyMemory += sizeof(historyElem) + history.back().cells.capacity() * sizeof(historyCell);
+	historyPos++;
+
+	/* Forget the oldest actions, but always keep the last one */
+	while (historyMemory > HISTORY_MEMORY_BUDGET && history.size() > 1)
 	{
-		_y += size;
-		size = abs(size);
+		historyMemory -= sizeof(historyElem) + history.front().cells.capacity() * sizeof(historyCell);
+		history.pop_front();
+		historyPos--;
 	}
+}
 
-	if (_y + size >= mt_getPatternSize(fm, fm->order))
-	{
-		size = mt_getPatternSize(fm, fm->order) - _y;
-	}
+/* Call before editing cells of the current pattern (size changes included), and historyEnd after */
+void SongEditor::historyBegin()
+{
+	historyBegin(0, fm->channelCount, 0, MT_MAX_ROWS);
+}
+
+/* Same, when only the cells of channels channel1..channel2-1 and rows row1..row2-1 change */
+void SongEditor::historyBegin(int channel1, int channel2, int row1, int row2)
+{
+	historyEnd();
+
+	historyPendingPattern = fm->order;
+	historyPendingSize = fm->patternSize[fm->order];
+	historyChannel1 = max(0, channel1);
+	historyChannel2 = min(channel2, (int)fm->channelCount);
+	historyRow1 = max(0, row1);
+	historyRow2 = row2;
+	copyCells(historyBefore, fm, fm->order, historyChannel1, historyChannel2, historyRow1, historyRow2);
+	historyPending = true;
+}
 
+/* Same, for patPaste(copiedData, channel, ypos) */
+void SongEditor::historyBeginPaste(patternSelection* copiedData, int channel, int ypos)
+{
+	int width = copiedData->data.size();
+	int height = width > 0 ? copiedData->data[0].size() : 0;
+
+	historyBegin(channel, channel + (copiedData->x1 % 4 + max(width, 1) - 1) / 4 + 1, ypos, ypos + max(height, 1));
+}
 
-	while (history[fm->order].size()>0 && currentHistoryPos[fm->order] < history[fm->order].size())
+void SongEditor::historyEnd()
+{
+	if (!historyPending)
+		return;
+
+	historyPending = false;
+	int p = historyPendingPattern;
+	if (p >= fm->patternCount)
+		return;
+
+	static historyElem elem;
+	static vector<Cell> after;
+	elem.type = HISTORY_CELLS;
+	elem.pattern = p;
+	elem.sizeBefore = historyPendingSize;
+	elem.sizeAfter = fm->patternSize[p];
+	elem.cells.clear();
+	copyCells(after, fm, p, historyChannel1, historyChannel2, historyRow1, historyRow2);
+	diffCells(elem.cells, historyChannel1, historyRow1, historyChannel2 - historyChannel1, historyBefore, after);
+
+	if (elem.cells.size() > 0 || elem.sizeBefore != elem.sizeAfter)
 	{
-		history[fm->order].pop_back();
+		historyPush(elem);
 	}
+}
 
-	history[fm->order].push_back(historyElem());
+/* Call after a pattern was inserted */
+void SongEditor::historyInsertPattern(int pattern)
+{
+	historyEnd();
+
+	static historyElem elem;
+	static vector<Cell> after;
+	elem.type = HISTORY_INSERTPATTERN;
+	elem.pattern = pattern;
+	elem.sizeBefore = 0;
+	elem.sizeAfter = fm->patternSize[pattern];
+	elem.cells.clear();
+	copyCells(after, fm, pattern, 0, fm->channelCount, 0, elem.sizeAfter);
+	diffCells(elem.cells, 0, 0, fm->channelCount, vector<Cell>(), after);
+	historyPush(elem);
+}
 
-	history[fm->order][currentHistoryPos[fm->order]].y = _y;
-	history[fm->order][currentHistoryPos[fm->order]].patternSize = fm->patternSize[fm->order];
-	history[fm->order][currentHistoryPos[fm->order]].data.resize(size);
+/* Call before a pattern is removed */
+void SongEditor::historyRemovePattern(int pattern)
+{
+	historyEnd();
+
+	static historyElem elem;
+	static vector<Cell> before;
+	elem.type = HISTORY_REMOVEPATTERN;
+	elem.pattern = pattern;
+	elem.sizeBefore = fm->patternSize[pattern];
+	elem.sizeAfter = 0;
+	elem.cells.clear();
+	copyCells(before, fm, pattern, 0, fm->channelCount, 0, elem.sizeBefore);
+	diffCells(elem.cells, 0, 0, fm->channelCount, before, vector<Cell>());
+	historyPush(elem);
+}
 
-	for (unsigned y = _y; y < _y + size; y++)
-	{
+void SongEditor::historyMovePattern(int from, int to)
+{
+	historyEnd();
+
+	static historyElem elem;
+	elem.type = HISTORY_MOVEPATTERN;
+	elem.pattern = from;
+	elem.destination = to;
+	elem.sizeBefore = elem.sizeAfter = 0;
+	elem.cells.clear();
+	historyPush(elem);
+}
 
-		history[fm->order][currentHistoryPos[fm->order]].data[y - _y].resize(FM_ch);
-		if (y >= fm->patternSize[fm->order])
-		{
+void SongEditor::historyApply(const historyElem &elem, bool undo)
+{
+	int p = elem.pattern;
+	int size = undo ? elem.sizeBefore : elem.sizeAfter;
+	bool removed = false;
 
+	switch (elem.type)
+	{
+		case HISTORY_CELLS:
+			if (p >= fm->patternCount)
+				return;
+			if (fm->patternSize[p] != size)
+				mt_resizePattern(fm, p, size, 0);
+			break;
+		case HISTORY_INSERTPATTERN:
+		case HISTORY_REMOVEPATTERN:
+			/* Undoing an insertion or redoing a removal */
+			if (size == 0)
+			{
+				mt_removePattern(fm, p);
+				removed = true;
+			}
+			else
+			{
+				mt_insertPattern(fm, size, p);
+			}
+			break;
+		case HISTORY_MOVEPATTERN:
+			if (undo)
+			{
+				mt_movePattern(fm, elem.destination, elem.pattern);
+				patternList.move(elem.destination, elem.pattern);
+			}
+			else
+			{
+				mt_movePattern(fm, elem.pattern, elem.destination);
+				patternList.move(elem.pattern, elem.destination);
+			}
+			p = undo ? elem.pattern : elem.destination;
 			break;
-		}
-		for (int ch = 0; ch <FM_ch; ch++)
-			history[fm->order][currentHistoryPos[fm->order]].data[y - _y][ch] = fm->pattern[fm->order][y][ch];
 	}
 
-	if (history[fm->order].size()>4 * 1000)
+	if (!removed)
 	{
-		history[fm->order].erase(history[fm->order].begin() + 0);
-	}
-	else
-	{
-		currentHistoryPos[fm->order]++;
+		for (unsigned i = 0; i < elem.cells.size(); i++)
+		{
+			const historyCell &c = elem.cells[i];
+			if (c.row < fm->patternSize[p] && c.ch < fm->channelCount)
+				fm->pattern[p][c.row][c.ch] = undo ? c.before : c.after;
+		}
 	}
-}
 
+	fm->channelStatesDone = 0;
 
-void SongEditor::addHistory()
-{
-	int x1, x2, y1, y2;
-	selection.getBounds(&x1, &x2, &y1, &y2);
+	/* Show the pattern that changed */
+	if (!fm->playing)
+		mt_setPosition(fm, min(p, (int)fm->patternCount - 1), fm->row, 0);
 
-	saveToHistory(y1, y2-y1);
-	saveToHistory(y1, y2-y1);
+	updateFromFM();
+	updateScrollbar();
+	songModified(1);
 }
 
-
 void SongEditor::resetHistory()
 {
-	history.resize(fm->patternCount);
-	currentHistoryPos.resize(fm->patternCount);
-	for (int i = 0; i < history.size(); i++)
-	{
-		history[i].clear();
-		currentHistoryPos[i] = 0;
-	}
-}
\ No newline at end of file
+	history.clear();
+	historyPos = 0;
+	historyMemory = 0;
+	historyPending = false;
+}
@@ -1,10 +1,11 @@
 #include "songEditor.hpp"
+#include "../../freeze/freeze.hpp"
 
 void SongEditor::updateRecordChannels()
 {
 	/* Check if select channel is in recording channels*/
 	int inSelecteds = 0;
-	for (int i = 0; i < FM_ch; i++)
+	for (int i = 0; i < (int)fm->channelCount; i++)
 	{
 		if (selectedChannel == i && channelHead[i].record.selected == 1)
 		{
@@ -15,7 +16,7 @@ void SongEditor::updateRecordChannels()
 	if (!inSelecteds)
 	{
 		int firstOfSelecteds = 0;
-		for (int i = 0; i < FM_ch; i++)
+		for (int i = 0; i < (int)fm->channelCount; i++)
 		{
 			/* Pre select current recording channel */
 			if (!firstOfSelecteds && channelHead[i].record.selected == 1)
@@ -41,7 +42,7 @@ void SongEditor::moveCursor(bool _updateRecordChannels)
 	selectedType = mouseXpat % 4;
 	selectedChannel = mouseXpat / 4;
 
-	selection.bg.setPosition(clamp(mouseXpat*COL_WIDTH, 0, FM_ch*CH_WIDTH), clamp(selectedRow*ROW_HEIGHT, 0, (fm->patternSize[fm->order] - 1)*ROW_HEIGHT));
+	selection.bg.setPosition(clamp(mouseXpat*COL_WIDTH, 0, (int)fm->channelCount*CH_WIDTH), clamp(selectedRow*ROW_HEIGHT, 0, (fm->patternSize[fm->order] - 1)*ROW_HEIGHT));
 
 	if (_updateRecordChannels)
 	{
@@ -55,7 +56,7 @@ void SongEditor::moveCursor(bool _updateRecordChannels)
 void SongEditor::doubleClick()
 {
 	/* Check if the element selected is the same as the one when 1st click */
-	if (clickedElem == selectedRow + (selectedType + selectedChannel * 4) * 256)
+	if (clickedElem == selectedRow + (selectedType + selectedChannel * 4) * MT_MAX_ROWS)
 	{
 		mouse.clickg = 0;
 		int popups[4] = { POPUP_TRANSPOSE, POPUP_REPLACE_INSTRUMENT, POPUP_FADE, POPUP_EFFECTS };
@@ -132,7 +133,10 @@ void SongEditor::rightMouseEvents()
 
 		selected = false;
 		if (!fm->playing && (!contextMenu || !patMenu.hover()))
+		{
+			patMenu.setElement(9, freeze_channelState(selectedChannel) ? "Unfreeze channel" : "Freeze channel");
 			patMenu.show();
+		}
 	}
 	else
 	{
@@ -188,7 +192,7 @@ void SongEditor::leftMouseEvents()
 					if (mouse.dblClick <= 0)
 					{
 						mouse.dblClick = 15;
-						clickedElem = selectedRow + (selectedType + selectedChannel * 4) * 256;
+						clickedElem = selectedRow + (selectedType + selectedChannel * 4) * MT_MAX_ROWS;
 					}
 					else if (!fm->playing)
 					{
@@ -248,15 +252,14 @@ void SongEditor::leftMouseRelease()
 			mt_setPosition(fm, fm->order, selectedRow, 0);
 			selectedChannel = mouseXpat / 4;
 			selectedType = mouseXpat % 4;
-			selection.bg.setPosition(min<int>(selectedChannel * CH_WIDTH + selectedType * COL_WIDTH, FM_ch * CH_WIDTH), selectedRow*ROW_HEIGHT);
+			selection.bg.setPosition(min<int>(selectedChannel * CH_WIDTH + selectedType * COL_WIDTH, (int)fm->channelCount * CH_WIDTH), selectedRow*ROW_HEIGHT);
 			selectionDisappear();
 		}
 		else
 		{
 			/* Copy data */
-			saveToHistory(selectedRow, selection.bg.getSize().y / ROW_HEIGHT);
+			historyBegin();
 			multipleEdit(2, &movedSelection,0,0,false);
-			saveToHistory(selectedRow, selection.bg.getSize().y / ROW_HEIGHT);
 
 			/* Get row/channel from selection position. do -0.5/+0.5 to correct float-to-int value rounding */
 			selectedRow = selection.getMovedRow();
@@ -292,7 +295,7 @@ void SongEditor::leftMouseRelease()
 				movedSelection.y2 -= exceedSizeY;
 			}
 
-			int exceedSizeX = selectedChannel + (selection.bg.getSize().x + 0.5) / CH_WIDTH - FM_ch;
+			int exceedSizeX = selectedChannel + (selection.bg.getSize().x + 0.5) / CH_WIDTH - (int)fm->channelCount;
 
 			if (exceedSizeX > 0)
 			{
@@ -301,23 +304,21 @@ void SongEditor::leftMouseRelease()
 			}
 
 
-			for (int i = 0; i < FM_ch; i++)
+			for (int i = 0; i < (int)fm->channelCount; i++)
 			{
 				channelHead[i].record.selected = 0;
 			}
 			channelHead[selectedChannel].record.selected = 1;
 
 			mt_setPosition(fm, fm->order, selectedRow, 0);
-			selection.bg.setPosition(min<int>(selectedChannel*CH_WIDTH + selectedType*COL_WIDTH, FM_ch*CH_WIDTH), selectedRow*ROW_HEIGHT);
+			selection.bg.setPosition(min<int>(selectedChannel*CH_WIDTH + selectedType*COL_WIDTH, (int)fm->channelCount*CH_WIDTH), selectedRow*ROW_HEIGHT);
 			setScroll(fm->row);
 			playCursor.setPosition(0, (int)fm->row*ROW_HEIGHT);
 			mouseXpat = selectedChannel*4+selectedType;
 			mouseYpat=selectedRow;
 
-			saveToHistory(selectedRow, selection.bg.getSize().y / ROW_HEIGHT);
-
 			patPaste(&movedSelection, oldChannel, oldRow);
-			saveToHistory(selectedRow, selection.bg.getSize().y / ROW_HEIGHT);
+			historyEnd();
 			fm->channelStatesDone = 0;
 		}
 	}
@@ -356,6 +357,6 @@ void SongEditor::updateSelectedsFromCursor()
 
 void SongEditor::updateMousePat()
 {
-	mouseXpat = clamp((int)round(mousePattern.x / COL_WIDTH), 0, FM_ch * 4 - 1);
+	mouseXpat = clamp((int)round(mousePattern.x / COL_WIDTH), 0, (int)fm->channelCount * 4 - 1);
 	mouseYpat = clamp((int)round(mousePattern.y / ROW_HEIGHT), 0, (int)fm->patternSize[fm->order] - 1);
 }
\ No newline at end of file
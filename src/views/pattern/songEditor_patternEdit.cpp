@@ -42,12 +42,21 @@ void SongEditor::patCopy(patternSelection* copiedData)
 void SongEditor::multipleEdit(int action, patternSelection* copiedData, int param, int param2, bool saveHistory)
 {
 	
-	if (action != 0 && saveHistory) // not a copy action
-		addHistory();
-
 	if (copiedData == NULL)
 		copiedData = &copiedSelection;
 
+	if (action == 1 && saveHistory)
+	{
+		historyBeginPaste(copiedData, selectedChannel, selectedRow);
+	}
+	else if (action != 0 && saveHistory) // not a copy action
+	{
+		/* The selected columns, and the cursor row for a single cell */
+		int x1, x2, y1, y2;
+		selection.getBounds(&x1, &x2, &y1, &y2);
+		historyBegin(x1 / 4, (x2 + 3) / 4, min(y1, selectedRow), max(y2, selectedRow + 1));
+	}
+
 	if (action == 2)
 	{
 		patCopy(copiedData);
@@ -55,6 +64,8 @@ void SongEditor::multipleEdit(int action, patternSelection* copiedData, int para
 	else if (action == 1)
 	{
 		patPaste(copiedData, selectedChannel, selectedRow);
+		if (saveHistory)
+			historyEnd();
 		return;
 	}
 	else if (action == 0)
@@ -207,7 +218,7 @@ void SongEditor::multipleEdit(int action, patternSelection* copiedData, int para
 
 	}
 	for (unsigned i = x1 / 4; i < x2 / 4 + 1; i++)
-	if (i < FM_ch)
+	if (i < fm->channelCount)
 		updateChannelData(i);
 
 	if (action == 7 || action == 10 || action == 2)
@@ -216,7 +227,7 @@ void SongEditor::multipleEdit(int action, patternSelection* copiedData, int para
 		songModified(1);
 
 	if (action != 0 && saveHistory) // not a copy action
-		addHistory();
+		historyEnd();
 }
 
 void SongEditor::patPaste(patternSelection* copiedData, int channel, int ypos)
@@ -255,7 +266,7 @@ void SongEditor::patPaste(patternSelection* copiedData, int channel, int ypos)
 			for (unsigned j = 0; j < copiedData->data[i].size(); j++)
 			{
 
-				if (ypos + j < 0 || ypos + j >= fm->patternSize[fm->order] || channel + (copiedData->x1 % 4 + i) / 4 < 0 || channel + (copiedData->x1 % 4 + i) / 4 >= FM_ch)continue;
+				if (ypos + j < 0 || ypos + j >= fm->patternSize[fm->order] || channel + (copiedData->x1 % 4 + i) / 4 < 0 || channel + (copiedData->x1 % 4 + i) / 4 >= (int)fm->channelCount)continue;
 
 
 				switch ((copiedData->x1 + i) % 4)
@@ -286,7 +297,7 @@ void SongEditor::patPaste(patternSelection* copiedData, int channel, int ypos)
 
 		}
 	}
-	for (unsigned i = 0; i< FM_ch; i++)
+	for (unsigned i = 0; i< fm->channelCount; i++)
 	{
 		updateChannelData(i);
 	}
@@ -303,9 +314,9 @@ void SongEditor::patPaste(patternSelection* copiedData, int channel, int ypos)
 
 	selection.bg.setPosition(selectedChannel*CH_WIDTH +(copiedData->x1%4) *COL_WIDTH , selection.bg.getPosition().y);
 
-	if (selectedChannel * 4 + (copiedData->x1%4) + copiedData->data.size() > 4 * FM_ch)
+	if (selectedChannel * 4 + (copiedData->x1%4) + copiedData->data.size() > 4 * fm->channelCount)
 	{
-		selection.bg.setSize(Vector2f((4 * FM_ch - (selectedChannel * 4 + selectedType))*COL_WIDTH, selection.bg.getSize().y));
+		selection.bg.setSize(Vector2f((4 * (int)fm->channelCount - (selectedChannel * 4 + selectedType))*COL_WIDTH, selection.bg.getSize().y));
 	}
 
 	songModified(1);
@@ -318,7 +329,7 @@ void SongEditor::wrappingValue()
 	{
 		if (textEntered[textEnteredCount] > 45 && textEntered[textEnteredCount] < 58)
 		{
-			addHistory();
+			historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 			if (selectedType == 1)
 			{ // user changes instrument number
 				wrapValue(&fm->pattern[fm->order][selectedRow][selectedChannel].instr, textEntered[textEnteredCount], instrList->text.size());
@@ -368,15 +379,15 @@ void SongEditor::wrappingValue()
 				songModified(1);
 
 			fm->channelStatesDone = 0;
-			addHistory();
+			historyEnd();
 		}
 		else if (textEntered[textEnteredCount] >64 && textEntered[textEnteredCount] <91 // uppercase
 			|| textEntered[textEnteredCount] >96 && textEntered[textEnteredCount] < 123)
 		{ // lowercase
 			if (selectedType == 3)
 			{ // effect shortcuts
-				addHistory();
 				moveCursorAfterDataEntered();
+				historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 				if (fm->pattern[fm->order][selectedRow][selectedChannel].fx == 255)
 				{
 					fm->pattern[fm->order][selectedRow][selectedChannel].fxdata = 0;
@@ -387,7 +398,7 @@ void SongEditor::wrappingValue()
 
 				songModified(1);
 				fm->channelStatesDone = 0;
-				addHistory();
+				historyEnd();
 			}
 		}
 	}
@@ -395,11 +406,10 @@ void SongEditor::wrappingValue()
 
 void SongEditor::pattern_insertrows(int count)
 {
-	saveToHistory(0, fm->patternSize[fm->order]);
-	saveToHistory(0, fm->patternSize[fm->order]);
-	if (fm->patternSize[fm->order] + count > 256)
+	historyBegin();
+	if (fm->patternSize[fm->order] + count > MT_MAX_ROWS)
 	{
-		count = 256 - fm->patternSize[fm->order];
+		count = MT_MAX_ROWS - fm->patternSize[fm->order];
 	}
 
 	mt_insertRows(fm, fm->order, selectedRow, count);
@@ -407,14 +417,12 @@ void SongEditor::pattern_insertrows(int count)
 	updateFromFM();
 	songModified(1);
 
-	saveToHistory(0, fm->patternSize[fm->order]);
-	saveToHistory(0, fm->patternSize[fm->order]);
+	historyEnd();
 }
 
 void SongEditor::pattern_deleterows(int count)
 {
-	saveToHistory(0, fm->patternSize[fm->order]);
-	saveToHistory(0, fm->patternSize[fm->order]);
+	historyBegin();
 
 	if (selectedRow + count > fm->patternSize[fm->order])
 	{
@@ -425,6 +433,5 @@ void SongEditor::pattern_deleterows(int count)
 	updateFromFM();
 	songModified(1);
 
-	saveToHistory(0, fm->patternSize[fm->order]);
-	saveToHistory(0, fm->patternSize[fm->order]);
+	historyEnd();
 }
\ No newline at end of file
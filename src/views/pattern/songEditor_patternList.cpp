@@ -5,27 +5,26 @@ void SongEditor::pattern_copy()
 	copiedPattern.resize(fm->patternSize[fm->order]);
 	for (int i = 0; i < copiedPattern.size(); i++)
 	{
-		copiedPattern[i].resize(FM_ch);
-		for (int ch = 0; ch <FM_ch; ch++)
+		copiedPattern[i].resize(fm->channelCount);
+		for (int ch = 0; ch < fm->channelCount; ch++)
 			copiedPattern[i][ch] = fm->pattern[fm->order][i][ch];
 	}
 }
 
 void SongEditor::pattern_paste(int insertAfter)
 {
-	if (copiedPattern.size()>0)
+	if (copiedPattern.size()>0 && mt_insertPattern(fm, copiedPattern.size(), fm->order + insertAfter))
 	{
 		patternList.insert(fm->order + insertAfter, std::to_string(patternList.elementCount()));
-		mt_insertPattern(fm, copiedPattern.size(), fm->order + insertAfter);
 		for (int i = 0; i < copiedPattern.size(); i++)
 		{
-			for (int ch = 0; ch < FM_ch; ch++)
+			/* Copied from a song that may have had more channels */
+			for (int ch = 0; ch < min(copiedPattern[i].size(), (size_t)fm->channelCount); ch++)
 				fm->pattern[fm->order + insertAfter][i][ch] = copiedPattern[i][ch];
 		}
+		historyInsertPattern(fm->order + insertAfter);
 		updateFromFM();
 		songModified(1);
-		history.insert(history.begin() + fm->order, vector<historyElem>());
-		currentHistoryPos.insert(currentHistoryPos.begin() + fm->order, 0);
 		mt_setPosition(fm, fm->order + insertAfter, fm->row, 2);
 	}
 }
@@ -35,8 +34,7 @@ void SongEditor::pattern_delete()
 	{
 
 		patternList.erase(fm->order);
-		history.erase(history.begin() + fm->order);
-		currentHistoryPos.erase(currentHistoryPos.begin() + fm->order);
+		historyRemovePattern(fm->order);
 
 		mt_removePattern(fm, fm->order);
 
@@ -44,9 +42,9 @@ void SongEditor::pattern_delete()
 	}
 	else
 	{
+		historyBegin();
 		mt_removePattern(fm, 0);
-		history[0].clear();
-		currentHistoryPos[0] = 0;
+		historyEnd();
 	}
 	fm->order = clamp(fm->order, 0, fm->patternCount - 1);
 	updateFromFM();
@@ -59,8 +57,8 @@ void SongEditor::pattern_cut()
 	copiedPattern.resize(fm->patternSize[fm->order]);
 	for (int i = 0; i < copiedPattern.size(); i++)
 	{
-		copiedPattern[i].resize(FM_ch);
-		for (int ch = 0; ch < FM_ch; ch++)
+		copiedPattern[i].resize(fm->channelCount);
+		for (int ch = 0; ch < fm->channelCount; ch++)
 			copiedPattern[i][ch] = fm->pattern[fm->order][i][ch];
 	}
 
@@ -75,27 +73,23 @@ void SongEditor::pattern_duplicate()
 
 void SongEditor::pattern_insert()
 {
+	if (!mt_insertPattern(fm, patSize.value, fm->order))
+		return;
+
 	patternList.insert(fm->order, std::to_string(patternList.elementCount()));
-	mt_insertPattern(fm, patSize.value, fm->order);
+	historyInsertPattern(fm->order);
 	updateFromFM();
-	history.insert(history.begin() + fm->order, vector<historyElem>());
-	currentHistoryPos.insert(currentHistoryPos.begin() + fm->order, 0);
 	songModified(1);
 }
 
 void SongEditor::pattern_move(int from, int to)
 {
 	mt_movePattern(fm, from, to);
+	historyMovePattern(from, to);
 
 	songModified(1);
 
 
 	patternList.move(from, to);
 
-	history.insert(history.begin() + to+(to>from), history[from]);
-	history.erase(history.begin() + from + (to <= from));
-
-	currentHistoryPos.insert(currentHistoryPos.begin() + to+(to>from), currentHistoryPos[from]);
-	currentHistoryPos.erase(currentHistoryPos.begin() + from + (to <= from));
-
 }
\ No newline at end of file
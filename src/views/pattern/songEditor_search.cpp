@@ -32,11 +32,12 @@ int SongEditor::search(int searchWhat, unsigned char searchValues[5], int search
 	{
 		chBegin = (selectedChannel * 4 + selectedType) / 4;
 		chEnd = ceil((selectedChannel * 4 + selectedType + selection.bg.getSize().x / COL_WIDTH) / 4); // ceil because need to take channel even if selection is smaller than a channel width
+		chEnd = min(chEnd, (int)fm->channelCount);
 	}
 	else
 	{
 		chBegin = 0;
-		chEnd = FM_ch;
+		chEnd = (int)fm->channelCount;
 	}
 
 	for (unsigned i = orderBegin; i < orderEnd; i++)
@@ -63,7 +64,7 @@ int SongEditor::search(int searchWhat, unsigned char searchValues[5], int search
 			if (!replaceWhat && j == rowBegin && i == orderBegin)
 			{
 				chBegin = selectedChannel + 1;
-				if (chBegin >= FM_ch)
+				if (chBegin >= (int)fm->channelCount)
 				{
 					chBegin = 0;
 					continue;
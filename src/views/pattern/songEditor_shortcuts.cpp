@@ -74,23 +74,23 @@ void SongEditor::handleShortcuts()
 
 				if (selectedType == 1)
 				{
-					addHistory();
+					historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 					fm->pattern[fm->order][selectedRow][selectedChannel].instr = min(instrList->text.size() - 1, fm->pattern[fm->order][selectedRow][selectedChannel].instr + 1);
-					addHistory();
+					historyEnd();
 					songModified(1);
 				}
 				else if (selectedType == 2)
 				{
-					addHistory();
+					historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 					fm->pattern[fm->order][selectedRow][selectedChannel].vol = min(99, fm->pattern[fm->order][selectedRow][selectedChannel].vol + 1);
-					addHistory();
+					historyEnd();
 					songModified(1);
 				}
 				else if (selectedType == 3)
 				{
-					addHistory();
+					historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 					fm->pattern[fm->order][selectedRow][selectedChannel].fxdata = min(255, fm->pattern[fm->order][selectedRow][selectedChannel].fxdata + 1);
-					addHistory();
+					historyEnd();
 					songModified(1);
 				}
 				else
@@ -112,23 +112,23 @@ void SongEditor::handleShortcuts()
 			{
 				if (selectedType == 1)
 				{
-					addHistory();
+					historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 					fm->pattern[fm->order][selectedRow][selectedChannel].instr = max(0, fm->pattern[fm->order][selectedRow][selectedChannel].instr - 1);
-					addHistory();
+					historyEnd();
 					songModified(1);
 				}
 				else if (selectedType == 2)
 				{
-					addHistory();
+					historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 					fm->pattern[fm->order][selectedRow][selectedChannel].vol = max(0, fm->pattern[fm->order][selectedRow][selectedChannel].vol - 1);
-					addHistory();
+					historyEnd();
 					songModified(1);
 				}
 				else if (selectedType == 3)
 				{
-					addHistory();
+					historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 					fm->pattern[fm->order][selectedRow][selectedChannel].fxdata = max(0, fm->pattern[fm->order][selectedRow][selectedChannel].fxdata - 1);
-					addHistory();
+					historyEnd();
 					songModified(1);
 				}
 				else
@@ -150,12 +150,12 @@ void SongEditor::handleShortcuts()
 		case Keyboard::Equal:
 			if (selectedType == 0)
 			{ // stop a note
-				addHistory();
+				historyBegin(selectedChannel, selectedChannel + 1, selectedRow, selectedRow + 1);
 				fm->pattern[fm->order][selectedRow][selectedChannel].note = 128;
 				fm->pattern[fm->order][selectedRow][selectedChannel].instr = 255;
 				fm->pattern[fm->order][selectedRow][selectedChannel].vol = 255;
 				updateChannelData(selectedChannel);
-				addHistory();
+				historyEnd();
 			}
 			break;
 		case Keyboard::PageUp: // scroll to pattern top
@@ -246,7 +246,7 @@ void SongEditor::handleShortcuts()
 
 			if (keyboard.shift)
 			{
-				if ((selection.bg.getPosition().x + selection.bg.getSize().x) / COL_WIDTH < FM_ch * 4)
+				if ((selection.bg.getPosition().x + selection.bg.getSize().x) / COL_WIDTH < (int)fm->channelCount * 4)
 				{
 					selection.resizeRelative(1, 0);
 					if (selection.bg.getPosition().x + selection.bg.getSize().x> scrollX*CH_WIDTH + (windowWidth - 270))
@@ -325,17 +325,15 @@ void SongEditor::handleShortcuts()
 				if (copiedSelection.data.size())
 				{
 
-					saveToHistory(fm->row, copiedSelection.data[0].size());
-					saveToHistory(fm->row, copiedSelection.data[0].size());
+					historyBeginPaste(&copiedSelection, selectedChannel, selectedRow);
 					patPaste(&copiedSelection, selectedChannel, selectedRow);
-					saveToHistory(fm->row, copiedSelection.data[0].size());
-					saveToHistory(fm->row, copiedSelection.data[0].size());
+					historyEnd();
 				}
 				break;
 			case Keyboard::A:// tout s�lectionner
 				selectedRow = selectedType = selectedChannel = 0;
 				selection.bg.setPosition(0, 0);
-				selection.bg.setSize(Vector2f(FM_ch*CH_WIDTH, fm->patternSize[fm->order] * ROW_HEIGHT));
+				selection.bg.setSize(Vector2f((int)fm->channelCount*CH_WIDTH, fm->patternSize[fm->order] * ROW_HEIGHT));
 				break;
 			default:
 				break;
@@ -345,42 +343,21 @@ void SongEditor::handleShortcuts()
 
 void SongEditor::undo()
 {
-	if (currentHistoryPos[fm->order] > 0)
+	historyEnd();
+
+	if (historyPos > 0)
 	{
-		currentHistoryPos[fm->order]--;
-		udpatePatternFromHistory();
-
-		currentHistoryPos[fm->order]--;
-		udpatePatternFromHistory();
-		currentHistoryPos[fm->order]--;
-		udpatePatternFromHistory();
-		currentHistoryPos[fm->order]--;
-		udpatePatternFromHistory();
-		for (unsigned ch = 0; ch < FM_ch; ++ch)
-		{
-			updateChannelData(ch);
-		}
-		songModified(1);
+		historyPos--;
+		historyApply(history[historyPos], true);
 	}
 }
 void SongEditor::redo()
 {
-	if (currentHistoryPos[fm->order] < (int)history[fm->order].size() - 1)
-	{
-
-		udpatePatternFromHistory();
-		currentHistoryPos[fm->order]++;
-		udpatePatternFromHistory();
-		currentHistoryPos[fm->order]++;
-		udpatePatternFromHistory();
-		currentHistoryPos[fm->order]++;
-		udpatePatternFromHistory();
-		currentHistoryPos[fm->order]++;
-		for (unsigned ch = 0; ch < FM_ch; ++ch)
-		{
-			updateChannelData(ch);
-		}
-		songModified(1);
+	historyEnd();
 
+	if (historyPos < history.size())
+	{
+		historyApply(history[historyPos], false);
+		historyPos++;
 	}
 }
\ No newline at end of file
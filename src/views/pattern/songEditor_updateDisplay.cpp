@@ -21,7 +21,7 @@ void SongEditor::updateFromFM()
 
 	fm->order = fm->order;
 
-	for (unsigned ch = 0; ch < FM_ch; ++ch)
+	for (unsigned ch = 0; ch < fm->channelCount; ++ch)
 	{
 		updateChannelData(ch);
 		channelHead[ch].updateFromFM();
@@ -40,47 +40,25 @@ void SongEditor::updateFromFM()
 	selection.bg.setSize(Vector2f(COL_WIDTH, ROW_HEIGHT));
 
 	playCursor.setPosition(0, (int)fm->row*ROW_HEIGHT);
+
+	/* The song may have another channel count */
+	if (selectedChannel >= (int)fm->channelCount)
+	{
+		selectedChannel = fm->channelCount - 1;
+		mouseXpat = selectedChannel * 4 + selectedType;
+		selection.bg.setPosition(mouseXpat*COL_WIDTH, selectedRow*ROW_HEIGHT);
+	}
+	playCursor.setSize(Vector2f(CH_WIDTH*(int)fm->channelCount, ROW_HEIGHT));
+	patHSlider.setScrollableContent(CH_WIDTH*(int)fm->channelCount, windowWidth - 231);
+	setXscroll(scrollXsmooth);
+	updatePatternLines();
 }
 
 void SongEditor::updateChannelData(int channel)
 {
-	if (fm->patternCount == 0)
-		return;
-
-	
-	s0.clear();
-	s1.clear();
-	s2.clear();
-	s3.clear();
-
-	size_t pSize = fm->patternSize[fm->order];
+	/* Only the cells that changed are laid out again */
+	grid.update(fm, fm->order, channel);
 
-	s0.reserve(5 * pSize);
-	s1.reserve(5 * pSize);
-	s2.reserve(5 * pSize);
-	s3.reserve(5 * pSize);
-
-
-	for (unsigned i = 0; i < pSize; ++i)
-	{
-		if (fm->pattern[fm->order][i][channel].note < 255)
-			s0 += noteName(fm->pattern[fm->order][i][channel].note);
-		s0 += "\n";
-		if (fm->pattern[fm->order][i][channel].instr < 255)
-			s1 += int2str[(int)fm->pattern[fm->order][i][channel].instr];
-		s1 += "\n";
-		if (fm->pattern[fm->order][i][channel].vol < 255)
-			s2 += int2str[(int)fm->pattern[fm->order][i][channel].vol];
-		s2 += "\n";
-		if (fm->pattern[fm->order][i][channel].fx < 255)
-		{
-			s3 += fm->pattern[fm->order][i][channel].fx;
-			s3 += int2str[(int)fm->pattern[fm->order][i][channel].fxdata];
-		}
-		s3 += "\n";
-	}
-	text[channel][0].setString(s0);
-	text[channel][1].setString(s1);
-	text[channel][2].setString(s2);
-	text[channel][3].setString(s3);
+	/* Cells are edited directly in the patterns, let the song indexes know */
+	mt_cellsChanged(fm, channel);
 }
\ No newline at end of file
@@ -8,8 +8,11 @@
 #include "../general/generalEditor.hpp"
 #include "../../gui/mainmenu.hpp"
 #include "../settings/configEditor.hpp"
+#include "../../library/instrumentLibrary.hpp"
+#include "../../loader/songLoader.hpp"
+#include "../../freeze/freeze.hpp"
+#include "songFileActions.hpp"
 
-extern CSimpleIniA ini_gmlist;
 string saveAs;
 string songLoadedRequest;
 
@@ -68,7 +71,7 @@ int song_save()
 
 
 
-void song_load(const char* filename, bool fromAutoReload)
+void song_load(const char* filename, bool fromAutoReload, void (*loaded)())
 {
 	if (isSongModified && !fromAutoReload)
 	{
@@ -77,25 +80,12 @@ void song_load(const char* filename, bool fromAutoReload)
 		return;
 	}
 
-	int playing = fm->playing;
-	int opened = 0;
+	/* The current song keeps playing until the new one is loaded, see songLoader.hpp */
+	songLoader_start(filename, fromAutoReload, loaded);
+}
 
-	song_stop();
-	if (checkExtension(filename, "mdts"))
-	{
-		if ((opened = mt_loadSong(fm, filename)) == 0)
-			saveAs = filename;
-	}
-	else if (checkExtension(filename, "mid") || checkExtension(filename, "smf") || checkExtension(filename, "rmi"))
-	{
-		if ((opened = midiImport(filename)) == 0)
-			saveAs = "";
-	}
-	else if (checkExtension(filename, "mus"))
-	{
-		if ((opened = musImport(filename)) == 0)
-			saveAs = "";
-	}
+void song_loaded(const char* filename, int opened, bool fromAutoReload)
+{
 	if (opened == MT_ERR_FILEIO && !fromAutoReload)
 	{
 		popup->show(POPUP_OPENFAILED);
@@ -118,15 +108,23 @@ void song_load(const char* filename, bool fromAutoReload)
 			config->lastSongRotate();
 		}
 
+		if (opened == 0)
+		{
+			/* Imported songs aren't saved over the MIDI file */
+			saveAs = checkExtension(filename, "mdts") ? filename : "";
+			if (saveAs == "")
+				instrList->select(0);
+		}
+
+		freeze_clear();
+
 		instrEditor->reset();
-		pianoRoll->updateFromFM();
+		if (pianoRoll)
+			pianoRoll->updateFromFM();
 
 		songEditor->reset();
-		generalEditor->updateFromFM();
-
-		mt_setPosition(fm, 0, 0, 2);
-		if (playing)
-			song_play();
+		if (generalEditor)
+			generalEditor->updateFromFM();
 
 		setWindowTitle(filename);
 
@@ -163,22 +161,26 @@ void song_open()
 void song_clear()
 {
 	mouse.clickLock2 = 1;
+	songLoader_cancel();
+	freeze_clear();
 	song_stop();
 	mt_clearSong(fm);
 	mt_setVolume(fm, config->defaultVolume.value);
 	mt_insertPattern(fm, config->patternSize.value, 0);
 	mt_setPosition(fm, 0, 0, 2);
 	mt_resizeInstrumentList(fm, 1);
-	if (mt_loadInstrument(fm, string("instruments/" + config->defaultPreloadedSound + ".mdti").c_str(), 0) < 0)
+	if (instrumentLibrary_load(fm, config->defaultPreloadedSound, 0) < 0)
 	{
-		mt_loadInstrument(fm, string(string("instruments/") + ini_gmlist.GetValue("melodic", "default", "0") + string(".mdti")).c_str(), 0);
+		instrumentLibrary_loadDefault(fm, 0);
 	}
 	
 
 	instrEditor->reset();
-	generalEditor->updateFromFM();
+	if (generalEditor)
+		generalEditor->updateFromFM();
 
-	pianoRoll->updateFromFM();
+	if (pianoRoll)
+		pianoRoll->updateFromFM();
 	lastSongOpened = "";
 	songEditor->reset();
 	setWindowTitle("New song");
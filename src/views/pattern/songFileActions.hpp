@@ -1,7 +1,11 @@
 #ifndef SONGFILEACTIONS_H
 #define SONGFILEACTIONS_H
 
-void song_load(const char* filename, bool fromAutoReload=false);
+/* Opens a song or imports a MIDI/MUS file, in the background (see songLoader.hpp). 'loaded' is called once it is opened */
+void song_load(const char* filename, bool fromAutoReload=false, void (*loaded)()=NULL);
+
+/* End of song_load : updates the pages, or shows why the file couldn't be opened */
+void song_loaded(const char* filename, int opened, bool fromAutoReload);
 
 int song_save();
 
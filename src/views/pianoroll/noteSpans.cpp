@@ -0,0 +1,97 @@
+#include "noteSpans.hpp"
+#include <algorithm>
+
+NoteSpans::NoteSpans() : songRevision(0), built(false)
+{
+	for (unsigned ch = 0; ch < FM_ch; ch++)
+	{
+		maxLength[ch] = 0;
+		revision[ch] = 0;
+	}
+}
+
+void NoteSpans::build(mtsynth *mt, unsigned channel)
+{
+	std::vector<noteSpan> &s = spans[channel];
+	s.clear();
+	maxLength[channel] = 0;
+
+	/* Index of the note still playing, or -1 */
+	int open = -1;
+	unsigned pos = 0;
+
+	for (unsigned order = 0; order <= mt->patternCount; order++)
+	{
+		/* A note lasts until the next note or note off, and is cut at the song end
+			or at the first pattern start past NOTESPAN_MAX_LENGTH rows */
+		if (open >= 0 && (order == mt->patternCount || pos - s[open].start > NOTESPAN_MAX_LENGTH))
+		{
+			s[open].length = pos - s[open].start;
+			open = -1;
+		}
+
+		if (order == mt->patternCount)
+			break;
+
+		for (unsigned row = 0; row < mt->patternSize[order]; row++, pos++)
+		{
+			const Cell &cell = mt->pattern[order][row][channel];
+
+			if (cell.note == 255)
+				continue;
+
+			if (open >= 0)
+			{
+				s[open].length = pos - s[open].start;
+				open = -1;
+			}
+
+			if (cell.note < 128)
+			{
+				noteSpan span;
+				span.start = pos;
+				span.length = 0;
+				span.note = cell.note;
+				span.instr = cell.instr;
+				span.pattern = order;
+				span.row = row;
+				s.push_back(span);
+				open = s.size() - 1;
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < s.size(); i++)
+		maxLength[channel] = std::max(maxLength[channel], s[i].length);
+
+	revision[channel] = mt->channelRevision[channel];
+}
+
+void NoteSpans::update(mtsynth *mt)
+{
+	bool all = !built || songRevision != mt->songRevision;
+
+	for (unsigned ch = 0; ch < mt->channelCount; ch++)
+	{
+		if (all || revision[ch] != mt->channelRevision[ch])
+			build(mt, ch);
+	}
+
+	songRevision = mt->songRevision;
+	built = true;
+}
+
+static bool spanStartsBefore(const noteSpan &span, int pos)
+{
+	return (int)span.start < pos;
+}
+
+void NoteSpans::visible(unsigned channel, int from, int to, const noteSpan **first, const noteSpan **last) const
+{
+	const std::vector<noteSpan> &s = spans[channel];
+	const noteSpan *begin = s.data(), *end = s.data() + s.size();
+
+	/* No note starting before from - maxLength can reach 'from' */
+	*first = std::lower_bound(begin, end, from - (int)maxLength[channel], spanStartsBefore);
+	*last = std::lower_bound(*first, end, to, spanStartsBefore);
+}
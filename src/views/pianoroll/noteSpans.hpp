@@ -0,0 +1,39 @@
+#ifndef NOTESPANS_H
+#define NOTESPANS_H
+
+#include "../../mtengine/mtlib.h"
+#include <vector>
+
+/* Notes longer than this are cut at the next pattern start */
+#define NOTESPAN_MAX_LENGTH 256
+
+/* A note of the song : where it starts (song position, see mt_getSongPosition), how many rows it lasts
+	until the next note or note off, and the cell it comes from */
+struct noteSpan{
+	unsigned start, length;
+	unsigned char note, instr;
+	unsigned short pattern, row;
+};
+
+/* The notes of each channel, sorted by start. A channel is only read again from the patterns
+	when the engine revision counters tell it changed */
+class NoteSpans{
+	std::vector<noteSpan> spans[FM_ch];
+	unsigned maxLength[FM_ch];
+	unsigned revision[FM_ch], songRevision;
+	bool built;
+
+	void build(mtsynth *mt, unsigned channel);
+
+public:
+	NoteSpans();
+
+	/* Rebuilds the channels changed since the previous call */
+	void update(mtsynth *mt);
+
+	/* Notes of 'channel' which may overlap the song positions [from, to[, as [*first, *last[.
+		Notes starting before 'from' are included as long as a note that long could reach it */
+	void visible(unsigned channel, int from, int to, const noteSpan **first, const noteSpan **last) const;
+};
+
+#endif
@@ -32,10 +32,7 @@ bracket(Vector2f(1,18))
 	piano.setTexture(*tileset);
 	piano.setTextureRect(IntRect(0, 64, 57, 96));
 
-	invisible = sf::Color(0,0,0,0);
-
 	vertices.setPrimitiveType(sf::Quads);
-    vertices.resize(PIANOROLL_MAX_NOTES * 4);
 
 	for (int i = 0; i < 8; i++)
 	{
@@ -104,33 +101,9 @@ void Pianoroll::doubleClick()
 	clickedElem = -1;
 }
 
-void getOrderRowFromPos(int *order, int *row, int pos)
-{
-	*row = 0;
-	*order = 0;
-	while (pos > 0 && *order < fm->patternCount - 1 && pos >= fm->patternSize[*order])
-	{
-		pos -= fm->patternSize[*order];
-		*row = 0;
-		(*order)++;
-	}
-
-	if (pos > 0)
-	{
-		(*row) += pos;
-	}
-}
-
-
 int Pianoroll::getPos(int order, int row)
 {
-	int pos = 0;
-	for (int i = 0; i < order; i++)
-	{
-		pos += fm->patternSize[i];
-	}
-	pos += row;
-	return pos;
+	return mt_getSongPosition(fm, order, row);
 }
 
 void Pianoroll::update()
@@ -149,10 +122,10 @@ void Pianoroll::update()
 		if (pos != oldPos && (resizeNote==1 && pos < noteMoveLimit && oldPos < noteMoveLimit || resizeNote==2 && pos > noteMoveLimit && oldPos > noteMoveLimit))
 		{
 			//printf("%d %d\n", pos, noteMoveLimit);
-			int oldRow, oldOrder;
-			getOrderRowFromPos(&oldOrder, &oldRow, oldPos);
-			int newRow, newOrder;
-			getOrderRowFromPos(&newOrder, &newRow, pos);
+			unsigned oldRow, oldOrder;
+			mt_getPatternRow(fm, oldPos, &oldOrder, &oldRow);
+			unsigned newRow, newOrder;
+			mt_getPatternRow(fm, pos, &newOrder, &newRow);
 
 			if(fm->pattern[newOrder][newRow][selectedCh].note==128)
 				fm->pattern[newOrder][newRow][selectedCh].note=255;
@@ -161,6 +134,7 @@ void Pianoroll::update()
 			fm->pattern[newOrder][newRow][selectedCh] = fm->pattern[oldOrder][oldRow][selectedCh];
 			fm->pattern[oldOrder][oldRow][selectedCh]=temp;
 			//memset(&fm->pattern[oldOrder][oldRow][noteCh], 255, sizeof(Cell));
+			mt_cellsChanged(fm, selectedCh);
 			oldPos = pos;
 		}
 
@@ -177,6 +151,7 @@ void Pianoroll::update()
 			mouse.pos = input_getmouse(view);
 			oldNote = fm->pattern[selectedOrder][selectedRow][selectedCh].note;
 			fm->pattern[selectedOrder][selectedRow][selectedCh].note = clamp((y + 950 - mouse.pos.y - 0.5) / 8 + 1,0,127);
+			mt_cellsChanged(fm, selectedCh);
 
 			if (oldNote != fm->pattern[selectedOrder][selectedRow][selectedCh].note)
 			{
@@ -198,11 +173,12 @@ void Pianoroll::update()
 
 
 
-			int row, order, newPos = getPos(refOrder, refRow) - (mouse.pos.x - deltaX) / 8;
+			unsigned row, order;
+			int newPos = getPos(refOrder, refRow) - (mouse.pos.x - deltaX) / 8;
 
 			subrow = ((deltaX - mouse.pos.x) % 8);
 
-			getOrderRowFromPos(&order, &row, newPos);
+			mt_getPatternRow(fm, newPos, &order, &row);
 
 			mt_setPosition(fm, order, row, 0);
 		}
@@ -212,9 +188,10 @@ void Pianoroll::update()
 	{
 		if (keyboard.shift)
 		{
-			int row, order, pos = getPos(fm->order, fm->row) + mouse.scroll * 4;
+			unsigned row, order;
+			int pos = getPos(fm->order, fm->row) + mouse.scroll * 4;
 
-			getOrderRowFromPos(&order, &row, pos);
+			mt_getPatternRow(fm, pos, &order, &row);
 
 			mt_setPosition(fm, order, row, 0);
 		}
@@ -1,21 +1,20 @@
 #ifndef PIANOROLL_H
 #define PIANOROLL_H
 
-#define PIANOROLL_MAX_NOTES 1024
-
 #include "../../mtengine/mtlib.h"
 #include "../../state.hpp"
 #include "../../gui/contextmenu/contextmenu.hpp"
 #include "../../gui/slider/dataslider.hpp"
 #include "../../gui/button/button.hpp"
+#include "noteSpans.hpp"
 
 class Pianoroll : public State{
 	int y;
 
 	sf::VertexArray vertices;
+	NoteSpans spans;
 	RectangleShape cursor, noteBg;
 	sf::RenderStates states;
-	sf::Color invisible;
 
 	int instrumentToShow;
 	
@@ -42,7 +41,7 @@ public:
 	void updateFromFM();
 	void update();
 	void draw();
-	void drawMarkers(int order, int row);
+	void drawMarkers(int order, int row, int pos);
 	void doubleClick();
 	void handleEvents();
 	void resetView(int width, int height);
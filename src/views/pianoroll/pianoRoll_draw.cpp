@@ -3,36 +3,34 @@
 #include "../../gui/popup/popup.hpp"
 #include "../../input/noteInput.hpp"
 #include "../../gui/sidebar.hpp"
+#include "../../profiler/profiler.hpp"
 
-#define PIANOROLL_MAX_WALKBACK 256
-
-void Pianoroll::drawMarkers(int order, int row)
+void Pianoroll::drawMarkers(int order, int row, int pos)
 {
 	/* Draw beat lines */
 	if (row%config->rowHighlight.value == 0)
 	{
-		int pos = getPos(order, row);
 		cursor.setPosition(pos * 8, 0);
 
 		if (config->rowHighlight.value > 1)
 		{
-			window->draw(cursor);
+			profiler_draw(window, cursor);
 		}
 
 		if (row == 0)
 		{
-			window->draw(cursor);
-			time.setPosition((pos - row) * 8 + 4, 64 + (int)(charSize*1.5));
+			profiler_draw(window, cursor);
+			time.setPosition(pos * 8 + 4, 64 + (int)(charSize*1.5));
 			time.setString(std::to_string((int)fm->channelStates[order][row].time / 60) + ":" + std::to_string((int)fm->channelStates[order][row].time % 60));
-			window->draw(time);
+			profiler_draw(window, time);
 		}
 	}
 	/* Draw new pattern line */
 	if (row == 0)
 	{
 		marker.setString(std::to_string(order));
-		marker.setPosition(getPos(order, 0) * 8 + 4, 64);
-		window->draw(marker);
+		marker.setPosition(pos * 8 + 4, 64);
+		profiler_draw(window, marker);
 	}
 }
 
@@ -52,9 +50,6 @@ void Pianoroll::draw()
 	hoveredRow=-1;
 
 
-	int row = (int)fm->row - PIANOROLL_MAX_WALKBACK;
-	unsigned order = fm->order;
-
 	if (!fm->playing && !popup->visible && mouseGlobal.x < 58 && mouseGlobal.y>=32)
 	{
 		int n = (int)(y + 950 - mouse.pos.y - 0.5) / 8 + 1;
@@ -74,7 +69,7 @@ void Pianoroll::draw()
 	if (fm->playing)
 		subrow = ((double)fm->frameTimer / ((60 / fm->diviseur) * (double)fm->sampleRate / fm->tempo)) * 8;
 
-	int calcScrollX = windowWidth / 2 + 8 * getPos(order, row) + subrow + PIANOROLL_MAX_WALKBACK * 8 -57;
+	int calcScrollX = windowWidth / 2 + 8 * getPos(fm->order, fm->row) + subrow - 57;
 
 	int scrollX = max(windowWidth / 2 - 56, calcScrollX);
 	int windowLeftX = scrollX - windowWidth / 2 + 57;
@@ -82,58 +77,51 @@ void Pianoroll::draw()
 	view.setCenter(Vector2f(scrollX, (float)windowHeight / 2));
 
 	mouse.pos = input_getmouse(view);
-	while (row < 0)
-	{
-		if (order == 0)
-		{
-			row = 0;
-			break;
-		}
-		order--;
 
-		row += fm->patternSize[order];
-	}
-	
-	unsigned squareCount = 0;
+	/* Visible song positions */
+	int firstPos = windowLeftX / 8;
+	int lastPos = (scrollX + (int)windowWidth / 2) / 8 + 1;
 
-	while (order < fm->patternCount)
+	unsigned markerOrder, markerRow;
+	if (mt_getPatternRow(fm, firstPos, &markerOrder, &markerRow))
 	{
-		for (unsigned ch = 0; ch < FM_ch; ch++)
+		for (int pos = getPos(markerOrder, markerRow); pos < lastPos && markerOrder < fm->patternCount; pos++)
 		{
+			drawMarkers(markerOrder, markerRow, pos);
 
-			if (squareCount >= PIANOROLL_MAX_NOTES)
-				goto end;
-
-			if (fm->pattern[order][row][ch].note >= 128)
-				continue;
-
-			int noteLength = 0;
-			int tempRow = row;
-			int tempOrder = order;
-
-			do
+			if (++markerRow >= fm->patternSize[markerOrder])
 			{
-				tempRow++;
-				noteLength += 8;
-				if (tempRow >= fm->patternSize[tempOrder])
-				{
-					tempRow = 0;
-					tempOrder++;
-					if (tempOrder >= fm->patternCount || noteLength > PIANOROLL_MAX_WALKBACK * 8)
-						break;
-				}
-			} while (fm->pattern[tempOrder][tempRow][ch].note == 255);
+				markerRow = 0;
+				markerOrder++;
+			}
+		}
+	}
 
+	spans.update(fm);
 
+	unsigned squareCount = 0;
 
+	for (unsigned ch = 0; ch < fm->channelCount; ch++)
+	{
+		const noteSpan *first, *last;
+		spans.visible(ch, firstPos, lastPos, &first, &last);
+
+		for (const noteSpan *span = first; span < last; span++)
+		{
+			int order = span->pattern;
+			int row = span->row;
+			int noteLength = span->length * 8;
 
-			int sX = getPos(order, row) * 8;
+			int sX = span->start * 8;
 
 			/* Don't display notes finishing before the window left side */
 			if (sX + noteLength < windowLeftX)
 				continue;
 
-			int sY = y + 950 - (int)fm->pattern[order][row][ch].note * 8;
+			int sY = y + 950 - (int)span->note * 8;
+
+			if ((squareCount + 1) * 4 > vertices.getVertexCount())
+				vertices.resize(max<size_t>(256, vertices.getVertexCount() * 2));
 
 			sf::Vertex *quad = &vertices[squareCount * 4];
 
@@ -144,9 +132,9 @@ void Pianoroll::draw()
 
 
 
-			Color squareColor = instrColors[(fm->pattern[order][row][ch].instr)%instrColors.size()];
+			Color squareColor = instrColors[span->instr%instrColors.size()];
 				
-			if (instrumentToShow != -1 && fm->pattern[order][row][ch].instr != instrumentToShow)
+			if (instrumentToShow != -1 && span->instr != instrumentToShow)
 			{
 				squareColor.a = 30;
 			}
@@ -167,16 +155,16 @@ void Pianoroll::draw()
 					if ((resizeNote || moveNote || mouse.pos.y >= sY  && mouse.pos.y < sY + 8) && ch==hoveredCh &&  !contextMenu && mouse.pos.x >= sX && mouse.pos.x < sX + noteLength )
 					{
 						bracket.setPosition(sX, sY-5);
-						window->draw(bracket);
+						profiler_draw(window, bracket);
 						bracket.setPosition(sX+noteLength, sY-5);
-						window->draw(bracket);
+						profiler_draw(window, bracket);
 					}
 
 					if (mouse.pos.y >= sY  && mouse.pos.y < sY + 8)
 					{
 
 					
-						if (instrumentToShow == -1 || instrumentToShow == fm->pattern[order][row][ch].instr) {
+						if (instrumentToShow == -1 || instrumentToShow == span->instr) {
 							/* Resize the note */
 							if (mouse.pos.x<sX + 3 || mouse.pos.x > sX + noteLength - 4)
 							{
@@ -243,6 +231,7 @@ void Pianoroll::draw()
 							if (keyboard.del || keyboard.equal)
 							{
 								fm->pattern[order][row][ch].note = 128;
+								mt_cellsChanged(fm, ch);
 							}
 							/* Show context menu */
 							if (mouse.clickd)
@@ -252,9 +241,9 @@ void Pianoroll::draw()
 
 							if (!resizeNote || (selectedCh == ch)) {
 								bracket.setPosition(sX, sY-5);
-								window->draw(bracket);
+								profiler_draw(window, bracket);
 								bracket.setPosition(sX+noteLength, sY-5);
-								window->draw(bracket);
+								profiler_draw(window, bracket);
 								
 							}
 
@@ -266,7 +255,7 @@ void Pianoroll::draw()
 
 					
 				}
-				if ( selectedCh == ch && (instrumentToShow == -1 || instrumentToShow == fm->pattern[order][row][ch].instr))
+				if ( selectedCh == ch && (instrumentToShow == -1 || instrumentToShow == span->instr))
 				{
 					quad[0].color = colors[BLOCKTEXT];
 					quad[1].color = colors[BLOCKTEXT];
@@ -278,37 +267,21 @@ void Pianoroll::draw()
 			
 
 	
-			if (sX < scrollX -(int)windowWidth/2 + 57 && (instrumentToShow==-1 || instrumentToShow == fm->pattern[order][row][ch].instr))
+			if (sX < scrollX -(int)windowWidth/2 + 57 && (instrumentToShow==-1 || instrumentToShow == span->instr))
 			{
 				pressedNotes[(int)(950 + y - sY) / 8] = 1;
 			}
 
 			squareCount++;
 		}
-
-		
-		drawMarkers(order, row);
-
-		if (++row >= fm->patternSize[order])
-		{
-			row = 0;
-			order++;
-		}
-
 	}
-end:
 
-	for (unsigned i = squareCount; i < PIANOROLL_MAX_NOTES; i++)
+	if (squareCount > 0)
 	{
-		sf::Vertex *quad = &vertices[i * 4];
-		quad[0].color=invisible;
-		quad[1].color=invisible;
-		quad[2].color=invisible;
-		quad[3].color=invisible;
+		window->draw(&vertices[0], squareCount * 4, sf::Quads);
+		profiler_countDraw(squareCount * 4);
 	}
 
-	window->draw(vertices);
-
 	window->setView(globalView);
 	mouse.pos = input_getmouse(globalView);
 
@@ -316,7 +289,7 @@ end:
 	for (int i = 0; i < 10; i++)
 	{
 		piano.setPosition(0, y + i * 96);
-		window->draw(piano);
+		profiler_draw(window, piano);
 	}
 
 
@@ -329,7 +302,7 @@ end:
 		{
 			pressedNotes[i] = 0;
 			notePressed[keyData[i % 12]].setPosition(0, y + 960 - (i / 12) * 96 - keyData[12 + i % 12]);
-			window->draw(notePressed[keyData[i % 12]]);
+			profiler_draw(window, notePressed[keyData[i % 12]]);
 
 		}
 	}
@@ -339,19 +312,19 @@ end:
 		noteBg.setSize(Vector2f(note.getLocalBounds().width + 2, charSize + 2));
 		noteBg.setPosition(mouse.pos.x + 16 - 1, mouse.pos.y + 16);
 		note.setPosition(mouse.pos.x + 16, mouse.pos.y + 16);
-		window->draw(noteBg);
-		window->draw(note);
+		profiler_draw(window, noteBg);
+		profiler_draw(window, note);
 
 	}
 
 	
 	cache.setPosition(windowWidth - 250, 0);
-	window->draw(cache);
+	profiler_draw(window, cache);
 	for (int i = instrList->scroll; i < min<int>(instrList->scroll + instrList->maxrows, instrList->text.size()); i++)
 	{
 
 		legend[i].setPosition(windowWidth - 233, 375 + (i - instrList->scroll) * 17);
-		window->draw(legend[i]);
+		profiler_draw(window, legend[i]);
 	}
 
 	showAllInstruments.draw();
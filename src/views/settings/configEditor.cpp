@@ -30,7 +30,8 @@ rowHighlightText2("", font, charSize),
 rowHighlight(210, 590, 8, 1, "", 4, 40),
 soundDevicesList(420, 100, 10, 360),
 soundDeviceText("Sound device", font, charSize),
-patternSize(14, 380, 256, 1, "Pattern size", 8, 200),
+patternSize(14, 380, MT_MAX_ROWS, 1, "Pattern size", 8, 200),
+importChannels(230, 380, FM_ch, 1, "Channels", FM_ch, 150),
 samplerate(420, 280, 5, 0, "Sample Rate (hz)", 3, 170),
 sampleRateError("", font, charSize),
 openLastSong(14, 510, "Reopen last song")
@@ -50,6 +51,7 @@ previewReverb(420, 480, 99, 0, "Note preview reverb", 10),
 startup("At startup", font, charSize),
 keyPreset("Presets :", font, charSize),
 defaultVolume(14, 410, 99, 0, "Song volume", 10),
+autosaveInterval(14, 440, 60, 0, "Autosave every (min)", 5),
 display("Display", font, charSize),
 directXdevicesCount(0),
 wasapiExclusive(420, 325, "Exclusive mode")
@@ -82,7 +84,9 @@ wasapiExclusive(420, 325, "Exclusive mode")
 	keyMappingReset.add("Reset this key");
 
 	patternSize.setValue(atoi(ini_config.GetValue("config", "defaultPatternSize", "128")));
+	importChannels.setValue(atoi(ini_config.GetValue("config", "midiImportChannels", std::to_string(FM_ch).c_str())));
 	defaultVolume.setValue(atoi(ini_config.GetValue("config", "defaultSongVolume", "60")));
+	autosaveInterval.setValue(atoi(ini_config.GetValue("config", "autosaveInterval", "5")));
 	maxRecentSongCount = atoi(ini_config.GetValue("recentSongs", "max", "10"));
 
 	lastRunVersion = ini_config.GetValue("config", "lastRunVersion", "1.4");
@@ -221,11 +225,7 @@ wasapiExclusive(420, 325, "Exclusive mode")
 	rowHighlightText.setFillColor(colors[BLOCKTEXT]);
 	diviseurText.setFillColor(colors[BLOCKTEXT]);
 
-	refresh();
-
-
-
-
+	/* Device lists are filled by refresh() once the devices are initialized, see startup_waitDevices */
 }
 
 void ConfigEditor::updateRowHighlightText()
@@ -247,7 +247,7 @@ void ConfigEditor::draw()
 	window->setView(globalView);
 	samplerate.setDisplayedValueOnly(to_string(sampleRates[samplerate.value]));
 
-	drawBatcher.initialize();
+	drawBatcher.initialize(this);
 
 
 	drawBatcher.addItem(&midiDevicesList);
@@ -259,6 +259,7 @@ void ConfigEditor::draw()
 
 	drawBatcher.addItem(&diviseur);
 	drawBatcher.addItem(&patternSize);
+	drawBatcher.addItem(&importChannels);
 	drawBatcher.addItem(&samplerate);
 	drawBatcher.addItem(&latency);
 
@@ -267,6 +268,7 @@ void ConfigEditor::draw()
 	drawBatcher.addItem(&midiImport);
 	drawBatcher.addItem(&themeFile);
 	drawBatcher.addItem(&defaultVolume);
+	drawBatcher.addItem(&autosaveInterval);
 	drawBatcher.addItem(&diviseurText);
 	drawBatcher.addItem(&rowHighlightText);
 	drawBatcher.addItem(&rowHighlightText2);
@@ -405,6 +407,7 @@ void ConfigEditor::update()
 
 
 	defaultVolume.update();
+	autosaveInterval.update();
 	previewReverb.update();
 
 	diviseur.update();
@@ -430,6 +433,7 @@ void ConfigEditor::update()
 
 
 	patternSize.update();
+	importChannels.update();
 	openLastSong.clicked();
 	subquantize.clicked();
 
@@ -447,12 +451,14 @@ void ConfigEditor::save()
 	ini_config.SetValue("window", "maximized", std::to_string(isWindowMaximized()).c_str());
 
 	ini_config.SetValue("config", "defaultPatternSize", std::to_string(patternSize.value).c_str());
+	ini_config.SetValue("config", "midiImportChannels", std::to_string(importChannels.value).c_str());
 	ini_config.SetValue("config", "rowsPerQuarterNote", std::to_string(diviseur.value).c_str());
 	ini_config.SetValue("config", "patternRowHighlight", std::to_string(rowHighlight.value).c_str());
 	ini_config.SetValue("config", "openLastFileAtStart", std::to_string(openLastSong.checked).c_str());
 	ini_config.SetValue("config", "preserveUnquantizedNotes", std::to_string(subquantize.checked).c_str());
 	ini_config.SetValue("config", "defaultNoteVolume", std::to_string(sidebar->defNoteVol.value).c_str());
 	ini_config.SetValue("config", "notePreviewReverb", std::to_string(previewReverb.value).c_str());
+	ini_config.SetValue("config", "autosaveInterval", std::to_string(autosaveInterval.value).c_str());
 	ini_config.SetValue("config", "defaultPreloadedSound", defaultPreloadedSound.c_str());
 	ini_config.SetValue("config", "defaultVolume", std::to_string(defaultVolume.value).c_str());
 	ini_config.SetValue("config", "editingStep", std::to_string(sidebar->editingStep.value).c_str());
@@ -41,8 +41,9 @@ class ConfigEditor : public State{
 	List noteList, keyList;
 	int currentSoundDeviceId;
 	int maxRecentSongCount;
-	DataSlider diviseur, rowHighlight, patternSize, samplerate, latency, defaultVolume;
+	DataSlider diviseur, rowHighlight, patternSize, importChannels, samplerate, latency, defaultVolume;
 	DataSlider previewReverb;
+	DataSlider autosaveInterval;
 	string defaultPreloadedSound;
 	ConfigEditor();
 	void draw();